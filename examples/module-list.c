@@ -31,14 +31,71 @@
 #include <sys/mman.h>
 #include <stdio.h>
 
+static status_t
+print_module(
+    vmi_instance_t vmi,
+    addr_t next_module,
+    const void *fields,
+    void *data)
+{
+    /* print out the module name */
+
+    /* Note: the module struct that we are looking at has a string
+     * directly following the next / prev pointers.  This is why you
+     * can just add the length of 2 address fields to get the name.
+     * See include/linux/module.h for mode details */
+    if (VMI_OS_LINUX == vmi_get_ostype(vmi)) {
+        char *modname = NULL;
+
+        if (VMI_PM_IA32E == vmi_get_page_mode(vmi)) {   // 64-bit paging
+            modname = vmi_read_str_va(vmi, next_module + 16, 0);
+        }
+        else {
+            modname = vmi_read_str_va(vmi, next_module + 8, 0);
+        }
+        printf("%s\n", modname);
+        free(modname);
+    }
+    else if (VMI_OS_WINDOWS == vmi_get_ostype(vmi)) {
+
+        unicode_string_t *us = NULL;
+
+        /*
+         * The offset 0x58 and 0x2c is the offset in the _LDR_DATA_TABLE_ENTRY structure
+         * to the BaseDllName member.
+         * These offset values are stable (at least) between XP and Windows 7.
+         */
+
+        if (VMI_PM_IA32E == vmi_get_page_mode(vmi)) {
+            us = vmi_read_unicode_str_va(vmi, next_module + 0x58, 0);
+        } else {
+            us = vmi_read_unicode_str_va(vmi, next_module + 0x2c, 0);
+        }
+
+        unicode_string_t out = { 0 };
+        //         both of these work
+        if (us &&
+            VMI_SUCCESS == vmi_convert_str_encoding(us, &out,
+                                                    "UTF-8")) {
+            printf("%s\n", out.contents);
+            //            if (us && 
+            //                VMI_SUCCESS == vmi_convert_string_encoding (us, &out, "WCHAR_T")) {
+            //                printf ("%ls\n", out.contents);
+            free(out.contents);
+        }   // if
+        if (us)
+            vmi_free_unicode_str(us);
+    }
+    return VMI_SUCCESS;
+}
+
 int
 main(
     int argc,
     char **argv)
 {
     vmi_instance_t vmi;
-    uint32_t offset;
-    addr_t next_module, list_head;
+    addr_t list_head = 0;
 
     /* this is the VM or file that we are looking at */
     char *name = argv[1];
@@ -55,75 +112,17 @@ main(
 
     /* get the head of the module list */
     if (VMI_OS_LINUX == vmi_get_ostype(vmi)) {
-        vmi_read_addr_ksym(vmi, "modules", &next_module);
+        list_head = vmi_translate_ksym2v(vmi, "modules");
     }
     else if (VMI_OS_WINDOWS == vmi_get_ostype(vmi)) {
-        vmi_read_addr_ksym(vmi, "PsLoadedModuleList", &next_module);
+        list_head = vmi_translate_ksym2v(vmi, "PsLoadedModuleList");
     }
-    list_head = next_module;
-
-    /* walk the module list */
-    while (1) {
-
-        /* follow the next pointer */
-        addr_t tmp_next = 0;
 
-        vmi_read_addr_va(vmi, next_module, 0, &tmp_next);
-
-        /* if we are back at the list head, we are done */
-        if (list_head == tmp_next) {
-            break;
-        }
-
-        /* print out the module name */
-
-        /* Note: the module struct that we are looking at has a string
-         * directly following the next / prev pointers.  This is why you
-         * can just add the length of 2 address fields to get the name.
-         * See include/linux/module.h for mode details */
-        if (VMI_OS_LINUX == vmi_get_ostype(vmi)) {
-            char *modname = NULL;
-
-            if (VMI_PM_IA32E == vmi_get_page_mode(vmi)) {   // 64-bit paging
-                modname = vmi_read_str_va(vmi, next_module + 16, 0);
-            }
-            else {
-                modname = vmi_read_str_va(vmi, next_module + 8, 0);
-            }
-            printf("%s\n", modname);
-            free(modname);
-        }
-        else if (VMI_OS_WINDOWS == vmi_get_ostype(vmi)) {
-
-            unicode_string_t *us = NULL;
-
-            /*
-             * The offset 0x58 and 0x2c is the offset in the _LDR_DATA_TABLE_ENTRY structure
-             * to the BaseDllName member.
-             * These offset values are stable (at least) between XP and Windows 7.
-             */
-
-            if (VMI_PM_IA32E == vmi_get_page_mode(vmi)) {
-                us = vmi_read_unicode_str_va(vmi, next_module + 0x58, 0);
-            } else {
-                us = vmi_read_unicode_str_va(vmi, next_module + 0x2c, 0);
-            }
-
-            unicode_string_t out = { 0 };
-            //         both of these work
-            if (us &&
-                VMI_SUCCESS == vmi_convert_str_encoding(us, &out,
-                                                        "UTF-8")) {
-                printf("%s\n", out.contents);
-                //            if (us && 
-                //                VMI_SUCCESS == vmi_convert_string_encoding (us, &out, "WCHAR_T")) {
-                //                printf ("%ls\n", out.contents);
-                free(out.contents);
-            }   // if
-            if (us)
-                vmi_free_unicode_str(us);
-        }
-        next_module = tmp_next;
+    /* walk the module list, each module is reported by the address
+     * of its list links */
+    if (VMI_FAILURE == vmi_walk_list(vmi, 0, list_head, 0, 0, NULL, 0,
+                                     print_module, NULL)) {
+        printf("Failed to walk the module list\n");
     }
 
 error_exit:
@@ -25,6 +25,7 @@
  */
 
 #include <libvmi/libvmi.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -32,18 +33,34 @@
 #include <stdio.h>
 #include <inttypes.h>
 
+/* the members of a task_struct or _EPROCESS that get printed */
+struct process {
+    uint32_t pid;
+    char name[16];
+};
+
+static status_t
+print_process(
+    vmi_instance_t vmi,
+    addr_t entry,
+    const void *fields,
+    void *data)
+{
+    const struct process *process = fields;
+
+    /* NOTE: _EPROCESS.UniqueProcessId is a really VOID*, but is never > 32 bits,
+     * so this is safe enough for x64 Windows for example purposes */
+    printf("[%5d] %.15s (struct addr:%"PRIx64")\n", process->pid, process->name, entry);
+    return VMI_SUCCESS;
+}
+
 int main (int argc, char **argv)
 {
     vmi_instance_t vmi;
-    unsigned char *memory = NULL;
-    uint32_t offset;
-    addr_t list_head = 0, current_list_entry = 0, next_list_entry = 0;
-    addr_t current_process = 0;
-    addr_t tmp_next = 0;
-    char *procname = NULL;
-    vmi_pid_t pid = 0;
+    addr_t list_head = 0, current_process = 0;
     unsigned long tasks_offset, pid_offset, name_offset;
-    status_t status;
+    vmi_field_t fields[2];
+    struct process swapper;
 
     /* this is the VM or file that we are looking at */
     if (argc != 2) {
@@ -107,6 +124,15 @@ int main (int argc, char **argv)
     }
     free(name2);
 
+    /* Note: the task_struct that we are looking at has a lot of
+     * information.  However, the process name and id are burried
+     * nice and deep.  Instead of doing something sane like mapping
+     * this data to a task_struct, I'm just picking the fields with
+     * the info that I want.  See include/linux/sched.h for mode details */
+    fields[0] = (vmi_field_t) { pid_offset, VMI_FIELD_32, 0, offsetof(struct process, pid) };
+    fields[1] = (vmi_field_t) { name_offset, VMI_FIELD_BYTES, sizeof(swapper.name),
+                                offsetof(struct process, name) };
+
     /* get the head of the list */
     if (VMI_OS_LINUX == vmi_get_ostype(vmi)) {
         /* Begin at PID 0, the 'swapper' task. It's not typically shown by OS
@@ -114,71 +140,38 @@ int main (int argc, char **argv)
          *  display as such.
          */
         current_process = vmi_translate_ksym2v(vmi, "init_task");
+        list_head = current_process + tasks_offset;
+
+        /* the walk starts behind the head, so print the head itself first */
+        if (VMI_FAILURE == vmi_read_struct(vmi, current_process, 0, fields, 2, &swapper)) {
+            printf("Failed to read init_task at 0x%"PRIx64"\n", current_process);
+            goto error_exit;
+        }
+        print_process(vmi, current_process, &swapper, NULL);
     }
     else if (VMI_OS_WINDOWS == vmi_get_ostype(vmi)) {
+        size_t width = vmi_get_address_width(vmi);
 
         // find PEPROCESS PsInitialSystemProcess
         vmi_read_addr_ksym(vmi, "PsInitialSystemProcess", &current_process);
 
+        /* System is the first process, so the Blink of its list entry
+         * is PsActiveProcessHead */
+        if (VMI_FAILURE == vmi_read_addr_va(vmi, current_process + tasks_offset + width,
+                                            0, &list_head)) {
+            printf("Failed to read PsActiveProcessHead\n");
+            goto error_exit;
+        }
     }
 
     /* walk the task list */
-    list_head = current_process + tasks_offset;
-    current_list_entry = list_head;
-
-    status = vmi_read_addr_va(vmi, current_list_entry, 0, &next_list_entry);
-    if (status == VMI_FAILURE) {
-        printf("Failed to read next pointer at 0x%"PRIx64" before entering loop\n",
-                current_list_entry);
+    if (VMI_FAILURE == vmi_walk_list(vmi, 0, list_head, 0, tasks_offset,
+                                     fields, 2, print_process, NULL)) {
+        printf("Failed to walk the process list at %"PRIx64"\n", list_head);
         goto error_exit;
     }
 
-    printf("Next list entry is at: %"PRIx64"\n", next_list_entry);
-
-    do {
-        /* Note: the task_struct that we are looking at has a lot of
-         * information.  However, the process name and id are burried
-         * nice and deep.  Instead of doing something sane like mapping
-         * this data to a task_struct, I'm just jumping to the location
-         * with the info that I want.  This helps to make the example
-         * code cleaner, if not more fragile.  In a real app, you'd
-         * want to do this a little more robust :-)  See
-         * include/linux/sched.h for mode details */
-
-        /* NOTE: _EPROCESS.UniqueProcessId is a really VOID*, but is never > 32 bits,
-         * so this is safe enough for x64 Windows for example purposes */
-        vmi_read_32_va(vmi, current_process + pid_offset, 0, &pid);
-
-        procname = vmi_read_str_va(vmi, current_process + name_offset, 0);
-
-        if (!procname) {
-            printf("Failed to find procname\n");
-            goto error_exit;
-        }
-
-        /* print out the process name */
-        printf("[%5d] %s (struct addr:%"PRIx64")\n", pid, procname, current_process);
-        if (procname) {
-            free(procname);
-            procname = NULL;
-        }
-
-        current_list_entry = next_list_entry;
-        current_process = current_list_entry - tasks_offset;
-
-        /* follow the next pointer */
-
-        status = vmi_read_addr_va(vmi, current_list_entry, 0, &next_list_entry);
-        if (status == VMI_FAILURE) {
-            printf("Failed to read next pointer in loop at %"PRIx64"\n", current_list_entry);
-            goto error_exit;
-        }
-
-    } while (next_list_entry != list_head);
-
-    error_exit: if (procname)
-        free(procname);
-
+error_exit:
     /* resume the vm */
     vmi_resume_vm(vmi);
 
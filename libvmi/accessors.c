@@ -44,6 +44,30 @@ vmi_get_page_mode(
     }
 }
 
+status_t
+vmi_set_page_mode(
+    vmi_instance_t vmi,
+    page_mode_t page_mode)
+{
+    switch (page_mode) {
+    case VMI_PM_LEGACY:
+    case VMI_PM_PAE:
+    case VMI_PM_IA32E:
+        break;
+    default:
+        errprint("Unsupported page mode %d.\n", page_mode);
+        return VMI_FAILURE;
+    }
+
+    vmi->page_mode = page_mode;
+    vmi->pae = (VMI_PM_LEGACY != page_mode);
+    vmi->lme = (VMI_PM_IA32E == page_mode);
+
+    /* translations made under the old mode are no longer valid */
+    v2p_cache_flush(vmi);
+    return VMI_SUCCESS;
+}
+
 uint8_t vmi_get_address_width(
     vmi_instance_t vmi)
 {
@@ -51,6 +75,11 @@ uint8_t vmi_get_address_width(
 
     driver_get_address_width(vmi, &width);
 
+    /* the file and KVM drivers do not know, go by the paging mode */
+    if (!width) {
+        width = (vmi->page_mode == VMI_PM_IA32E) ? 8 : 4;
+    }
+
     return width;
 }
 
@@ -186,7 +215,13 @@ status_t
 vmi_resume_vm(
     vmi_instance_t vmi)
 {
-    return driver_resume_vm(vmi);
+    status_t ret = driver_resume_vm(vmi);
+
+    /* the guest may rewrite its page tables once it runs again */
+    if (VMI_SUCCESS == ret) {
+        vmi->v2p_generation++;
+    }
+    return ret;
 }
 
 #if ENABLE_SHM_SNAPSHOT == 1
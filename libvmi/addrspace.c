@@ -0,0 +1,211 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "libvmi.h"
+#include "private.h"
+#include "driver/interface.h"
+
+/* number of pages remembered by a handle, must be a power of two */
+#define AS_TLB_SIZE 64
+
+struct as_tlb_entry {
+    addr_t tag;     /* virtual page | 1, zero when unused */
+    addr_t ppage;
+};
+
+struct vmi_address_space {
+    vmi_instance_t vmi;
+    vmi_pid_t pid;
+    addr_t dtb;
+    page_mode_t page_mode;
+    uint32_t generation;
+    struct as_tlb_entry tlb[AS_TLB_SIZE];
+};
+
+static vmi_as_t
+as_create(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    addr_t dtb)
+{
+    vmi_as_t as = safe_malloc(sizeof(struct vmi_address_space));
+
+    as->vmi = vmi;
+    as->pid = pid;
+    as->dtb = dtb;
+    vmi_as_flush(as);
+    return as;
+}
+
+vmi_as_t
+vmi_open_address_space(
+    vmi_instance_t vmi,
+    vmi_pid_t pid)
+{
+    reg_t dtb = 0;
+
+    if (pid) {
+        dtb = vmi_pid_to_dtb(vmi, pid);
+    }
+    else if (vmi->kpgd) {
+        dtb = vmi->kpgd;
+    }
+    else {
+        driver_get_vcpureg(vmi, &dtb, CR3, 0);
+    }
+
+    if (!dtb) {
+        dbprint(VMI_DEBUG_PTLOOKUP, "--no address space found for pid %d\n", pid);
+        return NULL;
+    }
+    return as_create(vmi, pid, dtb);
+}
+
+vmi_as_t
+vmi_open_address_space_dtb(
+    vmi_instance_t vmi,
+    addr_t dtb)
+{
+    if (!dtb) {
+        return NULL;
+    }
+    return as_create(vmi, 0, dtb);
+}
+
+void
+vmi_close_address_space(
+    vmi_as_t as)
+{
+    free(as);
+}
+
+addr_t
+vmi_as_get_dtb(
+    vmi_as_t as)
+{
+    return as->dtb;
+}
+
+void
+vmi_as_flush(
+    vmi_as_t as)
+{
+    memset(as->tlb, 0, sizeof(as->tlb));
+    as->page_mode = as->vmi->page_mode;
+    as->generation = as->vmi->v2p_generation;
+}
+
+addr_t
+vmi_as_translate(
+    vmi_as_t as,
+    addr_t vaddr)
+{
+    vmi_instance_t vmi = as->vmi;
+    addr_t offset_mask = (addr_t) vmi->page_size - 1;
+    addr_t tag = (vaddr & ~offset_mask) | 1;
+    struct as_tlb_entry *slot =
+        &as->tlb[(vaddr >> vmi->page_shift) & (AS_TLB_SIZE - 1)];
+    addr_t paddr = 0;
+
+    /* the instance flushed its caches or changed paging mode */
+    if (as->generation != vmi->v2p_generation || as->page_mode != vmi->page_mode) {
+        vmi_as_flush(as);
+    }
+
+    if (slot->tag == tag) {
+        uint8_t value = 0;
+
+        paddr = slot->ppage | (vaddr & offset_mask);
+        if (VMI_V2P_VALIDATE_ALWAYS != vmi->v2p_validation
+            || VMI_SUCCESS == vmi_read_8_pa(vmi, paddr, &value)) {
+            return paddr;
+        }
+        slot->tag = 0;
+    }
+
+    paddr = vmi_pagetable_lookup(vmi, as->dtb, vaddr);
+
+    /* the process may have gone and its pid been reused */
+    if (!paddr && as->pid && VMI_SUCCESS == pid_cache_del(vmi, as->pid)) {
+        addr_t dtb = vmi_pid_to_dtb(vmi, as->pid);
+
+        if (dtb && dtb != as->dtb) {
+            as->dtb = dtb;
+            vmi_as_flush(as);
+            paddr = vmi_pagetable_lookup(vmi, as->dtb, vaddr);
+        }
+    }
+
+    if (paddr) {
+        slot->tag = tag;
+        slot->ppage = paddr & ~offset_mask;
+    }
+    return paddr;
+}
+
+size_t
+vmi_as_read(
+    vmi_as_t as,
+    addr_t vaddr,
+    void *buf,
+    size_t count)
+{
+    vmi_instance_t vmi = as->vmi;
+    size_t buf_offset = 0;
+
+    if (NULL == buf) {
+        dbprint(VMI_DEBUG_READ, "--%s: buf passed as NULL, returning without read\n",
+                __FUNCTION__);
+        return 0;
+    }
+
+    while (buf_offset < count) {
+        addr_t va = vaddr + buf_offset;
+        addr_t paddr = vmi_as_translate(as, va);
+        size_t read_len = vmi->page_size - (va & (vmi->page_size - 1));
+        size_t len_read = 0;
+
+        if (!paddr) {
+            break;
+        }
+        if (read_len > count - buf_offset) {
+            read_len = count - buf_offset;
+        }
+
+        len_read = vmi_read_pa(vmi, paddr, ((char *) buf) + buf_offset, read_len);
+        buf_offset += len_read;
+        if (len_read != read_len) {
+            break;
+        }
+    }
+
+    return buf_offset;
+}
+
+status_t
+vmi_as_read_iov(
+    vmi_as_t as,
+    vmi_iovec_t *vec,
+    size_t n)
+{
+    return read_va_iov(as->vmi, as->dtb, vec, n);
+}
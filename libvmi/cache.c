@@ -143,6 +143,7 @@ pid_cache_init(
     vmi->pid_cache =
         g_hash_table_new_full(g_int_hash, g_int_equal,
                               pid_cache_key_free, pid_cache_entry_free);
+    pthread_mutex_init(&vmi->pid_cache_lock, NULL);
 }
 
 void
@@ -150,6 +151,7 @@ pid_cache_destroy(
     vmi_instance_t vmi)
 {
     g_hash_table_destroy(vmi->pid_cache);
+    pthread_mutex_destroy(&vmi->pid_cache_lock);
 }
 
 status_t
@@ -158,17 +160,20 @@ pid_cache_get(
     vmi_pid_t pid,
     addr_t *dtb)
 {
+    status_t ret = VMI_FAILURE;
     pid_cache_entry_t entry = NULL;
     gint key = (gint) pid;
 
+    vmi_lock(vmi, &vmi->pid_cache_lock);
     if ((entry = g_hash_table_lookup(vmi->pid_cache, &key)) != NULL) {
         entry->last_used = time(NULL);
         *dtb = entry->dtb;
         dbprint(VMI_DEBUG_PIDCACHE, "--PID cache hit %d -- 0x%.16"PRIx64"\n", pid, *dtb);
-        return VMI_SUCCESS;
+        ret = VMI_SUCCESS;
     }
+    vmi_unlock(vmi, &vmi->pid_cache_lock);
 
-    return VMI_FAILURE;
+    return ret;
 }
 
 void
@@ -182,7 +187,9 @@ pid_cache_set(
     *key = pid;
     pid_cache_entry_t entry = pid_cache_entry_create(pid, dtb);
 
+    vmi_lock(vmi, &vmi->pid_cache_lock);
     g_hash_table_insert(vmi->pid_cache, key, entry);
+    vmi_unlock(vmi, &vmi->pid_cache_lock);
     dbprint(VMI_DEBUG_PIDCACHE, "--PID cache set %d -- 0x%.16"PRIx64"\n", pid, dtb);
 }
 
@@ -191,23 +198,30 @@ pid_cache_del(
     vmi_instance_t vmi,
     vmi_pid_t pid)
 {
+    status_t ret = VMI_FAILURE;
     gint key = (gint) pid;
 
     dbprint(VMI_DEBUG_PIDCACHE, "--PID cache del %d\n", pid);
+    vmi_lock(vmi, &vmi->pid_cache_lock);
     if (TRUE == g_hash_table_remove(vmi->pid_cache, &key)) {
-        return VMI_SUCCESS;
-    }
-    else {
-        return VMI_FAILURE;
+        ret = VMI_SUCCESS;
     }
+    vmi_unlock(vmi, &vmi->pid_cache_lock);
+
+    return ret;
 }
 
 void
 pid_cache_flush(
     vmi_instance_t vmi)
 {
+    vmi_lock(vmi, &vmi->pid_cache_lock);
     g_hash_table_remove_all(vmi->pid_cache);
+    vmi_unlock(vmi, &vmi->pid_cache_lock);
     dbprint(VMI_DEBUG_PIDCACHE, "--PID cache flushed\n");
+
+    /* a pid may come back with a recycled dtb, drop its page table entries */
+    ps_cache_flush(vmi);
 }
 
 //
@@ -258,6 +272,7 @@ sym_cache_init(
     vmi->sym_cache =
         g_hash_table_new_full((GHashFunc)key_128_hash, key_128_equals, g_free,
                               (GDestroyNotify)g_hash_table_destroy);
+    pthread_mutex_init(&vmi->sym_cache_lock, NULL);
 }
 
 void
@@ -265,6 +280,7 @@ sym_cache_destroy(
     vmi_instance_t vmi)
 {
     g_hash_table_destroy(vmi->sym_cache);
+    pthread_mutex_destroy(&vmi->sym_cache_lock);
 }
 
 status_t
@@ -285,8 +301,9 @@ sym_cache_get(
     key_128_t key = &local_key;
     key_128_init(vmi, key, (uint64_t)base_addr, (uint64_t)pid);
 
+    vmi_lock(vmi, &vmi->sym_cache_lock);
     if ((symbol_table = g_hash_table_lookup(vmi->sym_cache, key)) == NULL) {
-        return ret;
+        goto done;
     }
 
     if ((entry = g_hash_table_lookup(symbol_table, sym)) != NULL) {
@@ -296,6 +313,8 @@ sym_cache_get(
         ret=VMI_SUCCESS;
     }
 
+done:
+    vmi_unlock(vmi, &vmi->sym_cache_lock);
     return ret;
 }
 
@@ -313,6 +332,7 @@ sym_cache_set(
 
     key_128_t key = key_128_build(vmi, (uint64_t)base_addr, (uint64_t)pid);
 
+    vmi_lock(vmi, &vmi->sym_cache_lock);
     symbol_table = g_hash_table_lookup(vmi->sym_cache, key);
     if (symbol_table == NULL) {
         symbol_table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
@@ -324,6 +344,7 @@ sym_cache_set(
 
     sym_dup = strndup(sym, 100);
     g_hash_table_insert(symbol_table, sym_dup, entry);
+    vmi_unlock(vmi, &vmi->sym_cache_lock);
     dbprint(VMI_DEBUG_SYMCACHE, "--SYM cache set %s -- 0x%.16"PRIx64"\n", sym, va);
 }
 
@@ -340,8 +361,9 @@ sym_cache_del(
     key_128_t key = &local_key;
     key_128_init(vmi, key, (uint64_t)base_addr, (uint64_t)pid);
 
+    vmi_lock(vmi, &vmi->sym_cache_lock);
     if ((symbol_table = g_hash_table_lookup(vmi->sym_cache, key)) == NULL) {
-        return ret;
+        goto done;
     }
 
     dbprint(VMI_DEBUG_SYMCACHE, "--SYM cache del %u:0x%.16"PRIx64":%s\n", pid, base_addr, sym);
@@ -354,6 +376,8 @@ sym_cache_del(
         }
     }
 
+done:
+    vmi_unlock(vmi, &vmi->sym_cache_lock);
     return ret;
 }
 
@@ -361,7 +385,9 @@ void
 sym_cache_flush(
     vmi_instance_t vmi)
 {
+    vmi_lock(vmi, &vmi->sym_cache_lock);
     g_hash_table_remove_all(vmi->sym_cache);
+    vmi_unlock(vmi, &vmi->sym_cache_lock);
     dbprint(VMI_DEBUG_SYMCACHE, "--SYM cache flushed\n");
 }
 
@@ -372,6 +398,7 @@ rva_cache_init(
     vmi->rva_cache =
         g_hash_table_new_full((GHashFunc)key_128_hash, key_128_equals, g_free,
                               (GDestroyNotify)g_hash_table_destroy);
+    pthread_mutex_init(&vmi->rva_cache_lock, NULL);
 }
 
 void
@@ -379,6 +406,7 @@ rva_cache_destroy(
     vmi_instance_t vmi)
 {
     g_hash_table_destroy(vmi->rva_cache);
+    pthread_mutex_destroy(&vmi->rva_cache_lock);
 }
 
 status_t
@@ -398,8 +426,9 @@ rva_cache_get(
     key_128_t key = &local_key;
     key_128_init(vmi, key, (uint64_t)base_addr, (uint64_t)pid);
 
+    vmi_lock(vmi, &vmi->rva_cache_lock);
     if ((rva_table = g_hash_table_lookup(vmi->rva_cache, key)) == NULL) {
-        return ret;
+        goto done;
     }
 
     if ((entry = g_hash_table_lookup(rva_table, GUINT_TO_POINTER(rva))) != NULL) {
@@ -409,6 +438,8 @@ rva_cache_get(
         ret=VMI_SUCCESS;
     }
 
+done:
+    vmi_unlock(vmi, &vmi->rva_cache_lock);
     return ret;
 }
 
@@ -425,8 +456,9 @@ rva_cache_set(
 
     key_128_t key = key_128_build(vmi, (uint64_t)base_addr, (uint64_t)pid);
 
+    vmi_lock(vmi, &vmi->rva_cache_lock);
     if ((rva_table = g_hash_table_lookup(vmi->rva_cache, key)) == NULL) {
-        rva_table = g_hash_table_new_full(g_int_hash, g_int_equal, NULL,
+        rva_table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                               sym_cache_entry_free);
         g_hash_table_insert(vmi->rva_cache, GUINT_TO_POINTER(key), rva_table);
     } else {
@@ -434,6 +466,7 @@ rva_cache_set(
     }
 
     g_hash_table_insert(rva_table, GUINT_TO_POINTER(rva), entry);
+    vmi_unlock(vmi, &vmi->rva_cache_lock);
     dbprint(VMI_DEBUG_RVACACHE, "--RVA cache set %s -- 0x%.16"PRIx64"\n", sym, rva);
 }
 
@@ -450,8 +483,9 @@ rva_cache_del(
     key_128_t key = &local_key;
     key_128_init(vmi, key, (uint64_t)base_addr, (uint64_t)pid);
 
+    vmi_lock(vmi, &vmi->rva_cache_lock);
     if ((rva_table = g_hash_table_lookup(vmi->rva_cache, key)) == NULL) {
-        return ret;
+        goto done;
     }
 
     dbprint(VMI_DEBUG_RVACACHE, "--RVA cache del %u:0x%.16"PRIx64":0x%.16"PRIx64"\n",
@@ -465,6 +499,8 @@ rva_cache_del(
         }
     }
 
+done:
+    vmi_unlock(vmi, &vmi->rva_cache_lock);
     return ret;
 }
 
@@ -472,7 +508,9 @@ void
 rva_cache_flush(
     vmi_instance_t vmi)
 {
+    vmi_lock(vmi, &vmi->rva_cache_lock);
     g_hash_table_remove_all(vmi->rva_cache);
+    vmi_unlock(vmi, &vmi->rva_cache_lock);
     dbprint(VMI_DEBUG_RVACACHE, "--RVA cache flushed\n");
 }
 
@@ -481,6 +519,7 @@ rva_cache_flush(
 struct v2p_cache_entry {
     addr_t pa;
     addr_t last_used;
+    uint32_t generation;
 };
 typedef struct v2p_cache_entry *v2p_cache_entry_t;
 
@@ -490,14 +529,307 @@ static v2p_cache_entry_t v2p_cache_entry_create (vmi_instance_t vmi, addr_t pa)
     pa &= ~((addr_t)vmi->page_size - 1);
     entry->pa = pa;
     entry->last_used = time(NULL);
+    entry->generation = vmi->v2p_generation;
     return entry;
 }
 
+/*
+ * Software TLB in front of the v2p hash table.  It is a small
+ * set-associative array indexed by (dtb, va >> page shift), where each
+ * entry remembers the size of the page it maps, so a 2MB or 1GB page
+ * takes a single slot.  Lookups probe each page size seen since the
+ * last flush, smallest first.  Ways within a set are kept in LRU order.
+ */
+#define V2P_TLB_SETS 256
+#define V2P_TLB_WAYS 4
+
+struct v2p_tlb_entry {
+    addr_t dtb;
+    addr_t vpn;         /* va >> shift */
+    addr_t pa;          /* base of the page */
+    uint32_t shift;     /* page size shift, zero for an empty slot */
+    uint32_t generation;
+};
+
+struct v2p_tlb {
+    uint64_t shifts;    /* bit n is set once a 1 << n page was inserted */
+    struct v2p_tlb_entry sets[V2P_TLB_SETS][V2P_TLB_WAYS];
+};
+
+static const uint32_t v2p_tlb_shifts[] = { 12, 21, 22, 30 };
+
+static inline uint32_t
+v2p_tlb_page_shift(
+    page_size_t size)
+{
+    switch (size) {
+    case VMI_PS_2MB: return 21;
+    case VMI_PS_4MB: return 22;
+    case VMI_PS_1GB: return 30;
+    default: return 12;
+    }
+}
+
+static inline struct v2p_tlb_entry *
+v2p_tlb_set_for(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t vpn,
+    uint32_t shift)
+{
+    return vmi->v2p_tlb->sets[hash128to64(vpn, dtb ^ shift) & (V2P_TLB_SETS - 1)];
+}
+
+static inline int
+v2p_tlb_find(
+    struct v2p_tlb_entry *set,
+    addr_t dtb,
+    addr_t vpn,
+    uint32_t shift)
+{
+    int way;
+
+    for (way = 0; way < V2P_TLB_WAYS; ++way) {
+        if (set[way].shift == shift && set[way].vpn == vpn && set[way].dtb == dtb) {
+            return way;
+        }
+    }
+    return -1;
+}
+
+/* move ways [0, way) down one slot and put entry in front */
+static inline void
+v2p_tlb_promote(
+    struct v2p_tlb_entry *set,
+    int way,
+    struct v2p_tlb_entry entry)
+{
+    memmove(&set[1], &set[0], way * sizeof(*set));
+    set[0] = entry;
+}
+
+static inline int
+v2p_cache_valid(
+    vmi_instance_t vmi,
+    uint32_t generation)
+{
+    return VMI_V2P_VALIDATE_GENERATION != vmi->v2p_validation
+        || generation == vmi->v2p_generation;
+}
+
+static status_t
+v2p_tlb_get(
+    vmi_instance_t vmi,
+    addr_t va,
+    addr_t dtb,
+    addr_t *pa,
+    page_size_t *size)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(v2p_tlb_shifts) / sizeof(v2p_tlb_shifts[0]); ++i) {
+        uint32_t shift = v2p_tlb_shifts[i];
+        addr_t vpn = va >> shift;
+        struct v2p_tlb_entry *set = NULL;
+        int way;
+
+        if (!(vmi->v2p_tlb->shifts & (1ULL << shift))) {
+            continue;
+        }
+
+        set = v2p_tlb_set_for(vmi, dtb, vpn, shift);
+        way = v2p_tlb_find(set, dtb, vpn, shift);
+        if (way < 0 || !v2p_cache_valid(vmi, set[way].generation)) {
+            continue;
+        }
+
+        v2p_tlb_promote(set, way, set[way]);
+        *pa = set[0].pa | (va & ((1ULL << shift) - 1));
+        if (size) {
+            *size = (page_size_t) (1ULL << shift);
+        }
+        return VMI_SUCCESS;
+    }
+
+    return VMI_FAILURE;
+}
+
+static void
+v2p_tlb_set(
+    vmi_instance_t vmi,
+    addr_t va,
+    addr_t dtb,
+    addr_t pa,
+    page_size_t size)
+{
+    uint32_t shift = v2p_tlb_page_shift(size);
+    struct v2p_tlb_entry entry = {
+        .dtb = dtb,
+        .vpn = va >> shift,
+        .pa = pa & ~((1ULL << shift) - 1),
+        .shift = shift,
+        .generation = vmi->v2p_generation
+    };
+    struct v2p_tlb_entry *set = v2p_tlb_set_for(vmi, dtb, entry.vpn, shift);
+    int way = v2p_tlb_find(set, dtb, entry.vpn, shift);
+
+    v2p_tlb_promote(set, way < 0 ? V2P_TLB_WAYS - 1 : way, entry);
+    vmi->v2p_tlb->shifts |= 1ULL << shift;
+}
+
+static void
+v2p_tlb_del(
+    vmi_instance_t vmi,
+    addr_t va,
+    addr_t dtb)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(v2p_tlb_shifts) / sizeof(v2p_tlb_shifts[0]); ++i) {
+        uint32_t shift = v2p_tlb_shifts[i];
+        struct v2p_tlb_entry *set = v2p_tlb_set_for(vmi, dtb, va >> shift, shift);
+        int way = v2p_tlb_find(set, dtb, va >> shift, shift);
+
+        if (way >= 0) {
+            memmove(&set[way], &set[way + 1], (V2P_TLB_WAYS - way - 1) * sizeof(*set));
+            memset(&set[V2P_TLB_WAYS - 1], 0, sizeof(*set));
+        }
+    }
+}
+
+/*
+ * Paging-structure cache.  Like the hardware caches of the same name it
+ * holds non-leaf page table entries, keyed by dtb and the part of the
+ * virtual address that selects the entry (va >> shift), so a walk that
+ * misses the TLB can resume at the deepest level found here.  Entries
+ * carry the whole path of upper level entries above them, so a resumed
+ * walk still fills in a complete page_info_t.
+ */
+#define PS_CACHE_SETS 128
+#define PS_CACHE_WAYS 4
+
+struct ps_cache_entry {
+    addr_t dtb;
+    addr_t prefix;      /* va >> shift */
+    uint32_t shift;     /* zero for an empty slot */
+    uint32_t generation;
+    addr_t l4_a;
+    uint64_t l4_v;
+    addr_t l3_a;
+    uint64_t l3_v;
+    addr_t l2_a;
+    uint64_t l2_v;
+};
+
+struct ps_cache {
+    struct ps_cache_entry sets[PS_CACHE_SETS][PS_CACHE_WAYS];
+};
+
+static inline struct ps_cache_entry *
+ps_cache_set_for(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t prefix,
+    uint32_t shift)
+{
+    return vmi->ps_cache->sets[hash128to64(prefix, dtb ^ shift) & (PS_CACHE_SETS - 1)];
+}
+
+status_t
+ps_cache_get(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t va,
+    uint32_t shift,
+    page_info_t *info)
+{
+    status_t ret = VMI_FAILURE;
+    addr_t prefix = va >> shift;
+    struct ps_cache_entry *set = NULL;
+    struct ps_cache_entry entry;
+    int way;
+
+    vmi_lock(vmi, &vmi->v2p_cache_lock);
+    set = ps_cache_set_for(vmi, dtb, prefix, shift);
+    for (way = 0; way < PS_CACHE_WAYS; ++way) {
+        if (set[way].shift == shift && set[way].prefix == prefix && set[way].dtb == dtb
+            && v2p_cache_valid(vmi, set[way].generation)) {
+            break;
+        }
+    }
+    if (way < PS_CACHE_WAYS) {
+        entry = set[way];
+        memmove(&set[1], &set[0], way * sizeof(*set));
+        set[0] = entry;
+
+        info->l4_a = entry.l4_a;
+        info->l4_v = entry.l4_v;
+        info->l3_a = entry.l3_a;
+        info->l3_v = entry.l3_v;
+        info->l2_a = entry.l2_a;
+        info->l2_v = entry.l2_v;
+        ret = VMI_SUCCESS;
+    }
+    vmi_unlock(vmi, &vmi->v2p_cache_lock);
+
+    return ret;
+}
+
+void
+ps_cache_set(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t va,
+    uint32_t shift,
+    page_info_t *info)
+{
+    struct ps_cache_entry entry = {
+        .dtb = dtb,
+        .prefix = va >> shift,
+        .shift = shift,
+        .generation = vmi->v2p_generation,
+        .l4_a = info->l4_a,
+        .l4_v = info->l4_v,
+        .l3_a = info->l3_a,
+        .l3_v = info->l3_v,
+        .l2_a = info->l2_a,
+        .l2_v = info->l2_v
+    };
+    struct ps_cache_entry *set = NULL;
+    int way;
+
+    vmi_lock(vmi, &vmi->v2p_cache_lock);
+    set = ps_cache_set_for(vmi, dtb, entry.prefix, shift);
+    for (way = 0; way < PS_CACHE_WAYS - 1; ++way) {
+        if (set[way].shift == shift && set[way].prefix == entry.prefix && set[way].dtb == dtb) {
+            break;
+        }
+    }
+    memmove(&set[1], &set[0], way * sizeof(*set));
+    set[0] = entry;
+    vmi_unlock(vmi, &vmi->v2p_cache_lock);
+}
+
+void
+ps_cache_flush(
+    vmi_instance_t vmi)
+{
+    vmi_lock(vmi, &vmi->v2p_cache_lock);
+    memset(vmi->ps_cache, 0, sizeof(struct ps_cache));
+    vmi_unlock(vmi, &vmi->v2p_cache_lock);
+    dbprint(VMI_DEBUG_V2PCACHE, "--Paging structure cache flushed\n");
+}
+
 void
 v2p_cache_init(
     vmi_instance_t vmi)
 {
     vmi->v2p_cache = g_hash_table_new_full((GHashFunc) key_128_hash, key_128_equals, g_free, g_free);
+    vmi->v2p_tlb = safe_malloc(sizeof(struct v2p_tlb));
+    memset(vmi->v2p_tlb, 0, sizeof(struct v2p_tlb));
+    vmi->ps_cache = safe_malloc(sizeof(struct ps_cache));
+    memset(vmi->ps_cache, 0, sizeof(struct ps_cache));
+    pthread_mutex_init(&vmi->v2p_cache_lock, NULL);
 }
 
 void
@@ -505,6 +837,11 @@ v2p_cache_destroy(
     vmi_instance_t vmi)
 {
     g_hash_table_destroy(vmi->v2p_cache);
+    free(vmi->v2p_tlb);
+    vmi->v2p_tlb = NULL;
+    free(vmi->ps_cache);
+    vmi->ps_cache = NULL;
+    pthread_mutex_destroy(&vmi->v2p_cache_lock);
 }
 
 status_t
@@ -514,22 +851,51 @@ v2p_cache_get(
     addr_t dtb,
     addr_t *pa)
 {
+    status_t ret = VMI_FAILURE;
     v2p_cache_entry_t entry = NULL;
     struct key_128 local_key;
     key_128_t key = &local_key;
 
-    key_128_init(vmi, key, (uint64_t)va, (uint64_t)dtb);
+    vmi_lock(vmi, &vmi->v2p_cache_lock);
+    if (VMI_SUCCESS == v2p_tlb_get(vmi, va, dtb, pa, NULL)) {
+        ret = VMI_SUCCESS;
+        goto done;
+    }
 
-    if ((entry = g_hash_table_lookup(vmi->v2p_cache, key)) != NULL) {
+    key_128_init(vmi, key, (uint64_t)va, (uint64_t)dtb);
+    if ((entry = g_hash_table_lookup(vmi->v2p_cache, key)) != NULL
+        && v2p_cache_valid(vmi, entry->generation)) {
 
         entry->last_used = time(NULL);
         *pa = entry->pa | ((vmi->page_size - 1) & va);
         dbprint(VMI_DEBUG_V2PCACHE, "--V2P cache hit 0x%.16"PRIx64" -- 0x%.16"PRIx64" (0x%.16"PRIx64"/0x%.16"PRIx64")\n",
                 va, *pa, key->high, key->low);
-        return VMI_SUCCESS;
+        v2p_tlb_set(vmi, va, dtb, entry->pa, VMI_PS_4KB);
+        ret = VMI_SUCCESS;
     }
 
-    return VMI_FAILURE;
+done:
+    vmi_unlock(vmi, &vmi->v2p_cache_lock);
+
+    return ret;
+}
+
+/* only the TLB knows the size of the page backing a translation */
+status_t
+v2p_cache_get_page(
+    vmi_instance_t vmi,
+    addr_t va,
+    addr_t dtb,
+    addr_t *pa,
+    page_size_t *size)
+{
+    status_t ret = VMI_FAILURE;
+
+    vmi_lock(vmi, &vmi->v2p_cache_lock);
+    ret = v2p_tlb_get(vmi, va, dtb, pa, size);
+    vmi_unlock(vmi, &vmi->v2p_cache_lock);
+
+    return ret;
 }
 
 void
@@ -537,16 +903,65 @@ v2p_cache_set(
     vmi_instance_t vmi,
     addr_t va,
     addr_t dtb,
-    addr_t pa)
+    addr_t pa,
+    page_size_t size)
 {
     if (!va || !dtb || !pa) {
         return;
     }
     key_128_t key = key_128_build(vmi, (uint64_t)va, (uint64_t)dtb);
     v2p_cache_entry_t entry = v2p_cache_entry_create(vmi, pa);
-    g_hash_table_insert(vmi->v2p_cache, key, entry);
     dbprint(VMI_DEBUG_V2PCACHE, "--V2P cache set 0x%.16"PRIx64" -- 0x%.16"PRIx64" (0x%.16"PRIx64"/0x%.16"PRIx64")\n", va,
             pa, key->high, key->low);
+    vmi_lock(vmi, &vmi->v2p_cache_lock);
+    g_hash_table_insert(vmi->v2p_cache, key, entry);
+    v2p_tlb_set(vmi, va, dtb, pa, size);
+    vmi_unlock(vmi, &vmi->v2p_cache_lock);
+}
+
+/* insert several translations of one address space under a single lock */
+void
+v2p_cache_set_many(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    const addr_t *va,
+    const addr_t *pa,
+    size_t n,
+    page_size_t size)
+{
+    key_128_t *keys = NULL;
+    v2p_cache_entry_t *entries = NULL;
+    size_t i, count = 0;
+
+    if (!dtb || !n) {
+        return;
+    }
+    keys = safe_malloc(n * sizeof(key_128_t));
+    entries = safe_malloc(n * sizeof(v2p_cache_entry_t));
+    for (i = 0; i < n; ++i) {
+        if (!va[i] || !pa[i]) {
+            continue;
+        }
+        keys[count] = key_128_build(vmi, (uint64_t)va[i], (uint64_t)dtb);
+        entries[count] = v2p_cache_entry_create(vmi, pa[i]);
+        count++;
+    }
+
+    vmi_lock(vmi, &vmi->v2p_cache_lock);
+    for (i = 0; i < count; ++i) {
+        g_hash_table_insert(vmi->v2p_cache, keys[i], entries[i]);
+    }
+    for (i = 0; i < n; ++i) {
+        if (va[i] && pa[i]) {
+            v2p_tlb_set(vmi, va[i], dtb, pa[i], size);
+        }
+    }
+    vmi_unlock(vmi, &vmi->v2p_cache_lock);
+    dbprint(VMI_DEBUG_V2PCACHE, "--V2P cache set %zu entries for dtb 0x%.16"PRIx64"\n",
+            count, dtb);
+
+    free(entries);
+    free(keys);
 }
 
 status_t
@@ -555,6 +970,7 @@ v2p_cache_del(
     addr_t va,
     addr_t dtb)
 {
+    status_t ret = VMI_FAILURE;
     struct key_128 local_key;
     key_128_t key = &local_key;
     key_128_init(vmi, key, (uint64_t)va, (uint64_t)dtb);
@@ -564,19 +980,26 @@ v2p_cache_del(
     // key collision doesn't really matter here because worst case
     // scenario we incur an small performance hit
 
+    vmi_lock(vmi, &vmi->v2p_cache_lock);
+    v2p_tlb_del(vmi, va, dtb);
     if (TRUE == g_hash_table_remove(vmi->v2p_cache, key)){
-        return VMI_SUCCESS;
-    }
-    else{
-        return VMI_FAILURE;
+        ret = VMI_SUCCESS;
     }
+    vmi_unlock(vmi, &vmi->v2p_cache_lock);
+
+    return ret;
 }
 
 void
 v2p_cache_flush(
     vmi_instance_t vmi)
 {
+    vmi_lock(vmi, &vmi->v2p_cache_lock);
     g_hash_table_remove_all(vmi->v2p_cache);
+    memset(vmi->v2p_tlb, 0, sizeof(struct v2p_tlb));
+    memset(vmi->ps_cache, 0, sizeof(struct ps_cache));
+    vmi->v2p_generation++;
+    vmi_unlock(vmi, &vmi->v2p_cache_lock);
     dbprint(VMI_DEBUG_V2PCACHE, "--V2P cache flushed\n");
 }
 
@@ -605,6 +1028,7 @@ v2m_cache_init(
     vmi_instance_t vmi)
 {
     vmi->v2m_cache = g_hash_table_new_full((GHashFunc) key_128_hash, key_128_equals, g_free, g_free);
+    pthread_mutex_init(&vmi->v2m_cache_lock, NULL);
 }
 
 void
@@ -612,6 +1036,7 @@ v2m_cache_destroy(
     vmi_instance_t vmi)
 {
     g_hash_table_destroy(vmi->v2m_cache);
+    pthread_mutex_destroy(&vmi->v2m_cache_lock);
 }
 
 status_t
@@ -622,12 +1047,14 @@ v2m_cache_get(
     addr_t *ma,
     uint64_t *length)
 {
+    status_t ret = VMI_FAILURE;
     v2m_cache_entry_t entry = NULL;
     struct key_128 local_key;
     key_128_t key = &local_key;
 
     key_128_init(vmi, key, (uint64_t)va, (uint64_t)pid);
 
+    vmi_lock(vmi, &vmi->v2m_cache_lock);
     if ((entry = g_hash_table_lookup(vmi->v2m_cache, key)) != NULL) {
 
         entry->last_used = time(NULL);
@@ -635,10 +1062,11 @@ v2m_cache_get(
         *length = entry->length;
         dbprint(VMI_DEBUG_V2MCACHE, "--v2m cache hit 0x%.16"PRIx64" -- 0x%.16"PRIx64" len 0x%.16"PRIx64" (0x%.16"PRIx64"/0x%.16"PRIx64")\n",
                 va, *ma, *length, key->high, key->low);
-        return VMI_SUCCESS;
+        ret = VMI_SUCCESS;
     }
+    vmi_unlock(vmi, &vmi->v2m_cache_lock);
 
-    return VMI_FAILURE;
+    return ret;
 }
 
 void
@@ -654,9 +1082,11 @@ v2m_cache_set(
     }
     key_128_t key = key_128_build(vmi, (uint64_t)va, (uint64_t)pid);
     v2m_cache_entry_t entry = v2m_cache_entry_create(vmi, ma, length);
-    g_hash_table_insert(vmi->v2m_cache, key, entry);
     dbprint(VMI_DEBUG_V2MCACHE, "--v2m cache set 0x%.16"PRIx64" -- 0x%.16"PRIx64" len 0x%.16"PRIx64" (0x%.16"PRIx64"/0x%.16"PRIx64")\n", va,
             ma, length, key->high, key->low);
+    vmi_lock(vmi, &vmi->v2m_cache_lock);
+    g_hash_table_insert(vmi->v2m_cache, key, entry);
+    vmi_unlock(vmi, &vmi->v2m_cache_lock);
 }
 
 status_t
@@ -665,6 +1095,7 @@ v2m_cache_del(
     addr_t va,
     pid_t pid)
 {
+    status_t ret = VMI_FAILURE;
     struct key_128 local_key;
     key_128_t key = &local_key;
     key_128_init(vmi, key, (uint64_t)va, (uint64_t)pid);
@@ -674,19 +1105,22 @@ v2m_cache_del(
     // key collision doesn't really matter here because worst case
     // scenario we incur an small performance hit
 
+    vmi_lock(vmi, &vmi->v2m_cache_lock);
     if (TRUE == g_hash_table_remove(vmi->v2m_cache, key)){
-        return VMI_SUCCESS;
-    }
-    else{
-        return VMI_FAILURE;
+        ret = VMI_SUCCESS;
     }
+    vmi_unlock(vmi, &vmi->v2m_cache_lock);
+
+    return ret;
 }
 
 void
 v2m_cache_flush(
     vmi_instance_t vmi)
 {
+    vmi_lock(vmi, &vmi->v2m_cache_lock);
     g_hash_table_remove_all(vmi->v2m_cache);
+    vmi_unlock(vmi, &vmi->v2m_cache_lock);
     dbprint(VMI_DEBUG_V2MCACHE, "--v2m cache flushed\n");
 }
 #endif
@@ -869,12 +1303,36 @@ v2p_cache_get(
     return VMI_FAILURE;
 }
 
+status_t
+v2p_cache_get_page(
+    vmi_instance_t vmi,
+    addr_t va,
+    addr_t dtb,
+    addr_t *pa,
+    page_size_t *size)
+{
+    return VMI_FAILURE;
+}
+
 void
 v2p_cache_set(
     vmi_instance_t vmi,
     addr_t va,
     addr_t dtb,
-    addr_t pa)
+    addr_t pa,
+    page_size_t size)
+{
+    return;
+}
+
+void
+v2p_cache_set_many(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    const addr_t *va,
+    const addr_t *pa,
+    size_t n,
+    page_size_t size)
 {
     return;
 }
@@ -891,6 +1349,36 @@ v2p_cache_del(
 void
 v2p_cache_flush(
     vmi_instance_t vmi)
+{
+    /* address space handles keep translations of their own */
+    vmi->v2p_generation++;
+}
+
+status_t
+ps_cache_get(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t va,
+    uint32_t shift,
+    page_info_t *info)
+{
+    return VMI_FAILURE;
+}
+
+void
+ps_cache_set(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t va,
+    uint32_t shift,
+    page_info_t *info)
+{
+    return;
+}
+
+void
+ps_cache_flush(
+    vmi_instance_t vmi)
 {
     return;
 }
@@ -1010,7 +1498,7 @@ vmi_v2pcache_add(
     addr_t dtb,
     addr_t pa)
 {
-    return v2p_cache_set(vmi, va, dtb, pa);
+    return v2p_cache_set(vmi, va, dtb, pa, VMI_PS_4KB);
 }
 
 void
@@ -1019,3 +1507,11 @@ vmi_v2pcache_flush(
 {
     return v2p_cache_flush(vmi);
 }
+
+void
+vmi_v2pcache_set_validation(
+    vmi_instance_t vmi,
+    v2p_validation_t policy)
+{
+    vmi->v2p_validation = policy;
+}
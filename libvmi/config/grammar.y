@@ -284,7 +284,9 @@ int vmi_parse_config (const char *target_name)
 %token<str>    WIN_KPCR
 %token<str>    WIN_SYSPROC
 %token<str>    SYSMAPTOK
+%token<str>    PROFILE_CACHE
 %token<str>    OSTYPETOK
+%token<str>    PAGE_CACHE_SIZE
 %token<str>    WORD
 %token<str>    FILENAME
 %token         QUOTE
@@ -318,6 +320,8 @@ assignment:
         |
         sysmap_assignment
         |
+        profile_cache_assignment
+        |
         ostype_assignment
         |
         linux_tasks_assignment
@@ -355,6 +359,8 @@ assignment:
         win_kpcr_assignment
         |
         win_sysproc_assignment
+        |
+        page_cache_size_assignment
         ;
 
 linux_tasks_assignment:
@@ -551,6 +557,17 @@ win_sysproc_assignment:
         }
         ;
 
+page_cache_size_assignment:
+        PAGE_CACHE_SIZE EQUALS NUM
+        {
+            uint64_t tmp = strtoull($3, NULL, 0);
+            uint64_t *tmp_ptr = malloc(sizeof(uint64_t));
+            (*tmp_ptr) = tmp;
+            g_hash_table_insert(tmp_entry, $1, tmp_ptr);
+            free($3);
+        }
+        ;
+
 sysmap_assignment:
         SYSMAPTOK EQUALS QUOTE FILENAME QUOTE
         {
@@ -561,6 +578,16 @@ sysmap_assignment:
         }
         ;
 
+profile_cache_assignment:
+        PROFILE_CACHE EQUALS QUOTE FILENAME QUOTE
+        {
+            snprintf(tmp_str, CONFIG_STR_LENGTH, "%s", $4);
+            char* profile_path = strndup(tmp_str, CONFIG_STR_LENGTH);
+            g_hash_table_insert(tmp_entry, $1, profile_path);
+            free($4);
+        }
+        ;
+
 ostype_assignment:
         OSTYPETOK EQUALS QUOTE WORD QUOTE
         {
@@ -122,6 +122,24 @@ set_os_type_from_config(
     return ret;
 }
 
+static void
+set_page_cache_size_from_config(
+    vmi_instance_t vmi,
+    GHashTable *configtbl)
+{
+    uint64_t *bytes = NULL;
+
+    if (configtbl == NULL) {
+        return;
+    }
+
+    bytes = g_hash_table_lookup(configtbl, "page_cache_size");
+    if (bytes != NULL) {
+        dbprint(VMI_DEBUG_CORE, "**set page cache size = %"PRIu64" bytes\n", *bytes);
+        memory_cache_set_limit(vmi, *bytes);
+    }
+}
+
 status_t
 read_config_file(
     vmi_instance_t vmi, FILE* config_file);
@@ -546,6 +564,8 @@ vmi_init_private(
             goto error_exit;
         }
 
+        set_page_cache_size_from_config(*vmi, (*vmi)->config);
+
 
         /* setup the correct page offset size for the target OS */
         if (VMI_FAILURE == init_page_offset(*vmi)) {
@@ -596,6 +616,10 @@ vmi_init_private(
 
         return status;
     } else if (init_mode & VMI_INIT_PARTIAL) {
+        if (VMI_CONFIG_GHASHTABLE & (*vmi)->config_mode) {
+            set_page_cache_size_from_config(*vmi, (GHashTable*)config);
+        }
+
         init_page_offset(*vmi);
         driver_get_memsize(*vmi, &(*vmi)->size);
 
@@ -711,6 +735,14 @@ vmi_init_complete(
         flags |= VMI_INIT_EVENTS;
     }
 
+    if (((*vmi)->flags) & VMI_INIT_THREADSAFE) {
+        flags |= VMI_INIT_THREADSAFE;
+    }
+
+    if (((*vmi)->flags) & VMI_INIT_PAGECACHE) {
+        flags |= VMI_INIT_PAGECACHE;
+    }
+
     vmi_destroy(*vmi);
     return vmi_init_private(vmi,
                             flags,
@@ -74,30 +74,28 @@ file_get_memory(
         goto error_noprint;
     }   // if
 
-    memory = safe_malloc(length);
-
 #if USE_MMAP
-    (void) memcpy(memory,
-                  ((uint8_t *) file_get_instance(vmi)->map) + paddr,
-                  length);
+    // the whole image is already mapped, so hand out a pointer into the
+    // mapping instead of copying the page
+    memory = ((uint8_t *) file_get_instance(vmi)->map) + paddr;
 #else
-    if (paddr != lseek(file_get_instance(vmi)->fd, paddr, SEEK_SET)) {
-        goto error_print;
-    }
-    if (length != read(file_get_instance(vmi)->fd, memory, length)) {
+    memory = safe_malloc(length);
+    if (length != pread(file_get_instance(vmi)->fd, memory, length, paddr)) {
         goto error_print;
     }
 #endif // USE_MMAP
 
     return memory;
 
+#if !USE_MMAP
 error_print:
     dbprint(VMI_DEBUG_WRITE, "%s: failed to read %d bytes at "
             "PA (offset) 0x%.16"PRIx64" [VM size 0x%.16"PRIx64"]\n", __FUNCTION__,
             length, paddr, vmi->size);
-error_noprint:
     if (memory)
         free(memory);
+#endif // !USE_MMAP
+error_noprint:
     return NULL;
 }
 
@@ -106,8 +104,11 @@ file_release_memory(
     void *memory,
     size_t length)
 {
+    // with mmap the memory belongs to the file mapping, see file_get_memory
+#if !USE_MMAP
     if (memory)
         free(memory);
+#endif // !USE_MMAP
 }
 
 //----------------------------------------------------------------------------
@@ -161,6 +162,13 @@ file_init(
     }
     fi->map = map;
 
+    // the whole image is mapped, so pages can be handed out without
+    // going through the memory cache
+    if (!(vmi->flags & VMI_INIT_PAGECACHE)) {
+        vmi->flat_memory = map;
+        vmi->flat_memory_size = size;
+    }
+
     // Note: madvise(.., MADV_SEQUENTIAL | MADV_WILLNEED) does not seem to
     // improve performance
 
@@ -181,6 +189,8 @@ file_destroy(
     file_instance_t *fi = file_get_instance(vmi);
 
 #if USE_MMAP
+    vmi->flat_memory = NULL;
+    vmi->flat_memory_size = 0;
     if (fi->map) {
         (void) munmap(fi->map, vmi->size);
         fi->map = 0;
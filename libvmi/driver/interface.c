@@ -130,12 +130,12 @@ struct driver_instance {
 };
 typedef struct driver_instance *driver_instance_t;
 
-static driver_instance_t instance = NULL;
-
 static void
 driver_xen_setup(
     vmi_instance_t vmi)
 {
+    driver_instance_t instance = vmi->driver_ptrs;
+
     vmi->driver = safe_malloc(sizeof(xen_instance_t));
     memset(vmi->driver, 0, sizeof(xen_instance_t));
     instance->init_ptr = &xen_init;
@@ -191,6 +191,8 @@ static void
 driver_kvm_setup(
     vmi_instance_t vmi)
 {
+    driver_instance_t instance = vmi->driver_ptrs;
+
     vmi->driver = safe_malloc(sizeof(kvm_instance_t));
     memset(vmi->driver, 0, sizeof(kvm_instance_t));
     instance->init_ptr = &kvm_init;
@@ -235,6 +237,8 @@ static void
 driver_file_setup(
     vmi_instance_t vmi)
 {
+    driver_instance_t instance = vmi->driver_ptrs;
+
     vmi->driver = safe_malloc(sizeof(file_instance_t));
     memset(vmi->driver, 0, sizeof(file_instance_t));
     instance->init_ptr = &file_init;
@@ -268,6 +272,8 @@ static void
 driver_null_setup(
     vmi_instance_t vmi)
 {
+    driver_instance_t instance = vmi->driver_ptrs;
+
     vmi->driver = NULL;
     instance->init_ptr = NULL;
     instance->destroy_ptr = NULL;
@@ -299,12 +305,13 @@ static driver_instance_t
 driver_get_instance(
     vmi_instance_t vmi)
 {
-    if (NULL == vmi->driver || NULL == instance) {
+    if (NULL == vmi->driver || NULL == vmi->driver_ptrs) {
         /* allocate memory for the function pointers, if needed */
-        if (NULL == instance) {
-            instance =
+        if (NULL == vmi->driver_ptrs) {
+            vmi->driver_ptrs =
                 (driver_instance_t)
                 safe_malloc(sizeof(struct driver_instance));
+            memset(vmi->driver_ptrs, 0, sizeof(struct driver_instance));
         }
 
         /* assign the function pointers */
@@ -322,7 +329,7 @@ driver_get_instance(
         }
 
     }
-    return instance;
+    return vmi->driver_ptrs;
 }
 
 status_t
@@ -390,12 +397,14 @@ driver_destroy(
     if (NULL != ptrs && NULL != ptrs->destroy_ptr) {
         ptrs->destroy_ptr(vmi);
         free(vmi->driver);
-        return;
     }
     else {
         dbprint(VMI_DEBUG_DRIVER, "WARNING: driver_destroy function not implemented.\n");
-        return;
     }
+
+    vmi->driver = NULL;
+    free(vmi->driver_ptrs);
+    vmi->driver_ptrs = NULL;
 }
 
 unsigned long
@@ -49,27 +49,86 @@
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
 
-// request struct matches a definition in qemu source code
-struct request {
-    uint8_t type;   // 0 quit, 1 read, 2 write, ... rest reserved
-    uint64_t address;   // address to read from OR write to
-    uint64_t length;    // number of bytes to read OR write
-};
-
 //----------------------------------------------------------------------------
 // Helper functions
 
 //
 // QMP Command Interactions
+
+/* a guest started with -qmp unix:KVM_QMP_SOCKET_DIR/<name>.qmp,server,nowait
+ * gets a persistent session; libvirt keeps its own monitor to itself */
+#define KVM_QMP_SOCKET_DIR "/var/run/libvmi"
+
+/* native mode dumps guest memory to a tmpfs file with pmemsave */
+#define KVM_PMEMSAVE_DIR "/dev/shm"
+
+static void
+init_qmp_session(
+    kvm_instance_t *kvm)
+{
+    const char *name = virDomainGetName(kvm->dom);
+    char *path = NULL;
+
+    if (NULL == name) {
+        return;
+    }
+
+    path = safe_malloc(strlen(KVM_QMP_SOCKET_DIR) + strlen(name) + sizeof("/.qmp"));
+    sprintf(path, "%s/%s.qmp", KVM_QMP_SOCKET_DIR, name);
+    kvm->qmp = qmp_connect(path);
+    if (NULL == kvm->qmp) {
+        dbprint(VMI_DEBUG_KVM, "--kvm: no QMP socket at %s, using virsh\n", path);
+    }
+    free(path);
+}
+
+static char *
+exec_qmp_session(
+    kvm_instance_t *kvm,
+    char *query)
+{
+    char *command = strdup(query);
+    size_t length = strlen(command);
+    char *reply = NULL, *output = NULL;
+
+    /* queries are quoted for the virsh command line */
+    if (length >= 2 && '\'' == command[0] && '\'' == command[length - 1]) {
+        memmove(command, command + 1, length - 2);
+        command[length - 2] = '\0';
+    }
+
+    pthread_mutex_lock(&kvm->qmp_lock);
+    if (NULL != kvm->qmp) {
+        reply = qmp_execute(kvm->qmp, command);
+        if (NULL == reply) {
+            dbprint(VMI_DEBUG_KVM, "--kvm: QMP session lost, using virsh\n");
+            qmp_close(kvm->qmp);
+            kvm->qmp = NULL;
+        }
+    }
+    pthread_mutex_unlock(&kvm->qmp_lock);
+
+    if (NULL != reply) {
+        output = strdup(reply);
+        g_free(reply);
+    }
+    free(command);
+    return output;
+}
+
 static char *
 exec_qmp_cmd(
     kvm_instance_t *kvm,
     char *query)
 {
     FILE *p;
-    char *output = safe_malloc(20000);
+    char *output = NULL;
     size_t length = 0;
 
+    if (NULL != kvm->qmp && NULL != (output = exec_qmp_session(kvm, query))) {
+        return output;
+    }
+
     char *name = (char *) virDomainGetName(kvm->dom);
     int cmd_length = strlen(name) + strlen(query) + 29;
     char *cmd = safe_malloc(cmd_length);
@@ -85,7 +144,26 @@ exec_qmp_cmd(
         return NULL;
     }
 
-    length = fread(output, 1, 20000, p);
+    /* "info registers -a" grows with the vCPU count */
+    size_t n = 0, size = 20000;
+    char *grown = NULL;
+
+    output = safe_malloc(size);
+    while ((n = fread(output + length, 1, size - length - 1, p)) > 0) {
+        length += n;
+        if (length == size - 1) {
+            size *= 2;
+            grown = realloc(output, size);
+            if (NULL == grown) {
+                errprint("Failed to grow the QMP output buffer to %zu bytes\n", size);
+                free(output);
+                output = NULL;
+                length = 0;
+                break;
+            }
+            output = grown;
+        }
+    }
     pclose(p);
     free(cmd);
 
@@ -94,19 +172,51 @@ exec_qmp_cmd(
         return NULL;
     }
     else {
+        output[length] = '\0';
         return output;
     }
 }
 
+/* registers of every vCPU in one command, "-a" is missing in old QEMU */
 static char *
 exec_info_registers(
-    kvm_instance_t *kvm)
+    kvm_instance_t *kvm,
+    int all_vcpus)
 {
-    char *query =
+    char *query = all_vcpus ?
+        "'{\"execute\": \"human-monitor-command\", \"arguments\": {\"command-line\": \"info registers -a\"}}'" :
         "'{\"execute\": \"human-monitor-command\", \"arguments\": {\"command-line\": \"info registers\"}}'";
     return exec_qmp_cmd(kvm, query);
 }
 
+static qmp_registers_t
+parse_registers(
+    char *ir_output)
+{
+    char *dump = qmp_reply_string(ir_output);
+    qmp_registers_t regs = qmp_parse_registers(dump);
+
+    g_free(dump);
+    return regs;
+}
+
+static qmp_registers_t
+fetch_registers(
+    kvm_instance_t *kvm)
+{
+    qmp_registers_t regs = NULL;
+    char *output = exec_info_registers(kvm, 1);
+
+    regs = parse_registers(output);
+    free(output);
+    if (NULL == regs) {
+        output = exec_info_registers(kvm, 0);
+        regs = parse_registers(output);
+        free(output);
+    }
+    return regs;
+}
+
 static char *
 exec_memory_access(
     kvm_instance_t *kvm)
@@ -135,7 +245,7 @@ exec_xp(
     char *query = (char *) safe_malloc(256);
 
     sprintf(query,
-            "'{\"execute\": \"human-monitor-command\", \"arguments\": {\"command-line\": \"xp /%dwx 0x%x\"}}'",
+            "'{\"execute\": \"human-monitor-command\", \"arguments\": {\"command-line\": \"xp /%dwx 0x%"PRIx64"\"}}'",
             numwords, paddr);
 
     char *output = exec_qmp_cmd(kvm, query);
@@ -144,26 +254,6 @@ exec_xp(
     return output;
 }
 
-static reg_t
-parse_reg_value(
-    char *regname,
-    char *ir_output)
-{
-    if (NULL == ir_output || NULL == regname) {
-        return 0;
-    }
-
-    char *ptr = strcasestr(ir_output, regname);
-
-    if (NULL != ptr) {
-        ptr += strlen(regname) + 1;
-        return (reg_t) strtoll(ptr, (char **) NULL, 16);
-    }
-    else {
-        return 0;
-    }
-}
-
 status_t
 exec_memory_access_success(
     char *status)
@@ -235,12 +325,9 @@ destroy_domain_socket(
     kvm_instance_t *kvm)
 {
     if (VMI_SUCCESS == test_using_kvm_patch(kvm)) {
-        struct request req;
-
-        req.type = 0;   // quit
-        req.address = 0;
-        req.length = 0;
-        write(kvm->socket_fd, &req, sizeof(struct request));
+        memaccess_quit(kvm->socket_fd);
+        close(kvm->socket_fd);
+        kvm->socket_fd = 0;
     }
 }
 
@@ -1247,9 +1334,15 @@ kvm_setup_shm_snapshot_mode(
     if (VMI_SUCCESS == exec_shm_snapshot_success(shm_snapshot_status)) {
 
         // dump cpu registers
-        char *cpu_regs = exec_info_registers(kvm_get_instance(vmi));
-        kvm_get_instance(vmi)->shm_snapshot_cpu_regs = strdup(cpu_regs);
-        free(cpu_regs);
+        char *cpu_regs = exec_info_registers(kvm_get_instance(vmi), 1);
+        qmp_registers_t regs = parse_registers(cpu_regs);
+
+        if (NULL == regs) {
+            free(cpu_regs);
+            cpu_regs = exec_info_registers(kvm_get_instance(vmi), 0);
+        }
+        qmp_free_registers(regs);
+        kvm_get_instance(vmi)->shm_snapshot_cpu_regs = cpu_regs;
 
         pid_cache_flush(vmi);
         sym_cache_flush(vmi);
@@ -1263,7 +1356,16 @@ kvm_setup_shm_snapshot_mode(
         if (shm_snapshot_status)
             free (shm_snapshot_status);
 
-        return link_mmap_shm_snapshot_dev(vmi);
+        if (VMI_SUCCESS != link_mmap_shm_snapshot_dev(vmi)) {
+            return VMI_FAILURE;
+        }
+
+        // the snapshot is one flat mapping, read pages straight out of it
+        if (!(vmi->flags & VMI_INIT_PAGECACHE)) {
+            vmi->flat_memory = kvm_get_instance(vmi)->shm_snapshot_map;
+            vmi->flat_memory_size = vmi->size;
+        }
+        return VMI_SUCCESS;
     } else {
         if (shm_snapshot_status)
             free (shm_snapshot_status);
@@ -1279,6 +1381,8 @@ kvm_teardown_shm_snapshot_mode(
 
     if (VMI_SUCCESS == test_using_shm_snapshot(kvm)) {
         dbprint(VMI_DEBUG_KVM, "--kvm: teardown KVM shm-snapshot\n");
+        vmi->flat_memory = NULL;
+        vmi->flat_memory_size = 0;
         munmap_unlink_shm_snapshot_dev(kvm, vmi->size);
         if (kvm->shm_snapshot_cpu_regs != NULL) {
             free(kvm->shm_snapshot_cpu_regs);
@@ -1301,40 +1405,83 @@ kvm_get_memory_patch(
     addr_t paddr,
     uint32_t length)
 {
-    char *buf = safe_malloc(length + 1);
-    struct request req;
+    kvm_instance_t *kvm = kvm_get_instance(vmi);
+    char *buf = safe_malloc(length);
+    status_t ret;
 
-    req.type = 1;   // read request
-    req.address = (uint64_t) paddr;
-    req.length = (uint64_t) length;
+    // requests and replies must not interleave on the socket
+    vmi_lock(vmi, &kvm->socket_lock);
+    ret = memaccess_read(kvm->socket_fd, paddr, buf, length);
+    vmi_unlock(vmi, &kvm->socket_lock);
 
-    int nbytes =
-        write(kvm_get_instance(vmi)->socket_fd, &req,
-              sizeof(struct request));
-    if (nbytes != sizeof(struct request)) {
-        goto error_exit;
+    if (VMI_FAILURE == ret) {
+        free(buf);
+        return NULL;
     }
-    else {
-        // get the data from kvm
-        nbytes =
-            read(kvm_get_instance(vmi)->socket_fd, buf, length + 1);
-        if (nbytes != (length + 1)) {
-            goto error_exit;
-        }
+    return buf;
+}
 
-        // check that kvm thinks everything is ok by looking at the last byte
-        // of the buffer, 0 is failure and 1 is success
-        if (buf[length]) {
-            // success, return pointer to buf
-            return buf;
+/* cache misses of a prefetch as pipelined BATCH_READs */
+static size_t
+kvm_get_memory_patch_batch(
+    vmi_instance_t vmi,
+    const addr_t *paddrs,
+    void **data,
+    size_t n)
+{
+    kvm_instance_t *kvm = kvm_get_instance(vmi);
+    memaccess_range_t *ranges = safe_malloc(n * sizeof(memaccess_range_t));
+    size_t i, fetched = 0;
+    status_t ret;
+
+    for (i = 0; i < n; i++) {
+        ranges[i].address = paddrs[i];
+        ranges[i].length = vmi->page_size;
+        ranges[i].buf = safe_malloc(vmi->page_size);
+    }
+
+    vmi_lock(vmi, &kvm->socket_lock);
+    ret = memaccess_read_batch(kvm->socket_fd, ranges, n);
+    vmi_unlock(vmi, &kvm->socket_lock);
+    if (VMI_FAILURE == ret) {
+        errprint("--kvm: lost the memory access socket during a batch read\n");
+    }
+
+    for (i = 0; i < n; i++) {
+        if (VMI_SUCCESS == ret && ranges[i].status) {
+            data[i] = ranges[i].buf;
+            fetched++;
+        }
+        else {
+            free(ranges[i].buf);
+            data[i] = NULL;
         }
     }
 
-    // default failure
-error_exit:
-    if (buf)
-        free(buf);
-    return NULL;
+    dbprint(VMI_DEBUG_KVM, "--kvm: batch read %zu of %zu pages\n", fetched, n);
+    free(ranges);
+    return fetched;
+}
+
+/* pmemsave only goes through the QMP session, virsh would show the dump path
+ * to every user on its command line; qmp_lock also covers the dump file,
+ * which every pmemsave rewrites */
+static size_t
+kvm_get_memory_pmemsave_batch(
+    vmi_instance_t vmi,
+    const addr_t *paddrs,
+    void **data,
+    size_t n)
+{
+    kvm_instance_t *kvm = kvm_get_instance(vmi);
+    size_t fetched = 0;
+
+    pthread_mutex_lock(&kvm->qmp_lock);
+    fetched = qmp_pmemsave_batch(kvm->qmp, kvm->pmemsave_path, paddrs, data, n, vmi->page_size);
+    pthread_mutex_unlock(&kvm->qmp_lock);
+
+    dbprint(VMI_DEBUG_KVM, "--kvm: pmemsave read %zu of %zu pages\n", fetched, n);
+    return fetched;
 }
 
 void *
@@ -1343,35 +1490,32 @@ kvm_get_memory_native(
     addr_t paddr,
     uint32_t length)
 {
-    int numwords = ceil(length / 4);
+    kvm_instance_t *kvm = kvm_get_instance(vmi);
+    int numwords = (length + 3) / 4;
     char *buf = safe_malloc(numwords * 4);
-    char *bufstr = exec_xp(kvm_get_instance(vmi), numwords, paddr);
-
-    char *paddrstr = safe_malloc(32);
-
-    sprintf(paddrstr, "%.16x", paddr);
-
-    char *ptr = strcasestr(bufstr, paddrstr);
-    int i = 0, j = 0;
-
-    while (i < numwords && NULL != ptr) {
-        ptr += strlen(paddrstr) + 2;
-
-        for (j = 0; j < 4; ++j) {
-            uint32_t value = strtol(ptr, (char **) NULL, 16);
-
-            memcpy(buf + i * 4, &value, 4);
-            ptr += 11;
-            i++;
+    char *output = NULL, *dump = NULL;
+    size_t filled = 0;
+    status_t saved = VMI_FAILURE;
+
+    if (NULL != kvm->pmemsave_path) {
+        pthread_mutex_lock(&kvm->qmp_lock);
+        saved = qmp_pmemsave(kvm->qmp, kvm->pmemsave_path, paddr, buf, length);
+        pthread_mutex_unlock(&kvm->qmp_lock);
+        if (VMI_SUCCESS == saved) {
+            return buf;
         }
+    }
 
-        sprintf(paddrstr, "%.16x", paddr + i * 4);
-        ptr = strcasestr(ptr, paddrstr);
+    output = exec_xp(kvm, numwords, paddr);
+    dump = qmp_reply_string(output);
+    filled = qmp_parse_xp(dump, paddr, buf, numwords * 4);
+    free(output);
+    g_free(dump);
+
+    if (filled < length) {
+        free(buf);
+        return NULL;
     }
-    if (bufstr)
-        free(bufstr);
-    if (paddrstr)
-        free(paddrstr);
     return buf;
 }
 
@@ -1391,33 +1535,99 @@ kvm_put_memory(
     uint32_t length,
     void *buf)
 {
-    struct request req;
+    kvm_instance_t *kvm = kvm_get_instance(vmi);
+    status_t ret;
+
+    vmi_lock(vmi, &kvm->socket_lock);
+    ret = memaccess_write(kvm->socket_fd, paddr, buf, length);
+    vmi_unlock(vmi, &kvm->socket_lock);
+
+    return ret;
+}
+
+/* QEMU fopen()s the pmemsave file with its own uid and umask.  The file is
+ * created here instead, 0600 and owned by the uid at the other end of the
+ * QMP socket, in a 0700 directory owned by that uid as well, so no other
+ * user can read guest memory out of it.  QEMU truncates the file but keeps
+ * its owner and mode. */
+static status_t
+init_pmemsave(
+    kvm_instance_t *kvm)
+{
+    char *dir = NULL;
+    char *path = NULL;
+    void *probe = NULL;
+    status_t saved = VMI_FAILURE;
+    uid_t uid = 0;
+    int fd = -1;
 
-    req.type = 2;   // write request
-    req.address = (uint64_t) paddr;
-    req.length = (uint64_t) length;
+    if (NULL != kvm->pmemsave_path) {
+        return VMI_SUCCESS;
+    }
+    if (NULL == kvm->qmp || VMI_FAILURE == qmp_peer_uid(kvm->qmp, &uid)) {
+        dbprint(VMI_DEBUG_KVM, "--kvm: pmemsave needs the QMP socket, reading memory through xp\n");
+        return VMI_FAILURE;
+    }
 
-    int nbytes =
-        write(kvm_get_instance(vmi)->socket_fd, &req,
-              sizeof(struct request));
-    if (nbytes != sizeof(struct request)) {
+    dir = strdup(KVM_PMEMSAVE_DIR "/libvmi-XXXXXX");
+    if (NULL == mkdtemp(dir)) {
+        free(dir);
+        return VMI_FAILURE;
+    }
+    path = safe_malloc(strlen(dir) + sizeof("/memory"));
+    sprintf(path, "%s/memory", dir);
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+    if (fd < 0) {
         goto error_exit;
     }
-    else {
-        uint8_t status = 0;
+    if (uid != geteuid() && (fchown(fd, uid, -1) || chown(dir, uid, -1))) {
+        dbprint(VMI_DEBUG_KVM, "--kvm: cannot hand the pmemsave file to uid %u\n", (unsigned int) uid);
+        goto error_exit;
+    }
+    close(fd);
+    fd = -1;
 
-        write(kvm_get_instance(vmi)->socket_fd, buf, length);
-        read(kvm_get_instance(vmi)->socket_fd, &status, 1);
-        if (0 == status) {
-            goto error_exit;
-        }
+    probe = safe_malloc(4096);
+    pthread_mutex_lock(&kvm->qmp_lock);
+    saved = qmp_pmemsave(kvm->qmp, path, 0, probe, 4096);
+    pthread_mutex_unlock(&kvm->qmp_lock);
+    free(probe);
+    if (VMI_FAILURE == saved) {
+        dbprint(VMI_DEBUG_KVM, "--kvm: pmemsave unusable, reading memory through xp\n");
+        goto error_exit;
     }
+    kvm->pmemsave_dir = dir;
+    kvm->pmemsave_path = path;
 
+    dbprint(VMI_DEBUG_KVM, "--kvm: reading memory through pmemsave to %s\n", path);
     return VMI_SUCCESS;
+
 error_exit:
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlink(path);
+    rmdir(dir);
+    free(path);
+    free(dir);
     return VMI_FAILURE;
 }
 
+static void
+destroy_pmemsave(
+    kvm_instance_t *kvm)
+{
+    if (NULL == kvm->pmemsave_path) {
+        return;
+    }
+    unlink(kvm->pmemsave_path);
+    rmdir(kvm->pmemsave_dir);
+    free(kvm->pmemsave_path);
+    free(kvm->pmemsave_dir);
+    kvm->pmemsave_path = NULL;
+    kvm->pmemsave_dir = NULL;
+}
+
 /**
  * Setup KVM live (i.e. KVM patch or KVM native) mode.
  * If KVM patch has been setup before, resume it.
@@ -1440,6 +1650,9 @@ kvm_setup_live_mode(
         memory_cache_destroy(vmi);
         memory_cache_init(vmi, kvm_get_memory_patch, kvm_release_memory,
                           1);
+        if (kvm->batch_reads) {
+            memory_cache_set_batch(vmi, kvm_get_memory_patch_batch);
+        }
         return VMI_SUCCESS;
     }
 
@@ -1451,7 +1664,15 @@ kvm_setup_live_mode(
                           1);
         if (status)
             free(status);
-        return init_domain_socket(kvm_get_instance(vmi));
+        if (VMI_FAILURE == init_domain_socket(kvm)) {
+            return VMI_FAILURE;
+        }
+        kvm->batch_reads = memaccess_probe_batch(kvm->socket_fd);
+        if (kvm->batch_reads) {
+            dbprint(VMI_DEBUG_KVM, "--kvm: patch supports batched reads\n");
+            memory_cache_set_batch(vmi, kvm_get_memory_patch_batch);
+        }
+        return VMI_SUCCESS;
     }
     else {
         dbprint
@@ -1459,6 +1680,9 @@ kvm_setup_live_mode(
         memory_cache_destroy(vmi);
         memory_cache_init(vmi, kvm_get_memory_native,
                           kvm_release_memory, 1);
+        if (VMI_SUCCESS == init_pmemsave(kvm)) {
+            memory_cache_set_batch(vmi, kvm_get_memory_pmemsave_batch);
+        }
         if (status)
             free(status);
         return VMI_SUCCESS;
@@ -1476,6 +1700,10 @@ kvm_init(
     virDomainPtr dom = NULL;
     virDomainInfo info;
 
+    pthread_mutex_init(&kvm_get_instance(vmi)->socket_lock, NULL);
+    pthread_mutex_init(&kvm_get_instance(vmi)->qmp_lock, NULL);
+    pthread_mutex_init(&kvm_get_instance(vmi)->regs_lock, NULL);
+
     conn =
         virConnectOpenAuth("qemu:///system", virConnectAuthPtrDefault,
                            0);
@@ -1504,6 +1732,8 @@ kvm_init(
     kvm_get_instance(vmi)->socket_fd = 0;
     vmi->hvm = 1;
 
+    init_qmp_session(kvm_get_instance(vmi));
+
     //get the VCPU count from virDomainInfo structure
     if (-1 == virDomainGetInfo(kvm_get_instance(vmi)->dom, &info)) {
         dbprint(VMI_DEBUG_KVM, "--failed to get vm info\n");
@@ -1551,6 +1781,16 @@ kvm_destroy(
     if (kvm_get_instance(vmi)->conn) {
         virConnectClose(kvm_get_instance(vmi)->conn);
     }
+
+    destroy_pmemsave(kvm);
+    qmp_free_registers(kvm->regs);
+    kvm->regs = NULL;
+    qmp_close(kvm->qmp);
+    kvm->qmp = NULL;
+
+    pthread_mutex_destroy(&kvm_get_instance(vmi)->socket_lock);
+    pthread_mutex_destroy(&kvm->qmp_lock);
+    pthread_mutex_destroy(&kvm->regs_lock);
 }
 
 unsigned long
@@ -1708,6 +1948,59 @@ error_exit:
     return VMI_FAILURE;
 }
 
+/* "info registers" names; 32-bit guests print the E* forms */
+static const struct {
+    registers_t reg;
+    const char *ia32e;
+    const char *legacy;
+} kvm_register_names[] = {
+    { RAX, "RAX", "EAX" },
+    { RBX, "RBX", "EBX" },
+    { RCX, "RCX", "ECX" },
+    { RDX, "RDX", "EDX" },
+    { RBP, "RBP", "EBP" },
+    { RSI, "RSI", "ESI" },
+    { RDI, "RDI", "EDI" },
+    { RSP, "RSP", "ESP" },
+    { R8, "R8", NULL },
+    { R9, "R9", NULL },
+    { R10, "R10", NULL },
+    { R11, "R11", NULL },
+    { R12, "R12", NULL },
+    { R13, "R13", NULL },
+    { R14, "R14", NULL },
+    { R15, "R15", NULL },
+    { RIP, "RIP", "EIP" },
+    { RFLAGS, "RFL", "EFL" },
+    { CR0, "CR0", "CR0" },
+    { CR2, "CR2", "CR2" },
+    { CR3, "CR3", "CR3" },
+    { CR4, "CR4", "CR4" },
+    { DR0, "DR0", "DR0" },
+    { DR1, "DR1", "DR1" },
+    { DR2, "DR2", "DR2" },
+    { DR3, "DR3", "DR3" },
+    { DR6, "DR6", "DR6" },
+    { DR7, "DR7", "DR7" },
+    { MSR_EFER, "EFER", "EFER" }
+};
+
+static const char *
+kvm_register_name(
+    vmi_instance_t vmi,
+    registers_t reg)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(kvm_register_names) / sizeof(kvm_register_names[0]); ++i) {
+        if (kvm_register_names[i].reg == reg) {
+            return VMI_PM_IA32E == vmi->page_mode ?
+                kvm_register_names[i].ia32e : kvm_register_names[i].legacy;
+        }
+    }
+    return NULL;
+}
+
 status_t
 kvm_get_vcpureg(
     vmi_instance_t vmi,
@@ -1715,188 +2008,42 @@ kvm_get_vcpureg(
     registers_t reg,
     unsigned long vcpu)
 {
-    char *regs = NULL;
+    kvm_instance_t *kvm = kvm_get_instance(vmi);
+    const char *name = kvm_register_name(vmi, reg);
+    qmp_registers_t regs = NULL;
+    status_t ret = VMI_FAILURE;
+
+    if (NULL == name) {
+        return VMI_FAILURE;
+    }
 
 #if ENABLE_SHM_SNAPSHOT == 1
     // if we have shm-snapshot configuration, then read from the loaded string.
-    if (kvm_get_instance(vmi)->shm_snapshot_cpu_regs != NULL) {
-        regs = strdup(kvm_get_instance(vmi)->shm_snapshot_cpu_regs);
+    if (kvm->shm_snapshot_cpu_regs != NULL) {
         dbprint(VMI_DEBUG_KVM, "read cpu regs from shm-snapshot\n");
+        regs = parse_registers(kvm->shm_snapshot_cpu_regs);
+        ret = qmp_get_register(regs, vcpu, name, value);
+        qmp_free_registers(regs);
+        return ret;
     }
 #endif
 
-    if (NULL == regs)
-        regs = exec_info_registers(kvm_get_instance(vmi));
-
-    status_t ret = VMI_SUCCESS;
-
-    if (VMI_PM_IA32E == vmi->page_mode) {
-        switch (reg) {
-        case RAX:
-            *value = parse_reg_value("RAX", regs);
-            break;
-        case RBX:
-            *value = parse_reg_value("RBX", regs);
-            break;
-        case RCX:
-            *value = parse_reg_value("RCX", regs);
-            break;
-        case RDX:
-            *value = parse_reg_value("RDX", regs);
-            break;
-        case RBP:
-            *value = parse_reg_value("RBP", regs);
-            break;
-        case RSI:
-            *value = parse_reg_value("RSI", regs);
-            break;
-        case RDI:
-            *value = parse_reg_value("RDI", regs);
-            break;
-        case RSP:
-            *value = parse_reg_value("RSP", regs);
-            break;
-        case R8:
-            *value = parse_reg_value("R8", regs);
-            break;
-        case R9:
-            *value = parse_reg_value("R9", regs);
-            break;
-        case R10:
-            *value = parse_reg_value("R10", regs);
-            break;
-        case R11:
-            *value = parse_reg_value("R11", regs);
-            break;
-        case R12:
-            *value = parse_reg_value("R12", regs);
-            break;
-        case R13:
-            *value = parse_reg_value("R13", regs);
-            break;
-        case R14:
-            *value = parse_reg_value("R14", regs);
-            break;
-        case R15:
-            *value = parse_reg_value("R15", regs);
-            break;
-        case RIP:
-            *value = parse_reg_value("RIP", regs);
-            break;
-        case RFLAGS:
-            *value = parse_reg_value("RFL", regs);
-            break;
-        case CR0:
-            *value = parse_reg_value("CR0", regs);
-            break;
-        case CR2:
-            *value = parse_reg_value("CR2", regs);
-            break;
-        case CR3:
-            *value = parse_reg_value("CR3", regs);
-            break;
-        case CR4:
-            *value = parse_reg_value("CR4", regs);
-            break;
-        case DR0:
-            *value = parse_reg_value("DR0", regs);
-            break;
-        case DR1:
-            *value = parse_reg_value("DR1", regs);
-            break;
-        case DR2:
-            *value = parse_reg_value("DR2", regs);
-            break;
-        case DR3:
-            *value = parse_reg_value("DR3", regs);
-            break;
-        case DR6:
-            *value = parse_reg_value("DR6", regs);
-            break;
-        case DR7:
-            *value = parse_reg_value("DR7", regs);
-            break;
-        case MSR_EFER:
-            *value = parse_reg_value("EFER", regs);
-            break;
-        default:
-            ret = VMI_FAILURE;
-            break;
+    /* a paused guest keeps its registers, one dump serves every lookup
+     * until kvm_resume_vm */
+    vmi_lock(vmi, &kvm->regs_lock);
+    regs = kvm->regs;
+    if (NULL == regs) {
+        regs = fetch_registers(kvm);
+        if (kvm->paused) {
+            kvm->regs = regs;
         }
     }
-    else {
-        switch (reg) {
-        case RAX:
-            *value = parse_reg_value("EAX", regs);
-            break;
-        case RBX:
-            *value = parse_reg_value("EBX", regs);
-            break;
-        case RCX:
-            *value = parse_reg_value("ECX", regs);
-            break;
-        case RDX:
-            *value = parse_reg_value("EDX", regs);
-            break;
-        case RBP:
-            *value = parse_reg_value("EBP", regs);
-            break;
-        case RSI:
-            *value = parse_reg_value("ESI", regs);
-            break;
-        case RDI:
-            *value = parse_reg_value("EDI", regs);
-            break;
-        case RSP:
-            *value = parse_reg_value("ESP", regs);
-            break;
-        case RIP:
-            *value = parse_reg_value("EIP", regs);
-            break;
-        case RFLAGS:
-            *value = parse_reg_value("EFL", regs);
-            break;
-        case CR0:
-            *value = parse_reg_value("CR0", regs);
-            break;
-        case CR2:
-            *value = parse_reg_value("CR2", regs);
-            break;
-        case CR3:
-            *value = parse_reg_value("CR3", regs);
-            break;
-        case CR4:
-            *value = parse_reg_value("CR4", regs);
-            break;
-        case DR0:
-            *value = parse_reg_value("DR0", regs);
-            break;
-        case DR1:
-            *value = parse_reg_value("DR1", regs);
-            break;
-        case DR2:
-            *value = parse_reg_value("DR2", regs);
-            break;
-        case DR3:
-            *value = parse_reg_value("DR3", regs);
-            break;
-        case DR6:
-            *value = parse_reg_value("DR6", regs);
-            break;
-        case DR7:
-            *value = parse_reg_value("DR7", regs);
-            break;
-        case MSR_EFER:
-            *value = parse_reg_value("EFER", regs);
-            break;
-        default:
-            ret = VMI_FAILURE;
-            break;
-        }
+    ret = qmp_get_register(regs, vcpu, name, value);
+    if (regs != kvm->regs) {
+        qmp_free_registers(regs);
     }
+    vmi_unlock(vmi, &kvm->regs_lock);
 
-    if (regs)
-        free(regs);
     return ret;
 }
 
@@ -1952,9 +2099,14 @@ status_t
 kvm_pause_vm(
     vmi_instance_t vmi)
 {
-    if (-1 == virDomainSuspend(kvm_get_instance(vmi)->dom)) {
+    kvm_instance_t *kvm = kvm_get_instance(vmi);
+
+    if (-1 == virDomainSuspend(kvm->dom)) {
         return VMI_FAILURE;
     }
+    vmi_lock(vmi, &kvm->regs_lock);
+    kvm->paused = 1;
+    vmi_unlock(vmi, &kvm->regs_lock);
     return VMI_SUCCESS;
 }
 
@@ -1962,9 +2114,16 @@ status_t
 kvm_resume_vm(
     vmi_instance_t vmi)
 {
-    if (-1 == virDomainResume(kvm_get_instance(vmi)->dom)) {
+    kvm_instance_t *kvm = kvm_get_instance(vmi);
+
+    if (-1 == virDomainResume(kvm->dom)) {
         return VMI_FAILURE;
     }
+    vmi_lock(vmi, &kvm->regs_lock);
+    kvm->paused = 0;
+    qmp_free_registers(kvm->regs);
+    kvm->regs = NULL;
+    vmi_unlock(vmi, &kvm->regs_lock);
     return VMI_SUCCESS;
 }
 
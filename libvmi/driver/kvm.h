@@ -27,6 +27,9 @@
 #if ENABLE_KVM == 1
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
+#include <pthread.h>
+#include "driver/memaccess.h"
+#include "driver/qmp.h"
 
 #if ENABLE_SHM_SNAPSHOT == 1
 
@@ -84,6 +87,15 @@ typedef struct kvm_instance {
     char *name;
     char *ds_path;
     int socket_fd;
+    pthread_mutex_t socket_lock; /** serializes patch requests with VMI_INIT_THREADSAFE */
+    int batch_reads;            /** patch answers MEMACCESS_BATCH_READ */
+    qmp_session_t qmp;          /** persistent monitor session, NULL falls back to virsh */
+    pthread_mutex_t qmp_lock;   /** serializes commands on the session and the pmemsave file */
+    qmp_registers_t regs;       /** register file of all vCPUs, kept while paused */
+    pthread_mutex_t regs_lock;  /** guards regs and paused with VMI_INIT_THREADSAFE */
+    int paused;                 /** paused through kvm_pause_vm */
+    char *pmemsave_dir;         /** directory QEMU dumps memory into */
+    char *pmemsave_path;        /** native mode reads through pmemsave, NULL uses xp */
 
 #if ENABLE_SHM_SNAPSHOT == 1
     char *shm_snapshot_path;  /** shared memory snapshot device path in /dev/shm directory */
@@ -0,0 +1,223 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Kept free of library internals so tools/performance can build it in. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libvmi.h"
+#include "driver/memaccess.h"
+
+static status_t
+write_full(
+    int fd,
+    const void *buf,
+    size_t length)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (length) {
+        n = send(fd, p, length, MSG_NOSIGNAL);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            return VMI_FAILURE;
+        }
+        p += n;
+        length -= n;
+    }
+    return VMI_SUCCESS;
+}
+
+static status_t
+read_full(
+    int fd,
+    void *buf,
+    size_t length)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (length) {
+        n = read(fd, p, length);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            return VMI_FAILURE;
+        }
+        p += n;
+        length -= n;
+    }
+    return VMI_SUCCESS;
+}
+
+static status_t
+send_request(
+    int fd,
+    uint8_t type,
+    uint64_t address,
+    uint64_t length)
+{
+    memaccess_request_t req;
+
+    memset(&req, 0, sizeof(req));
+    req.type = type;
+    req.address = address;
+    req.length = length;
+    return write_full(fd, &req, sizeof(req));
+}
+
+int
+memaccess_probe_batch(
+    int fd)
+{
+    uint8_t status = 0;
+
+    if (VMI_FAILURE == send_request(fd, MEMACCESS_BATCH_READ, 0, 0)
+        || VMI_FAILURE == read_full(fd, &status, 1)) {
+        return 0;
+    }
+    return 1 == status;
+}
+
+status_t
+memaccess_read(
+    int fd,
+    uint64_t address,
+    void *buf,
+    uint64_t length)
+{
+    char *reply = malloc(length + 1);
+    ssize_t n = 0;
+    status_t ret = VMI_FAILURE;
+
+    if (!reply || VMI_FAILURE == send_request(fd, MEMACCESS_READ, address, length)) {
+        goto done;
+    }
+
+    /* a failed read is answered with one byte only */
+    do {
+        n = read(fd, reply, length + 1);
+    } while (n < 0 && EINTR == errno);
+    if (n <= 0 || (1 == n && length)) {
+        goto done;
+    }
+    if (n < length + 1
+        && VMI_FAILURE == read_full(fd, reply + n, length + 1 - n)) {
+        goto done;
+    }
+
+    if (reply[length]) {
+        memcpy(buf, reply, length);
+        ret = VMI_SUCCESS;
+    }
+
+done:
+    free(reply);
+    return ret;
+}
+
+status_t
+memaccess_write(
+    int fd,
+    uint64_t address,
+    const void *buf,
+    uint64_t length)
+{
+    uint8_t status = 0;
+
+    if (VMI_FAILURE == send_request(fd, MEMACCESS_WRITE, address, length)
+        || VMI_FAILURE == write_full(fd, buf, length)
+        || VMI_FAILURE == read_full(fd, &status, 1)) {
+        return VMI_FAILURE;
+    }
+    return status ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+static status_t
+send_batch(
+    int fd,
+    const memaccess_range_t *ranges,
+    size_t n)
+{
+    memaccess_request_t req[MEMACCESS_BATCH_MAX + 1];
+    size_t i;
+
+    memset(req, 0, (n + 1) * sizeof(memaccess_request_t));
+    req[0].type = MEMACCESS_BATCH_READ;
+    req[0].length = n;
+    for (i = 0; i < n; ++i) {
+        req[i + 1].type = MEMACCESS_READ;
+        req[i + 1].address = ranges[i].address;
+        req[i + 1].length = ranges[i].length;
+    }
+    return write_full(fd, req, (n + 1) * sizeof(memaccess_request_t));
+}
+
+/* the next batch goes out before the replies to the previous ones are read,
+ * so the server never waits for the client between batches */
+status_t
+memaccess_read_batch(
+    int fd,
+    memaccess_range_t *ranges,
+    size_t n)
+{
+    size_t sent = 0, received = 0;
+    size_t count;
+
+    for (count = 0; count < n; ++count) {
+        ranges[count].status = 0;
+    }
+
+    while (received < n) {
+        while (sent < n) {
+            count = n - sent < MEMACCESS_BATCH_MAX ? n - sent : MEMACCESS_BATCH_MAX;
+            if (sent + count > received + MEMACCESS_WINDOW * MEMACCESS_BATCH_MAX) {
+                break;
+            }
+            if (VMI_FAILURE == send_batch(fd, ranges + sent, count)) {
+                return VMI_FAILURE;
+            }
+            sent += count;
+        }
+
+        if (VMI_FAILURE == read_full(fd, ranges[received].buf, ranges[received].length)
+            || VMI_FAILURE == read_full(fd, &ranges[received].status, 1)) {
+            return VMI_FAILURE;
+        }
+        received++;
+    }
+    return VMI_SUCCESS;
+}
+
+void
+memaccess_quit(
+    int fd)
+{
+    send_request(fd, MEMACCESS_QUIT, 0, 0);
+}
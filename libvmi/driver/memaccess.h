@@ -0,0 +1,89 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMACCESS_H
+#define MEMACCESS_H
+
+#include "libvmi.h"
+
+/*
+ * Client side of the physmem-access socket from tools/qemu-kvm-patch.
+ *
+ * Every message starts with a memaccess_request.  READ is answered with
+ * <length> bytes plus a status byte (1 ok), or with a lone 0 byte when the
+ * read fails.  WRITE is followed by <length> bytes and answered with a
+ * status byte.
+ *
+ * BATCH_READ carries <length> READ requests right after it.  They are
+ * answered in order, each with exactly <length> bytes (zeros on failure)
+ * and a status byte, so replies can be scattered without looking at them
+ * and a client may send further batches before the earlier replies are
+ * in.  An empty BATCH_READ is answered with a single 1, and servers that
+ * predate it answer any unknown type with a single 0; that is the probe.
+ */
+
+/* matches struct request in the qemu patch, padding included */
+typedef struct memaccess_request {
+    uint8_t type;
+    uint64_t address;
+    uint64_t length;
+} memaccess_request_t;
+
+#define MEMACCESS_QUIT       0
+#define MEMACCESS_READ       1
+#define MEMACCESS_WRITE      2
+#define MEMACCESS_BATCH_READ 3
+
+#define MEMACCESS_BATCH_MAX  256    /* ranges per BATCH_READ */
+#define MEMACCESS_WINDOW     4      /* BATCH_READs in flight */
+
+typedef struct memaccess_range {
+    uint64_t address;
+    uint64_t length;
+    void *buf;          /* filled with <length> bytes */
+    uint8_t status;     /* 1 if the server read the range */
+} memaccess_range_t;
+
+/* 1 if the server speaks BATCH_READ */
+int memaccess_probe_batch(
+    int fd);
+
+status_t memaccess_read(
+    int fd,
+    uint64_t address,
+    void *buf,
+    uint64_t length);
+
+status_t memaccess_write(
+    int fd,
+    uint64_t address,
+    const void *buf,
+    uint64_t length);
+
+/* VMI_FAILURE only when the connection broke, see each range's status */
+status_t memaccess_read_batch(
+    int fd,
+    memaccess_range_t *ranges,
+    size_t n);
+
+void memaccess_quit(
+    int fd);
+
+#endif /* MEMACCESS_H */
@@ -33,107 +33,294 @@
 
 #include "glib_compat.h"
 
+/* number of entries carved out of each slab allocation */
+#define MEMORY_CACHE_SLAB_ENTRIES 64
+
+/* default byte budget; page_size is not yet known when the cache is set up */
+#define MEMORY_CACHE_DEFAULT_BYTES ((uint64_t) MAX_PAGE_CACHE_SIZE * 4096)
+
+/* number of independently locked shards used with VMI_INIT_THREADSAFE */
+#define MEMORY_CACHE_SHARDS 16
+
+/*
+ * Each entry doubles as its own hash table key (via &entry->paddr) and
+ * carries its own links into the LRU list, so a cache hit or eviction
+ * never has to allocate or search.
+ */
 struct memory_cache_entry {
     addr_t paddr;
     uint32_t length;
+    uint32_t pins;
     time_t last_updated;
     time_t last_used;
     void *data;
+    struct memory_cache_shard *shard;
+    struct memory_cache_entry *lru_prev;
+    struct memory_cache_entry *lru_next;
 };
 typedef struct memory_cache_entry *memory_cache_entry_t;
-static void *(
-    *get_data_callback) (
-    vmi_instance_t,
-    addr_t,
-    uint32_t) = NULL;
-static void (
-    *release_data_callback) (
-    void *,
-    size_t) = NULL;
+
+struct memory_cache_slab {
+    struct memory_cache_slab *next;
+    struct memory_cache_entry entries[MEMORY_CACHE_SLAB_ENTRIES];
+};
+typedef struct memory_cache_slab *memory_cache_slab_t;
+
+/*
+ * An instance has a single shard unless it was created with
+ * VMI_INIT_THREADSAFE.  Pages are then spread over the shards by PFN,
+ * each shard keeps its own LRU and a share of the byte budget, and
+ * readers touching different shards never contend.
+ */
+struct memory_cache_shard {
+    pthread_mutex_t lock;
+    GHashTable *table;
+    memory_cache_entry_t lru_head;
+    memory_cache_entry_t lru_tail;
+    memory_cache_entry_t free;
+    memory_cache_slab_t slabs;
+    uint32_t size;
+    uint64_t bytes;
+    uint64_t bytes_max;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refreshes;
+    uint64_t evictions;
+    struct memory_cache_retired *retired;
+};
+typedef struct memory_cache_shard *memory_cache_shard_t;
+
+/*
+ * Drivers destroy and re-create the cache when they switch modes, e.g.
+ * for shm snapshots.  Shards destroyed while vmi_map_pa pins are held
+ * are retired instead of freed: their pinned pages stay mapped and the
+ * shards stay allocated until the last pin is released.
+ */
+struct memory_cache_retired {
+    memory_cache_shard_t shards;
+    uint32_t shard_count;
+    uint32_t pins;
+    void (*release_data) (void *, size_t);
+};
+typedef struct memory_cache_retired *memory_cache_retired_t;
 
 //---------------------------------------------------------
 // Internal implementation functions
 
+static void *
+get_memory_data(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    uint32_t length)
+{
+    if (!vmi->memory_cache_get_data) {
+        return NULL;
+    }
+    return vmi->memory_cache_get_data(vmi, paddr, length);
+}
+
+/* NULL once memory_cache_destroy ran and until the next memory_cache_init,
+ * e.g. after leaving shm-snapshot mode; lookups then miss */
+static inline memory_cache_shard_t
+get_shard(
+    vmi_instance_t vmi,
+    addr_t paddr)
+{
+    if (!vmi->memory_cache_shard_count) {
+        return NULL;
+    }
+    /* page_shift may not be set yet, so shard on 4kB frames */
+    return &vmi->memory_cache_shards[(paddr >> 12) % vmi->memory_cache_shard_count];
+}
+
 static void
-memory_cache_entry_free(
-    gpointer data)
+lru_unlink(
+    memory_cache_shard_t shard,
+    memory_cache_entry_t entry)
 {
-    memory_cache_entry_t entry = (memory_cache_entry_t) data;
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else {
+        shard->lru_head = entry->lru_next;
+    }
 
-    if (entry) {
-        release_data_callback(entry->data, entry->length);
-        free(entry);
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
     }
+    else {
+        shard->lru_tail = entry->lru_prev;
+    }
+
+    entry->lru_prev = entry->lru_next = NULL;
 }
 
-static void *
-get_memory_data(
+static void
+lru_push_front(
+    memory_cache_shard_t shard,
+    memory_cache_entry_t entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+
+    if (shard->lru_head) {
+        shard->lru_head->lru_prev = entry;
+    }
+    else {
+        shard->lru_tail = entry;
+    }
+    shard->lru_head = entry;
+}
+
+static memory_cache_entry_t
+entry_alloc(
+    memory_cache_shard_t shard)
+{
+    memory_cache_entry_t entry = NULL;
+
+    if (!shard->free) {
+        memory_cache_slab_t slab = safe_malloc(sizeof(struct memory_cache_slab));
+        int i;
+
+        slab->next = shard->slabs;
+        shard->slabs = slab;
+
+        for (i = 0; i < MEMORY_CACHE_SLAB_ENTRIES; i++) {
+            slab->entries[i].lru_next = shard->free;
+            shard->free = &slab->entries[i];
+        }
+    }
+
+    entry = shard->free;
+    shard->free = entry->lru_next;
+    memset(entry, 0, sizeof(struct memory_cache_entry));
+    return entry;
+}
+
+static void
+entry_release(
     vmi_instance_t vmi,
-    addr_t paddr,
-    uint32_t length)
+    memory_cache_shard_t shard,
+    memory_cache_entry_t entry)
 {
-    return get_data_callback(vmi, paddr, length);
+    vmi->memory_cache_release_data(entry->data, entry->length);
+    entry->data = NULL;
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->free;
+    shard->free = entry;
 }
 
 static void
-remove_entry(
-    gpointer key,
-    gpointer cache)
+evict_entry(
+    vmi_instance_t vmi,
+    memory_cache_shard_t shard,
+    memory_cache_entry_t entry)
 {
-    GHashTable *memory_cache = cache;
+    dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache evict 0x%"PRIx64"\n", entry->paddr);
+
+    lru_unlink(shard, entry);
+    g_hash_table_remove(shard->table, &entry->paddr);
 
-    g_hash_table_remove(memory_cache, key);
-    free(key);
+    shard->bytes -= entry->length;
+    shard->size--;
+    shard->evictions++;
+
+    entry_release(vmi, shard, entry);
 }
 
+/*
+ * Drop least recently used entries until another 'needed' bytes fit in
+ * the budget.  Only as many entries as required are evicted, so a full
+ * cache costs one eviction per insert instead of periodic bulk flushes.
+ * Pinned entries are skipped, so the budget can be exceeded while
+ * pages are mapped by vmi_map_pa.
+ */
 static void
 clean_cache(
-    vmi_instance_t vmi)
+    vmi_instance_t vmi,
+    memory_cache_shard_t shard,
+    uint64_t needed)
 {
-    GList *list = NULL;
+    memory_cache_entry_t entry = shard->lru_tail;
 
-    while (vmi->memory_cache_size > vmi->memory_cache_size_max / 2) {
-        GList *last = g_list_last(vmi->memory_cache_lru);
+    while (entry && shard->bytes + needed > shard->bytes_max) {
+        memory_cache_entry_t prev = entry->lru_prev;
 
-        vmi->memory_cache_lru =
-            g_list_remove_link(vmi->memory_cache_lru, last);
-        list = g_list_concat(list, last);
-
-        vmi->memory_cache_size--;
+        /* when only shrinking, the most recently used page stays even if
+         * the budget is smaller than a page, see vmi_pagecache_set_limit */
+        if (!entry->pins && (needed || entry != shard->lru_head)) {
+            evict_entry(vmi, shard, entry);
+        }
+        entry = prev;
     }
-    g_list_foreach(list, remove_entry, vmi->memory_cache);
-    g_list_free(list);
-
-    dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache cleanup round complete (cache size = %u)\n",
-            g_hash_table_size(vmi->memory_cache));
 }
 
 static void *
 validate_and_return_data(
     vmi_instance_t vmi,
+    memory_cache_shard_t shard,
     memory_cache_entry_t entry)
 {
     time_t now = time(NULL);
 
-    if (vmi->memory_cache_age &&
+    /* a pinned page is in use, it is refreshed once unpinned */
+    if (vmi->memory_cache_age && !entry->pins &&
         (now - entry->last_updated > vmi->memory_cache_age)) {
         dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache refresh 0x%"PRIx64"\n", entry->paddr);
-        release_data_callback(entry->data, entry->length);
+        vmi->memory_cache_release_data(entry->data, entry->length);
         entry->data = get_memory_data(vmi, entry->paddr, entry->length);
         entry->last_updated = now;
+        shard->refreshes++;
+    }
 
-        GList* lru_entry = g_list_find_custom(vmi->memory_cache_lru,
-                &entry->paddr, g_int64_equal);
-        vmi->memory_cache_lru = g_list_remove_link(vmi->memory_cache_lru,
-                lru_entry);
-        vmi->memory_cache_lru = g_list_concat(lru_entry, vmi->memory_cache_lru);
+    if (entry != shard->lru_head) {
+        lru_unlink(shard, entry);
+        lru_push_front(shard, entry);
     }
+
     entry->last_used = now;
     return entry->data;
 }
 
-static memory_cache_entry_t create_new_entry (vmi_instance_t vmi, addr_t paddr,
-        uint32_t length)
+static memory_cache_entry_t
+add_entry(
+    vmi_instance_t vmi,
+    memory_cache_shard_t shard,
+    addr_t paddr,
+    uint32_t length,
+    void *data)
+{
+    memory_cache_entry_t entry = NULL;
+
+    clean_cache(vmi, shard, length);
+
+    entry = entry_alloc(shard);
+    entry->paddr = paddr;
+    entry->length = length;
+    entry->last_updated = time(NULL);
+    entry->last_used = entry->last_updated;
+    entry->data = data;
+    entry->shard = shard;
+
+    g_hash_table_insert(shard->table, &entry->paddr, entry);
+    lru_push_front(shard, entry);
+    shard->size++;
+    shard->bytes += entry->length;
+
+    return entry;
+}
+
+static int
+beyond_memsize(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    uint32_t length)
+{
+    return vmi->hvm && (paddr + length - 1 > vmi->size);
+}
+
+static memory_cache_entry_t create_new_entry (vmi_instance_t vmi,
+        memory_cache_shard_t shard, addr_t paddr, uint32_t length)
 {
 
     // sanity check - are we getting memory outside of the physical memory range?
@@ -145,7 +332,7 @@ static memory_cache_entry_t create_new_entry (vmi_instance_t vmi, addr_t paddr,
     //
     // TODO: perform other reasonable checks
 
-    if (vmi->hvm && (paddr + length - 1 > vmi->size)) {
+    if (beyond_memsize(vmi, paddr, length)) {
         errprint("--requesting PA [0x%"PRIx64"] beyond memsize [0x%"PRIx64"]\n",
                 paddr + length, vmi->size);
         errprint("\tpaddr: %"PRIx64", length %"PRIx32", vmi->size %"PRIx64"\n", paddr, length,
@@ -153,21 +340,46 @@ static memory_cache_entry_t create_new_entry (vmi_instance_t vmi, addr_t paddr,
         return 0;
     }
 
-    memory_cache_entry_t entry =
-        (memory_cache_entry_t)
-        safe_malloc(sizeof(struct memory_cache_entry));
+    void *data = get_memory_data(vmi, paddr, length);
 
-    entry->paddr = paddr;
-    entry->length = length;
-    entry->last_updated = time(NULL);
-    entry->last_used = entry->last_updated;
-    entry->data = get_memory_data(vmi, paddr, length);
+    if (!data) {
+        return 0;
+    }
 
-    if (vmi->memory_cache_size >= vmi->memory_cache_size_max) {
-        clean_cache(vmi);
+    return add_entry(vmi, shard, paddr, length, data);
+}
+
+static void
+shard_free(
+    memory_cache_shard_t shard)
+{
+    memory_cache_slab_t slab = shard->slabs;
+
+    while (slab) {
+        memory_cache_slab_t next = slab->next;
+
+        free(slab);
+        slab = next;
     }
+    pthread_mutex_destroy(&shard->lock);
+}
 
-    return entry;
+static void
+shard_set_limit(
+    vmi_instance_t vmi,
+    uint64_t bytes)
+{
+    uint32_t i;
+
+    vmi->memory_cache_bytes_max = bytes;
+    for (i = 0; i < vmi->memory_cache_shard_count; i++) {
+        memory_cache_shard_t shard = &vmi->memory_cache_shards[i];
+
+        vmi_lock(vmi, &shard->lock);
+        shard->bytes_max = bytes / vmi->memory_cache_shard_count;
+        clean_cache(vmi, shard, 0);
+        vmi_unlock(vmi, &shard->lock);
+    }
 }
 
 //---------------------------------------------------------
@@ -182,60 +394,240 @@ memory_cache_init(
                           size_t),
     unsigned long age_limit)
 {
-    vmi->memory_cache =
-        g_hash_table_new_full(g_int64_hash, g_int64_equal,
-                              g_free,
-                              memory_cache_entry_free);
-    vmi->memory_cache_lru = NULL;
+    pthread_mutexattr_t attr;
+    uint32_t i;
+
+    vmi->memory_cache_shard_count =
+        (vmi->flags & VMI_INIT_THREADSAFE) ? MEMORY_CACHE_SHARDS : 1;
+    vmi->memory_cache_shards =
+        safe_malloc(vmi->memory_cache_shard_count * sizeof(struct memory_cache_shard));
+    memset(vmi->memory_cache_shards, 0,
+           vmi->memory_cache_shard_count * sizeof(struct memory_cache_shard));
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    for (i = 0; i < vmi->memory_cache_shard_count; i++) {
+        memory_cache_shard_t shard = &vmi->memory_cache_shards[i];
+
+        pthread_mutex_init(&shard->lock, &attr);
+        shard->table = g_hash_table_new(g_int64_hash, g_int64_equal);
+    }
+    pthread_mutexattr_destroy(&attr);
+
     vmi->memory_cache_age = age_limit;
-    vmi->memory_cache_size = 0;
-    vmi->memory_cache_size_max = MAX_PAGE_CACHE_SIZE;
-    get_data_callback = get_data;
-    release_data_callback = release_data;
+    vmi->memory_cache_get_data = get_data;
+    vmi->memory_cache_get_data_batch = NULL;
+    vmi->memory_cache_release_data = release_data;
+
+    /* drivers re-init the cache when they switch modes, a budget set
+     * through the config or vmi_pagecache_set_limit carries over */
+    shard_set_limit(vmi, vmi->memory_cache_bytes_set ?
+                    vmi->memory_cache_bytes_max : MEMORY_CACHE_DEFAULT_BYTES);
 }
 
 
 #if ENABLE_PAGE_CACHE == 1
+/* find or fetch the entry for paddr, the shard lock must be held */
+static memory_cache_entry_t
+lookup_entry(
+    vmi_instance_t vmi,
+    memory_cache_shard_t shard,
+    addr_t paddr)
+{
+    memory_cache_entry_t entry = NULL;
+
+    if ((entry = g_hash_table_lookup(shard->table, &paddr)) != NULL) {
+        dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache hit 0x%"PRIx64"\n", paddr);
+        shard->hits++;
+        validate_and_return_data(vmi, shard, entry);
+    }
+    else {
+        dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache set 0x%"PRIx64"\n", paddr);
+        shard->misses++;
+
+        entry = create_new_entry(vmi, shard, paddr, vmi->page_size);
+        if (!entry) {
+            errprint("create_new_entry failed\n");
+        }
+    }
+
+    return (entry && entry->data) ? entry : NULL;
+}
+
 void *
 memory_cache_insert(
     vmi_instance_t vmi,
     addr_t paddr)
 {
     memory_cache_entry_t entry = NULL;
+    memory_cache_shard_t shard = NULL;
     addr_t paddr_aligned = paddr & ~(((addr_t) vmi->page_size) - 1);
+    void *data = NULL;
 
     if (paddr != paddr_aligned) {
         errprint("Memory cache request for non-aligned page\n");
         return NULL;
     }
 
-    gint64 *key = &paddr;
-    if ((entry = g_hash_table_lookup(vmi->memory_cache, key)) != NULL) {
-        dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache hit 0x%"PRIx64"\n", paddr);
-        return validate_and_return_data(vmi, entry);
+    shard = get_shard(vmi, paddr);
+    if (!shard) {
+        return NULL;
     }
-    else {
-        dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache set 0x%"PRIx64"\n", paddr);
+    vmi_lock(vmi, &shard->lock);
+    if ((entry = lookup_entry(vmi, shard, paddr)) != NULL) {
+        data = entry->data;
+    }
+    vmi_unlock(vmi, &shard->lock);
 
-        entry = create_new_entry(vmi, paddr, vmi->page_size);
-        if (!entry) {
-            errprint("create_new_entry failed\n");
-            return 0;
+    return data;
+}
+
+/*
+ * Like memory_cache_insert, but the page stays mapped and is neither
+ * evicted nor refreshed until memory_cache_unpin is called with the
+ * returned pin.
+ */
+void *
+memory_cache_pin(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    void **pin)
+{
+    memory_cache_entry_t entry = NULL;
+    memory_cache_shard_t shard = NULL;
+    void *data = NULL;
+
+    *pin = NULL;
+    if (paddr & (((addr_t) vmi->page_size) - 1)) {
+        errprint("Memory cache request for non-aligned page\n");
+        return NULL;
+    }
+
+    shard = get_shard(vmi, paddr);
+    if (!shard) {
+        return NULL;
+    }
+    vmi_lock(vmi, &shard->lock);
+    if ((entry = lookup_entry(vmi, shard, paddr)) != NULL) {
+        entry->pins++;
+        data = entry->data;
+        *pin = entry;
+    }
+    vmi_unlock(vmi, &shard->lock);
+
+    return data;
+}
+
+static void
+retired_free(
+    memory_cache_retired_t retired)
+{
+    uint32_t i;
+
+    dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache freeing retired shards\n");
+    for (i = 0; i < retired->shard_count; i++) {
+        shard_free(&retired->shards[i]);
+    }
+    free(retired->shards);
+    free(retired);
+}
+
+void
+memory_cache_unpin(
+    vmi_instance_t vmi,
+    void *pin)
+{
+    memory_cache_entry_t entry = pin;
+    memory_cache_shard_t shard = NULL;
+    memory_cache_retired_t retired = NULL;
+
+    if (!entry) {
+        return;
+    }
+
+    shard = entry->shard;
+    vmi_lock(vmi, &shard->lock);
+    entry->pins--;
+    if (shard->retired) {
+        /* the cache was destroyed while the page was pinned */
+        retired = shard->retired;
+        if (!entry->pins) {
+            retired->release_data(entry->data, entry->length);
+            entry->data = NULL;
         }
+    }
+    else if (!entry->pins) {
+        /* pinning may have pushed the shard over its budget */
+        clean_cache(vmi, shard, 0);
+    }
+    vmi_unlock(vmi, &shard->lock);
 
-        key = safe_malloc(sizeof(gint64));
-        *key = paddr;
-        g_hash_table_insert(vmi->memory_cache, key, entry);
+    if (retired && !__sync_sub_and_fetch(&retired->pins, 1)) {
+        retired_free(retired);
+    }
+}
 
-        gint64 *key2 = safe_malloc(sizeof(gint64));
+/*
+ * Fetch the pages in paddrs that are not cached yet with one call into
+ * the driver's batch callback, so the reads that follow all hit.
+ */
+void
+memory_cache_prefetch(
+    vmi_instance_t vmi,
+    const addr_t *paddrs,
+    size_t n)
+{
+    addr_t *missing = NULL;
+    void **data = NULL;
+    size_t i, count = 0;
 
-        *key2 = paddr;
-        vmi->memory_cache_lru =
-            g_list_prepend(vmi->memory_cache_lru, key2);
-        vmi->memory_cache_size++;
+    if (!vmi->memory_cache_get_data_batch || !vmi->memory_cache_shard_count
+        || vmi->flat_memory || !n) {
+        return;
+    }
+
+    missing = safe_malloc(n * sizeof(addr_t));
+    for (i = 0; i < n; i++) {
+        memory_cache_shard_t shard = get_shard(vmi, paddrs[i]);
+
+        if (beyond_memsize(vmi, paddrs[i], vmi->page_size)) {
+            continue;
+        }
+        vmi_lock(vmi, &shard->lock);
+        if (!g_hash_table_lookup(shard->table, &paddrs[i])) {
+            missing[count++] = paddrs[i];
+        }
+        vmi_unlock(vmi, &shard->lock);
+    }
 
-        return entry->data;
+    if (count) {
+        data = safe_malloc(count * sizeof(void *));
+        memset(data, 0, count * sizeof(void *));
+        vmi->memory_cache_get_data_batch(vmi, missing, data, count);
+
+        for (i = 0; i < count; i++) {
+            memory_cache_shard_t shard = get_shard(vmi, missing[i]);
+
+            if (!data[i]) {
+                continue;
+            }
+            vmi_lock(vmi, &shard->lock);
+            if (g_hash_table_lookup(shard->table, &missing[i])) {
+                /* another thread got here first */
+                vmi->memory_cache_release_data(data[i], vmi->page_size);
+            }
+            else {
+                dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache prefetch 0x%"PRIx64"\n", missing[i]);
+                shard->misses++;
+                add_entry(vmi, shard, missing[i], vmi->page_size, data[i]);
+            }
+            vmi_unlock(vmi, &shard->lock);
+        }
+        free(data);
     }
+
+    dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache prefetched %zu of %zu pages\n", count, n);
+    free(missing);
 }
 #else
 void *
@@ -245,32 +637,234 @@ memory_cache_insert(
 {
     return get_memory_data(vmi, paddr, vmi->page_size);
 }
+
+/* without a cache every pin owns a page of its own */
+void *
+memory_cache_pin(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    void **pin)
+{
+    memory_cache_entry_t entry = NULL;
+    void *data = get_memory_data(vmi, paddr, vmi->page_size);
+
+    *pin = NULL;
+    if (data) {
+        entry = safe_malloc(sizeof(struct memory_cache_entry));
+        memset(entry, 0, sizeof(struct memory_cache_entry));
+        entry->paddr = paddr;
+        entry->length = vmi->page_size;
+        entry->data = data;
+        *pin = entry;
+    }
+    return data;
+}
+
+void
+memory_cache_unpin(
+    vmi_instance_t vmi,
+    void *pin)
+{
+    memory_cache_entry_t entry = pin;
+
+    if (entry) {
+        vmi->memory_cache_release_data(entry->data, entry->length);
+        free(entry);
+    }
+}
+
+void
+memory_cache_prefetch(
+    vmi_instance_t vmi,
+    const addr_t *paddrs,
+    size_t n)
+{
+    return;
+}
 #endif
 
+void
+memory_cache_set_batch(
+    vmi_instance_t vmi,
+    size_t (*get_data_batch) (vmi_instance_t,
+                              const addr_t *,
+                              void **,
+                              size_t))
+{
+    vmi->memory_cache_get_data_batch = get_data_batch;
+}
+
+/*
+ * With VMI_INIT_THREADSAFE another thread may evict a page as soon as
+ * memory_cache_insert returns.  Callers that dereference the returned
+ * page bracket the lookup and their use of it with these calls, which
+ * hold the lock of the shard owning paddr.  The lock is recursive, so
+ * memory_cache_insert can take it again underneath.
+ */
+void
+memory_cache_lock(
+    vmi_instance_t vmi,
+    addr_t paddr)
+{
+    if (vmi->flat_memory || !vmi->memory_cache_shard_count) {
+        return;
+    }
+    vmi_lock(vmi, &get_shard(vmi, paddr)->lock);
+}
+
+void
+memory_cache_unlock(
+    vmi_instance_t vmi,
+    addr_t paddr)
+{
+    if (vmi->flat_memory || !vmi->memory_cache_shard_count) {
+        return;
+    }
+    vmi_unlock(vmi, &get_shard(vmi, paddr)->lock);
+}
+
+void
+memory_cache_set_limit(
+    vmi_instance_t vmi,
+    uint64_t bytes)
+{
+    vmi->memory_cache_bytes_set = 1;
+    shard_set_limit(vmi, bytes);
+
+    dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache limit %"PRIu64" bytes\n", bytes);
+}
+
 void
 memory_cache_destroy(
     vmi_instance_t vmi)
 {
-    vmi->memory_cache_size_max = 0;
+    memory_cache_retired_t retired = NULL;
+    uint32_t pins = 0;
+    uint32_t i;
 
-    if (vmi->memory_cache_lru) {
-#if GLIB_CHECK_VERSION(2, 28, 0)
-        g_list_free_full(vmi->memory_cache_lru, g_free);
-#else
-        g_list_foreach(vmi->memory_cache_lru, g_free, NULL);
-        g_list_free(vmi->memory_cache_lru);
-#endif
-        vmi->memory_cache_lru = NULL;
+    for (i = 0; i < vmi->memory_cache_shard_count; i++) {
+        memory_cache_entry_t entry = vmi->memory_cache_shards[i].lru_head;
+
+        for (; entry; entry = entry->lru_next) {
+            pins += entry->pins;
+        }
     }
 
-    if (vmi->memory_cache) {
-        g_hash_table_destroy(vmi->memory_cache);
-        vmi->memory_cache = NULL;
+    if (pins) {
+        dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache retired with %"PRIu32" pins\n", pins);
+        retired = safe_malloc(sizeof(struct memory_cache_retired));
+        retired->shards = vmi->memory_cache_shards;
+        retired->shard_count = vmi->memory_cache_shard_count;
+        retired->pins = pins;
+        retired->release_data = vmi->memory_cache_release_data;
     }
 
+    for (i = 0; i < vmi->memory_cache_shard_count; i++) {
+        memory_cache_shard_t shard = &vmi->memory_cache_shards[i];
+        memory_cache_entry_t entry = shard->lru_head;
+
+        while (entry) {
+            memory_cache_entry_t next = entry->lru_next;
+
+            /* pinned pages are released by memory_cache_unpin */
+            if (!entry->pins) {
+                vmi->memory_cache_release_data(entry->data, entry->length);
+            }
+            entry = next;
+        }
+
+        g_hash_table_destroy(shard->table);
+        shard->table = NULL;
+
+        if (retired) {
+            shard->retired = retired;
+        }
+        else {
+            shard_free(shard);
+        }
+    }
+
+    if (!retired) {
+        free(vmi->memory_cache_shards);
+    }
+    vmi->memory_cache_shards = NULL;
+    vmi->memory_cache_shard_count = 0;
+
     vmi->memory_cache_age = 0;
-    vmi->memory_cache_size = 0;
-    vmi->memory_cache_size_max = 0;
-    get_data_callback = NULL;
-    release_data_callback = NULL;
+    vmi->memory_cache_get_data = NULL;
+    vmi->memory_cache_get_data_batch = NULL;
+    vmi->memory_cache_release_data = NULL;
+}
+
+//---------------------------------------------------------
+// Public API functions
+
+status_t
+vmi_pagecache_set_limit(
+    vmi_instance_t vmi,
+    uint64_t bytes)
+{
+    if (!vmi || !vmi->memory_cache_shards) {
+        return VMI_FAILURE;
+    }
+
+    memory_cache_set_limit(vmi, bytes);
+    return VMI_SUCCESS;
+}
+
+uint64_t
+vmi_pagecache_get_limit(
+    vmi_instance_t vmi)
+{
+    if (!vmi) {
+        return 0;
+    }
+
+    return vmi->memory_cache_bytes_max;
+}
+
+status_t
+vmi_pagecache_get_stats(
+    vmi_instance_t vmi,
+    vmi_cache_stats_t *stats)
+{
+    uint32_t i;
+
+    if (!vmi || !stats) {
+        return VMI_FAILURE;
+    }
+
+    memset(stats, 0, sizeof(vmi_cache_stats_t));
+    for (i = 0; i < vmi->memory_cache_shard_count; i++) {
+        memory_cache_shard_t shard = &vmi->memory_cache_shards[i];
+
+        vmi_lock(vmi, &shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->refreshes += shard->refreshes;
+        stats->evictions += shard->evictions;
+        stats->resident_bytes += shard->bytes;
+        stats->entries += shard->size;
+        vmi_unlock(vmi, &shard->lock);
+    }
+    stats->limit_bytes = vmi->memory_cache_bytes_max;
+    return VMI_SUCCESS;
+}
+
+void
+vmi_pagecache_reset_stats(
+    vmi_instance_t vmi)
+{
+    uint32_t i;
+
+    for (i = 0; i < vmi->memory_cache_shard_count; i++) {
+        memory_cache_shard_t shard = &vmi->memory_cache_shards[i];
+
+        vmi_lock(vmi, &shard->lock);
+        shard->hits = 0;
+        shard->misses = 0;
+        shard->refreshes = 0;
+        shard->evictions = 0;
+        vmi_unlock(vmi, &shard->lock);
+    }
 }
@@ -36,9 +36,42 @@ void memory_cache_init(
                           size_t),
     unsigned long age_limit);
 
+void memory_cache_set_batch(
+    vmi_instance_t vmi,
+    size_t (*get_data_batch) (vmi_instance_t,
+                              const addr_t *,
+                              void **,
+                              size_t));
+
 void *memory_cache_insert(
     vmi_instance_t vmi,
     addr_t paddr);
 
+void *memory_cache_pin(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    void **pin);
+
+void memory_cache_unpin(
+    vmi_instance_t vmi,
+    void *pin);
+
+void memory_cache_prefetch(
+    vmi_instance_t vmi,
+    const addr_t *paddrs,
+    size_t n);
+
+void memory_cache_lock(
+    vmi_instance_t vmi,
+    addr_t paddr);
+
+void memory_cache_unlock(
+    vmi_instance_t vmi,
+    addr_t paddr);
+
+void memory_cache_set_limit(
+    vmi_instance_t vmi,
+    uint64_t bytes);
+
 void memory_cache_destroy(
     vmi_instance_t vmi);
@@ -0,0 +1,580 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* QMP client
+ *
+ * The KVM driver used to fork "virsh qemu-monitor-command" for every monitor
+ * command.  A session here stays connected to a QMP socket of the guest's
+ * QEMU, so a command costs one round trip.  Replies are one JSON object per
+ * line; asynchronous event lines in between are dropped. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "libvmi.h"
+#include "private.h"
+#include "driver/qmp.h"
+
+#define QMP_TIMEOUT_SEC 10
+#define QMP_MAX_REGS 128
+#define QMP_REG_NAME 8
+
+struct qmp_session {
+    int fd;
+    GString *pending;   /* received bytes past the last full line */
+};
+
+struct qmp_vcpu_registers {
+    unsigned int count;
+    struct {
+        char name[QMP_REG_NAME];
+        reg_t value;
+    } regs[QMP_MAX_REGS];
+};
+
+struct qmp_registers {
+    unsigned long nvcpus;
+    int shared;     /* no CPU#n headers, the one section is every vCPU's */
+    struct qmp_vcpu_registers *vcpus;
+};
+
+static char *
+qmp_read_line(
+    qmp_session_t qmp)
+{
+    char chunk[4096];
+    char *eol = NULL;
+    char *line = NULL;
+    ssize_t n;
+
+    while (!(eol = memchr(qmp->pending->str, '\n', qmp->pending->len))) {
+        n = recv(qmp->fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            dbprint(VMI_DEBUG_KVM, "--qmp: connection lost\n");
+            return NULL;
+        }
+        g_string_append_len(qmp->pending, chunk, n);
+    }
+
+    line = g_strndup(qmp->pending->str, eol - qmp->pending->str);
+    g_string_erase(qmp->pending, 0, eol - qmp->pending->str + 1);
+    return line;
+}
+
+static status_t
+qmp_write(
+    qmp_session_t qmp,
+    const char *data,
+    size_t length)
+{
+    ssize_t n;
+
+    while (length) {
+        n = send(qmp->fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            return VMI_FAILURE;
+        }
+        data += n;
+        length -= n;
+    }
+    return VMI_SUCCESS;
+}
+
+/* the first key of a reply is "return" or "error", events start otherwise */
+static int
+qmp_is_reply(
+    const char *line)
+{
+    const char *p = line;
+
+    while (*p && (isspace((unsigned char) *p) || '{' == *p)) {
+        ++p;
+    }
+    if (!strncmp(p, "\"return\"", 8) || !strncmp(p, "\"error\"", 7)) {
+        return 1;
+    }
+    return NULL == strstr(line, "\"event\"");
+}
+
+qmp_session_t
+qmp_connect(
+    const char *path)
+{
+    struct sockaddr_un address;
+    struct timeval timeout = { QMP_TIMEOUT_SEC, 0 };
+    qmp_session_t qmp = NULL;
+    char *line = NULL;
+
+    if (!path || strlen(path) >= sizeof(address.sun_path)) {
+        return NULL;
+    }
+
+    qmp = g_malloc0(sizeof(struct qmp_session));
+    qmp->pending = g_string_new(NULL);
+    qmp->fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (qmp->fd < 0) {
+        goto error_exit;
+    }
+    setsockopt(qmp->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    if (connect(qmp->fd, (struct sockaddr *) &address, sizeof(address))) {
+        dbprint(VMI_DEBUG_KVM, "--qmp: no monitor at %s\n", path);
+        goto error_exit;
+    }
+
+    /* {"QMP": {"version": ...}} */
+    line = qmp_read_line(qmp);
+    if (!line || !strstr(line, "\"QMP\"")) {
+        dbprint(VMI_DEBUG_KVM, "--qmp: %s is not a QMP monitor\n", path);
+        goto error_exit;
+    }
+    g_free(line);
+
+    line = qmp_execute(qmp, "{\"execute\": \"qmp_capabilities\"}");
+    if (!line || !strstr(line, "\"return\"")) {
+        dbprint(VMI_DEBUG_KVM, "--qmp: capabilities negotiation failed\n");
+        goto error_exit;
+    }
+    g_free(line);
+
+    dbprint(VMI_DEBUG_KVM, "--qmp: connected to %s\n", path);
+    return qmp;
+
+error_exit:
+    g_free(line);
+    qmp_close(qmp);
+    return NULL;
+}
+
+char *
+qmp_execute(
+    qmp_session_t qmp,
+    const char *command)
+{
+    char *line = NULL;
+
+    if (!qmp) {
+        return NULL;
+    }
+
+    dbprint(VMI_DEBUG_KVM, "--qmp: %s\n", command);
+    if (VMI_FAILURE == qmp_write(qmp, command, strlen(command))
+        || VMI_FAILURE == qmp_write(qmp, "\n", 1)) {
+        dbprint(VMI_DEBUG_KVM, "--qmp: failed to send command\n");
+        return NULL;
+    }
+
+    while ((line = qmp_read_line(qmp))) {
+        if (qmp_is_reply(line)) {
+            return line;
+        }
+        dbprint(VMI_DEBUG_KVM, "--qmp: skipping %s\n", line);
+        g_free(line);
+    }
+    return NULL;
+}
+
+char *
+qmp_reply_string(
+    const char *reply)
+{
+    const char *p = NULL;
+    GString *out = NULL;
+    unsigned int code = 0;
+
+    if (!reply || !(p = strstr(reply, "\"return\""))) {
+        return NULL;
+    }
+    p += 8;
+    while (isspace((unsigned char) *p) || ':' == *p) {
+        ++p;
+    }
+    if ('"' != *p++) {
+        return NULL;
+    }
+
+    out = g_string_new(NULL);
+    for (; *p && '"' != *p; ++p) {
+        if ('\\' != *p) {
+            g_string_append_c(out, *p);
+            continue;
+        }
+        switch (*++p) {
+        case 'n':
+            g_string_append_c(out, '\n');
+            break;
+        case 'r':
+            g_string_append_c(out, '\r');
+            break;
+        case 't':
+            g_string_append_c(out, '\t');
+            break;
+        case 'b':
+            g_string_append_c(out, '\b');
+            break;
+        case 'f':
+            g_string_append_c(out, '\f');
+            break;
+        case 'u':
+            /* monitor output is ASCII */
+            if (1 != sscanf(p + 1, "%4x", &code)) {
+                goto error_exit;
+            }
+            g_string_append_c(out, code < 0x80 ? (char) code : '?');
+            p += 4;
+            break;
+        case '\0':
+            goto error_exit;
+        default:
+            g_string_append_c(out, *p);
+            break;
+        }
+    }
+    if ('"' != *p) {
+        goto error_exit;
+    }
+    return g_string_free(out, FALSE);
+
+error_exit:
+    g_string_free(out, TRUE);
+    return NULL;
+}
+
+void
+qmp_close(
+    qmp_session_t qmp)
+{
+    if (!qmp) {
+        return;
+    }
+    if (qmp->fd >= 0) {
+        close(qmp->fd);
+    }
+    g_string_free(qmp->pending, TRUE);
+    g_free(qmp);
+}
+
+status_t
+qmp_peer_uid(
+    qmp_session_t qmp,
+    uid_t *uid)
+{
+    struct ucred cred;
+    socklen_t length = sizeof(cred);
+
+    if (!qmp || getsockopt(qmp->fd, SOL_SOCKET, SO_PEERCRED, &cred, &length)) {
+        return VMI_FAILURE;
+    }
+    *uid = cred.uid;
+    return VMI_SUCCESS;
+}
+
+/* NAME=value tokens, e.g. "RAX=0000000000000000 RBX=..." or "CR3=001ab000";
+ * short names are padded ("R8 =...", "CS =0010 ..." takes the selector) */
+static void
+qmp_parse_section(
+    struct qmp_vcpu_registers *vcpu,
+    const char *start,
+    const char *end)
+{
+    const char *p = start;
+    const char *name = NULL;
+    char *value_end = NULL;
+    size_t length;
+    reg_t value;
+
+    while (p < end) {
+        if (p != start && !isspace((unsigned char) p[-1])) {
+            ++p;
+            continue;
+        }
+        for (name = p; p < end && isalnum((unsigned char) *p); ++p);
+        length = p - name;
+        while (p < end && ' ' == *p) {
+            ++p;
+        }
+        if (!length || length >= QMP_REG_NAME || p >= end || '=' != *p) {
+            ++p;
+            continue;
+        }
+
+        value = (reg_t) strtoull(p + 1, &value_end, 16);
+        if (value_end == p + 1 || value_end > end) {
+            continue;
+        }
+        p = value_end;
+        if (vcpu->count < QMP_MAX_REGS) {
+            memcpy(vcpu->regs[vcpu->count].name, name, length);
+            vcpu->regs[vcpu->count].name[length] = '\0';
+            vcpu->regs[vcpu->count].value = value;
+            vcpu->count++;
+        }
+    }
+}
+
+qmp_registers_t
+qmp_parse_registers(
+    const char *dump)
+{
+    qmp_registers_t regs = NULL;
+    const char *section = NULL, *next = NULL;
+    unsigned long index;
+
+    if (!dump) {
+        return NULL;
+    }
+
+    regs = g_malloc0(sizeof(struct qmp_registers));
+    section = strstr(dump, "CPU#");
+    if (!section) {
+        regs->nvcpus = 1;
+        regs->shared = 1;
+        regs->vcpus = g_malloc0(sizeof(struct qmp_vcpu_registers));
+        qmp_parse_section(regs->vcpus, dump, dump + strlen(dump));
+    }
+
+    for (; section; section = next) {
+        index = strtoul(section + 4, NULL, 10);
+        next = strstr(section + 4, "CPU#");
+        if (index >= regs->nvcpus) {
+            regs->vcpus = g_realloc(regs->vcpus,
+                                    (index + 1) * sizeof(struct qmp_vcpu_registers));
+            memset(regs->vcpus + regs->nvcpus, 0,
+                   (index + 1 - regs->nvcpus) * sizeof(struct qmp_vcpu_registers));
+            regs->nvcpus = index + 1;
+        }
+        regs->vcpus[index].count = 0;
+        qmp_parse_section(&regs->vcpus[index], section + 4,
+                          next ? next : section + strlen(section));
+    }
+
+    for (index = 0; index < regs->nvcpus; ++index) {
+        if (regs->vcpus[index].count) {
+            return regs;
+        }
+    }
+
+    /* e.g. an error message instead of a register dump */
+    qmp_free_registers(regs);
+    return NULL;
+}
+
+status_t
+qmp_get_register(
+    qmp_registers_t regs,
+    unsigned long vcpu,
+    const char *name,
+    reg_t *value)
+{
+    struct qmp_vcpu_registers *set = NULL;
+    unsigned int i;
+
+    if (!regs) {
+        return VMI_FAILURE;
+    }
+    if (regs->shared) {
+        vcpu = 0;
+    }
+    if (vcpu >= regs->nvcpus) {
+        return VMI_FAILURE;
+    }
+
+    set = &regs->vcpus[vcpu];
+    for (i = 0; i < set->count; ++i) {
+        if (!strcmp(set->regs[i].name, name)) {
+            *value = set->regs[i].value;
+            return VMI_SUCCESS;
+        }
+    }
+    return VMI_FAILURE;
+}
+
+unsigned long
+qmp_registers_vcpus(
+    qmp_registers_t regs)
+{
+    return regs ? regs->nvcpus : 0;
+}
+
+void
+qmp_free_registers(
+    qmp_registers_t regs)
+{
+    if (!regs) {
+        return;
+    }
+    g_free(regs->vcpus);
+    g_free(regs);
+}
+
+/* rows are "<address>: 0x<word> 0x<word> 0x<word> 0x<word>" */
+size_t
+qmp_parse_xp(
+    const char *dump,
+    addr_t paddr,
+    void *buf,
+    size_t length)
+{
+    const char *p = dump;
+    char *end = NULL;
+    addr_t row;
+    uint32_t word;
+    size_t filled = 0, offset;
+
+    while (p && *p) {
+        row = (addr_t) strtoull(p, &end, 16);
+        if (end == p || ':' != *end || row < paddr) {
+            p = strchr(p, '\n');
+            p = p ? p + 1 : NULL;
+            continue;
+        }
+        p = end + 1;
+        for (offset = row - paddr; offset + 4 <= length; offset += 4) {
+            while (' ' == *p) {
+                ++p;
+            }
+            if (strncmp(p, "0x", 2)) {
+                break;
+            }
+            word = (uint32_t) strtoul(p, &end, 16);
+            if (end == p) {
+                break;
+            }
+            memcpy((char *) buf + offset, &word, 4);
+            if (offset == filled) {
+                filled += 4;
+            }
+            p = end;
+        }
+        p = strchr(p, '\n');
+        p = p ? p + 1 : NULL;
+    }
+    return filled;
+}
+
+/* QEMU rewrites the dump file with every pmemsave, callers copy out of the
+ * mapping and unmap it before the next one */
+static void *
+qmp_map_pmemsave(
+    qmp_session_t qmp,
+    const char *path,
+    addr_t paddr,
+    size_t length)
+{
+    char *command = NULL, *reply = NULL;
+    struct stat st;
+    void *dump = MAP_FAILED;
+    int saved = 0, fd;
+
+    command = safe_malloc(strlen(path) + 128);
+    sprintf(command,
+            "{\"execute\": \"pmemsave\", \"arguments\": {\"val\": %"PRIu64", \"size\": %zu, \"filename\": \"%s\"}}",
+            paddr, length, path);
+    reply = qmp_execute(qmp, command);
+    saved = reply && strstr(reply, "\"return\"") && !strstr(reply, "\"error\"");
+    g_free(reply);
+    free(command);
+    if (!saved) {
+        dbprint(VMI_DEBUG_KVM, "--qmp: pmemsave failed at 0x%"PRIx64"\n", paddr);
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (!fstat(fd, &st) && st.st_size >= length) {
+        dump = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    return (MAP_FAILED == dump) ? NULL : dump;
+}
+
+status_t
+qmp_pmemsave(
+    qmp_session_t qmp,
+    const char *path,
+    addr_t paddr,
+    void *buf,
+    size_t length)
+{
+    void *dump = qmp_map_pmemsave(qmp, path, paddr, length);
+
+    if (!dump) {
+        return VMI_FAILURE;
+    }
+    memcpy(buf, dump, length);
+    munmap(dump, length);
+    return VMI_SUCCESS;
+}
+
+/* runs of ascending frames within QMP_PMEMSAVE_MAX bytes share one dump */
+size_t
+qmp_pmemsave_batch(
+    qmp_session_t qmp,
+    const char *path,
+    const addr_t *paddrs,
+    void **data,
+    size_t n,
+    size_t page_size)
+{
+    size_t i = 0, j, k, length, fetched = 0;
+    uint8_t *dump = NULL;
+
+    while (i < n) {
+        for (j = i + 1; j < n && paddrs[j] > paddrs[j - 1]
+             && paddrs[j] + page_size - paddrs[i] <= QMP_PMEMSAVE_MAX; ++j);
+
+        length = paddrs[j - 1] + page_size - paddrs[i];
+        dump = qmp_map_pmemsave(qmp, path, paddrs[i], length);
+        for (k = i; k < j; ++k) {
+            data[k] = NULL;
+            if (dump) {
+                data[k] = safe_malloc(page_size);
+                memcpy(data[k], dump + (paddrs[k] - paddrs[i]), page_size);
+                fetched++;
+            }
+        }
+        if (dump) {
+            munmap(dump, length);
+        }
+        i = j;
+    }
+    return fetched;
+}
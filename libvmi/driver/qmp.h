@@ -0,0 +1,100 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QMP_H
+#define QMP_H
+
+#include "libvmi.h"
+#include "private.h"
+
+/* largest range dumped by one pmemsave */
+#define QMP_PMEMSAVE_MAX (1024 * 1024)
+
+/* A QMP session on a QEMU monitor socket (-qmp unix:<path>,server,nowait) */
+typedef struct qmp_session *qmp_session_t;
+
+/* The register file of every vCPU, parsed from "info registers" output */
+typedef struct qmp_registers *qmp_registers_t;
+
+/* connect to <path>, read the greeting and enter command mode */
+qmp_session_t qmp_connect(
+    const char *path);
+
+/* send one JSON command; returns the raw reply line, events are skipped */
+char *qmp_execute(
+    qmp_session_t qmp,
+    const char *command);
+
+/* the "return" string of a reply with its JSON escapes decoded */
+char *qmp_reply_string(
+    const char *reply);
+
+void qmp_close(
+    qmp_session_t qmp);
+
+/* uid of the process serving the monitor, i.e. of QEMU */
+status_t qmp_peer_uid(
+    qmp_session_t qmp,
+    uid_t *uid);
+
+/* output of "info registers -a" (one "CPU#n" section per vCPU) or of plain
+ * "info registers" (a single section that answers for any vCPU) */
+qmp_registers_t qmp_parse_registers(
+    const char *dump);
+
+status_t qmp_get_register(
+    qmp_registers_t regs,
+    unsigned long vcpu,
+    const char *name,
+    reg_t *value);
+
+unsigned long qmp_registers_vcpus(
+    qmp_registers_t regs);
+
+void qmp_free_registers(
+    qmp_registers_t regs);
+
+/* words of "xp /<n>wx <paddr>" output into buf, returns the bytes filled
+ * from the start of buf */
+size_t qmp_parse_xp(
+    const char *dump,
+    addr_t paddr,
+    void *buf,
+    size_t length);
+
+/* pmemsave [paddr, paddr + length) to the file at path and copy it to buf */
+status_t qmp_pmemsave(
+    qmp_session_t qmp,
+    const char *path,
+    addr_t paddr,
+    void *buf,
+    size_t length);
+
+/* the pages at paddrs into data[i], allocated here and NULL where the dump
+ * failed; returns the pages read */
+size_t qmp_pmemsave_batch(
+    qmp_session_t qmp,
+    const char *path,
+    const addr_t *paddrs,
+    void **data,
+    size_t n,
+    size_t page_size);
+
+#endif /* QMP_H */
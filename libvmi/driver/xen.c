@@ -395,6 +395,12 @@ xen_setup_shm_snapshot_mode(
     memory_cache_init(vmi, xen_get_memory_shm_snapshot, xen_release_memory_shm_snapshot,
         1);
 
+    // the snapshot is one flat buffer, read pages straight out of it
+    if (!(vmi->flags & VMI_INIT_PAGECACHE)) {
+        vmi->flat_memory = xen->shm_snapshot_map;
+        vmi->flat_memory_size = vmi->size;
+    }
+
     return VMI_SUCCESS;
 }
 
@@ -406,6 +412,8 @@ xen_teardown_shm_snapshot_mode(
 
     if (VMI_SUCCESS == test_using_shm_snapshot(xen)) {
         dbprint(VMI_DEBUG_XEN, "--xen: teardown shm-snapshot\n");
+        vmi->flat_memory = NULL;
+        vmi->flat_memory_size = 0;
         if (xen->shm_snapshot_map != NULL) {
             free(xen->shm_snapshot_map);
             xen->shm_snapshot_map = NULL;
@@ -475,6 +483,49 @@ xen_release_memory(
     munmap(memory, length);
 }
 
+/*
+ * Map many frames with a single hypercall.  The pages come back as one
+ * mapping, but each is handed out and later unmapped on its own.
+ */
+size_t
+xen_get_memory_batch(
+    vmi_instance_t vmi,
+    const addr_t *paddrs,
+    void **data,
+    size_t n)
+{
+    xen_pfn_t *pfns = safe_malloc(n * sizeof(xen_pfn_t));
+    uint8_t *memory = NULL;
+    size_t i, mapped = 0;
+
+    for (i = 0; i < n; i++) {
+        pfns[i] = paddrs[i] >> vmi->page_shift;
+    }
+
+    memory = xc_map_foreign_batch(xen_get_xchandle(vmi),
+                                  xen_get_domainid(vmi),
+                                  PROT_READ, pfns, n);
+    if (MAP_FAILED == memory || NULL == memory) {
+        dbprint(VMI_DEBUG_XEN, "--xen_get_memory_batch failed on %zu pages\n", n);
+        free(pfns);
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (pfns[i] & XEN_DOMCTL_PFINFO_XTAB) {
+            munmap(memory + i * XC_PAGE_SIZE, XC_PAGE_SIZE);
+            data[i] = NULL;
+        }
+        else {
+            data[i] = memory + i * XC_PAGE_SIZE;
+            mapped++;
+        }
+    }
+
+    free(pfns);
+    return mapped;
+}
+
 status_t
 xen_put_memory(
     vmi_instance_t vmi,
@@ -757,6 +808,7 @@ xen_setup_live_mode(
     memory_cache_destroy(vmi);
     memory_cache_init(vmi, xen_get_memory, xen_release_memory,
                           0);
+    memory_cache_set_batch(vmi, xen_get_memory_batch);
     return VMI_SUCCESS;
 }
 
@@ -0,0 +1,258 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libvmi.h"
+#include "private.h"
+
+struct vmi_sym {
+    addr_t vaddr;
+    addr_t paddr;       /* zero until translated */
+    addr_t dtb;         /* kpgd the translation was made with */
+    uint32_t generation;
+};
+
+vmi_sym_t
+vmi_resolve_ksym(
+    vmi_instance_t vmi,
+    const char *name)
+{
+    addr_t vaddr = vmi_translate_ksym2v(vmi, name);
+    vmi_sym_t sym = NULL;
+
+    if (!vaddr) {
+        dbprint(VMI_DEBUG_READ, "--%s: vmi_translate_ksym2v failed for '%s'\n",
+                __FUNCTION__, name);
+        return NULL;
+    }
+
+    sym = safe_malloc(sizeof(struct vmi_sym));
+    sym->vaddr = vaddr;
+    sym->paddr = 0;
+    return sym;
+}
+
+void
+vmi_free_sym(
+    vmi_sym_t sym)
+{
+    free(sym);
+}
+
+addr_t
+vmi_sym_get_vaddr(
+    vmi_sym_t sym)
+{
+    return sym->vaddr;
+}
+
+/* the physical address of the symbol, translated again once the
+ * instance flushed its caches or the VM was resumed */
+static addr_t
+sym_paddr(
+    vmi_instance_t vmi,
+    vmi_sym_t sym)
+{
+    if (!sym->paddr || sym->generation != vmi->v2p_generation || sym->dtb != vmi->kpgd) {
+        sym->paddr = vmi_translate_kv2p(vmi, sym->vaddr);
+        sym->dtb = vmi->kpgd;
+        sym->generation = vmi->v2p_generation;
+    }
+    return sym->paddr;
+}
+
+/* whether count bytes from the symbol stay on its page */
+static int
+sym_on_page(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    size_t count)
+{
+    return (sym->vaddr & (vmi->page_size - 1)) + count <= vmi->page_size;
+}
+
+size_t
+vmi_read_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    void *buf,
+    size_t count)
+{
+    addr_t paddr = 0;
+
+    if (!sym_on_page(vmi, sym, count)) {
+        return vmi_read_va(vmi, sym->vaddr, 0, buf, count);
+    }
+
+    paddr = sym_paddr(vmi, sym);
+    if (paddr && count == vmi_read_pa(vmi, paddr, buf, count)) {
+        return count;
+    }
+
+    /* the cached translation may have gone stale */
+    sym->paddr = 0;
+    paddr = sym_paddr(vmi, sym);
+    if (!paddr) {
+        dbprint(VMI_DEBUG_READ, "--%s: failed to translate 0x%"PRIx64"\n",
+                __FUNCTION__, sym->vaddr);
+        return 0;
+    }
+    return vmi_read_pa(vmi, paddr, buf, count);
+}
+
+size_t
+vmi_write_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    void *buf,
+    size_t count)
+{
+    addr_t paddr = 0;
+
+    if (!sym_on_page(vmi, sym, count)) {
+        return vmi_write_va(vmi, sym->vaddr, 0, buf, count);
+    }
+
+    paddr = sym_paddr(vmi, sym);
+    if (paddr && count == vmi_write_pa(vmi, paddr, buf, count)) {
+        return count;
+    }
+
+    /* the cached translation may have gone stale */
+    sym->paddr = 0;
+    paddr = sym_paddr(vmi, sym);
+    if (!paddr) {
+        dbprint(VMI_DEBUG_WRITE, "--%s: failed to translate 0x%"PRIx64"\n",
+                __FUNCTION__, sym->vaddr);
+        return 0;
+    }
+    return vmi_write_pa(vmi, paddr, buf, count);
+}
+
+///////////////////////////////////////////////////////////
+// Easy access to memory using symbol handles
+static status_t
+vmi_read_X_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    void *value,
+    size_t size)
+{
+    return (vmi_read_sym(vmi, sym, value, size) == size) ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+status_t
+vmi_read_8_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint8_t * value)
+{
+    return vmi_read_X_sym(vmi, sym, value, 1);
+}
+
+status_t
+vmi_read_16_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint16_t * value)
+{
+    return vmi_read_X_sym(vmi, sym, value, 2);
+}
+
+status_t
+vmi_read_32_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint32_t * value)
+{
+    return vmi_read_X_sym(vmi, sym, value, 4);
+}
+
+status_t
+vmi_read_64_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint64_t * value)
+{
+    return vmi_read_X_sym(vmi, sym, value, 8);
+}
+
+status_t
+vmi_read_addr_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    addr_t *value)
+{
+    if (vmi->page_mode == VMI_PM_IA32E) {
+        return vmi_read_64_sym(vmi, sym, value);
+    }
+    else {
+        uint32_t tmp = 0;
+        status_t ret = vmi_read_32_sym(vmi, sym, &tmp);
+
+        *value = (uint64_t) tmp;
+        return ret;
+    }
+}
+
+static status_t
+vmi_write_X_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    void *value,
+    size_t size)
+{
+    return (vmi_write_sym(vmi, sym, value, size) == size) ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+status_t
+vmi_write_8_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint8_t * value)
+{
+    return vmi_write_X_sym(vmi, sym, value, 1);
+}
+
+status_t
+vmi_write_16_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint16_t * value)
+{
+    return vmi_write_X_sym(vmi, sym, value, 2);
+}
+
+status_t
+vmi_write_32_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint32_t * value)
+{
+    return vmi_write_X_sym(vmi, sym, value, 4);
+}
+
+status_t
+vmi_write_64_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint64_t * value)
+{
+    return vmi_write_X_sym(vmi, sym, value, 8);
+}
@@ -58,7 +58,7 @@ extern "C" {
 /* enable or disable the page cache */
 #define ENABLE_PAGE_CACHE 1
 
-/* max number of pages held in page cache */
+/* default number of 4kB pages held in page cache, see vmi_pagecache_set_limit */
 #define MAX_PAGE_CACHE_SIZE 512
 
 typedef uint32_t vmi_mode_t;
@@ -81,6 +81,10 @@ typedef uint32_t vmi_mode_t;
 
 #define VMI_INIT_SHM_SNAPSHOT (1 << 19) /**< setup shm-snapshot in vmi_init() if the feature is activated */
 
+#define VMI_INIT_THREADSAFE (1 << 20) /**< allow concurrent reads on one instance from several threads */
+
+#define VMI_INIT_PAGECACHE (1 << 21) /**< read through the page cache even where memory could be read in place */
+
 #define VMI_CONFIG_NONE (1 << 24) /**< no config provided */
 
 #define VMI_CONFIG_GLOBAL_FILE_ENTRY (1 << 25) /**< config in file provided */
@@ -143,7 +147,7 @@ typedef enum page_size {
 
     VMI_PS_4MB = 0x400000ULL, /**< 4Mb */
 
-    VMI_PS_1GB = 0x4000000ULL /**< 1Gb */
+    VMI_PS_1GB = 0x40000000ULL /**< 1Gb */
 
 } page_size_t;
 
@@ -266,6 +270,103 @@ typedef struct page_info {
     addr_t l4_v; // the value of the       -  /  -   / pml4e
 } page_info_t;
 
+/**
+ * One request of a vectored read, see vmi_read_pa_iov and vmi_read_va_iov
+ */
+typedef struct vmi_iovec {
+
+    addr_t addr;     /**< address to read from */
+
+    void *buf;       /**< where to store the data */
+
+    size_t len;      /**< number of bytes to read */
+
+    status_t status; /**< set to VMI_SUCCESS if all \a len bytes were read */
+
+} vmi_iovec_t;
+
+/**
+ * How a field is read by vmi_read_struct
+ */
+typedef enum vmi_field_type {
+
+    VMI_FIELD_8,     /**< stored as uint8_t */
+
+    VMI_FIELD_16,    /**< stored as uint16_t */
+
+    VMI_FIELD_32,    /**< stored as uint32_t */
+
+    VMI_FIELD_64,    /**< stored as uint64_t */
+
+    VMI_FIELD_ADDR,  /**< guest pointer, stored as addr_t */
+
+    VMI_FIELD_BYTES  /**< raw bytes, see vmi_field_t.size */
+
+} vmi_field_type_t;
+
+/**
+ * One field of a guest structure read by vmi_read_struct
+ */
+typedef struct vmi_field {
+
+    size_t offset;          /**< offset of the field in the guest structure */
+
+    vmi_field_type_t type;  /**< how to read the field */
+
+    size_t size;            /**< number of bytes, only for VMI_FIELD_BYTES */
+
+    size_t out_offset;      /**< where to store the value in the output */
+
+} vmi_field_t;
+
+/**
+ * A virtually and physically contiguous piece of an address range,
+ * see vmi_translate_range
+ */
+typedef struct vmi_extent {
+
+    addr_t va;  /**< first virtual address of the extent */
+
+    addr_t pa;  /**< physical address backing va */
+
+    size_t len; /**< length in bytes */
+
+} vmi_extent_t;
+
+/**
+ * How LibVMI checks a cached virtual to physical translation before
+ * using it.
+ */
+typedef enum v2p_validation {
+
+    VMI_V2P_VALIDATE_ALWAYS, /**< probe the physical page on every hit (default) */
+
+    VMI_V2P_VALIDATE_NEVER, /**< trust cached translations until they are flushed */
+
+    VMI_V2P_VALIDATE_GENERATION /**< trust cached translations until the VM is resumed */
+
+} v2p_validation_t;
+
+/**
+ * Page cache usage counters, see vmi_pagecache_get_stats
+ */
+typedef struct vmi_cache_stats {
+
+    uint64_t hits;           /**< lookups served from the cache */
+
+    uint64_t misses;         /**< lookups that had to read from the driver */
+
+    uint64_t refreshes;      /**< cached pages re-read after aging out */
+
+    uint64_t evictions;      /**< pages dropped to stay within the budget */
+
+    uint64_t resident_bytes; /**< bytes of page data currently cached */
+
+    uint64_t limit_bytes;    /**< current byte budget of the cache */
+
+    uint32_t entries;        /**< number of pages currently cached */
+} vmi_cache_stats_t;
+
 /**
  * Generic representation of Unicode string to be used within libvmi
  */
@@ -291,6 +392,29 @@ typedef void* vmi_config_t;
  */
 typedef struct vmi_instance *vmi_instance_t;
 
+/**
+ * @brief LibVMI address space handle.
+ *
+ * Opaque handle on one virtual address space of an instance, created
+ * with vmi_open_address_space and released with vmi_close_address_space.
+ */
+typedef struct vmi_address_space *vmi_as_t;
+
+/**
+ * @brief Pin on a page mapped with vmi_map_pa or vmi_map_va.
+ *
+ * The page stays in the page cache until the pin is released with
+ * vmi_unmap.
+ */
+typedef struct vmi_pin *vmi_pin_t;
+
+/**
+ * @brief Pre-resolved kernel symbol.
+ *
+ * Created with vmi_resolve_ksym and released with vmi_free_sym.
+ */
+typedef struct vmi_sym *vmi_sym_t;
+
 /*---------------------------------------------------------
  * Initialization and Destruction functions from core.c
  */
@@ -413,6 +537,25 @@ addr_t vmi_translate_uv2p(
     addr_t vaddr,
     vmi_pid_t pid);
 
+/**
+ * Performs the translation from many virtual addresses of one process
+ * to physical addresses, see vmi_pagetable_lookup_batch.  The page
+ * directory of \a pid is looked up once for the whole batch.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] pid Process id for desired address space, 0 for kernel
+ * @param[in] in Virtual addresses to translate, in any order
+ * @param[out] out Physical addresses, zero where \a in is not mapped
+ * @param[in] n Number of addresses
+ * @return VMI_SUCCESS if every address was translated, else VMI_FAILURE
+ */
+status_t vmi_translate_v2p_batch(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    const addr_t *in,
+    addr_t *out,
+    size_t n);
+
 /**
  * Performs the translation from a kernel symbol to a virtual address.
  *
@@ -444,7 +587,8 @@ addr_t vmi_translate_sym2v(
 /**
  * Performs the translation from an RVA to a symbol
  * On Windows this function walks the PE export table.
- * Linux is unimplemented at this time.
+ * On Linux it looks up the kernel address \a base_vaddr + \a rva
+ * in the System.map, \a pid is ignored.
  *
  * @param[in] vmi LibVMI instance
  * @param[in] base_vaddr Base virtual address (beginning of PE header in Windows)
@@ -499,6 +643,52 @@ addr_t vmi_pagetable_lookup (
     addr_t dtb,
     addr_t vaddr);
 
+/**
+ * Translates many virtual addresses of one address space at once.
+ * Addresses are grouped by page directory entry so that each group
+ * costs one page walk and one read of its page table, and all
+ * translations are added to the v2p cache.  The cache is not
+ * consulted, which makes this the cheaper choice for large batches.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] dtb address of the relevant page directory base
+ * @param[in] in Virtual addresses to translate, in any order
+ * @param[out] out Physical addresses, zero where \a in is not mapped
+ * @param[in] n Number of addresses
+ * @return VMI_SUCCESS if every address was translated, else VMI_FAILURE
+ */
+status_t vmi_pagetable_lookup_batch(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    const addr_t *in,
+    addr_t *out,
+    size_t n);
+
+/**
+ * Translates the virtual range [\a vaddr, \a vaddr + \a len) into extents
+ * that are contiguous both virtually and physically.  One translation
+ * covers a whole large page, and neighbouring pages that are also
+ * physically adjacent are merged into one extent.  Translation stops
+ * at the first unmapped page or once \a n extents are filled; the
+ * lengths of the returned extents tell how much of the range was
+ * covered.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] dtb address of the relevant page directory base
+ * @param[in] vaddr first virtual address of the range
+ * @param[in] len length of the range in bytes
+ * @param[out] extents Array receiving the extents in address order
+ * @param[in] n Capacity of \a extents
+ * @return Number of extents filled in
+ */
+size_t vmi_translate_range(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t vaddr,
+    size_t len,
+    vmi_extent_t *extents,
+    size_t n);
+
 /**
  * Gets the physical address and page size of the VA
  * as well as the addresses of other paging related structures
@@ -516,6 +706,383 @@ status_t vmi_pagetable_lookup_extended(
     addr_t vaddr,
     page_info_t *info);
 
+/**
+ * Callback invoked by vmi_foreach_va_page for every mapped page.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] va Virtual address of the start of the page
+ * @param[in] size Size of the page
+ * @param[in] data Caller data passed to vmi_foreach_va_page
+ * @return VMI_SUCCESS to continue the walk, VMI_FAILURE to stop it
+ */
+typedef status_t (*va_page_callback_t)(
+    vmi_instance_t vmi,
+    addr_t va,
+    page_size_t size,
+    void *data);
+
+/**
+ * Walks the page tables of an address space and calls \a callback
+ * for each mapped page, in ascending virtual address order.  Unlike
+ * vmi_get_va_pages no list is built, so results can be streamed.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] dtb address of the relevant page directory base
+ * @param[in] callback Function to call for each mapped page
+ * @param[in] data Passed through to \a callback
+ * @return VMI_SUCCESS if the whole address space was walked,
+ *  VMI_FAILURE if the walk failed or \a callback stopped it
+ */
+status_t vmi_foreach_va_page(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    va_page_callback_t callback,
+    void *data);
+
+/*---------------------------------------------------------
+ * Address space handles from addrspace.c
+ */
+
+/**
+ * Opens a handle on the virtual address space of \a pid.  The page
+ * directory is looked up once here, so reads and translations through
+ * the handle skip the pid to dtb lookup.  The handle keeps a small
+ * translation cache of its own, which is dropped whenever the v2p cache
+ * of the instance is flushed or the VM is resumed.  A handle must not
+ * be used by several threads at once.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] pid Process id of the address space, 0 for kernel
+ * @return The handle, or NULL if the address space was not found
+ */
+vmi_as_t vmi_open_address_space(
+    vmi_instance_t vmi,
+    vmi_pid_t pid);
+
+/**
+ * Opens a handle on the virtual address space rooted at \a dtb, see
+ * vmi_open_address_space.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] dtb Page directory of the address space
+ * @return The handle, or NULL on error
+ */
+vmi_as_t vmi_open_address_space_dtb(
+    vmi_instance_t vmi,
+    addr_t dtb);
+
+/**
+ * Releases a handle opened with vmi_open_address_space.
+ *
+ * @param[in] as Address space handle, may be NULL
+ */
+void vmi_close_address_space(
+    vmi_as_t as);
+
+/**
+ * Gets the page directory an address space handle resolved to.
+ *
+ * @param[in] as Address space handle
+ * @return The directory table base
+ */
+addr_t vmi_as_get_dtb(
+    vmi_as_t as);
+
+/**
+ * Drops the translations cached in an address space handle.
+ *
+ * @param[in] as Address space handle
+ */
+void vmi_as_flush(
+    vmi_as_t as);
+
+/**
+ * Performs the translation from a virtual address of the handle's
+ * address space to a physical address.
+ *
+ * @param[in] as Address space handle
+ * @param[in] vaddr Desired virtual address to translate
+ * @return Physical address, or zero on error
+ */
+addr_t vmi_as_translate(
+    vmi_as_t as,
+    addr_t vaddr);
+
+/**
+ * Reads \a count bytes from the virtual address \a vaddr of the handle's
+ * address space and stores the output in \a buf.
+ *
+ * @param[in] as Address space handle
+ * @param[in] vaddr Virtual address to read from
+ * @param[out] buf The data read from memory
+ * @param[in] count The number of bytes to read
+ * @return The number of bytes read.
+ */
+size_t vmi_as_read(
+    vmi_as_t as,
+    addr_t vaddr,
+    void *buf,
+    size_t count);
+
+/**
+ * Performs many small reads from the handle's address space at once,
+ * see vmi_read_va_iov.
+ *
+ * @param[in] as Address space handle
+ * @param[in,out] vec Requests with virtual addresses, each gets a status
+ * @param[in] n Number of requests
+ * @return VMI_SUCCESS if every request was read in full, else VMI_FAILURE
+ */
+status_t vmi_as_read_iov(
+    vmi_as_t as,
+    vmi_iovec_t *vec,
+    size_t n);
+
+/*---------------------------------------------------------
+ * Kernel symbol handles from ksym.c
+ */
+
+/**
+ * Looks up a kernel symbol once, for use with the vmi_read_*_sym and
+ * vmi_write_*_sym functions.  These skip the symbol lookup and, while
+ * the v2p cache is not flushed and the VM not resumed, the address
+ * translation too.  A handle must not be used by several threads at once.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] name Kernel symbol
+ * @return The handle, or NULL if the symbol was not found
+ */
+vmi_sym_t vmi_resolve_ksym(
+    vmi_instance_t vmi,
+    const char *name);
+
+/**
+ * Releases a handle from vmi_resolve_ksym.
+ *
+ * @param[in] sym Symbol handle
+ */
+void vmi_free_sym(
+    vmi_sym_t sym);
+
+/**
+ * Gets the virtual address of a resolved kernel symbol.
+ *
+ * @param[in] sym Symbol handle
+ * @return Virtual address of the symbol
+ */
+addr_t vmi_sym_get_vaddr(
+    vmi_sym_t sym);
+
+/**
+ * Reads \a count bytes from memory located at a resolved kernel symbol
+ * and stores the output in \a buf.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[out] buf The data read from memory
+ * @param[in] count The number of bytes to read
+ * @return The number of bytes read.
+ */
+size_t vmi_read_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    void *buf,
+    size_t count);
+
+/**
+ * Reads 8 bits from memory, given a resolved kernel symbol.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[out] value The value read from memory
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_read_8_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint8_t * value);
+
+/**
+ * Reads 16 bits from memory, given a resolved kernel symbol.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[out] value The value read from memory
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_read_16_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint16_t * value);
+
+/**
+ * Reads 32 bits from memory, given a resolved kernel symbol.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[out] value The value read from memory
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_read_32_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint32_t * value);
+
+/**
+ * Reads 64 bits from memory, given a resolved kernel symbol.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[out] value The value read from memory
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_read_64_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint64_t * value);
+
+/**
+ * Reads an address from memory, given a resolved kernel symbol.  The
+ * number of bytes read is 8 for 64-bit systems and 4 for 32-bit systems.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[out] value The value read from memory
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_read_addr_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    addr_t *value);
+
+/**
+ * Writes \a count bytes to memory located at a resolved kernel symbol
+ * from \a buf.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[in] buf The data written to memory
+ * @param[in] count The number of bytes to write
+ * @return The number of bytes written.
+ */
+size_t vmi_write_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    void *buf,
+    size_t count);
+
+/**
+ * Writes 8 bits to memory, given a resolved kernel symbol.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[in] value The value written to memory
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_write_8_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint8_t * value);
+
+/**
+ * Writes 16 bits to memory, given a resolved kernel symbol.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[in] value The value written to memory
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_write_16_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint16_t * value);
+
+/**
+ * Writes 32 bits to memory, given a resolved kernel symbol.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[in] value The value written to memory
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_write_32_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint32_t * value);
+
+/**
+ * Writes 64 bits to memory, given a resolved kernel symbol.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] sym Symbol handle
+ * @param[in] value The value written to memory
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_write_64_sym(
+    vmi_instance_t vmi,
+    vmi_sym_t sym,
+    uint64_t * value);
+
+/*---------------------------------------------------------
+ * Physical memory scanning from scan.c
+ */
+
+/**
+ * A byte string searched for by vmi_scan_pa.
+ */
+typedef struct {
+    const void *data;   /**< bytes to look for */
+    size_t len;         /**< number of bytes, at least one */
+} vmi_pattern_t;
+
+/**
+ * Callback invoked by vmi_scan_pa for every match.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] paddr Physical address of the first byte of the match
+ * @param[in] pattern Index of the matching pattern
+ * @param[in] data Caller data passed to vmi_scan_pa
+ * @return VMI_SUCCESS to continue the scan, VMI_FAILURE to stop it
+ */
+typedef status_t (*scan_callback_t)(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    size_t pattern,
+    void *data);
+
+/**
+ * Searches physical memory in [\a start, \a end) for any of \a n byte
+ * patterns and calls \a callback for every match lying wholly inside
+ * the range.  Memory is read in large chunks which a pool of worker
+ * threads searches in parallel, but \a callback is always called on the
+ * calling thread, in ascending address order and, for patterns matching
+ * at the same address, in pattern order.  Matches crossing the chunk
+ * boundaries are found; unreadable pages are skipped and nothing
+ * matches across them.
+ *
+ * Without VMI_INIT_THREADSAFE the workers take turns reading, and
+ * reads are held off while \a callback runs, so \a callback may use
+ * \a vmi freely.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] start First physical address to search
+ * @param[in] end End of the range, clamped to the memory size
+ * @param[in] patterns Patterns to search for
+ * @param[in] n Number of patterns
+ * @param[in] callback Function to call for each match
+ * @param[in] data Passed through to \a callback
+ * @return VMI_SUCCESS if the whole range was searched,
+ *  VMI_FAILURE if the arguments are invalid or \a callback stopped the scan
+ */
+status_t vmi_scan_pa(
+    vmi_instance_t vmi,
+    addr_t start,
+    addr_t end,
+    const vmi_pattern_t *patterns,
+    size_t n,
+    scan_callback_t callback,
+    void *data);
+
 /*---------------------------------------------------------
  * Memory access functions from util.c
  */
@@ -570,6 +1137,164 @@ size_t vmi_read_pa(
     void *buf,
     size_t count);
 
+/**
+ * Reads several fields of one guest structure at once.  The byte range
+ * covering all \a fields is read with a single vmi_read_va, then each
+ * value is stored at its out_offset in \a out.  VMI_FIELD_ADDR fields
+ * are as wide as vmi_get_address_width reports and are zero-extended.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] vaddr Virtual address of the structure
+ * @param[in] pid Pid of the virtual address space (0 for kernel)
+ * @param[in] fields Fields to read, in any order
+ * @param[in] n Number of fields
+ * @param[out] out Buffer receiving the values
+ * @return VMI_SUCCESS, or VMI_FAILURE if any field could not be read
+ */
+status_t vmi_read_struct(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    vmi_pid_t pid,
+    const vmi_field_t *fields,
+    size_t n,
+    void *out);
+
+/**
+ * Callback invoked by vmi_walk_list for every entry of a list.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] entry Virtual address of the entry
+ * @param[in] fields Values of the requested fields, laid out as by vmi_read_struct
+ * @param[in] data Caller data passed to vmi_walk_list
+ * @return VMI_SUCCESS to continue the walk, VMI_FAILURE to stop it
+ */
+typedef status_t (*list_entry_callback_t)(
+    vmi_instance_t vmi,
+    addr_t entry,
+    const void *fields,
+    void *data);
+
+/**
+ * Walks a circular doubly linked list of guest objects, such as the
+ * Linux task list or the Windows process list, and calls \a callback
+ * for every entry.  The list head itself is not reported.  Each entry
+ * is fetched with a single read covering \a fields and its forward
+ * pointer, and the pages of the next entry are prefetched while the
+ * current one is handed to \a callback.  The walk gives up on NULL
+ * pointers, unreadable entries, loops that do not return to \a head
+ * and lists longer than a million entries.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] pid Pid of the address space holding the list, 0 for kernel
+ * @param[in] head Virtual address of the list head (list_head, LIST_ENTRY)
+ * @param[in] next_offset Offset of the pointer to follow within a link,
+ *  0 for forward and the pointer width for backward walks
+ * @param[in] entry_offset Offset of the link within each entry
+ * @param[in] fields Fields to read from each entry, relative to its start
+ * @param[in] n Number of fields, may be 0
+ * @param[in] callback Function to call for each entry
+ * @param[in] data Passed through to \a callback
+ * @return VMI_SUCCESS if the whole list was walked,
+ *  VMI_FAILURE if the walk failed or \a callback stopped it
+ */
+status_t vmi_walk_list(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    addr_t head,
+    size_t next_offset,
+    size_t entry_offset,
+    const vmi_field_t *fields,
+    size_t n,
+    list_entry_callback_t callback,
+    void *data);
+
+/**
+ * Maps the page holding the physical address \a paddr for reading in
+ * place, without copying it out of the page cache.  The page is pinned:
+ * it is not evicted or refreshed until the pin is released with
+ * vmi_unmap, so hold pins briefly on a running guest.  Pinned pages stay
+ * mapped when the driver drops its page cache, e.g. in
+ * vmi_shm_snapshot_create or vmi_shm_snapshot_destroy, and are released
+ * by vmi_unmap.  Pages mapped out of a shm snapshot itself come without
+ * a pin and are invalid once the snapshot is destroyed.  All pins must
+ * be released before vmi_destroy.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] paddr Physical address to map
+ * @param[out] len Number of bytes readable from the returned pointer,
+ *  i.e. up to the end of the page (may be NULL)
+ * @param[out] pin Pin to release with vmi_unmap, may be NULL for
+ *  backends that keep all of memory mapped
+ * @return Read-only pointer to \a paddr, or NULL on error
+ */
+const void *vmi_map_pa(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    size_t *len,
+    vmi_pin_t *pin);
+
+/**
+ * Maps the page holding the virtual address \a vaddr for reading in
+ * place, see vmi_map_pa.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] vaddr Virtual address to map
+ * @param[in] pid Pid of the virtual address space (0 for kernel)
+ * @param[out] len Number of bytes readable from the returned pointer
+ *  (may be NULL)
+ * @param[out] pin Pin to release with vmi_unmap
+ * @return Read-only pointer to \a vaddr, or NULL on error
+ */
+const void *vmi_map_va(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    vmi_pid_t pid,
+    size_t *len,
+    vmi_pin_t *pin);
+
+/**
+ * Releases a page mapped with vmi_map_pa or vmi_map_va.  The pointer
+ * returned by the map call must not be used afterwards.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] pin Pin returned by the map call, NULL is ignored
+ */
+void vmi_unmap(
+    vmi_instance_t vmi,
+    vmi_pin_t pin);
+
+/**
+ * Performs many small reads from physical memory at once.  The requests
+ * are sorted by page so every page is fetched once, and backends that
+ * can map several pages in one call (Xen) fetch all missing pages of
+ * the batch up front.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in,out] vec Requests with physical addresses, each gets a status
+ * @param[in] n Number of requests
+ * @return VMI_SUCCESS if every request was read in full, else VMI_FAILURE
+ */
+status_t vmi_read_pa_iov(
+    vmi_instance_t vmi,
+    vmi_iovec_t *vec,
+    size_t n);
+
+/**
+ * Performs many small reads from one virtual address space at once, see
+ * vmi_read_pa_iov.  The page directory of \a pid is looked up once.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] pid Pid of the virtual address space (0 for kernel)
+ * @param[in,out] vec Requests with virtual addresses, each gets a status
+ * @param[in] n Number of requests
+ * @return VMI_SUCCESS if every request was read in full, else VMI_FAILURE
+ */
+status_t vmi_read_va_iov(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    vmi_iovec_t *vec,
+    size_t n);
+
 /**
  * Reads 8 bits from memory, given a kernel symbol.
  *
@@ -1181,6 +1906,19 @@ uint32_t vmi_get_access_mode(
 page_mode_t vmi_get_page_mode(
     vmi_instance_t vmi);
 
+/**
+ * Sets the page mode used for address translation.  This is needed
+ * for memory images where the mode cannot be read from the vCPU
+ * registers and no OS specific heuristics are configured.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] page_mode VMI_PM_LEGACY, VMI_PM_PAE or VMI_PM_IA32E
+ * @return VMI_SUCCESS or VMI_FAILURE for an unsupported mode
+ */
+status_t vmi_set_page_mode(
+    vmi_instance_t vmi,
+    page_mode_t page_mode);
+
 /**
  * Gets the current address width for the given vmi_instance_t
  *
@@ -1188,6 +1926,8 @@ page_mode_t vmi_get_page_mode(
  *       Also, if paging mode is altered after vmi_init,
  *       the information as recorded in vmi_instance_t will
  *       be stale and require re-initialization.
+ *       Drivers that cannot tell report the width of the
+ *       paging mode, 8 bytes for VMI_PM_IA32E and 4 otherwise.
  *
  * @param[in] vmi LibVMI instance
  * @return address size in bytes
@@ -1427,6 +2167,23 @@ void vmi_v2pcache_add(
     addr_t dtb,
     addr_t pa);
 
+/**
+ * Selects how cached virtual to physical translations are validated.
+ * VMI_V2P_VALIDATE_ALWAYS reads from the cached physical page on every
+ * hit.  VMI_V2P_VALIDATE_NEVER skips that read and relies on the caller
+ * to flush the cache when the guest page tables change.
+ * VMI_V2P_VALIDATE_GENERATION skips the read as well, but discards
+ * all translations made before the last vmi_resume_vm.  Upper level page
+ * table entries are only cached for page walks under the latter two
+ * policies; with VMI_V2P_VALIDATE_ALWAYS every walk reads them again.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] policy Validation policy
+ */
+void vmi_v2pcache_set_validation(
+    vmi_instance_t vmi,
+    v2p_validation_t policy);
+
 /**
  * Removes all entries from LibVMI's internal kernel symbol to virtual address
  * cache.  This is generally only useful if you believe that an entry in
@@ -1504,6 +2261,53 @@ void vmi_pidcache_add(
     vmi_pid_t pid,
     addr_t dtb);
 
+/**
+ * Sets the byte budget of LibVMI's internal page cache.  If the cache
+ * currently holds more than \a bytes, the least recently used pages are
+ * evicted right away.  The most recently read page is always kept (one
+ * per cache shard with VMI_INIT_THREADSAFE), so a budget smaller than one
+ * page effectively caches a single page.  The budget can also be set with
+ * the "page_cache_size" configuration key.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] bytes New budget in bytes
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_pagecache_set_limit(
+    vmi_instance_t vmi,
+    uint64_t bytes);
+
+/**
+ * Gets the byte budget of LibVMI's internal page cache.
+ *
+ * @param[in] vmi LibVMI instance
+ * @return Budget in bytes, 0 without an instance
+ */
+uint64_t vmi_pagecache_get_limit(
+    vmi_instance_t vmi);
+
+/**
+ * Retrieves the usage counters of LibVMI's internal page cache.  The
+ * counters accumulate from the time the instance was initialized or
+ * the last call to vmi_pagecache_reset_stats.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[out] stats Filled with the current counters
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_pagecache_get_stats(
+    vmi_instance_t vmi,
+    vmi_cache_stats_t *stats);
+
+/**
+ * Resets the hit, miss, refresh and eviction counters of LibVMI's
+ * internal page cache.  Cached pages are not affected.
+ *
+ * @param[in] vmi LibVMI instance
+ */
+void vmi_pagecache_reset_stats(
+    vmi_instance_t vmi);
+
 /*---------------------------------------------------------
  * Event management
  */
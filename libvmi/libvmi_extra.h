@@ -54,6 +54,19 @@ GSList* vmi_get_va_pages(
     vmi_instance_t vmi,
     addr_t dtb);
 
+/**
+ * Retrieve the pages mapped into the address space of a process
+ * as one array.
+ * @param[in] vmi Instance
+ * @param[in] dtb The directory table base of the process
+ *
+ * @return GArray of va_page_t structures, empty on error.
+ * The caller is responsible for freeing the array with g_array_free.
+ */
+GArray* vmi_get_va_pages_array(
+    vmi_instance_t vmi,
+    addr_t dtb);
+
 #pragma GCC visibility pop
 
 #ifdef __cplusplus
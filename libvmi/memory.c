@@ -353,17 +353,38 @@ void buffalo_nopae (vmi_instance_t instance, uint32_t entry, int pde)
     }
 }
 
+/*
+ * Cached upper level entries are not read again on a hit, so the walkers
+ * only use them when cached translations are trusted anyway (see
+ * vmi_v2pcache_set_validation) and never for vmi_pagetable_lookup_extended,
+ * which reports the entries it walked.
+ */
+static inline int
+ps_cache_usable (vmi_instance_t vmi, int cached)
+{
+    return cached && VMI_V2P_VALIDATE_ALWAYS != vmi->v2p_validation;
+}
+
 /* translation */
 addr_t v2p_nopae (vmi_instance_t vmi,
     addr_t dtb,
     addr_t vaddr,
-    page_info_t *info)
+    page_info_t *info,
+    int cached)
 {
     addr_t pgd = 0, pte = 0;
+    int use_ps_cache = ps_cache_usable(vmi, cached);
+    int hit = 0;
 
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: lookup vaddr = 0x%.16"PRIx64"\n", vaddr);
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: dtb = 0x%.16"PRIx64"\n", dtb);
-    pgd = get_pgd_nopae(vmi, vaddr, dtb, &info->l2_a);
+    if (use_ps_cache && VMI_SUCCESS == ps_cache_get(vmi, dtb, vaddr, 22, info)) {
+        pgd = info->l2_v;
+        hit = 1;
+    }
+    else {
+        pgd = get_pgd_nopae(vmi, vaddr, dtb, &info->l2_a);
+    }
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pgd = 0x%.8"PRIx32"\n", pgd);
 
     if (entry_present(vmi->os_type, pgd)) {
@@ -374,6 +395,9 @@ addr_t v2p_nopae (vmi_instance_t vmi,
             dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 4MB page 0x%"PRIx32"\n", pgd);
         }
         else {
+            if (use_ps_cache && !hit) {
+                ps_cache_set(vmi, dtb, vaddr, 22, info);
+            }
             pte = get_pte_nopae(vmi, vaddr, pgd, &info->l1_a);
             dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pte = 0x%.8"PRIx32"\n", pte);
             if (entry_present(vmi->os_type, pte)) {
@@ -396,12 +420,25 @@ addr_t v2p_nopae (vmi_instance_t vmi,
 addr_t v2p_pae (vmi_instance_t vmi,
     addr_t dtb,
     addr_t vaddr,
-    page_info_t *info)
+    page_info_t *info,
+    int cached)
 {
     uint64_t pdpe, pgd, pte;
+    int use_ps_cache = ps_cache_usable(vmi, cached);
 
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: lookup vaddr = 0x%.16"PRIx64"\n", vaddr);
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: dtb = 0x%.16"PRIx64"\n", dtb);
+
+    /* resume at the deepest upper level entry we have cached */
+    if (use_ps_cache && VMI_SUCCESS == ps_cache_get(vmi, dtb, vaddr, 21, info)) {
+        pgd = info->l2_v;
+        goto walk_pt;
+    }
+    if (use_ps_cache && VMI_SUCCESS == ps_cache_get(vmi, dtb, vaddr, 30, info)) {
+        pdpe = info->l3_v;
+        goto walk_pd;
+    }
+
     pdpe = get_pdpi(vmi, vaddr, dtb, &info->l3_a);
 
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pdpe = 0x%.16"PRIx64"\n", pdpe);
@@ -409,26 +446,35 @@ addr_t v2p_pae (vmi_instance_t vmi,
         goto done;
     }
     info->l3_v = pdpe;
+    if (use_ps_cache) {
+        ps_cache_set(vmi, dtb, vaddr, 30, info);
+    }
 
+walk_pd:
     pgd = get_pgd_pae(vmi, vaddr, pdpe, &info->l2_a);
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pgd = 0x%.16"PRIx64"\n", pgd);
 
-    if (entry_present(vmi->os_type, pgd)) {
-        info->l2_v = pgd;
-        if (page_size_flag(pgd)) {
-            info->paddr = get_large_paddr(vmi, vaddr, pgd);
-            info->size = VMI_PS_2MB;
-            dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 2MB page\n");
-        }
-        else {
-            pte = get_pte_pae(vmi, vaddr, pgd, &info->l1_a);
-            dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pte = 0x%.16"PRIx64"\n", pte);
-            if (entry_present(vmi->os_type, pte)) {
-                info->l1_v = pte;
-                info->size = VMI_PS_4KB;
-                info->paddr = get_paddr_pae(vaddr, pte);
-            }
-        }
+    if (!entry_present(vmi->os_type, pgd)) {
+        goto done;
+    }
+    info->l2_v = pgd;
+    if (page_size_flag(pgd)) {
+        info->paddr = get_large_paddr(vmi, vaddr, pgd);
+        info->size = VMI_PS_2MB;
+        dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 2MB page\n");
+        goto done;
+    }
+    if (use_ps_cache) {
+        ps_cache_set(vmi, dtb, vaddr, 21, info);
+    }
+
+walk_pt:
+    pte = get_pte_pae(vmi, vaddr, pgd, &info->l1_a);
+    dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pte = 0x%.16"PRIx64"\n", pte);
+    if (entry_present(vmi->os_type, pte)) {
+        info->l1_v = pte;
+        info->size = VMI_PS_4KB;
+        info->paddr = get_paddr_pae(vaddr, pte);
     }
 
 done:
@@ -439,9 +485,11 @@ done:
 addr_t v2p_ia32e (vmi_instance_t vmi,
     addr_t dtb,
     addr_t vaddr,
-    page_info_t *info)
+    page_info_t *info,
+    int cached)
 {
     uint64_t pml4e = 0, pdpte = 0, pde = 0, pte = 0;
+    int use_ps_cache = ps_cache_usable(vmi, cached);
 
     // are we in compatibility mode OR 64-bit mode ???
 
@@ -451,267 +499,336 @@ addr_t v2p_ia32e (vmi_instance_t vmi,
 
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: lookup vaddr = 0x%.16"PRIx64"\n", vaddr);
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: dtb = 0x%.16"PRIx64"\n", dtb);
+
+    /* resume at the deepest upper level entry we have cached */
+    if (use_ps_cache && VMI_SUCCESS == ps_cache_get(vmi, dtb, vaddr, 21, info)) {
+        pde = info->l2_v;
+        goto walk_pt;
+    }
+    if (use_ps_cache && VMI_SUCCESS == ps_cache_get(vmi, dtb, vaddr, 30, info)) {
+        pdpte = info->l3_v;
+        goto walk_pd;
+    }
+    if (use_ps_cache && VMI_SUCCESS == ps_cache_get(vmi, dtb, vaddr, 39, info)) {
+        pml4e = info->l4_v;
+        goto walk_pdpt;
+    }
+
     pml4e = get_pml4e(vmi, vaddr, dtb, &info->l4_a);
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pml4e = 0x%.16"PRIx64"\n", pml4e);
 
-    if (entry_present(vmi->os_type, pml4e)) {
-        info->l4_v = pml4e;
+    if (!entry_present(vmi->os_type, pml4e)) {
+        goto done;
+    }
+    info->l4_v = pml4e;
+    if (use_ps_cache) {
+        ps_cache_set(vmi, dtb, vaddr, 39, info);
+    }
 
-        pdpte = get_pdpte_ia32e(vmi, vaddr, pml4e, &info->l3_a);
-        dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pdpte = 0x%.16"PRIx64"\n", pdpte);
+walk_pdpt:
+    pdpte = get_pdpte_ia32e(vmi, vaddr, pml4e, &info->l3_a);
+    dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pdpte = 0x%.16"PRIx64"\n", pdpte);
 
-        if (entry_present(vmi->os_type, pdpte)) {
-            info->l3_v = pdpte;
-            if (page_size_flag(pdpte)) { // pdpte maps a 1GB page
-                info->paddr = get_gigpage_ia32e(vaddr, pdpte);
-                info->size = VMI_PS_1GB;
-                dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 1GB page\n");
-            }
-            else {
-                pde = get_pde_ia32e(vmi, vaddr, pdpte, &info->l2_a);
-                dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pde = 0x%.16"PRIx64"\n", pde);
-            }
+    if (!entry_present(vmi->os_type, pdpte)) {
+        goto done;
+    }
+    info->l3_v = pdpte;
+    if (page_size_flag(pdpte)) { // pdpte maps a 1GB page
+        info->paddr = get_gigpage_ia32e(vaddr, pdpte);
+        info->size = VMI_PS_1GB;
+        dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 1GB page\n");
+        goto done;
+    }
+    if (use_ps_cache) {
+        ps_cache_set(vmi, dtb, vaddr, 30, info);
+    }
 
-            if (entry_present(vmi->os_type, pde)) {
-                info->l2_v = pde;
-                if (page_size_flag(pde)) { // pde maps a 2MB page
-                    info->paddr = get_2megpage_ia32e(vaddr, pde);
-                    info->size = VMI_PS_2MB;
-                    dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 2MB page\n");
-                }
-                else {
-                    pte = get_pte_ia32e(vmi, vaddr, pde, &info->l1_a);
-                    dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pte = 0x%.16"PRIx64"\n", pte);
-                }
+walk_pd:
+    pde = get_pde_ia32e(vmi, vaddr, pdpte, &info->l2_a);
+    dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pde = 0x%.16"PRIx64"\n", pde);
 
-                if (entry_present(vmi->os_type, pte)) {
-                    info->l1_v = pte;
-                    info->size = VMI_PS_4KB;
-                    info->paddr = get_paddr_ia32e(vaddr, pte);
-                }
-            }
-        }
+    if (!entry_present(vmi->os_type, pde)) {
+        goto done;
+    }
+    info->l2_v = pde;
+    if (page_size_flag(pde)) { // pde maps a 2MB page
+        info->paddr = get_2megpage_ia32e(vaddr, pde);
+        info->size = VMI_PS_2MB;
+        dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 2MB page\n");
+        goto done;
+    }
+    if (use_ps_cache) {
+        ps_cache_set(vmi, dtb, vaddr, 21, info);
+    }
+
+walk_pt:
+    pte = get_pte_ia32e(vmi, vaddr, pde, &info->l1_a);
+    dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pte = 0x%.16"PRIx64"\n", pte);
+
+    if (entry_present(vmi->os_type, pte)) {
+        info->l1_v = pte;
+        info->size = VMI_PS_4KB;
+        info->paddr = get_paddr_ia32e(vaddr, pte);
     }
 
+done:
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: paddr = 0x%.16"PRIx64"\n", info->paddr);
     return info->paddr;
 }
 
-GSList* get_va_pages_nopae(vmi_instance_t vmi, addr_t dtb) {
+/*
+ * Page table enumeration.  Every table is fetched with a single page
+ * read and its entries are then scanned in place, instead of issuing a
+ * separate physical read (and cache lookup) per entry.
+ */
 
-    #define PTRS_PER_PTE 1024
-    #define PTRS_PER_PGD 1024
+#define PTRS_PER_PTE 1024
+#define PTRS_PER_PGD 1024
+#define PTRS_PER_PDPI 4
+#define PTRS_PER_PAE_PTE 512
+#define PTRS_PER_PAE_PGD 512
+#define PDES_AND_PTES_PER_PAGE 0x200 // 0x1000/0x8
 
-    addr_t pgd_curr = dtb;
-    uint8_t entry_size = 0x4;
+static status_t
+read_table_page (vmi_instance_t vmi, addr_t table, void *buf)
+{
+    if (VMI_PS_4KB != vmi_read_pa(vmi, table, buf, VMI_PS_4KB)) {
+        return VMI_FAILURE;
+    }
+    return VMI_SUCCESS;
+}
 
-    GSList *ret = NULL;
+static status_t
+foreach_va_page_nopae (vmi_instance_t vmi, addr_t dtb,
+    va_page_callback_t callback, void *data)
+{
+    uint32_t pgd[PTRS_PER_PGD];
+    uint32_t pte[PTRS_PER_PTE];
+    uint32_t j, k;
 
-    uint32_t j;
-    for(j=0;j<PTRS_PER_PGD;j++,pgd_curr+=entry_size) {
-        uint64_t soffset = j * PTRS_PER_PGD * PTRS_PER_PTE * entry_size;
+    if (VMI_FAILURE == read_table_page(vmi, pdba_base_nopae(dtb), pgd)) {
+        return VMI_FAILURE;
+    }
+
+    for (j = 0; j < PTRS_PER_PGD; j++) {
+        addr_t soffset = (addr_t) j * VMI_PS_4MB;
 
-        uint32_t entry;
-        if(VMI_FAILURE == vmi_read_32_pa(vmi, pgd_curr, &entry)) {
+        if (!entry_present(vmi->os_type, pgd[j])) {
             continue;
         }
 
-        if(entry_present(vmi->os_type, entry)) {
-
-            if(page_size_flag(entry)) {
-                struct va_page *p = g_malloc0(sizeof(struct va_page));
-                p->va = soffset;
-                p->size = VMI_PS_4MB;
-                ret = g_slist_append(ret, p);
-                continue;
+        if (page_size_flag(pgd[j])) {
+            if (VMI_FAILURE == callback(vmi, soffset, VMI_PS_4MB, data)) {
+                return VMI_FAILURE;
             }
+            continue;
+        }
 
-            uint32_t pte_curr = entry & ~(0xFFF);
-
-            uint32_t k;
-            for(k=0;k<PTRS_PER_PTE;k++,pte_curr+=entry_size){
-                uint32_t pte_entry;
-                if(VMI_FAILURE == vmi_read_32_pa(vmi, pte_curr, &pte_entry)) {
-                    continue;
-                }
+        if (VMI_FAILURE == read_table_page(vmi, ptba_base_nopae(pgd[j]), pte)) {
+            continue;
+        }
 
-                if(entry_present(vmi->os_type, pte_entry)) {
-                    struct va_page *p = g_malloc0(sizeof(struct va_page));
-                    p->va = soffset + k * VMI_PS_4KB;
-                    p->size = VMI_PS_4KB;
-                    ret = g_slist_append(ret, p);
-                }
+        for (k = 0; k < PTRS_PER_PTE; k++) {
+            if (entry_present(vmi->os_type, pte[k])
+                && VMI_FAILURE == callback(vmi, soffset + k * VMI_PS_4KB, VMI_PS_4KB, data)) {
+                return VMI_FAILURE;
             }
         }
     }
 
-    return ret;
+    return VMI_SUCCESS;
 }
 
-GSList* get_va_pages_pae(vmi_instance_t vmi, addr_t dtb) {
-
-    #define PTRS_PER_PDPI 4
-    #define PTRS_PER_PAE_PTE 512
-    #define PTRS_PER_PAE_PGD 512
-
-    uint32_t pdpi_base = get_pdptb(dtb);
-    uint8_t entry_size = 0x8;
-
-    GSList *ret = NULL;
-
-    uint32_t i;
-    for(i=0;i<PTRS_PER_PDPI;i++) {
-
-        uint32_t start = i * PTRS_PER_PAE_PGD * PTRS_PER_PAE_PGD * PTRS_PER_PAE_PTE * entry_size;
-        uint32_t pdpi_entry = pdpi_base + i * entry_size;
+static status_t
+foreach_va_page_pae (vmi_instance_t vmi, addr_t dtb,
+    va_page_callback_t callback, void *data)
+{
+    uint64_t pdpi[PTRS_PER_PDPI];
+    uint64_t pgd[PTRS_PER_PAE_PGD];
+    uint64_t pte[PTRS_PER_PAE_PTE];
+    uint32_t i, j, k;
+
+    /* the PDPT is only 32 bytes and need not be page aligned */
+    if (sizeof(pdpi) != vmi_read_pa(vmi, get_pdptb(dtb), pdpi, sizeof(pdpi))) {
+        return VMI_FAILURE;
+    }
 
-        uint64_t pdpe;
-        vmi_read_64_pa(vmi, pdpi_entry, &pdpe);
+    for (i = 0; i < PTRS_PER_PDPI; i++) {
+        addr_t start = (addr_t) i << 30;
 
-        if(!entry_present(vmi->os_type, pdpe)) {
+        if (!entry_present(vmi->os_type, pdpi[i])
+            || VMI_FAILURE == read_table_page(vmi, pdba_base_pae(pdpi[i]), pgd)) {
             continue;
         }
 
-        uint64_t pgd_curr = pdba_base_pae(pdpe);
-
-        uint32_t j;
-        for(j=0;j<PTRS_PER_PAE_PGD;j++,pgd_curr+=entry_size) {
-            uint64_t soffset = start + (j * PTRS_PER_PAE_PGD * PTRS_PER_PAE_PTE * entry_size);
+        for (j = 0; j < PTRS_PER_PAE_PGD; j++) {
+            addr_t soffset = start + (addr_t) j * VMI_PS_2MB;
 
-            uint64_t entry;
-            if(VMI_FAILURE == vmi_read_64_pa(vmi, pgd_curr, &entry)) {
+            if (!entry_present(vmi->os_type, pgd[j])) {
                 continue;
             }
 
-            if(entry_present(vmi->os_type, entry)) {
-
-                if(page_size_flag(entry)) {
-                    struct va_page *p = g_malloc0(sizeof(struct va_page));
-                    p->va = soffset;
-                    p->size = VMI_PS_2MB;
-                    ret = g_slist_append(ret, p);
-                    continue;
+            if (page_size_flag(pgd[j])) {
+                if (VMI_FAILURE == callback(vmi, soffset, VMI_PS_2MB, data)) {
+                    return VMI_FAILURE;
                 }
+                continue;
+            }
 
-                uint64_t pte_curr = entry & ~(0xFFF);
-                uint32_t k;
-                for(k=0;k<PTRS_PER_PAE_PTE;k++,pte_curr+=entry_size){
-                    uint64_t pte_entry;
-                    if(VMI_FAILURE == vmi_read_64_pa(vmi, pte_curr, &pte_entry)) {
-                        continue;
-                    }
+            if (VMI_FAILURE == read_table_page(vmi, ptba_base_pae(pgd[j]), pte)) {
+                continue;
+            }
 
-                    if(entry_present(vmi->os_type, pte_entry)) {
-                        struct va_page *p = g_malloc0(sizeof(struct va_page));
-                        p->va = soffset + k * VMI_PS_4KB;
-                        p->size = VMI_PS_4KB;
-                        ret = g_slist_append(ret, p);
-                    }
+            for (k = 0; k < PTRS_PER_PAE_PTE; k++) {
+                if (entry_present(vmi->os_type, pte[k])
+                    && VMI_FAILURE == callback(vmi, soffset + k * VMI_PS_4KB, VMI_PS_4KB, data)) {
+                    return VMI_FAILURE;
                 }
             }
         }
     }
 
-    return ret;
+    return VMI_SUCCESS;
 }
 
-GSList* get_va_pages_ia32e(vmi_instance_t vmi, addr_t dtb) {
-
-    GSList *ret = NULL;
-    uint8_t entry_size = 0x8;
-
-    #define PDES_AND_PTES_PER_PAGE 0x200 // 0x1000/0x8
-
-    uint64_t pml4e;
-    for(pml4e=0;pml4e<PDES_AND_PTES_PER_PAGE;pml4e++) {
+static status_t
+foreach_va_page_ia32e (vmi_instance_t vmi, addr_t dtb,
+    va_page_callback_t callback, void *data)
+{
+    uint64_t pml4[PDES_AND_PTES_PER_PAGE];
+    uint64_t pdpt[PDES_AND_PTES_PER_PAGE];
+    uint64_t pgd[PDES_AND_PTES_PER_PAGE];
+    uint64_t pte[PDES_AND_PTES_PER_PAGE];
+    uint64_t i, j, k, l;
+
+    if (VMI_FAILURE == read_table_page(vmi, get_bits_51to12(dtb), pml4)) {
+        return VMI_FAILURE;
+    }
 
-        addr_t vaddr = pml4e << 39;
-        addr_t pml4e_a = 0;
-        uint64_t pml4e_value = get_pml4e(vmi, vaddr, dtb, &pml4e_a);
+    for (i = 0; i < PDES_AND_PTES_PER_PAGE; i++) {
 
-        if(!entry_present(vmi->os_type, pml4e_value)) {
+        if (!entry_present(vmi->os_type, pml4[i])
+            || VMI_FAILURE == read_table_page(vmi, get_bits_51to12(pml4[i]), pdpt)) {
             continue;
         }
 
-        uint64_t pdpte;
-        for(pdpte=0;pdpte<PDES_AND_PTES_PER_PAGE;pdpte++) {
-
-            vaddr = (pml4e << 39) | (pdpte << 30);
+        for (j = 0; j < PDES_AND_PTES_PER_PAGE; j++) {
+            addr_t vaddr = (i << 39) | (j << 30);
 
-            addr_t pdpte_a = 0;
-            uint64_t pdpte_value = get_pdpte_ia32e(vmi, vaddr, pml4e_value, &pdpte_a);
-            if(!entry_present(vmi->os_type, pdpte_value)) {
+            if (!entry_present(vmi->os_type, pdpt[j])) {
                 continue;
             }
 
-            if(page_size_flag(pdpte_value)) {
-                struct va_page *p = g_malloc0(sizeof(struct va_page));
-                p->va = vaddr;
-                p->size = VMI_PS_1GB;
-                ret = g_slist_append(ret, p);
+            if (page_size_flag(pdpt[j])) {
+                if (VMI_FAILURE == callback(vmi, vaddr, VMI_PS_1GB, data)) {
+                    return VMI_FAILURE;
+                }
                 continue;
             }
 
-            uint64_t pgd_curr = pdba_base_ia32e(pdpte_value);
-            uint64_t j;
-            for(j=0;j<PTRS_PER_PAE_PGD;j++,pgd_curr+=entry_size) {
+            if (VMI_FAILURE == read_table_page(vmi, pdba_base_ia32e(pdpt[j]), pgd)) {
+                continue;
+            }
 
-                uint64_t soffset = vaddr + (j * PTRS_PER_PAE_PGD * PTRS_PER_PAE_PTE * entry_size);
+            for (k = 0; k < PDES_AND_PTES_PER_PAGE; k++) {
+                addr_t soffset = vaddr + k * VMI_PS_2MB;
 
-                uint64_t entry;
-                if(VMI_FAILURE == vmi_read_64_pa(vmi, pgd_curr, &entry)) {
+                if (!entry_present(vmi->os_type, pgd[k])) {
                     continue;
                 }
 
-                if(entry_present(vmi->os_type, entry)) {
-
-                    if(page_size_flag(entry)) {
-                        struct va_page *p = g_malloc0(sizeof(struct va_page));
-                        p->va = soffset;
-                        p->size = VMI_PS_2MB;
-                        ret = g_slist_append(ret, p);
-                        continue;
+                if (page_size_flag(pgd[k])) {
+                    if (VMI_FAILURE == callback(vmi, soffset, VMI_PS_2MB, data)) {
+                        return VMI_FAILURE;
                     }
+                    continue;
+                }
 
-                    uint64_t pte_curr = pte_pfn_ia32e(entry);
-                    uint64_t k;
-                    for(k=0;k<PTRS_PER_PAE_PTE;k++,pte_curr+=entry_size) {
-                        uint64_t pte_entry;
-                        if(VMI_FAILURE == vmi_read_64_pa(vmi, pte_curr, &pte_entry)) {
-                            continue;
-                        }
-
-                        if(entry_present(vmi->os_type, pte_entry)) {
-                            struct va_page *p = g_malloc0(sizeof(struct va_page));
-                            p->va = soffset + k * VMI_PS_4KB;
-                            p->size = VMI_PS_4KB;
-                            ret = g_slist_append(ret, p);
-                            continue;
-                        }
+                if (VMI_FAILURE == read_table_page(vmi, pte_pfn_ia32e(pgd[k]), pte)) {
+                    continue;
+                }
+
+                for (l = 0; l < PDES_AND_PTES_PER_PAGE; l++) {
+                    if (entry_present(vmi->os_type, pte[l])
+                        && VMI_FAILURE == callback(vmi, soffset + l * VMI_PS_4KB, VMI_PS_4KB, data)) {
+                        return VMI_FAILURE;
                     }
                 }
             }
         }
     }
 
+    return VMI_SUCCESS;
+}
+
+status_t vmi_foreach_va_page (vmi_instance_t vmi, addr_t dtb,
+    va_page_callback_t callback, void *data)
+{
+    if (vmi->page_mode == VMI_PM_LEGACY) {
+        return foreach_va_page_nopae(vmi, dtb, callback, data);
+    } else if (vmi->page_mode == VMI_PM_PAE) {
+        return foreach_va_page_pae(vmi, dtb, callback, data);
+    } else if (vmi->page_mode == VMI_PM_IA32E) {
+        return foreach_va_page_ia32e(vmi, dtb, callback, data);
+    }
+
+    return VMI_FAILURE;
+}
+
+static status_t
+va_page_to_array (vmi_instance_t vmi, addr_t va, page_size_t size, void *data)
+{
+    va_page_t page = { .va = va, .size = size };
+
+    g_array_append_val((GArray *) data, page);
+    return VMI_SUCCESS;
+}
+
+GArray* vmi_get_va_pages_array(vmi_instance_t vmi, addr_t dtb) {
+
+    GArray *ret = g_array_new(FALSE, FALSE, sizeof(va_page_t));
+
+    vmi_foreach_va_page(vmi, dtb, va_page_to_array, ret);
+
     return ret;
 }
 
 GSList* vmi_get_va_pages(vmi_instance_t vmi, addr_t dtb) {
 
     GSList *ret = NULL;
+    GArray *pages = vmi_get_va_pages_array(vmi, dtb);
+    guint i;
 
-    if (vmi->page_mode == VMI_PM_LEGACY) {
-        ret = get_va_pages_nopae(vmi, dtb);
-    } else if (vmi->page_mode == VMI_PM_PAE) {
-        ret = get_va_pages_pae(vmi, dtb);
-    } else if (vmi->page_mode == VMI_PM_IA32E) {
-        ret = get_va_pages_ia32e(vmi, dtb);
+    /* prepend from the back so building the list stays linear */
+    for (i = pages->len; i > 0; i--) {
+        va_page_t *p = g_malloc(sizeof(va_page_t));
+
+        *p = g_array_index(pages, va_page_t, i - 1);
+        ret = g_slist_prepend(ret, p);
     }
+    g_array_free(pages, TRUE);
 
     return ret;
 }
 
+/* do the actual page walk in guest memory */
+static void
+pagetable_walk (vmi_instance_t vmi, addr_t dtb, addr_t vaddr, page_info_t *info)
+{
+    if (vmi->page_mode == VMI_PM_LEGACY) {
+        v2p_nopae(vmi, dtb, vaddr, info, 1);
+    }
+    else if (vmi->page_mode == VMI_PM_PAE) {
+        v2p_pae(vmi, dtb, vaddr, info, 1);
+    }
+    else if (vmi->page_mode == VMI_PM_IA32E) {
+        v2p_ia32e(vmi, dtb, vaddr, info, 1);
+    }
+    else {
+        errprint("Invalid paging mode during vmi_pagetable_lookup\n");
+    }
+}
+
 addr_t vmi_pagetable_lookup (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
 {
 
@@ -723,7 +840,8 @@ addr_t vmi_pagetable_lookup (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
         /* verify that address is still valid */
         uint8_t value = 0;
 
-        if (VMI_SUCCESS == vmi_read_8_pa(vmi, info.paddr, &value)) {
+        if (VMI_V2P_VALIDATE_ALWAYS != vmi->v2p_validation
+            || VMI_SUCCESS == vmi_read_8_pa(vmi, info.paddr, &value)) {
             return info.paddr;
         }
         else {
@@ -731,27 +849,77 @@ addr_t vmi_pagetable_lookup (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
         }
     }
 
-    /* do the actual page walk in guest memory */
-    if (vmi->page_mode == VMI_PM_LEGACY) {
-        v2p_nopae(vmi, dtb, vaddr, &info);
-    }
-    else if (vmi->page_mode == VMI_PM_PAE) {
-        v2p_pae(vmi, dtb, vaddr, &info);
-    }
-    else if (vmi->page_mode == VMI_PM_IA32E) {
-        v2p_ia32e(vmi, dtb, vaddr, &info);
+    pagetable_walk(vmi, dtb, vaddr, &info);
+
+    /* add this to the cache */
+    if (info.paddr) {
+        v2p_cache_set(vmi, vaddr, dtb, info.paddr, info.size);
     }
-    else {
-        errprint("Invalid paging mode during vmi_pagetable_lookup\n");
+    return info.paddr;
+}
+
+/* like vmi_pagetable_lookup, but also tell the size of the backing page */
+static addr_t
+pagetable_lookup_page (vmi_instance_t vmi, addr_t dtb, addr_t vaddr,
+    page_size_t *size)
+{
+    page_info_t info = {0};
+
+    if (VMI_SUCCESS == v2p_cache_get_page(vmi, vaddr, dtb, &info.paddr, size)) {
+        uint8_t value = 0;
+
+        if (VMI_V2P_VALIDATE_ALWAYS != vmi->v2p_validation
+            || VMI_SUCCESS == vmi_read_8_pa(vmi, info.paddr, &value)) {
+            return info.paddr;
+        }
+        v2p_cache_del(vmi, vaddr, dtb);
     }
 
-    /* add this to the cache */
+    pagetable_walk(vmi, dtb, vaddr, &info);
     if (info.paddr) {
-        v2p_cache_set(vmi, vaddr, dtb, info.paddr);
+        v2p_cache_set(vmi, vaddr, dtb, info.paddr, info.size);
+        *size = info.size;
     }
     return info.paddr;
 }
 
+size_t vmi_translate_range (vmi_instance_t vmi, addr_t dtb, addr_t vaddr,
+    size_t len, vmi_extent_t *extents, size_t n)
+{
+    size_t count = 0;
+
+    while (len > 0) {
+        page_size_t size = VMI_PS_4KB;
+        addr_t paddr = pagetable_lookup_page(vmi, dtb, vaddr, &size);
+        size_t chunk = size - (vaddr & ((addr_t) size - 1));
+
+        if (!paddr) {
+            break;
+        }
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        if (count && extents[count - 1].pa + extents[count - 1].len == paddr) {
+            extents[count - 1].len += chunk;
+        }
+        else if (count < n) {
+            extents[count].va = vaddr;
+            extents[count].pa = paddr;
+            extents[count].len = chunk;
+            count++;
+        }
+        else {
+            break;
+        }
+
+        vaddr += chunk;
+        len -= chunk;
+    }
+
+    return count;
+}
+
 status_t vmi_pagetable_lookup_extended(
     vmi_instance_t vmi,
     addr_t dtb,
@@ -767,13 +935,13 @@ status_t vmi_pagetable_lookup_extended(
     info->dtb = dtb;
 
     if (vmi->page_mode == VMI_PM_LEGACY) {
-        v2p_nopae(vmi, dtb, vaddr, info);
+        v2p_nopae(vmi, dtb, vaddr, info, 0);
     }
     else if (vmi->page_mode == VMI_PM_PAE) {
-        v2p_pae(vmi, dtb, vaddr, info);
+        v2p_pae(vmi, dtb, vaddr, info, 0);
     }
     else if (vmi->page_mode == VMI_PM_IA32E) {
-        v2p_ia32e(vmi, dtb, vaddr, info);
+        v2p_ia32e(vmi, dtb, vaddr, info, 0);
     }
     else {
         errprint("Invalid paging mode during vmi_pagetable_lookup_extended\n");
@@ -786,6 +954,159 @@ status_t vmi_pagetable_lookup_extended(
     return ret;
 }
 
+/* batch translation works on a copy of the inputs sorted by address */
+struct v2p_batch_item {
+    addr_t va;
+    size_t index;
+};
+
+static int
+v2p_batch_compare (const void *a, const void *b)
+{
+    addr_t va_a = ((const struct v2p_batch_item *) a)->va;
+    addr_t va_b = ((const struct v2p_batch_item *) b)->va;
+
+    return (va_a > va_b) - (va_a < va_b);
+}
+
+status_t vmi_pagetable_lookup_batch (vmi_instance_t vmi, addr_t dtb,
+    const addr_t *in, addr_t *out, size_t n)
+{
+    addr_t (*walk) (vmi_instance_t, addr_t, addr_t, page_info_t *, int) = NULL;
+    uint32_t table[VMI_PS_4KB / sizeof(uint32_t)];
+    struct v2p_batch_item *items = NULL;
+    addr_t *vas = NULL;
+    addr_t *pas = NULL;
+    uint32_t region_shift = 21;
+    status_t ret = VMI_SUCCESS;
+    size_t i, j;
+
+    if (vmi->page_mode == VMI_PM_LEGACY) {
+        walk = v2p_nopae;
+        region_shift = 22;
+    }
+    else if (vmi->page_mode == VMI_PM_PAE) {
+        walk = v2p_pae;
+    }
+    else if (vmi->page_mode == VMI_PM_IA32E) {
+        walk = v2p_ia32e;
+    }
+    else {
+        errprint("Invalid paging mode during vmi_pagetable_lookup_batch\n");
+        memset(out, 0, n * sizeof(addr_t));
+        return VMI_FAILURE;
+    }
+
+    items = safe_malloc(n * sizeof(struct v2p_batch_item));
+    vas = safe_malloc(n * sizeof(addr_t));
+    pas = safe_malloc(n * sizeof(addr_t));
+    for (i = 0; i < n; ++i) {
+        items[i].va = in[i];
+        items[i].index = i;
+    }
+    /* scanners usually hand in ascending addresses, skip the sort then */
+    for (i = 1; i < n; ++i) {
+        if (items[i - 1].va > items[i].va) {
+            qsort(items, n, sizeof(struct v2p_batch_item), v2p_batch_compare);
+            break;
+        }
+    }
+
+    /*
+     * Addresses under the same page directory entry share one walk:
+     * the first one is walked normally, then its page table is read
+     * as a whole and the rest are resolved from that copy.
+     */
+    for (i = 0; i < n; i = j) {
+        addr_t region = items[i].va >> region_shift;
+        page_info_t info = {0};
+        page_size_t size = VMI_PS_4KB;
+        int have_table = 0;
+        size_t count = 0;
+
+        walk(vmi, dtb, items[i].va, &info, 1);
+        if (info.l1_a
+            && VMI_PS_4KB == vmi_read_pa(vmi, info.l1_a & ~((addr_t) VMI_PS_4KB - 1),
+                                         table, VMI_PS_4KB)) {
+            have_table = 1;
+        }
+        else if (info.paddr && VMI_PS_4KB != info.size) {
+            size = info.size;
+        }
+
+        for (j = i; j < n && (items[j].va >> region_shift) == region; ++j) {
+            addr_t va = items[j].va;
+            addr_t pa = 0;
+
+            if (have_table) {
+                uint64_t pte = 0;
+
+                if (vmi->page_mode == VMI_PM_LEGACY) {
+                    pte = table[(va >> 12) & 0x3FF];
+                    if (entry_present(vmi->os_type, pte)) {
+                        pa = get_paddr_nopae(va, pte);
+                    }
+                }
+                else {
+                    pte = ((uint64_t *) table)[(va >> 12) & 0x1FF];
+                    if (entry_present(vmi->os_type, pte)) {
+                        pa = (vmi->page_mode == VMI_PM_PAE) ?
+                            get_paddr_pae(va, pte) : get_paddr_ia32e(va, pte);
+                    }
+                }
+            }
+            else if (VMI_PS_4KB != size) {
+                /* a large page covers the whole region */
+                pa = (info.paddr & ~((addr_t) size - 1)) | (va & (size - 1));
+            }
+            else if (info.l1_a) {
+                /* the page table could not be read in one go */
+                pa = vmi_pagetable_lookup(vmi, dtb, va);
+            }
+
+            out[items[j].index] = pa;
+            if (pa) {
+                vas[count] = va;
+                pas[count] = pa;
+                count++;
+            }
+            else {
+                ret = VMI_FAILURE;
+            }
+        }
+        v2p_cache_set_many(vmi, dtb, vas, pas, count, size);
+    }
+
+    free(pas);
+    free(vas);
+    free(items);
+    return ret;
+}
+
+status_t vmi_translate_v2p_batch (vmi_instance_t vmi, vmi_pid_t pid,
+    const addr_t *in, addr_t *out, size_t n)
+{
+    reg_t dtb = 0;
+
+    /* resolve the address space once for the whole batch */
+    if (pid) {
+        dtb = vmi_pid_to_dtb(vmi, pid);
+    }
+    else if (vmi->kpgd) {
+        dtb = vmi->kpgd;
+    }
+    else {
+        driver_get_vcpureg(vmi, &dtb, CR3, 0);
+    }
+
+    if (!dtb) {
+        dbprint(VMI_DEBUG_PTLOOKUP, "--early bail on v2p batch because dtb is zero\n");
+        memset(out, 0, n * sizeof(addr_t));
+        return VMI_FAILURE;
+    }
+    return vmi_pagetable_lookup_batch(vmi, dtb, in, out, n);
+}
+
 /* expose virtual to physical mapping for kernel space via api call */
 addr_t vmi_translate_kv2p (vmi_instance_t vmi, addr_t virt_address)
 {
@@ -942,6 +1263,15 @@ vmi_read_page (vmi_instance_t vmi, addr_t frame_num)
     if (!frame_num) {
         return NULL ;
     }
+    else if (vmi->flat_memory) {
+        /* flat backends need no lookup, the frame is an offset */
+        addr_t paddr = frame_num << vmi->page_shift;
+
+        if (paddr + vmi->page_size > vmi->flat_memory_size) {
+            return NULL;
+        }
+        return vmi->flat_memory + paddr;
+    }
     else {
         return driver_read_page(vmi, frame_num);
     }
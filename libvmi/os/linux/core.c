@@ -24,6 +24,7 @@
  * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+
 #include "libvmi.h"
 #include "private.h"
 #include "driver/interface.h"
@@ -51,6 +52,14 @@ status_t linux_init(vmi_instance_t vmi) {
     linux_instance_t linux_instance = vmi->os_data;
 
     g_hash_table_foreach(vmi->config, (GHFunc)linux_read_config_ghashtable_entries, vmi);
+    pthread_mutex_init(&linux_instance->sysmap_lock, NULL);
+
+    if (VMI_SUCCESS == linux_profile_restore(vmi)) {
+        goto found_kernel;
+    }
+
+    /* every symbol lookup below is served from this table */
+    linux_system_map_load(vmi);
 
     addr_t boundary = 0, phys_start = 0, virt_start = 0;
 
@@ -112,6 +121,10 @@ status_t linux_init(vmi_instance_t vmi) {
         goto _exit;
     }
 
+    linux_profile_save(vmi);
+
+    found_kernel:
+
     os_interface = safe_malloc(sizeof(struct os_interface));
     bzero(os_interface, sizeof(struct os_interface));
     os_interface->os_get_offset = linux_get_offset;
@@ -119,7 +132,7 @@ status_t linux_init(vmi_instance_t vmi) {
     os_interface->os_pgd_to_pid = linux_pgd_to_pid;
     os_interface->os_ksym2v = linux_system_map_symbol_to_address;
     os_interface->os_usym2rva = NULL;
-    os_interface->os_rva2sym = NULL;
+    os_interface->os_rva2sym = linux_system_map_address_to_symbol;
     os_interface->os_teardown = linux_teardown;
 
     vmi->os_interface = os_interface;
@@ -127,7 +140,11 @@ status_t linux_init(vmi_instance_t vmi) {
     return VMI_SUCCESS;
 
     _exit:
+    linux_system_map_free(linux_instance);
+    pthread_mutex_destroy(&linux_instance->sysmap_lock);
+    free(linux_instance->sysmap);
     free(vmi->os_data);
+    vmi->os_data = NULL;
     return VMI_FAILURE;
 }
 
@@ -170,6 +187,10 @@ void linux_read_config_ghashtable_entries(char* key, gpointer value,
         goto _done;
     }
 
+    if (strncmp(key, "profile_cache", CONFIG_STR_LENGTH) == 0) {
+        goto _done;
+    }
+
     if (strncmp(key, "name", CONFIG_STR_LENGTH) == 0) {
         goto _done;
     }
@@ -218,6 +239,8 @@ status_t linux_teardown(vmi_instance_t vmi) {
     if (linux_instance->sysmap) {
         free(linux_instance->sysmap);
     }
+    linux_system_map_free(linux_instance);
+    pthread_mutex_destroy(&linux_instance->sysmap_lock);
     free(vmi->os_data);
 
     vmi->os_data = NULL;
@@ -23,10 +23,17 @@
 #include "libvmi.h"
 #include "config/config_parser.h"
 #include <stdlib.h>
+#include <pthread.h>
 
 struct linux_instance {
     char *sysmap;           /**< system map file for domain's running kernel */
 
+    struct linux_symbols *symbols; /**< contents of sysmap, see symbols.c */
+
+    int sysmap_loaded; /**< nonzero once loading sysmap was attempted */
+
+    pthread_mutex_t sysmap_lock; /**< guards loading sysmap on first use */
+
     uint64_t kernel_boundary; /**< the VA where the kernel is mapped */
 
     uint64_t tasks_offset; /**< task_struct->tasks */
@@ -45,13 +52,24 @@ status_t linux_init(vmi_instance_t instance);
 
 uint64_t linux_get_offset(vmi_instance_t vmi, const char* offset_name);
 
+status_t linux_system_map_load(vmi_instance_t vmi);
+
+void linux_system_map_free(linux_instance_t linux_instance);
+
 status_t linux_system_map_symbol_to_address(vmi_instance_t instance,
         const char *symbol, addr_t *kernel_base_vaddr, addr_t *address);
 
+char* linux_system_map_address_to_symbol(vmi_instance_t vmi, addr_t rva,
+        addr_t base_vaddr, vmi_pid_t pid);
+
 addr_t linux_pid_to_pgd(vmi_instance_t vmi, vmi_pid_t pid);
 
 vmi_pid_t linux_pgd_to_pid(vmi_instance_t vmi, addr_t pgd);
 
 status_t linux_teardown(vmi_instance_t vmi);
 
+void linux_profile_save(vmi_instance_t vmi);
+
+status_t linux_profile_restore(vmi_instance_t vmi);
+
 #endif /* OS_LINUX_H_ */
@@ -25,22 +25,110 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/mman.h>
 #include "private.h"
 #include "os/linux/linux.h"
 
+/* task_struct members read while walking the task list */
+struct task_fields {
+    uint32_t pid;
+    addr_t mm;
+    addr_t active_mm;
+};
+
+struct task_search {
+    vmi_pid_t pid;
+    addr_t pgd;
+    int pgd_offset;
+    addr_t found;
+};
+
+static status_t
+task_match_pid(
+    vmi_instance_t vmi,
+    addr_t entry,
+    const void *fields,
+    void *data)
+{
+    const struct task_fields *task = fields;
+    struct task_search *search = data;
+
+    /* if pid matches, then we found what we want */
+    if ((vmi_pid_t) task->pid == search->pid) {
+        search->found = entry;
+        return VMI_FAILURE;
+    }
+    return VMI_SUCCESS;
+}
+
+static status_t
+task_match_pgd(
+    vmi_instance_t vmi,
+    addr_t entry,
+    const void *fields,
+    void *data)
+{
+    const struct task_fields *task = fields;
+    struct task_search *search = data;
+    addr_t task_pgd = 0;
+
+    /* task_struct->mm is NULL when Linux is executing on the behalf
+     * of a task, or if the task represents a kthread. In this context,
+     * task_struct->active_mm is non-NULL and we can use it as
+     * a fallback. task_struct->active_mm can be found very reliably
+     * at task_struct->mm + 1 pointer width
+     */
+    addr_t mm = task->mm ? task->mm : task->active_mm;
+
+    vmi_read_addr_va(vmi, mm + search->pgd_offset, 0, &task_pgd);
+
+    task_pgd = vmi_translate_kv2p(vmi, task_pgd);
+    if (task_pgd == search->pgd) {
+        search->found = entry;
+        return VMI_FAILURE;
+    }
+    return VMI_SUCCESS;
+}
+
+/* checks init_task, then walks the rest of the task list */
+static addr_t
+linux_search_tasks(
+    vmi_instance_t vmi,
+    const vmi_field_t *fields,
+    size_t n,
+    list_entry_callback_t match,
+    struct task_search *search)
+{
+    linux_instance_t os = vmi->os_data;
+    struct task_fields task;
+
+    /* vmi->init_task is the base of task_struct, the list runs
+     * through task_struct->tasks
+     */
+    memset(&task, 0, sizeof(task));
+    if (VMI_FAILURE == vmi_read_struct(vmi, vmi->init_task, 0, fields, n, &task)) {
+        return 0;
+    }
+    if (VMI_FAILURE == match(vmi, vmi->init_task, &task, search)) {
+        return search->found;
+    }
+
+    vmi_walk_list(vmi, 0, vmi->init_task + os->tasks_offset, 0, os->tasks_offset,
+                  fields, n, match, search);
+    return search->found;
+}
+
 /* finds the task struct for a given pid */
 static addr_t
 linux_get_taskstruct_addr_from_pid(
     vmi_instance_t vmi,
     vmi_pid_t pid)
 {
-    addr_t list_head = 0, next_process = 0;
-    vmi_pid_t task_pid = -1;
     linux_instance_t linux_instance = NULL;
-    int pid_offset = 0;
-    int tasks_offset = 0;
+    struct task_search search = { pid, 0, 0, 0 };
+    vmi_field_t field;
 
     if (vmi->os_data == NULL) {
         errprint("VMI_ERROR: No os_data initialized\n");
@@ -49,32 +137,10 @@ linux_get_taskstruct_addr_from_pid(
 
     linux_instance = vmi->os_data;
 
-    pid_offset = linux_instance->pid_offset;
-    tasks_offset = linux_instance->tasks_offset;
+    field = (vmi_field_t) { linux_instance->pid_offset, VMI_FIELD_32, 0,
+                            offsetof(struct task_fields, pid) };
 
-    /* First we need a pointer to the initial entry in the tasks list.
-     * Note that this is task_struct->tasks, not the base addr
-     *  of task_struct: task_struct base = $entry - tasks_offset.
-     */
-    next_process = vmi->init_task;
-    list_head = next_process;
-
-    do {
-        vmi_read_32_va(vmi, next_process + pid_offset, 0, &task_pid);
-
-        /* if pid matches, then we found what we want */
-        if (task_pid == pid) {
-            return next_process;
-        }
-
-        vmi_read_addr_va(vmi, next_process + tasks_offset, 0, &next_process);
-        next_process -= tasks_offset;
-
-        /* if we are back at the list head, we are done */
-    } while(list_head != next_process);
-
-error_exit:
-    return 0;
+    return linux_search_tasks(vmi, &field, 1, task_match_pid, &search);
 }
 
 static addr_t
@@ -82,14 +148,10 @@ linux_get_taskstruct_addr_from_pgd(
     vmi_instance_t vmi,
     addr_t pgd)
 {
-    addr_t list_head = 0, next_process = 0;
-    addr_t task_pgd = 0;
-    status_t rc = VMI_FAILURE;
     uint8_t width = 0;
-    int tasks_offset = 0;
-    int mm_offset = 0;
-    int pgd_offset = 0;
     linux_instance_t os = NULL;
+    struct task_search search = { 0, pgd, 0, 0 };
+    vmi_field_t fields[2];
 
     if (vmi->os_data == NULL) {
         errprint("VMI_ERROR: No os_data initialized\n");
@@ -97,50 +159,17 @@ linux_get_taskstruct_addr_from_pgd(
     }
 
     os = vmi->os_data;
+    search.pgd_offset = os->pgd_offset;
 
-    tasks_offset = os->tasks_offset;
-    mm_offset = os->mm_offset;
-    pgd_offset = os->pgd_offset;
-
-    /* First we need a pointer to the initial entry in the tasks list.
-     * Note that this is task_struct->tasks, not the base addr
-     *  of task_struct: task_struct base = $entry - tasks_offset.
-     */
-    next_process = vmi->init_task;
-    list_head = next_process;
-
-    /* May fail for some drivers, but handle gracefully below by
-     * testing width
-     */
-    rc = driver_get_address_width(vmi, &width);
-
-    do {
-        addr_t ptr = 0;
-        vmi_read_addr_va(vmi, next_process + mm_offset, 0, &ptr);
-
-        /* task_struct->mm is NULL when Linux is executing on the behalf
-         * of a task, or if the task represents a kthread. In this context,
-         * task_struct->active_mm is non-NULL and we can use it as
-         * a fallback. task_struct->active_mm can be found very reliably
-         * at task_struct->mm + 1 pointer width
-         */
-        if(!ptr && width)
-            vmi_read_addr_va(vmi, next_process + mm_offset + width, 0, &ptr);
-        vmi_read_addr_va(vmi, ptr + pgd_offset, 0, &task_pgd);
-
-        task_pgd = vmi_translate_kv2p(vmi, task_pgd);
-        if (task_pgd == pgd) {
-            return next_process;
-        }
+    /* the same width VMI_FIELD_ADDR reads with */
+    width = vmi_get_address_width(vmi);
 
-        vmi_read_addr_va(vmi, next_process + tasks_offset, 0, &next_process);
-        next_process -= tasks_offset;
+    fields[0] = (vmi_field_t) { os->mm_offset, VMI_FIELD_ADDR, 0,
+                                offsetof(struct task_fields, mm) };
+    fields[1] = (vmi_field_t) { os->mm_offset + width, VMI_FIELD_ADDR, 0,
+                                offsetof(struct task_fields, active_mm) };
 
-        /* if we are back at the list head, we are done */
-    } while (list_head != next_process);
-
-error_exit:
-    return 0;
+    return linux_search_tasks(vmi, fields, 2, task_match_pgd, &search);
 }
 
 /* finds the address of the page global directory for a given pid */
@@ -151,7 +180,6 @@ linux_pid_to_pgd(
 {
     addr_t ts_addr = 0, pgd = 0, ptr = 0;
     uint8_t width = 0;
-    status_t rc = VMI_FAILURE;
     linux_instance_t linux_instance = NULL;
     int pid_offset = 0;
     int tasks_offset = 0;
@@ -170,10 +198,7 @@ linux_pid_to_pgd(
     mm_offset = linux_instance->mm_offset;
     pgd_offset = linux_instance->pgd_offset;
 
-    /* May fail for some drivers, but handle gracefully below by
-     * testing width
-     */
-    rc = driver_get_address_width(vmi, &width);
+    width = vmi_get_address_width(vmi);
 
     /* first we the address of this PID's task_struct */
     ts_addr = linux_get_taskstruct_addr_from_pid(vmi, pid);
@@ -191,7 +216,7 @@ linux_pid_to_pgd(
      * a fallback. task_struct->active_mm can be found very reliably
      * at task_struct->mm + 1 pointer width
      */
-    if(!ptr && width)
+    if(!ptr)
         vmi_read_addr_va(vmi, ts_addr + mm_offset + width, 0, &ptr);
     vmi_read_addr_va(vmi, ptr + pgd_offset, 0, &pgd);
 
@@ -0,0 +1,125 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libvmi.h"
+#include "private.h"
+#include "os/linux/linux.h"
+#include <string.h>
+#include <sys/stat.h>
+
+/* The init profile (see libvmi/profile.c) is keyed on linux_banner and on the
+ * System.map file, as that is where the symbols come from. */
+static status_t linux_fingerprint(vmi_instance_t vmi, addr_t kpgd,
+        addr_t banner, char *fingerprint) {
+    linux_instance_t linux_instance = vmi->os_data;
+    char text[PROFILE_STR_LENGTH - 64];
+    struct stat st;
+    addr_t paddr = 0;
+    size_t len = 0;
+
+    if (!banner || !linux_instance->sysmap || stat(linux_instance->sysmap, &st)) {
+        return VMI_FAILURE;
+    }
+
+    paddr = vmi_pagetable_lookup(vmi, kpgd, banner);
+    if (!paddr) {
+        return VMI_FAILURE;
+    }
+    len = vmi_read_pa(vmi, paddr, text, sizeof(text) - 1);
+    text[len] = '\0';
+    text[strcspn(text, "\n")] = '\0';
+    if (strncmp(text, "Linux version ", 14)) {
+        return VMI_FAILURE;
+    }
+
+    snprintf(fingerprint, PROFILE_STR_LENGTH, "sysmap:%llx:%llx:%s",
+            (unsigned long long) st.st_size, (unsigned long long) st.st_mtime, text);
+    return VMI_SUCCESS;
+}
+
+void linux_profile_save(vmi_instance_t vmi) {
+    linux_instance_t linux_instance = vmi->os_data;
+    init_profile_t profile;
+
+    if (!profile_enabled(vmi)) {
+        return;
+    }
+
+    memset(&profile, 0, sizeof(profile));
+    if (VMI_FAILURE == linux_system_map_symbol_to_address(vmi, "linux_banner", NULL, &profile.banner)
+            || VMI_FAILURE == linux_fingerprint(vmi, vmi->kpgd, profile.banner, profile.fingerprint)) {
+        dbprint(VMI_DEBUG_MISC, "--no linux_banner to key the init profile on\n");
+        return;
+    }
+
+    profile.page_mode = vmi->page_mode;
+    profile.kpgd = vmi->kpgd;
+    profile.init_task = vmi->init_task;
+    profile.kernel_boundary = linux_instance->kernel_boundary;
+    profile_save(vmi, "linux", &profile);
+}
+
+/* Uses the init profile if it was saved for this kernel and System.map,
+ * leaving System.map to be loaded by the first symbol lookup. */
+status_t linux_profile_restore(vmi_instance_t vmi) {
+    linux_instance_t linux_instance = vmi->os_data;
+    page_mode_t page_mode = vmi->page_mode;
+    char fingerprint[PROFILE_STR_LENGTH];
+    init_profile_t profile;
+    reg_t kpgd = 0;
+
+    if (VMI_FAILURE == profile_load(vmi, "linux", &profile)) {
+        return VMI_FAILURE;
+    }
+
+    if (VMI_PM_UNKNOWN == profile.page_mode
+            || (VMI_PM_UNKNOWN != page_mode && page_mode != profile.page_mode)) {
+        goto mismatch;
+    }
+    vmi->page_mode = profile.page_mode;
+
+    /* as below, a live vCPU has the better kpgd */
+    if (VMI_FAILURE == vmi_get_vcpureg(vmi, &kpgd, CR3, 0)) {
+        kpgd = profile.kpgd;
+    }
+
+    if (!kpgd || VMI_FAILURE == linux_fingerprint(vmi, kpgd, profile.banner, fingerprint)
+            || strcmp(fingerprint, profile.fingerprint)) {
+        dbprint(VMI_DEBUG_MISC, "--init profile is for another kernel or System.map\n");
+        goto mismatch;
+    }
+
+    if (!profile.init_task || !vmi_pagetable_lookup(vmi, kpgd, profile.init_task)) {
+        goto mismatch;
+    }
+
+    vmi->kpgd = kpgd;
+    vmi->init_task = profile.init_task;
+    linux_instance->kernel_boundary = profile.kernel_boundary;
+
+    dbprint(VMI_DEBUG_MISC, "**restored vmi->kpgd (0x%.16"PRIx64") and init_task from the init profile.\n",
+            vmi->kpgd);
+    return VMI_SUCCESS;
+
+mismatch:
+    vmi->page_mode = page_mode;
+    v2p_cache_flush(vmi);
+    return VMI_FAILURE;
+}
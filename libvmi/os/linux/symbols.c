@@ -29,113 +29,244 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include <glib.h>
 #include "os/linux/linux.h"
 
 #define MAX_ROW_LENGTH 500
 
+struct linux_symbol {
+    addr_t address;
+    size_t name;    /* offset of the name in linux_symbols.names */
+};
+
+/* System.map, loaded once by linux_init or by the first lookup */
+struct linux_symbols {
+    char *names;                    /* NUL separated symbol names */
+    struct linux_symbol *symbols;   /* sorted by address, then by file order */
+    size_t count;
+    GHashTable *by_name;            /* name -> first struct linux_symbol of that name */
+};
+
+/* splits "address type name" into its address and name */
 static int
-get_symbol_row(
-    FILE * f,
+parse_symbol_row(
     char *row,
-    const char *symbol,
-    int position)
+    addr_t *address,
+    char **name)
 {
-    int ret = VMI_FAILURE;
+    char *end = NULL;
+    size_t len = 0;
 
-    while (fgets(row, MAX_ROW_LENGTH, f) != NULL) {
-        char *token = NULL;
-
-        /* find the correct token to check */
-        int curpos = 0;
-        int position_copy = position;
-
-        while (position_copy > 0 && curpos < MAX_ROW_LENGTH) {
-            if (isspace(row[curpos])) {
-                while (isspace(row[curpos])) {
-                    row[curpos] = '\0';
-                    ++curpos;
-                }
-                --position_copy;
-                continue;
-            }
-            ++curpos;
-        }
-        if (position_copy == 0) {
-            token = row + curpos;
-            while (curpos < MAX_ROW_LENGTH) {
-                if (isspace(row[curpos])) {
-                    row[curpos] = '\0';
-                    break;
-                }
-                ++curpos;
-            }
-        }
-        else {  /* some went wrong in the loop above */
-            goto error_exit;
-        }
+    *address = (addr_t) strtoull(row, &end, 16);
+    if (end == row || !isspace(*end)) {
+        return 0;
+    }
 
-        /* check the token */
-        if (strncmp(token, symbol, MAX_ROW_LENGTH) == 0) {
-            ret = VMI_SUCCESS;
-            break;
-        }
+    /* skip the type column */
+    while (isspace(*end)) {
+        ++end;
+    }
+    while (*end && !isspace(*end)) {
+        ++end;
+    }
+    while (isspace(*end)) {
+        ++end;
     }
 
-error_exit:
-    if (ret == VMI_FAILURE) {
-        memset(row, 0, MAX_ROW_LENGTH);
+    len = strcspn(end, " \t\r\n");
+    if (!len) {
+        return 0;
     }
-    return ret;
+    end[len] = '\0';
+    *name = end;
+    return 1;
 }
 
-status_t
-linux_system_map_symbol_to_address(
-    vmi_instance_t vmi,
-    const char *symbol,
-    addr_t *kernel_base_vaddr,
-    addr_t *address)
+static int
+symbol_compare(
+    const void *a,
+    const void *b)
 {
-    FILE *f = NULL;
-    char *row = NULL;
-    status_t ret;
+    const struct linux_symbol *sa = a, *sb = b;
 
+    if (sa->address != sb->address) {
+        return (sa->address < sb->address) ? -1 : 1;
+    }
+    /* names are stored in file order */
+    return (sa->name < sb->name) ? -1 : (sa->name > sb->name);
+}
+
+status_t
+linux_system_map_load(
+    vmi_instance_t vmi)
+{
     linux_instance_t linux_instance = vmi->os_data;
+    struct linux_symbols *table = NULL;
+    GArray *names = NULL;
+    GArray *symbols = NULL;
+    char row[MAX_ROW_LENGTH];
+    FILE *f = NULL;
+    size_t i;
 
     if (linux_instance == NULL) {
         errprint("VMI_ERROR: OS instance not initialized\n");
-        return 0;
+        return VMI_FAILURE;
     }
 
+    linux_instance->sysmap_loaded = 1;
     if ((NULL == linux_instance->sysmap) || (strlen(linux_instance->sysmap) == 0)) {
         errprint("VMI_WARNING: No linux sysmap configured\n");
-        return 0;
+        return VMI_FAILURE;
     }
 
-    row = safe_malloc(MAX_ROW_LENGTH);
     if ((f = fopen(linux_instance->sysmap, "r")) == NULL) {
         fprintf(stderr,
                 "ERROR: could not find System.map file after checking:\n");
         fprintf(stderr, "\t%s\n", linux_instance->sysmap);
         fprintf(stderr,
                 "To fix this problem, add the correct sysmap entry to /etc/libvmi.conf\n");
-        address = 0;
-        goto error_exit;
+        return VMI_FAILURE;
+    }
+
+    names = g_array_sized_new(FALSE, FALSE, 1, 1 << 20);
+    symbols = g_array_new(FALSE, FALSE, sizeof(struct linux_symbol));
+    while (fgets(row, MAX_ROW_LENGTH, f) != NULL) {
+        struct linux_symbol symbol;
+        char *name = NULL;
+
+        if (!parse_symbol_row(row, &symbol.address, &name)) {
+            continue;
+        }
+        symbol.name = names->len;
+        g_array_append_vals(names, name, strlen(name) + 1);
+        g_array_append_val(symbols, symbol);
+    }
+    fclose(f);
+
+    table = safe_malloc(sizeof(struct linux_symbols));
+    table->count = symbols->len;
+    table->names = g_array_free(names, FALSE);
+    table->symbols = (struct linux_symbol *) g_array_free(symbols, FALSE);
+    qsort(table->symbols, table->count, sizeof(struct linux_symbol), symbol_compare);
+
+    /* lookups by name return the first row of that name, as a scan would */
+    table->by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    for (i = 0; i < table->count; ++i) {
+        char *name = table->names + table->symbols[i].name;
+        struct linux_symbol *other = g_hash_table_lookup(table->by_name, name);
+
+        if (!other || other->name > table->symbols[i].name) {
+            g_hash_table_insert(table->by_name, name, &table->symbols[i]);
+        }
+    }
+
+    dbprint(VMI_DEBUG_MISC, "--loaded %zu symbols from %s\n", table->count,
+            linux_instance->sysmap);
+
+    linux_system_map_free(linux_instance);
+    linux_instance->symbols = table;
+    return VMI_SUCCESS;
+}
+
+void
+linux_system_map_free(
+    linux_instance_t linux_instance)
+{
+    struct linux_symbols *table = linux_instance->symbols;
+
+    if (table) {
+        g_hash_table_destroy(table->by_name);
+        g_free(table->symbols);
+        g_free(table->names);
+        free(table);
+        linux_instance->symbols = NULL;
+    }
+}
+
+/* linux_init skips loading when it starts from an init profile */
+static struct linux_symbols *
+system_map_get(
+    vmi_instance_t vmi)
+{
+    linux_instance_t linux_instance = vmi->os_data;
+    struct linux_symbols *table = NULL;
+
+    vmi_lock(vmi, &linux_instance->sysmap_lock);
+    if (!linux_instance->symbols && !linux_instance->sysmap_loaded) {
+        linux_system_map_load(vmi);
+    }
+    table = linux_instance->symbols;
+    vmi_unlock(vmi, &linux_instance->sysmap_lock);
+    return table;
+}
+
+status_t
+linux_system_map_symbol_to_address(
+    vmi_instance_t vmi,
+    const char *symbol,
+    addr_t *kernel_base_vaddr,
+    addr_t *address)
+{
+    linux_instance_t linux_instance = vmi->os_data;
+    struct linux_symbols *table = NULL;
+    struct linux_symbol *entry = NULL;
+
+    if (linux_instance == NULL) {
+        errprint("VMI_ERROR: OS instance not initialized\n");
+        return VMI_FAILURE;
     }
-    if (get_symbol_row(f, row, symbol, 2) == VMI_FAILURE) {
-        address = 0;
-        goto error_exit;
+
+    table = system_map_get(vmi);
+    if (NULL == table) {
+        dbprint(VMI_DEBUG_MISC, "--no System.map loaded\n");
+        return VMI_FAILURE;
+    }
+
+    entry = g_hash_table_lookup(table->by_name, symbol);
+    if (NULL == entry) {
+        return VMI_FAILURE;
     }
 
     if (kernel_base_vaddr) {
         (*kernel_base_vaddr) = 0;
     }
-    (*address) = (addr_t) strtoull(row, NULL, 16);
+    (*address) = entry->address;
 
     return VMI_SUCCESS;
-error_exit:
-    if (row)
-        free(row);
-    if (f)
-        fclose(f);
-    return VMI_FAILURE;
+}
+
+/* the kernel is one image, so neither base_vaddr nor pid select a table */
+char *
+linux_system_map_address_to_symbol(
+    vmi_instance_t vmi,
+    addr_t rva,
+    addr_t base_vaddr,
+    vmi_pid_t pid)
+{
+    linux_instance_t linux_instance = vmi->os_data;
+    struct linux_symbols *table = NULL;
+    addr_t address = base_vaddr + rva;
+    size_t low = 0, high = 0;
+
+    if (linux_instance == NULL || NULL == (table = system_map_get(vmi))) {
+        return NULL;
+    }
+
+    /* find the first symbol at or above address */
+    high = table->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+
+        if (table->symbols[mid].address < address) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    if (low == table->count || table->symbols[low].address != address) {
+        return NULL;
+    }
+    return table->names + table->symbols[low].name;
 }
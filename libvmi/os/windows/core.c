@@ -314,6 +314,7 @@ uint64_t windows_get_offset(vmi_instance_t vmi, const char* offset_name) {
                 dbprint(VMI_DEBUG_MISC, "--failed to find pname_offset\n");
                 return 0;
             }
+            windows_profile_save(vmi);
         }
         return windows->pname_offset;
     } else {
@@ -377,6 +378,10 @@ void windows_read_config_ghashtable_entries(char* key, gpointer value,
         goto _done;
     }
 
+    if (strncmp(key, "profile_cache", CONFIG_STR_LENGTH) == 0) {
+        goto _done;
+    }
+
     if (strncmp(key, "name", CONFIG_STR_LENGTH) == 0) {
         goto _done;
     }
@@ -391,6 +396,24 @@ void windows_read_config_ghashtable_entries(char* key, gpointer value,
 }
 
 
+status_t
+windows_teardown(
+    vmi_instance_t vmi)
+{
+    windows_instance_t windows = vmi->os_data;
+
+    if (windows == NULL) {
+        return VMI_SUCCESS;
+    }
+
+    windows_export_index_destroy(windows);
+    pthread_mutex_destroy(&windows->export_lock);
+    free(vmi->os_data);
+
+    vmi->os_data = NULL;
+    return VMI_SUCCESS;
+}
+
 status_t
 windows_init(
     vmi_instance_t vmi)
@@ -412,6 +435,7 @@ windows_init(
     vmi->os_data = safe_malloc(sizeof(struct windows_instance));
     bzero(vmi->os_data, sizeof(struct windows_instance));
     windows = vmi->os_data;
+    pthread_mutex_init(&windows->export_lock, NULL);
 
     g_hash_table_foreach(vmi->config, (GHFunc)windows_read_config_ghashtable_entries, vmi);
 
@@ -424,10 +448,14 @@ windows_init(
     os_interface->os_ksym2v = windows_kernel_symbol_to_address;
     os_interface->os_usym2rva = windows_export_to_rva;
     os_interface->os_rva2sym = windows_rva_to_export;
-    os_interface->os_teardown = NULL;
+    os_interface->os_teardown = windows_teardown;
 
     vmi->os_interface = os_interface;
 
+    if (VMI_SUCCESS == windows_profile_restore(vmi)) {
+        return VMI_SUCCESS;
+    }
+
     /* get base address for kernel image in memory */
     if (VMI_PM_UNKNOWN == vmi->page_mode) {
         if (!vmi->kpgd) {
@@ -486,8 +514,10 @@ windows_init(
     goto error_exit;
 
 found_kpgd:
+    windows_profile_save(vmi);
     return VMI_SUCCESS;
 error_exit:
+    windows_export_index_destroy(windows);
     free(vmi->os_interface);
     vmi->os_interface = NULL;
     return VMI_FAILURE;
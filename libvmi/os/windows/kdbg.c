@@ -0,0 +1,275 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libvmi.h"
+#include "private.h"
+#include <string.h>
+#include <stddef.h>
+
+/* KdVersionBlock discovery
+ *
+ * init_kdversion_block tries its strategies in tiers: the config based
+ * lookup first, then the KPCR based PE search and the page table walk
+ * racing each other, and finally the scan of all of physical memory
+ * below.  Every candidate is validated before it is accepted and the
+ * first accepted one cancels the strategies still running. */
+
+/* ntoskrnl images are well below this, KDBG lies inside one */
+#define KDBG_MAX_KERNEL_SIZE 0x4000000
+
+int
+kdbg_cancelled(
+    struct kdbg_search *search)
+{
+    int done = 0;
+
+    if (!search) {
+        return 0;
+    }
+    pthread_mutex_lock(&search->lock);
+    done = search->done;
+    pthread_mutex_unlock(&search->lock);
+    return done;
+}
+
+/* checks the header and KernBase of a candidate KdVersionBlock */
+status_t
+kdbg_validate(
+    vmi_instance_t vmi,
+    addr_t kdvb_pa,
+    addr_t kernel_va_boundary)
+{
+    KDDEBUGGER_DATA64 d;
+    addr_t kernbase = 0, kdvb_va = kdvb_pa + kernel_va_boundary;
+    size_t len = offsetof(KDDEBUGGER_DATA64, KernBase) + sizeof(d.KernBase);
+
+    if (len != vmi_read_pa(vmi, kdvb_pa, &d, len)) {
+        return VMI_FAILURE;
+    }
+    if (memcmp(&d.Header.OwnerTag, "KDBG", 4)
+        || d.Header.Size < 0x80 || d.Header.Size >= 0x1000) {
+        return VMI_FAILURE;
+    }
+
+    /* 32-bit kernels sign extend their addresses */
+    kernbase = d.KernBase;
+    if (VMI_PM_IA32E != vmi->page_mode) {
+        kernbase &= 0xffffffffULL;
+        kdvb_va &= 0xffffffffULL;
+    }
+    if (!kernbase || (kernbase & (VMI_PS_4KB - 1))
+        || kernbase > kdvb_va || kdvb_va - kernbase >= KDBG_MAX_KERNEL_SIZE) {
+        return VMI_FAILURE;
+    }
+    return VMI_SUCCESS;
+}
+
+/* checks a KdVersionBlock remembered from an earlier init */
+status_t
+windows_kdbg_check(
+    vmi_instance_t vmi,
+    addr_t kdversion_block,
+    addr_t kernel_boundary)
+{
+    if (!kdversion_block || kdversion_block < kernel_boundary) {
+        return VMI_FAILURE;
+    }
+    return kdbg_validate(vmi, kdversion_block - kernel_boundary, kernel_boundary);
+}
+
+/* kernel VA boundary implied by a KdVersionBlock and its KernBase */
+static addr_t
+kdbg_kernel_boundary(
+    vmi_instance_t vmi,
+    addr_t kdvb_pa)
+{
+    uint64_t kernbase = 0;
+    int zeroes = __builtin_clzll(kdvb_pa);
+
+    if (VMI_SUCCESS != vmi_read_64_pa(vmi, kdvb_pa + offsetof(KDDEBUGGER_DATA64, KernBase), &kernbase)) {
+        return 0;
+    }
+    if (VMI_PM_IA32E != vmi->page_mode) {
+        kernbase &= 0xffffffffULL;
+    }
+    return (kernbase >> (64-zeroes)) << (64-zeroes);
+}
+
+struct kdbg_pa_scan {
+    struct kdbg_search *search;
+    int find_ofs;
+    addr_t kdvb_pa;
+    addr_t kernel_va_boundary;
+};
+
+static status_t
+kdbg_scan_match(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    size_t pattern,
+    void *data)
+{
+    struct kdbg_pa_scan *scan = data;
+    addr_t kdvb_pa = paddr - scan->find_ofs;
+    addr_t boundary = 0;
+
+    if (kdbg_cancelled(scan->search)) {
+        return VMI_FAILURE;
+    }
+    if ((paddr & 3) || paddr < scan->find_ofs) {
+        return VMI_SUCCESS;
+    }
+
+    boundary = kdbg_kernel_boundary(vmi, kdvb_pa);
+    if (VMI_SUCCESS != kdbg_validate(vmi, kdvb_pa, boundary)) {
+        return VMI_SUCCESS;
+    }
+
+    scan->kdvb_pa = kdvb_pa;
+    scan->kernel_va_boundary = boundary;
+    return VMI_FAILURE;
+}
+
+/* brute force search of all physical memory */
+status_t
+find_kdversionblock_address(
+    vmi_instance_t vmi,
+    struct kdbg_search *search,
+    addr_t *kdvb_pa,
+    addr_t *kernel_va_boundary)
+{
+    struct kdbg_pa_scan scan = { .search = search };
+    vmi_pattern_t pattern;
+
+    if (VMI_PM_IA32E == vmi->page_mode) {
+        pattern.data = "\x00\xf8\xff\xffKDBG";
+        pattern.len = 8;
+        scan.find_ofs = 0xc;
+    }
+    else {
+        pattern.data = "\x00\x00\x00\x00\x00\x00\x00\x00KDBG";
+        pattern.len = 12;
+        scan.find_ofs = 0x8;
+    }
+
+    vmi_scan_pa(vmi, 0, vmi_get_memsize(vmi), &pattern, 1, kdbg_scan_match, &scan);
+    if (!scan.kdvb_pa) {
+        return VMI_FAILURE;
+    }
+
+    *kdvb_pa = scan.kdvb_pa;
+    *kernel_va_boundary = scan.kernel_va_boundary;
+    return VMI_SUCCESS;
+}
+
+long
+kdbg_elapsed(
+    const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000L;
+}
+
+/* runs one strategy, the first validated result wins the search */
+static void *
+kdbg_run_strategy(
+    void *arg)
+{
+    struct kdbg_strategy *strategy = arg;
+    struct kdbg_search *search = strategy->search;
+    addr_t kdvb_pa = 0, boundary = 0;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    strategy->ran = 1;
+    strategy->ret = strategy->find(strategy->vmi, search, &kdvb_pa, &boundary);
+
+    if (VMI_SUCCESS == strategy->ret
+        && VMI_SUCCESS != kdbg_validate(strategy->vmi, kdvb_pa, boundary)) {
+        dbprint(VMI_DEBUG_MISC, "--KdVersionBlock %s candidate at PA 0x%"PRIx64" rejected\n",
+                strategy->name, kdvb_pa);
+        strategy->ret = VMI_FAILURE;
+    }
+
+    if (VMI_SUCCESS == strategy->ret) {
+        pthread_mutex_lock(&search->lock);
+        if (search->done) {
+            strategy->ret = VMI_FAILURE;
+        }
+        else {
+            search->done = 1;
+            search->kdvb_pa = kdvb_pa;
+            search->kernel_va_boundary = boundary;
+        }
+        pthread_mutex_unlock(&search->lock);
+    }
+
+    strategy->usec = kdbg_elapsed(&start);
+    return NULL;
+}
+
+/* runs a tier of strategies, racing them if the instance is thread safe */
+status_t
+kdbg_run_tier(
+    vmi_instance_t vmi,
+    struct kdbg_search *search,
+    struct kdbg_strategy *strategies,
+    size_t n)
+{
+    int race = n > 1 && (vmi->flags & VMI_INIT_THREADSAFE);
+    status_t ret = VMI_FAILURE;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        strategies[i].vmi = vmi;
+        strategies[i].search = search;
+        strategies[i].ret = VMI_FAILURE;
+        if (race && !pthread_create(&strategies[i].thread, NULL, kdbg_run_strategy, &strategies[i])) {
+            strategies[i].started = 1;
+        }
+    }
+
+    /* without threads the strategies run in order, cheapest first */
+    for (i = 0; i < n && !kdbg_cancelled(search); ++i) {
+        if (!strategies[i].started) {
+            kdbg_run_strategy(&strategies[i]);
+        }
+    }
+
+    for (i = 0; i < n; ++i) {
+        if (strategies[i].started) {
+            pthread_join(strategies[i].thread, NULL);
+        }
+        if (!strategies[i].ran) {
+            continue;
+        }
+        if (VMI_SUCCESS == strategies[i].ret) {
+            ret = VMI_SUCCESS;
+        }
+        dbprint(VMI_DEBUG_MISC, "**KdVersionBlock %s search %s after %ld us\n", strategies[i].name,
+                (VMI_SUCCESS == strategies[i].ret) ? "succeeded" :
+                kdbg_cancelled(search) ? "was cancelled" : "failed",
+                strategies[i].usec);
+    }
+
+    return ret;
+}
@@ -30,148 +30,9 @@
 #include "private.h"
 #define _GNU_SOURCE
 #include <string.h>
-
-struct _DBGKD_DEBUG_DATA_HEADER64 {
-    uint64_t List[2];
-    uint32_t OwnerTag;
-    uint32_t Size;
-} __attribute__ ((packed));
-typedef struct _DBGKD_DEBUG_DATA_HEADER64 DBGKD_DEBUG_DATA_HEADER64;
-
-struct _KDDEBUGGER_DATA64 {
-    DBGKD_DEBUG_DATA_HEADER64 Header;
-    uint64_t KernBase;
-    uint64_t BreakpointWithStatus;
-    uint64_t SavedContext;
-    uint16_t ThCallbackStack;
-    uint16_t NextCallback;
-    uint16_t FramePointer;
-    uint16_t PaeEnabled;
-    uint64_t KiCallUserMode;
-    uint64_t KeUserCallbackDispatcher;
-    uint64_t PsLoadedModuleList;
-    uint64_t PsActiveProcessHead;
-    uint64_t PspCidTable;
-    uint64_t ExpSystemResourcesList;
-    uint64_t ExpPagedPoolDescriptor;
-    uint64_t ExpNumberOfPagedPools;
-    uint64_t KeTimeIncrement;
-    uint64_t KeBugCheckCallbackListHead;
-    uint64_t KiBugcheckData;
-    uint64_t IopErrorLogListHead;
-    uint64_t ObpRootDirectoryObject;
-    uint64_t ObpTypeObjectType;
-    uint64_t MmSystemCacheStart;
-    uint64_t MmSystemCacheEnd;
-    uint64_t MmSystemCacheWs;
-    uint64_t MmPfnDatabase;
-    uint64_t MmSystemPtesStart;
-    uint64_t MmSystemPtesEnd;
-    uint64_t MmSubsectionBase;
-    uint64_t MmNumberOfPagingFiles;
-    uint64_t MmLowestPhysicalPage;
-    uint64_t MmHighestPhysicalPage;
-    uint64_t MmNumberOfPhysicalPages;
-    uint64_t MmMaximumNonPagedPoolInBytes;
-    uint64_t MmNonPagedSystemStart;
-    uint64_t MmNonPagedPoolStart;
-    uint64_t MmNonPagedPoolEnd;
-    uint64_t MmPagedPoolStart;
-    uint64_t MmPagedPoolEnd;
-    uint64_t MmPagedPoolInformation;
-    uint64_t MmPageSize;
-    uint64_t MmSizeOfPagedPoolInBytes;
-    uint64_t MmTotalCommitLimit;
-    uint64_t MmTotalCommittedPages;
-    uint64_t MmSharedCommit;
-    uint64_t MmDriverCommit;
-    uint64_t MmProcessCommit;
-    uint64_t MmPagedPoolCommit;
-    uint64_t MmExtendedCommit;
-    uint64_t MmZeroedPageListHead;
-    uint64_t MmFreePageListHead;
-    uint64_t MmStandbyPageListHead;
-    uint64_t MmModifiedPageListHead;
-    uint64_t MmModifiedNoWritePageListHead;
-    uint64_t MmAvailablePages;
-    uint64_t MmResidentAvailablePages;
-    uint64_t PoolTrackTable;
-    uint64_t NonPagedPoolDescriptor;
-    uint64_t MmHighestUserAddress;
-    uint64_t MmSystemRangeStart;
-    uint64_t MmUserProbeAddress;
-    uint64_t KdPrintCircularBuffer;
-    uint64_t KdPrintCircularBufferEnd;
-    uint64_t KdPrintWritePointer;
-    uint64_t KdPrintRolloverCount;
-    uint64_t MmLoadedUserImageList;
-    uint64_t NtBuildLab;
-    uint64_t KiNormalSystemCall;
-    uint64_t KiProcessorBlock;
-    uint64_t MmUnloadedDrivers;
-    uint64_t MmLastUnloadedDriver;
-    uint64_t MmTriageActionTaken;
-    uint64_t MmSpecialPoolTag;
-    uint64_t KernelVerifier;
-    uint64_t MmVerifierData;
-    uint64_t MmAllocatedNonPagedPool;
-    uint64_t MmPeakCommitment;
-    uint64_t MmTotalCommitLimitMaximum;
-    uint64_t CmNtCSDVersion;
-    uint64_t MmPhysicalMemoryBlock;
-    uint64_t MmSessionBase;
-    uint64_t MmSessionSize;
-    uint64_t MmSystemParentTablePage;
-    uint64_t MmVirtualTranslationBase;
-    uint16_t OffsetKThreadNextProcessor;
-    uint16_t OffsetKThreadTeb;
-    uint16_t OffsetKThreadKernelStack;
-    uint16_t OffsetKThreadInitialStack;
-    uint16_t OffsetKThreadApcProcess;
-    uint16_t OffsetKThreadState;
-    uint16_t OffsetKThreadBStore;
-    uint16_t OffsetKThreadBStoreLimit;
-    uint16_t SizeEProcess;
-    uint16_t OffsetEprocessPeb;
-    uint16_t OffsetEprocessParentCID;
-    uint16_t OffsetEprocessDirectoryTableBase;
-    uint16_t SizePrcb;
-    uint16_t OffsetPrcbDpcRoutine;
-    uint16_t OffsetPrcbCurrentThread;
-    uint16_t OffsetPrcbMhz;
-    uint16_t OffsetPrcbCpuType;
-    uint16_t OffsetPrcbVendorString;
-    uint16_t OffsetPrcbProcStateContext;
-    uint16_t OffsetPrcbNumber;
-    uint16_t SizeEThread;
-    uint64_t KdPrintCircularBufferPtr;
-    uint64_t KdPrintBufferSize;
-    uint64_t KeLoaderBlock;
-    uint16_t SizePcr;
-    uint16_t OffsetPcrSelfPcr;
-    uint16_t OffsetPcrCurrentPrcb;
-    uint16_t OffsetPcrContainedPrcb;
-    uint16_t OffsetPcrInitialBStore;
-    uint16_t OffsetPcrBStoreLimit;
-    uint16_t OffsetPcrInitialStack;
-    uint16_t OffsetPcrStackLimit;
-    uint16_t OffsetPrcbPcrPage;
-    uint16_t OffsetPrcbProcStateSpecialReg;
-    uint16_t GdtR0Code;
-    uint16_t GdtR0Data;
-    uint16_t GdtR0Pcr;
-    uint16_t GdtR3Code;
-    uint16_t GdtR3Data;
-    uint16_t GdtR3Teb;
-    uint16_t GdtLdt;
-    uint16_t GdtTss;
-    uint16_t Gdt64R3CmCode;
-    uint16_t Gdt64R3CmTeb;
-    uint64_t IopNumTriageDumpDataBlocks;
-    uint64_t IopTriageDumpDataBlocks;
-    uint64_t VfCrashDataBlock;
-} __attribute__ ((packed));
-typedef struct _KDDEBUGGER_DATA64 KDDEBUGGER_DATA64;
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
 
 static status_t
 kpcr_symbol_resolve(
@@ -771,120 +632,120 @@ find_windows_version(
     }
 }
 
-static addr_t
-find_kdversionblock_address(
-    vmi_instance_t vmi)
+
+struct kdbg_page_scan {
+    struct kdbg_search *search;
+    reg_t cr3;
+    addr_t memsize;
+    void *bm;   // boyer-moore internal state
+    int find_ofs;
+    addr_t *kdvb_pa;
+    addr_t *kernel_va_boundary;
+    status_t ret;
+};
+
+static status_t
+kdbg_scan_va_page(
+    vmi_instance_t vmi,
+    addr_t va,
+    page_size_t size,
+    void *data)
 {
-    addr_t kdvb_address = 0;
-    addr_t paddr = 0;
-    unsigned char buf[12];
-
-    for (paddr = 0; paddr + 12 <= vmi_get_memsize(vmi); paddr += 4) {
-        if (12 == vmi_read_pa(vmi, paddr, buf, 12)) {
-            if (VMI_PM_IA32E == vmi->page_mode) {
-                if (memcmp(buf, "\x00\xf8\xff\xffKDBG", 8) == 0) {
-                    kdvb_address = paddr - 0xc;
-                    break;
-                }
-            }
-            else {
-                if (memcmp
-                    (buf, "\x00\x00\x00\x00\x00\x00\x00\x00KDBG",
-                     12) == 0) {
-                    kdvb_address = paddr - 0x8;
-                    break;
-                }
+    struct kdbg_page_scan *scan = data;
+    const unsigned char *haystack = NULL;
+    vmi_pin_t pin = NULL;
+    size_t len = 0;
+
+    if (kdbg_cancelled(scan->search)) {
+        return VMI_FAILURE;
+    }
+
+    // We might get pages that are greater than 4Kb
+    // so we are just going to split them to 4Kb pages
+    while(size >= VMI_PS_4KB) {
+        size -= VMI_PS_4KB;
+        addr_t page_vaddr = va+size;
+        addr_t page_paddr = vmi_pagetable_lookup(vmi, scan->cr3, page_vaddr);
+
+        if(page_paddr + VMI_PS_4KB - 1 > scan->memsize) {
+            continue;
+        }
+
+        // scan the page in place instead of copying it out
+        haystack = vmi_map_pa(vmi, page_paddr, &len, &pin);
+        if (NULL == haystack || len < VMI_PS_4KB) {
+            vmi_unmap(vmi, pin);
+            continue;
+        }
+
+        int match_offset = boyer_moore2(scan->bm, (unsigned char *) haystack, VMI_PS_4KB);
+        vmi_unmap(vmi, pin);
+
+        if (-1 != match_offset) {
+            addr_t kdvb_pa = page_paddr + (unsigned int) match_offset - scan->find_ofs;
+            int zeroes = __builtin_clzll(page_paddr);
+            addr_t boundary = (page_vaddr >> (64-zeroes)) << (64-zeroes);
+
+            if (VMI_SUCCESS != kdbg_validate(vmi, kdvb_pa, boundary)) {
+                continue;
             }
+            *scan->kdvb_pa = kdvb_pa;
+            *scan->kernel_va_boundary = boundary;
+            scan->ret = VMI_SUCCESS;
+            // found it, stop the page walk
+            return VMI_FAILURE;
         }
     }
 
-    return kdvb_address;
+    return VMI_SUCCESS;
 }
 
-status_t
+/* walks the kernel page tables and searches every mapped page */
+static status_t
 find_kdversionblock_address_fast(
     vmi_instance_t vmi,
+    struct kdbg_search *search,
     addr_t *kdvb_pa,
     addr_t *kernel_va_boundary)
 {
     // Todo:
     // -support matching across frames (can this happen in windows?)
 
-    reg_t cr3;
-    driver_get_vcpureg(vmi, &cr3, CR3, 0);
+    struct kdbg_page_scan scan = {
+        .search = search,
+        .kdvb_pa = kdvb_pa,
+        .kernel_va_boundary = kernel_va_boundary,
+        .ret = VMI_FAILURE
+    };
 
-    status_t ret = VMI_FAILURE;
-    addr_t memsize = vmi_get_memsize(vmi);
-    GSList *va_pages = vmi_get_va_pages(vmi, (addr_t)cr3);
-    size_t read = 0;
-    void *bm = 0;   // boyer-moore internal state
-    unsigned char haystack[VMI_PS_4KB];
-    int find_ofs = 0;
+    driver_get_vcpureg(vmi, &scan.cr3, CR3, 0);
+    scan.memsize = vmi_get_memsize(vmi);
 
     if (VMI_PM_IA32E == vmi->page_mode) {
-        bm = boyer_moore_init("\x00\xf8\xff\xffKDBG", 8);
-        find_ofs = 0xc;
+        scan.bm = boyer_moore_init("\x00\xf8\xff\xffKDBG", 8);
+        scan.find_ofs = 0xc;
     }
     else {
-        bm = boyer_moore_init("\x00\x00\x00\x00\x00\x00\x00\x00KDBG",
-                              12);
-        find_ofs = 0x8;
+        scan.bm = boyer_moore_init("\x00\x00\x00\x00\x00\x00\x00\x00KDBG",
+                                   12);
+        scan.find_ofs = 0x8;
     }   // if-else
 
-    GSList *va_pages_loop = va_pages;
-    while(va_pages_loop) {
-
-        struct va_page *vap = (struct va_page *)va_pages_loop->data;
-
-        // We might get pages that are greater than 4Kb
-        // so we are just going to split them to 4Kb pages
-        while(vap && vap->size >= VMI_PS_4KB) {
-            vap->size -= VMI_PS_4KB;
-            addr_t page_vaddr = vap->va+vap->size;
-            addr_t page_paddr = vmi_pagetable_lookup(vmi, cr3, page_vaddr);
-
-            if(page_paddr + VMI_PS_4KB - 1 > memsize) {
-                continue;
-            }
-
-            read = vmi_read_pa(vmi, page_paddr, haystack, VMI_PS_4KB);
+    // pages are scanned as the page tables are walked, no list is built
+    vmi_foreach_va_page(vmi, (addr_t)scan.cr3, kdbg_scan_va_page, &scan);
 
-            if (VMI_PS_4KB != read) {
-                continue;
-            }
-
-            int match_offset = boyer_moore2(bm, haystack, VMI_PS_4KB);
-
-            if (-1 != match_offset) {
-                *kdvb_pa = page_paddr + (unsigned int) match_offset - find_ofs;
-                int zeroes = __builtin_clzll(page_paddr);
-                *kernel_va_boundary = (page_vaddr >> (64-zeroes)) << (64-zeroes);
-                ret = VMI_SUCCESS;
-                goto done;
-            }
-        }
-        g_free(vap);
-        va_pages_loop = va_pages_loop->next;
-    }
-
-done:
-    // free the rest of the list
-    while(va_pages_loop) {
-        g_free(va_pages_loop->data);
-        va_pages_loop = va_pages_loop->next;
-    }
-    g_slist_free(va_pages);
-
-    if (VMI_SUCCESS == ret)
+    if (VMI_SUCCESS == scan.ret)
         dbprint(VMI_DEBUG_MISC, "--Found KD version block at PA %.16"PRIx64". Kernel boundary %.16"PRIx64"\n",
                 *kdvb_pa, *kernel_va_boundary);
-    boyer_moore_fini(bm);
-    return ret;
+    boyer_moore_fini(scan.bm);
+    return scan.ret;
 }
 
-status_t
+/* searches outwards from the KPCR for ntoskrnl and its .data section */
+static status_t
 find_kdversionblock_address_faster(
     vmi_instance_t vmi,
+    struct kdbg_search *search,
     addr_t *kdvb_pa,
     addr_t *kernel_va_boundary)
 {
@@ -925,6 +786,10 @@ scan:
     page_paddr = (vmi_pagetable_lookup(vmi, cr3, fsgs) >> 12) << 12;
     for(; page_paddr + step >= 0 && page_paddr + step < vmi->size ; page_paddr += step) {
 
+        if (kdbg_cancelled(search)) {
+            goto done;
+        }
+
         uint8_t page[VMI_PS_4KB];
         status_t rc = peparse_get_image_phys(vmi, page_paddr, VMI_PS_4KB, page);
         if(VMI_FAILURE == rc) {
@@ -1020,9 +885,11 @@ done:
     return ret;
 }
 
-status_t
+/* uses the KPCR and KDBG offsets from the config */
+static status_t
 find_kdversionblok_address_instant(
     vmi_instance_t vmi,
+    struct kdbg_search *search,
     addr_t *kdvb_pa,
     addr_t *kernel_va_boundary)
 {
@@ -1066,6 +933,8 @@ done:
 
 }
 
+
+
 status_t
 init_kdversion_block(
     vmi_instance_t vmi)
@@ -1074,6 +943,19 @@ init_kdversion_block(
     addr_t KernelBoundary = 0;
     addr_t DebuggerDataList = 0, ListPtr = 0;
     windows_instance_t windows = NULL;
+    struct kdbg_search search;
+    struct kdbg_strategy instant[] = {
+        { "config", find_kdversionblok_address_instant }
+    };
+    struct kdbg_strategy racing[] = {
+        { "KPCR", find_kdversionblock_address_faster },
+        { "page table", find_kdversionblock_address_fast }
+    };
+    struct kdbg_strategy brute_force[] = {
+        { "physical memory", find_kdversionblock_address }
+    };
+    struct timespec start;
+    status_t ret = VMI_FAILURE;
 
     if (vmi->os_data == NULL) {
         return VMI_FAILURE;
@@ -1081,24 +963,26 @@ init_kdversion_block(
 
     windows = vmi->os_data;
 
-    if(VMI_SUCCESS == find_kdversionblok_address_instant(vmi, &KdVersionBlock_phys, &KernelBoundary))
-        goto init_done;
-
-    dbprint(VMI_DEBUG_MISC, "**KdVersionBlock instant init failed\n");
-
-    if(VMI_SUCCESS == find_kdversionblock_address_faster(vmi, &KdVersionBlock_phys, &KernelBoundary))
-        goto init_done;
+    memset(&search, 0, sizeof(search));
+    pthread_mutex_init(&search.lock, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    dbprint(VMI_DEBUG_MISC, "**KdVersionBlock fastest init failed\n");
-
-    if(VMI_SUCCESS == find_kdversionblock_address_fast(vmi, &KdVersionBlock_phys, &KernelBoundary))
-        goto init_done;
+    if (VMI_SUCCESS == kdbg_run_tier(vmi, &search, instant, 1)
+        || VMI_SUCCESS == kdbg_run_tier(vmi, &search, racing, 2)
+        || VMI_SUCCESS == kdbg_run_tier(vmi, &search, brute_force, 1)) {
+        KdVersionBlock_phys = search.kdvb_pa;
+        KernelBoundary = search.kernel_va_boundary;
+        ret = VMI_SUCCESS;
+    }
 
-    dbprint(VMI_DEBUG_MISC, "**KdVersionBlock init failed all the way\n");
+    pthread_mutex_destroy(&search.lock);
+    dbprint(VMI_DEBUG_MISC, "**KdVersionBlock search took %ld us\n", kdbg_elapsed(&start));
 
-    goto error_exit;
+    if (VMI_SUCCESS != ret) {
+        dbprint(VMI_DEBUG_MISC, "**KdVersionBlock init failed all the way\n");
+        goto error_exit;
+    }
 
-init_done:
     if (!windows->kdversion_block) {
         windows->kdversion_block = KdVersionBlock_phys + KernelBoundary;
         windows->kernel_boundary = KernelBoundary;
@@ -528,6 +528,310 @@ peparse_get_export_table(
     return VMI_SUCCESS;
 }
 
+///////////////////////////////////////////////////////////
+// Export index
+
+/* export tables larger than this are searched in guest memory */
+#define EXPORT_INDEX_MAX_NAMES 0x100000
+
+/* named export, sorted by rva */
+struct export_entry {
+    addr_t rva;
+    size_t name;    /* offset of the name in export_index.names */
+};
+
+/* the exports of one PE image, shared by every mapping of its export
+ * directory */
+struct export_index {
+    addr_t dir_pa;          /* physical address of the export directory */
+    addr_t et_rva;
+    size_t et_size;
+    char *names;            /* NUL separated export names */
+    struct export_entry *entries;
+    size_t count;
+    GHashTable *by_name;    /* name -> first struct export_entry of that name */
+    unsigned int refs;
+};
+
+/* an image mapped at base in the address space rooted at dtb */
+struct export_module {
+    addr_t base;
+    addr_t dtb;
+    struct export_index *index;
+};
+
+static guint
+export_module_hash(
+    gconstpointer key)
+{
+    const struct export_module *module = key;
+
+    return g_int64_hash(&module->base) ^ g_int64_hash(&module->dtb);
+}
+
+static gboolean
+export_module_equal(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const struct export_module *ma = a, *mb = b;
+
+    return ma->base == mb->base && ma->dtb == mb->dtb;
+}
+
+static void
+export_index_free(
+    gpointer data)
+{
+    struct export_index *index = data;
+
+    g_hash_table_destroy(index->by_name);
+    g_free(index->entries);
+    g_free(index->names);
+    free(index);
+}
+
+/* drops a module, and its index once no other module uses it */
+static void
+export_module_remove(
+    windows_instance_t windows,
+    struct export_module *module)
+{
+    struct export_index *index = module->index;
+
+    g_hash_table_remove(windows->export_modules, module);
+    if (!--index->refs) {
+        g_hash_table_remove(windows->export_indexes, &index->dir_pa);
+    }
+    free(module);
+}
+
+void
+windows_export_index_destroy(
+    windows_instance_t windows)
+{
+    GHashTableIter iter;
+    gpointer key = NULL, value = NULL;
+
+    if (windows->export_modules) {
+        g_hash_table_iter_init(&iter, windows->export_modules);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            free(value);
+        }
+        g_hash_table_destroy(windows->export_modules);
+        windows->export_modules = NULL;
+    }
+    if (windows->export_indexes) {
+        g_hash_table_destroy(windows->export_indexes);
+        windows->export_indexes = NULL;
+    }
+}
+
+static int
+export_entry_compare(
+    const void *a,
+    const void *b)
+{
+    const struct export_entry *ea = a, *eb = b;
+
+    if (ea->rva != eb->rva) {
+        return (ea->rva < eb->rva) ? -1 : 1;
+    }
+    /* names are stored in AddressOfNames order */
+    return (ea->name < eb->name) ? -1 : (ea->name > eb->name);
+}
+
+/* reads the name and function tables in bulk and indexes every named export */
+static struct export_index *
+export_index_build(
+    vmi_instance_t vmi,
+    addr_t base_vaddr,
+    vmi_pid_t pid,
+    struct export_table *et,
+    addr_t et_rva,
+    size_t et_size)
+{
+    struct export_index *index = NULL;
+    uint32_t *name_rvas = NULL, *functions = NULL;
+    uint16_t *ordinals = NULL;
+    uint8_t *dir = NULL;
+    GArray *names = NULL, *entries = NULL;
+    size_t n = et->number_of_names, nf = et->number_of_functions, i;
+
+    if (!n || n > EXPORT_INDEX_MAX_NAMES || nf > EXPORT_INDEX_MAX_NAMES
+        || et_size > EXPORT_INDEX_MAX_NAMES * 64) {
+        return NULL;
+    }
+
+    name_rvas = safe_malloc(n * sizeof(uint32_t));
+    ordinals = safe_malloc(n * sizeof(uint16_t));
+    functions = safe_malloc(nf * sizeof(uint32_t) + 1);
+    if (vmi_read_va(vmi, base_vaddr + et->address_of_names, pid, name_rvas,
+                    n * sizeof(uint32_t)) != n * sizeof(uint32_t)
+        || vmi_read_va(vmi, base_vaddr + et->address_of_name_ordinals, pid, ordinals,
+                       n * sizeof(uint16_t)) != n * sizeof(uint16_t)
+        || vmi_read_va(vmi, base_vaddr + et->address_of_functions, pid, functions,
+                       nf * sizeof(uint32_t)) != nf * sizeof(uint32_t)) {
+        dbprint(VMI_DEBUG_MISC, "--PEParse: export tables of 0x%"PRIx64" not readable\n",
+                base_vaddr);
+        goto done;
+    }
+
+    /* the names normally live inside the export directory, read it once */
+    dir = safe_malloc(et_size + 1);
+    if (vmi_read_va(vmi, base_vaddr + et_rva, pid, dir, et_size) != et_size) {
+        free(dir);
+        dir = NULL;
+    }
+    else {
+        dir[et_size] = '\0';
+    }
+
+    names = g_array_new(FALSE, FALSE, 1);
+    entries = g_array_new(FALSE, FALSE, sizeof(struct export_entry));
+    for (i = 0; i < n; ++i) {
+        struct export_entry entry;
+        char *name = NULL;
+
+        if (ordinals[i] >= nf || !name_rvas[i]) {
+            continue;
+        }
+
+        if (dir && name_rvas[i] >= et_rva && name_rvas[i] < et_rva + et_size) {
+            name = strdup((char *) dir + name_rvas[i] - et_rva);
+        }
+        else {
+            name = rva_to_string(vmi, (addr_t) name_rvas[i], base_vaddr, pid);
+        }
+        if (!name) {
+            continue;
+        }
+
+        entry.rva = functions[ordinals[i]];
+        entry.name = names->len;
+        g_array_append_vals(names, name, strlen(name) + 1);
+        g_array_append_val(entries, entry);
+        free(name);
+    }
+
+    index = safe_malloc(sizeof(struct export_index));
+    index->dir_pa = 0;
+    index->et_rva = et_rva;
+    index->et_size = et_size;
+    index->refs = 0;
+    index->count = entries->len;
+    index->names = g_array_free(names, FALSE);
+    index->entries = (struct export_entry *) g_array_free(entries, FALSE);
+    qsort(index->entries, index->count, sizeof(struct export_entry), export_entry_compare);
+
+    index->by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    for (i = 0; i < index->count; ++i) {
+        char *name = index->names + index->entries[i].name;
+        struct export_entry *other = g_hash_table_lookup(index->by_name, name);
+
+        if (!other || other->name > index->entries[i].name) {
+            g_hash_table_insert(index->by_name, name, &index->entries[i]);
+        }
+    }
+
+    dbprint(VMI_DEBUG_MISC, "--PEParse: indexed %zu exports of 0x%"PRIx64"\n",
+            index->count, base_vaddr);
+
+done:
+    free(name_rvas);
+    free(ordinals);
+    free(functions);
+    free(dir);
+    return index;
+}
+
+/* the export index of the image at base_vaddr, built on first use;
+ * the index is only valid while export_lock is held */
+static struct export_index *
+export_index_get(
+    vmi_instance_t vmi,
+    addr_t base_vaddr,
+    vmi_pid_t pid)
+{
+    windows_instance_t windows = vmi->os_data;
+    struct export_module key, *module = NULL;
+    struct export_index *index = NULL;
+    struct export_table et;
+    addr_t et_rva = 0, dir_pa = 0;
+    size_t et_size = 0;
+    reg_t dtb = 0;
+
+    if (!windows) {
+        return NULL;
+    }
+
+    if (pid) {
+        dtb = vmi_pid_to_dtb(vmi, pid);
+    }
+    else if (vmi->kpgd) {
+        dtb = vmi->kpgd;
+    }
+    else {
+        vmi_get_vcpureg(vmi, &dtb, CR3, 0);
+    }
+    if (!dtb) {
+        return NULL;
+    }
+
+    if (!windows->export_modules) {
+        windows->export_modules = g_hash_table_new(export_module_hash, export_module_equal);
+        windows->export_indexes = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                                        NULL, export_index_free);
+    }
+
+    /* still the same image if the export directory has not moved */
+    key.base = base_vaddr;
+    key.dtb = dtb;
+    module = g_hash_table_lookup(windows->export_modules, &key);
+    if (module) {
+        index = module->index;
+        if (vmi_pagetable_lookup(vmi, dtb, base_vaddr + index->et_rva) == index->dir_pa) {
+            return index;
+        }
+        export_module_remove(windows, module);
+    }
+
+    if (peparse_get_export_table(vmi, base_vaddr, pid, &et, &et_rva, &et_size) != VMI_SUCCESS) {
+        return NULL;
+    }
+    dir_pa = vmi_pagetable_lookup(vmi, dtb, base_vaddr + et_rva);
+    if (!dir_pa) {
+        return NULL;
+    }
+
+    /* the same DLL mapped into another process shares its index */
+    index = g_hash_table_lookup(windows->export_indexes, &dir_pa);
+    if (!index) {
+        index = export_index_build(vmi, base_vaddr, pid, &et, et_rva, et_size);
+        if (!index) {
+            return NULL;
+        }
+        index->dir_pa = dir_pa;
+        g_hash_table_insert(windows->export_indexes, &index->dir_pa, index);
+    }
+
+    module = safe_malloc(sizeof(struct export_module));
+    module->base = base_vaddr;
+    module->dtb = dtb;
+    module->index = index;
+    index->refs++;
+    g_hash_table_insert(windows->export_modules, module, module);
+    return index;
+}
+
+static int
+export_forwarded(
+    struct export_index *index,
+    addr_t rva)
+{
+    return rva >= index->et_rva && rva < index->et_rva + index->et_size;
+}
+
 /* returns the rva value for a windows PE export */
 status_t
 windows_export_to_rva(
@@ -542,6 +846,34 @@ windows_export_to_rva(
     size_t et_size;
     int aon_index = -1;
     int aof_index = -1;
+    windows_instance_t windows = vmi->os_data;
+    struct export_index *index = NULL;
+
+    if (windows) {
+        status_t ret = VMI_FAILURE;
+
+        vmi_lock(vmi, &windows->export_lock);
+        index = export_index_get(vmi, base_vaddr, pid);
+        if (index) {
+            struct export_entry *entry = g_hash_table_lookup(index->by_name, symbol);
+
+            if (!entry) {
+                dbprint(VMI_DEBUG_MISC, "--PEParse: %s not exported by 0x%"PRIx64"\n", symbol, base_vaddr);
+            }
+            else if (export_forwarded(index, entry->rva)) {
+                dbprint(VMI_DEBUG_MISC, "--PEParse: %s @ %u:0x%"PRIx64" is forwarded\n", symbol, pid, base_vaddr);
+            }
+            else {
+                *rva = entry->rva;
+                ret = VMI_SUCCESS;
+            }
+        }
+        vmi_unlock(vmi, &windows->export_lock);
+
+        if (index) {
+            return ret;
+        }
+    }
 
     // get export table structure
     if (peparse_get_export_table(vmi, base_vaddr, pid, &et, &et_rva, &et_size) != VMI_SUCCESS) {
@@ -589,9 +921,40 @@ windows_rva_to_export(
     struct export_table et;
     addr_t et_rva;
     size_t et_size;
-    int aon_index = -1;
-    int aof_index = -1;
     char* symbol = NULL;
+    windows_instance_t windows = vmi->os_data;
+    struct export_index *index = NULL;
+
+    if (windows) {
+        vmi_lock(vmi, &windows->export_lock);
+        index = export_index_get(vmi, base_vaddr, pid);
+        if (index && export_forwarded(index, rva)) {
+            dbprint(VMI_DEBUG_MISC, "--PEParse: symbol @ %u:0x%"PRIx64" is forwarded\n", pid, base_vaddr+rva);
+        }
+        else if (index) {
+            size_t low = 0, high = index->count;
+
+            /* first named export at rva */
+            while (low < high) {
+                size_t mid = low + (high - low) / 2;
+
+                if (index->entries[mid].rva < rva) {
+                    low = mid + 1;
+                }
+                else {
+                    high = mid;
+                }
+            }
+            if (low < index->count && index->entries[low].rva == rva) {
+                symbol = strdup(index->names + index->entries[low].name);
+            }
+        }
+        vmi_unlock(vmi, &windows->export_lock);
+
+        if (index) {
+            return symbol;
+        }
+    }
 
     // get export table structure
     if (peparse_get_export_table(vmi, base_vaddr, pid, &et, &et_rva, &et_size) != VMI_SUCCESS) {
@@ -610,28 +973,28 @@ windows_rva_to_export(
     addr_t base3 = base_vaddr + et.address_of_functions;
     uint32_t i = 0;
 
-    for (; i < et.number_of_functions; ++i) {
+    for (; i < et.number_of_names; ++i) {
         uint32_t name_rva = 0;
         uint16_t ordinal = 0;
         uint32_t loc = 0;
 
         if(VMI_FAILURE==vmi_read_16_va(vmi, base2 + i * sizeof(uint16_t), pid, &ordinal))
             continue;
-        if(VMI_FAILURE==vmi_read_32_va(vmi, base3 + ordinal + sizeof(uint32_t), pid, &loc))
+        if(VMI_FAILURE==vmi_read_32_va(vmi, base3 + ordinal * sizeof(uint32_t), pid, &loc))
             continue;
 
         if(loc==rva) {
 
-            if(i < et.number_of_names && VMI_SUCCESS==vmi_read_32_va(vmi, base1 + i * sizeof(uint32_t), pid, &name_rva) && name_rva) {
+            if(VMI_SUCCESS==vmi_read_32_va(vmi, base1 + i * sizeof(uint32_t), pid, &name_rva) && name_rva) {
                 symbol = rva_to_string(vmi, (addr_t)name_rva, base_vaddr, pid);
                 return symbol;
             }
-
-            dbprint(VMI_DEBUG_MISC, "--PEParse: symbol @ %u:0x%"PRIx64" is exported by ordinal only\n", pid, base_vaddr+rva);
             break;
         }
     }
 
+    dbprint(VMI_DEBUG_MISC, "--PEParse: no named export @ %u:0x%"PRIx64"\n", pid, base_vaddr+rva);
+
     return NULL;
 }
 
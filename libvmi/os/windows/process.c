@@ -150,68 +150,131 @@ get_check_magic_func(
     return rtn;
 }
 
+/* the EPROCESS magic values accepted by check, as scan patterns */
+static size_t
+magic_patterns(
+    check_magic_func check,
+    uint32_t values[3],
+    vmi_pattern_t patterns[3])
+{
+    const uint32_t magics[] = { MAGIC1, MAGIC2, MAGIC3 };
+    size_t i, n = 0;
+
+    for (i = 0; i < 3; ++i) {
+        if (check(magics[i])) {
+            values[n] = magics[i];
+            patterns[n].data = &values[n];
+            patterns[n].len = sizeof(uint32_t);
+            n++;
+        }
+    }
+    return n;
+}
+
+struct pname_scan {
+    void *bm;
+    addr_t found;
+    int offset;
+};
+
+static status_t
+pname_scan_match(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    size_t pattern,
+    void *data)
+{
+    struct pname_scan *scan = data;
+    unsigned char haystack[0x500];
+    int i;
+
+    /* EPROCESS structures are 8 byte aligned */
+    if (paddr & 7) {
+        return VMI_SUCCESS;
+    }
+
+    dbprint
+        (VMI_DEBUG_MISC, "--%s: found magic value @ 0x%.8"PRIx64"\n",
+         __FUNCTION__, paddr);
+
+    if (0x500 != vmi_read_pa(vmi, paddr, haystack, 0x500)) {
+        return VMI_SUCCESS;
+    }
+
+    i = boyer_moore2(scan->bm, haystack, 0x500);
+    if (-1 == i) {
+        return VMI_SUCCESS;
+    }
+
+    scan->found = paddr;
+    scan->offset = i;
+    return VMI_FAILURE;
+}
+
 int
 find_pname_offset(
     vmi_instance_t vmi,
     check_magic_func check)
 {
-    addr_t block_pa = 0;
-    addr_t offset = 0;
-    uint32_t value = 0;
-    size_t read = 0;
-    void *bm = 0;
-
-    bm = boyer_moore_init("Idle", 4);
-
-#define BLOCK_SIZE 1024 * 1024 * 1
-    unsigned char block_buffer[BLOCK_SIZE];
+    windows_instance_t windows = vmi->os_data;
+    struct pname_scan scan = { 0 };
+    uint32_t values[3];
+    vmi_pattern_t patterns[3];
+    size_t n = 0;
 
     if (NULL == check) {
         check = get_check_magic_func(vmi);
     }
 
-    for (block_pa = 4096; block_pa + BLOCK_SIZE <= vmi->size; block_pa += BLOCK_SIZE) {
-        read = vmi_read_pa(vmi, block_pa, block_buffer, BLOCK_SIZE);
-        if (BLOCK_SIZE != read) {
-            continue;
-        }
+    n = magic_patterns(check, values, patterns);
+    if (!n) {
+        return 0;
+    }
 
-        for (offset = 0; offset < BLOCK_SIZE; offset += 8) {
-            memcpy(&value, block_buffer + offset, 4);
-
-            if (check(value)) { // look for specific magic #
-                dbprint
-                    (VMI_DEBUG_MISC, "--%s: found magic value 0x%.8"PRIx32" @ offset 0x%.8"PRIx64"\n",
-                     __FUNCTION__, value, block_pa + offset);
-
-                unsigned char haystack[0x500];
-
-                read =
-                    vmi_read_pa(vmi, block_pa + offset, haystack,
-                                0x500);
-                if (0x500 != read) {
-                    continue;
-                }
-
-                int i = boyer_moore2(bm, haystack, 0x500);
-
-                if (-1 == i) {
-                    continue;
-                }
-                else {
-                    vmi->init_task =
-                        block_pa + offset;
-                    dbprint
-                        (VMI_DEBUG_MISC, "--%s: found Idle process at 0x%.8"PRIx64" + 0x%x\n",
-                         __FUNCTION__, block_pa + offset, i);
-                    boyer_moore_fini(bm);
-                    return i;
-                }
-            }
+    scan.bm = boyer_moore_init("Idle", 4);
+    vmi_scan_pa(vmi, 4096, vmi->size, patterns, n, pname_scan_match, &scan);
+    boyer_moore_fini(scan.bm);
+
+    if (!scan.found) {
+        return 0;
+    }
+
+    /* a physical address, unlike the kernel VA in vmi->init_task */
+    windows->idle_proc = scan.found;
+    dbprint
+        (VMI_DEBUG_MISC, "--%s: found Idle process at 0x%.8"PRIx64" + 0x%x\n",
+         __FUNCTION__, scan.found, scan.offset);
+    return scan.offset;
+}
+
+struct process_scan {
+    addr_t start;
+    const char *name;
+    addr_t found;
+};
+
+static status_t
+process_scan_match(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    size_t pattern,
+    void *data)
+{
+    struct process_scan *scan = data;
+    char *procname = NULL;
+
+    if ((paddr - scan->start) & 7) {
+        return VMI_SUCCESS;
+    }
+
+    procname = windows_get_eprocess_name(vmi, paddr);
+    if (procname) {
+        if (strncmp(procname, scan->name, 50) == 0) {
+            scan->found = paddr;
         }
+        free(procname);
     }
-    boyer_moore_fini(bm);
-    return 0;
+    return scan->found ? VMI_FAILURE : VMI_SUCCESS;
 }
 
 static addr_t
@@ -221,43 +284,20 @@ find_process_by_name(
     addr_t start_address,
     const char *name)
 {
-    addr_t block_pa = 0;
-    addr_t offset = 0;
-    uint32_t value = 0;
-    size_t read = 0;
-
-#define BLOCK_SIZE 1024 * 1024 * 1
-    unsigned char block_buffer[BLOCK_SIZE];
+    struct process_scan scan = { start_address, name, 0 };
+    uint32_t values[3];
+    vmi_pattern_t patterns[3];
+    size_t n = 0;
 
     if (NULL == check) {
         check = get_check_magic_func(vmi);
     }
 
-    for (block_pa = start_address; block_pa + BLOCK_SIZE <= vmi->size;
-         block_pa += BLOCK_SIZE) {
-        read = vmi_read_pa(vmi, block_pa, block_buffer, BLOCK_SIZE);
-        if (BLOCK_SIZE != read) {
-            continue;
-        }
-
-        for (offset = 0; offset < BLOCK_SIZE; offset += 8) {
-            memcpy(&value, block_buffer + offset, 4);
-
-            if (check(value)) { // look for specific magic #
-
-                char *procname =
-                    windows_get_eprocess_name(vmi, block_pa + offset);
-                if (procname) {
-                    if (strncmp(procname, name, 50) == 0) {
-                        free(procname);
-                        return block_pa + offset;
-                    }
-                    free(procname);
-                }
-            }
-        }
+    n = magic_patterns(check, values, patterns);
+    if (n) {
+        vmi_scan_pa(vmi, start_address, vmi->size, patterns, n, process_scan_match, &scan);
     }
-    return 0;
+    return scan.found;
 }
 
 addr_t
@@ -286,14 +326,35 @@ windows_find_eprocess(
         }
     }
 
-    if (vmi->init_task) {
-        start_address =
-            vmi->init_task;
+    if (windows->idle_proc) {
+        start_address = windows->idle_proc;
     }
 
     return find_process_by_name(vmi, check, start_address, name);
 }
 
+struct eprocess_search {
+    size_t len;
+    void *value;
+    addr_t found;
+};
+
+static status_t
+eprocess_match(
+        vmi_instance_t vmi,
+        addr_t entry,
+        const void *fields,
+        void *data)
+{
+    struct eprocess_search *search = data;
+
+    if (memcmp(fields, search->value, search->len) == 0) {
+        search->found = entry;
+        return VMI_FAILURE;
+    }
+    return VMI_SUCCESS;
+}
+
 addr_t
 eprocess_list_search(
         vmi_instance_t vmi,
@@ -301,38 +362,27 @@ eprocess_list_search(
         size_t len,
         void *value)
 {
-    addr_t next_process, list_head;
+    addr_t system_process = 0, list_head = 0;
     int tasks_offset;
-    void *buf = alloca(len);
-    addr_t rtnval = 0;
+    uint8_t width = vmi_get_address_width(vmi);
+    struct eprocess_search search = { len, value, 0 };
+    vmi_field_t field = { offset, VMI_FIELD_BYTES, len, 0 };
 
     tasks_offset = vmi_get_offset(vmi, "win_tasks");
 
-    vmi_read_addr_ksym(vmi, "PsInitialSystemProcess", &list_head);
-    vmi_read_addr_va(vmi, list_head + tasks_offset, 0, &next_process);
-    vmi_read_va(vmi, list_head + offset, 0, buf, len);
-    if (memcmp(buf, value, len) == 0) {
-        rtnval = list_head + tasks_offset;
-        goto exit;
+    /* System is the first process, so the Blink of its ActiveProcessLinks
+     * is PsActiveProcessHead, which is where the walk starts and stops
+     */
+    if (VMI_FAILURE == vmi_read_addr_ksym(vmi, "PsInitialSystemProcess", &system_process)
+        || VMI_FAILURE == vmi_read_addr_va(vmi, system_process + tasks_offset + width, 0, &list_head)) {
+        return 0;
     }
-    list_head = next_process;
 
-    while(1) {
-        addr_t tmp_next = 0;
-        vmi_read_addr_va(vmi, next_process, 0, &tmp_next);
-        if (list_head == tmp_next) {
-            break;
-        }
-        vmi_read_va(vmi, next_process + offset - tasks_offset, 0, buf, len);
-        if (memcmp(buf, value, len) == 0) {
-            rtnval = next_process;
-            goto exit;
-        }
-        next_process = tmp_next;
+    vmi_walk_list(vmi, 0, list_head, 0, tasks_offset, &field, 1, eprocess_match, &search);
+    if (search.found) {
+        return search.found + tasks_offset;
     }
-
-exit:
-    return rtnval;
+    return 0;
 }
 
 addr_t
@@ -0,0 +1,176 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libvmi.h"
+#include "private.h"
+#include "peparse.h"
+#include "os/windows/windows.h"
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_HEADER_BYTES 1024
+
+/* The init profile (see libvmi/profile.c) is keyed on the ntoskrnl build, named
+ * the way symbol servers do: PE timestamp followed by the image size.
+ */
+static status_t
+windows_fingerprint(
+    vmi_instance_t vmi,
+    addr_t ntoskrnl,
+    char *fingerprint)
+{
+    uint8_t image[MAX_HEADER_BYTES];
+    struct pe_header *pe_header = NULL;
+    struct optional_header_pe32 *oh_pe32 = NULL;
+    struct optional_header_pe32plus *oh_pe32plus = NULL;
+    uint16_t magic = 0;
+    uint32_t size_of_image = 0;
+
+    if (!ntoskrnl ||
+        VMI_SUCCESS != peparse_get_image_phys(vmi, ntoskrnl, MAX_HEADER_BYTES, image)) {
+        return VMI_FAILURE;
+    }
+
+    peparse_assign_headers(image, NULL, &pe_header, &magic, NULL, &oh_pe32, &oh_pe32plus);
+    if (IMAGE_PE32_MAGIC == magic) {
+        size_of_image = oh_pe32->size_of_image;
+    } else {
+        size_of_image = oh_pe32plus->size_of_image;
+    }
+
+    snprintf(fingerprint, PROFILE_STR_LENGTH, "ntoskrnl:%08X%x",
+             pe_header->time_date_stamp, size_of_image);
+    return VMI_SUCCESS;
+}
+
+void
+windows_profile_save(
+    vmi_instance_t vmi)
+{
+    windows_instance_t windows = vmi->os_data;
+    init_profile_t profile;
+
+    if (!profile_enabled(vmi)) {
+        return;
+    }
+
+    memset(&profile, 0, sizeof(profile));
+    if (VMI_SUCCESS != windows_fingerprint(vmi, windows->ntoskrnl, profile.fingerprint)) {
+        dbprint(VMI_DEBUG_MISC, "--no ntoskrnl header to key the init profile on\n");
+        return;
+    }
+
+    profile.page_mode = vmi->page_mode;
+    profile.kpgd = vmi->kpgd;
+    profile.init_task = vmi->init_task;
+    profile.kernel_boundary = windows->kernel_boundary;
+    profile.kdversion_block = windows->kdversion_block;
+    profile.ntoskrnl = windows->ntoskrnl;
+    profile.ntoskrnl_va = windows->ntoskrnl_va;
+    profile.pname_offset = windows->pname_offset;
+    profile_save(vmi, "windows", &profile);
+}
+
+/* EPROCESS->ImageFileName is a NUL terminated 15 character name */
+static status_t
+windows_pname_check(
+    vmi_instance_t vmi,
+    addr_t kpgd,
+    addr_t eprocess,
+    uint64_t pname_offset)
+{
+    char name[16];
+    addr_t paddr = vmi_pagetable_lookup(vmi, kpgd, eprocess + pname_offset);
+
+    if (!paddr || sizeof(name) != vmi_read_pa(vmi, paddr, name, sizeof(name))) {
+        return VMI_FAILURE;
+    }
+    if (!isprint((unsigned char) name[0]) || !memchr(name, '\0', sizeof(name))) {
+        return VMI_FAILURE;
+    }
+    return VMI_SUCCESS;
+}
+
+/* Uses the init profile if it was saved for this ntoskrnl build and
+ * everything in it still checks out against guest memory.
+ */
+status_t
+windows_profile_restore(
+    vmi_instance_t vmi)
+{
+    windows_instance_t windows = vmi->os_data;
+    page_mode_t page_mode = vmi->page_mode;
+    char fingerprint[PROFILE_STR_LENGTH];
+    init_profile_t profile;
+
+    if (VMI_SUCCESS != profile_load(vmi, "windows", &profile)) {
+        return VMI_FAILURE;
+    }
+
+    if (VMI_SUCCESS != windows_fingerprint(vmi, profile.ntoskrnl, fingerprint)
+        || strcmp(fingerprint, profile.fingerprint)) {
+        dbprint(VMI_DEBUG_MISC, "--init profile is for another ntoskrnl build\n");
+        return VMI_FAILURE;
+    }
+
+    if (VMI_PM_UNKNOWN == profile.page_mode
+        || (VMI_PM_UNKNOWN != page_mode && page_mode != profile.page_mode)) {
+        goto mismatch;
+    }
+    vmi->page_mode = profile.page_mode;
+
+    /* the kernel still has to be mapped where it was */
+    if (!profile.kpgd || !profile.ntoskrnl_va || !profile.init_task
+        || vmi_pagetable_lookup(vmi, profile.kpgd, profile.ntoskrnl_va) != profile.ntoskrnl
+        || !vmi_pagetable_lookup(vmi, profile.kpgd, profile.init_task)) {
+        goto mismatch;
+    }
+
+    /* a KdVersionBlock from the config takes precedence */
+    if (!windows->kdversion_block) {
+        if (VMI_SUCCESS != windows_kdbg_check(vmi, profile.kdversion_block,
+                                              profile.kernel_boundary)) {
+            goto mismatch;
+        }
+        windows->kdversion_block = profile.kdversion_block;
+        windows->kernel_boundary = profile.kernel_boundary;
+    }
+
+    if (!windows->pname_offset && profile.pname_offset
+        && VMI_SUCCESS == windows_pname_check(vmi, profile.kpgd, profile.init_task,
+                                              profile.pname_offset)) {
+        windows->pname_offset = profile.pname_offset;
+    }
+
+    vmi->kpgd = profile.kpgd;
+    vmi->init_task = profile.init_task;
+    windows->ntoskrnl = profile.ntoskrnl;
+    windows->ntoskrnl_va = profile.ntoskrnl_va;
+
+    dbprint(VMI_DEBUG_MISC, "**restored kpgd (0x%.16"PRIx64") and ntoskrnl @ VA 0x%.16"PRIx64" from the init profile.\n",
+            vmi->kpgd, windows->ntoskrnl_va);
+    return VMI_SUCCESS;
+
+mismatch:
+    dbprint(VMI_DEBUG_MISC, "--init profile no longer matches the guest\n");
+    vmi->page_mode = page_mode;
+    v2p_cache_flush(vmi);
+    return VMI_FAILURE;
+}
@@ -22,6 +22,8 @@
 #define OS_WINDOWS_H_
 
 #include "libvmi.h"
+#include <glib.h>
+#include <pthread.h>
 
 struct windows_instance {
     addr_t ntoskrnl; /**< base phys address for ntoskrnl image */
@@ -34,6 +36,8 @@ struct windows_instance {
 
     addr_t sysproc; /**< physical address for the system process */
 
+    addr_t idle_proc; /**< physical address of the Idle process, see find_pname_offset */
+
     uint64_t tasks_offset; /**< EPROCESS->ActiveProcessLinks */
 
     uint64_t pdbase_offset; /**< EPROCESS->Pcb.DirectoryTableBase */
@@ -47,6 +51,12 @@ struct windows_instance {
     uint64_t pname_offset; /**< EPROCESS->ImageFileName */
 
     win_ver_t version; /**< version of Windows */
+
+    GHashTable *export_indexes; /**< PE export indexes by export directory PA */
+
+    GHashTable *export_modules; /**< PE images by base VA and dtb, see peparse.c */
+
+    pthread_mutex_t export_lock; /**< guards export_indexes and export_modules */
 };
 typedef struct windows_instance *windows_instance_t;
 
@@ -64,11 +74,191 @@ windows_export_to_rva(vmi_instance_t vmi, addr_t base_vaddr, vmi_pid_t pid,
 char*
 windows_rva_to_export(vmi_instance_t vmi, addr_t rva, addr_t base_vaddr,
         vmi_pid_t pid);
+void windows_export_index_destroy(windows_instance_t windows);
+status_t windows_teardown(vmi_instance_t vmi);
+void windows_profile_save(vmi_instance_t vmi);
+status_t windows_profile_restore(vmi_instance_t vmi);
 
 typedef int (*check_magic_func)(uint32_t);
 int find_pname_offset(vmi_instance_t vmi, check_magic_func check);
 addr_t windows_find_eprocess_list_pid(vmi_instance_t vmi, vmi_pid_t pid);
 addr_t windows_find_eprocess_list_pgd(vmi_instance_t vmi, addr_t pgd);
 
+/* KdVersionBlock search, see kdbg.c */
+struct _DBGKD_DEBUG_DATA_HEADER64 {
+    uint64_t List[2];
+    uint32_t OwnerTag;
+    uint32_t Size;
+} __attribute__ ((packed));
+typedef struct _DBGKD_DEBUG_DATA_HEADER64 DBGKD_DEBUG_DATA_HEADER64;
+
+struct _KDDEBUGGER_DATA64 {
+    DBGKD_DEBUG_DATA_HEADER64 Header;
+    uint64_t KernBase;
+    uint64_t BreakpointWithStatus;
+    uint64_t SavedContext;
+    uint16_t ThCallbackStack;
+    uint16_t NextCallback;
+    uint16_t FramePointer;
+    uint16_t PaeEnabled;
+    uint64_t KiCallUserMode;
+    uint64_t KeUserCallbackDispatcher;
+    uint64_t PsLoadedModuleList;
+    uint64_t PsActiveProcessHead;
+    uint64_t PspCidTable;
+    uint64_t ExpSystemResourcesList;
+    uint64_t ExpPagedPoolDescriptor;
+    uint64_t ExpNumberOfPagedPools;
+    uint64_t KeTimeIncrement;
+    uint64_t KeBugCheckCallbackListHead;
+    uint64_t KiBugcheckData;
+    uint64_t IopErrorLogListHead;
+    uint64_t ObpRootDirectoryObject;
+    uint64_t ObpTypeObjectType;
+    uint64_t MmSystemCacheStart;
+    uint64_t MmSystemCacheEnd;
+    uint64_t MmSystemCacheWs;
+    uint64_t MmPfnDatabase;
+    uint64_t MmSystemPtesStart;
+    uint64_t MmSystemPtesEnd;
+    uint64_t MmSubsectionBase;
+    uint64_t MmNumberOfPagingFiles;
+    uint64_t MmLowestPhysicalPage;
+    uint64_t MmHighestPhysicalPage;
+    uint64_t MmNumberOfPhysicalPages;
+    uint64_t MmMaximumNonPagedPoolInBytes;
+    uint64_t MmNonPagedSystemStart;
+    uint64_t MmNonPagedPoolStart;
+    uint64_t MmNonPagedPoolEnd;
+    uint64_t MmPagedPoolStart;
+    uint64_t MmPagedPoolEnd;
+    uint64_t MmPagedPoolInformation;
+    uint64_t MmPageSize;
+    uint64_t MmSizeOfPagedPoolInBytes;
+    uint64_t MmTotalCommitLimit;
+    uint64_t MmTotalCommittedPages;
+    uint64_t MmSharedCommit;
+    uint64_t MmDriverCommit;
+    uint64_t MmProcessCommit;
+    uint64_t MmPagedPoolCommit;
+    uint64_t MmExtendedCommit;
+    uint64_t MmZeroedPageListHead;
+    uint64_t MmFreePageListHead;
+    uint64_t MmStandbyPageListHead;
+    uint64_t MmModifiedPageListHead;
+    uint64_t MmModifiedNoWritePageListHead;
+    uint64_t MmAvailablePages;
+    uint64_t MmResidentAvailablePages;
+    uint64_t PoolTrackTable;
+    uint64_t NonPagedPoolDescriptor;
+    uint64_t MmHighestUserAddress;
+    uint64_t MmSystemRangeStart;
+    uint64_t MmUserProbeAddress;
+    uint64_t KdPrintCircularBuffer;
+    uint64_t KdPrintCircularBufferEnd;
+    uint64_t KdPrintWritePointer;
+    uint64_t KdPrintRolloverCount;
+    uint64_t MmLoadedUserImageList;
+    uint64_t NtBuildLab;
+    uint64_t KiNormalSystemCall;
+    uint64_t KiProcessorBlock;
+    uint64_t MmUnloadedDrivers;
+    uint64_t MmLastUnloadedDriver;
+    uint64_t MmTriageActionTaken;
+    uint64_t MmSpecialPoolTag;
+    uint64_t KernelVerifier;
+    uint64_t MmVerifierData;
+    uint64_t MmAllocatedNonPagedPool;
+    uint64_t MmPeakCommitment;
+    uint64_t MmTotalCommitLimitMaximum;
+    uint64_t CmNtCSDVersion;
+    uint64_t MmPhysicalMemoryBlock;
+    uint64_t MmSessionBase;
+    uint64_t MmSessionSize;
+    uint64_t MmSystemParentTablePage;
+    uint64_t MmVirtualTranslationBase;
+    uint16_t OffsetKThreadNextProcessor;
+    uint16_t OffsetKThreadTeb;
+    uint16_t OffsetKThreadKernelStack;
+    uint16_t OffsetKThreadInitialStack;
+    uint16_t OffsetKThreadApcProcess;
+    uint16_t OffsetKThreadState;
+    uint16_t OffsetKThreadBStore;
+    uint16_t OffsetKThreadBStoreLimit;
+    uint16_t SizeEProcess;
+    uint16_t OffsetEprocessPeb;
+    uint16_t OffsetEprocessParentCID;
+    uint16_t OffsetEprocessDirectoryTableBase;
+    uint16_t SizePrcb;
+    uint16_t OffsetPrcbDpcRoutine;
+    uint16_t OffsetPrcbCurrentThread;
+    uint16_t OffsetPrcbMhz;
+    uint16_t OffsetPrcbCpuType;
+    uint16_t OffsetPrcbVendorString;
+    uint16_t OffsetPrcbProcStateContext;
+    uint16_t OffsetPrcbNumber;
+    uint16_t SizeEThread;
+    uint64_t KdPrintCircularBufferPtr;
+    uint64_t KdPrintBufferSize;
+    uint64_t KeLoaderBlock;
+    uint16_t SizePcr;
+    uint16_t OffsetPcrSelfPcr;
+    uint16_t OffsetPcrCurrentPrcb;
+    uint16_t OffsetPcrContainedPrcb;
+    uint16_t OffsetPcrInitialBStore;
+    uint16_t OffsetPcrBStoreLimit;
+    uint16_t OffsetPcrInitialStack;
+    uint16_t OffsetPcrStackLimit;
+    uint16_t OffsetPrcbPcrPage;
+    uint16_t OffsetPrcbProcStateSpecialReg;
+    uint16_t GdtR0Code;
+    uint16_t GdtR0Data;
+    uint16_t GdtR0Pcr;
+    uint16_t GdtR3Code;
+    uint16_t GdtR3Data;
+    uint16_t GdtR3Teb;
+    uint16_t GdtLdt;
+    uint16_t GdtTss;
+    uint16_t Gdt64R3CmCode;
+    uint16_t Gdt64R3CmTeb;
+    uint64_t IopNumTriageDumpDataBlocks;
+    uint64_t IopTriageDumpDataBlocks;
+    uint64_t VfCrashDataBlock;
+} __attribute__ ((packed));
+typedef struct _KDDEBUGGER_DATA64 KDDEBUGGER_DATA64;
+
+struct kdbg_search {
+    pthread_mutex_t lock;
+    int done;
+    addr_t kdvb_pa;
+    addr_t kernel_va_boundary;
+};
+
+typedef status_t (*kdbg_find_func)(vmi_instance_t vmi, struct kdbg_search *search,
+                                   addr_t *kdvb_pa, addr_t *kernel_va_boundary);
+
+struct kdbg_strategy {
+    const char *name;
+    kdbg_find_func find;
+    vmi_instance_t vmi;
+    struct kdbg_search *search;
+    pthread_t thread;
+    int started;
+    int ran;
+    status_t ret;
+    long usec;
+};
+
+int kdbg_cancelled(struct kdbg_search *search);
+status_t kdbg_validate(vmi_instance_t vmi, addr_t kdvb_pa,
+        addr_t kernel_va_boundary);
+status_t find_kdversionblock_address(vmi_instance_t vmi,
+        struct kdbg_search *search, addr_t *kdvb_pa,
+        addr_t *kernel_va_boundary);
+status_t kdbg_run_tier(vmi_instance_t vmi, struct kdbg_search *search,
+        struct kdbg_strategy *strategies, size_t n);
+long kdbg_elapsed(const struct timespec *start);
+status_t windows_kdbg_check(vmi_instance_t vmi, addr_t kdversion_block,
+        addr_t kernel_boundary);
 
 #endif /* OS_WINDOWS_H_ */
@@ -39,11 +39,17 @@
 #include <ctype.h>
 #include <time.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include "debug.h"
 #include "libvmi.h"
 #include "libvmi_extra.h"
 #include "os/os_interface.h"
 
+struct driver_instance;
+struct memory_cache_shard;
+struct v2p_tlb;
+struct ps_cache;
+
 /**
  * @brief LibVMI Instance.
  *
@@ -102,21 +108,53 @@ struct vmi_instance {
 
     GHashTable *v2p_cache;  /**< hash table to hold the v2p cache data */
 
+    struct v2p_tlb *v2p_tlb; /**< set-associative TLB in front of v2p_cache */
+
+    struct ps_cache *ps_cache; /**< cache of upper level page table entries */
+
+    uint32_t v2p_generation; /**< bumped whenever cached translations may be stale */
+
+    v2p_validation_t v2p_validation; /**< how cached translations are checked before use */
+
 #if ENABLE_SHM_SNAPSHOT == 1
     GHashTable *v2m_cache;  /**< hash table to hold the v2m cache data */
 #endif
 
+    pthread_mutex_t pid_cache_lock; /**< guards pid_cache with VMI_INIT_THREADSAFE */
+
+    pthread_mutex_t sym_cache_lock; /**< guards sym_cache with VMI_INIT_THREADSAFE */
+
+    pthread_mutex_t rva_cache_lock; /**< guards rva_cache with VMI_INIT_THREADSAFE */
+
+    pthread_mutex_t v2p_cache_lock; /**< guards v2p_cache with VMI_INIT_THREADSAFE */
+
+#if ENABLE_SHM_SNAPSHOT == 1
+    pthread_mutex_t v2m_cache_lock; /**< guards v2m_cache with VMI_INIT_THREADSAFE */
+#endif
+
     void *driver;           /**< driver-specific information */
 
-    GHashTable *memory_cache;  /**< hash table for memory cache */
+    struct driver_instance *driver_ptrs; /**< driver function table for this instance */
 
-    GList *memory_cache_lru;  /**< list holding the most recently used pages */
+    void *(*memory_cache_get_data) (vmi_instance_t, addr_t, uint32_t); /**< driver callback to fetch a page */
+
+    size_t (*memory_cache_get_data_batch) (vmi_instance_t, const addr_t *, void **, size_t); /**< optional driver callback to fetch many pages at once */
+
+    void (*memory_cache_release_data) (void *, size_t); /**< driver callback to release a page */
+
+    struct memory_cache_shard *memory_cache_shards; /**< memory cache, split by PFN with VMI_INIT_THREADSAFE */
+
+    uint32_t memory_cache_shard_count; /**< number of memory cache shards */
 
     uint32_t memory_cache_age; /**< max age of memory cache entry */
 
-    uint32_t memory_cache_size;/**< current size of memory cache */
+    uint64_t memory_cache_bytes_max; /**< byte budget of memory cache, split across shards */
+
+    uint8_t memory_cache_bytes_set; /**< memory_cache_bytes_max was configured and survives a cache re-init */
+
+    uint8_t *flat_memory; /**< guest physical memory as one host mapping, bypasses the memory cache */
 
-    uint32_t memory_cache_size_max;/**< max size of memory cache */
+    uint64_t flat_memory_size; /**< size of flat_memory in bytes */
 
     unsigned int num_vcpus; /**< number of VCPUs used by this instance */
 
@@ -205,6 +243,27 @@ typedef struct _windows_unicode_string32 {
     vmi_instance_t vmi,
     addr_t addr);
 
+/* Locks are only taken for instances created with VMI_INIT_THREADSAFE */
+static inline void
+vmi_lock(
+    vmi_instance_t vmi,
+    pthread_mutex_t *lock)
+{
+    if (vmi->flags & VMI_INIT_THREADSAFE) {
+        pthread_mutex_lock(lock);
+    }
+}
+
+static inline void
+vmi_unlock(
+    vmi_instance_t vmi,
+    pthread_mutex_t *lock)
+{
+    if (vmi->flags & VMI_INIT_THREADSAFE) {
+        pthread_mutex_unlock(lock);
+    }
+}
+
 /*-------------------------------------
  * cache.c
  */
@@ -259,17 +318,45 @@ typedef struct _windows_unicode_string32 {
     addr_t va,
     addr_t dtb,
     addr_t *pa);
+    status_t v2p_cache_get_page(
+    vmi_instance_t vmi,
+    addr_t va,
+    addr_t dtb,
+    addr_t *pa,
+    page_size_t *size);
     void v2p_cache_set(
     vmi_instance_t vmi,
     addr_t va,
     addr_t dtb,
-    addr_t pa);
+    addr_t pa,
+    page_size_t size);
+    void v2p_cache_set_many(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    const addr_t *va,
+    const addr_t *pa,
+    size_t n,
+    page_size_t size);
     status_t v2p_cache_del(
     vmi_instance_t vmi,
     addr_t va,
     addr_t dtb);
     void v2p_cache_flush(
     vmi_instance_t vmi);
+    status_t ps_cache_get(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t va,
+    uint32_t shift,
+    page_info_t *info);
+    void ps_cache_set(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t va,
+    uint32_t shift,
+    page_info_t *info);
+    void ps_cache_flush(
+    vmi_instance_t vmi);
 #if ENABLE_SHM_SNAPSHOT == 1
     void v2m_cache_init(
     vmi_instance_t vmi);
@@ -313,6 +400,15 @@ typedef struct _windows_unicode_string32 {
     vmi_instance_t vmi,
     addr_t frame_num);
 
+/*-----------------------------------------
+ * read.c
+ */
+    status_t read_va_iov(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    vmi_iovec_t *vec,
+    size_t n);
+
 /*-----------------------------------------
  * strmatch.c
  */
@@ -333,6 +429,56 @@ typedef struct _windows_unicode_string32 {
     unsigned char *y,
     int n);
 
+    typedef void (*multi_match_report_t)(
+    size_t offset,
+    size_t pattern,
+    void *data);
+    void *multi_match_init(
+    const vmi_pattern_t *patterns,
+    size_t n);
+    void multi_match(
+    void *mm,
+    const unsigned char *y,
+    size_t n,
+    size_t limit,
+    multi_match_report_t report,
+    void *data);
+    size_t multi_match_max_len(
+    void *mm);
+    void multi_match_fini(
+    void *mm);
+
+/*-----------------------------------------
+ * profile.c
+ */
+
+#define PROFILE_STR_LENGTH 256
+
+/* kernel facts remembered across attaches, zero when unknown */
+    typedef struct init_profile {
+        char fingerprint[PROFILE_STR_LENGTH]; /**< kernel build, see the OS code */
+        page_mode_t page_mode;
+        addr_t kpgd;
+        addr_t init_task;
+        addr_t kernel_boundary;
+        addr_t kdversion_block; /**< Windows KdVersionBlock VA */
+        addr_t ntoskrnl;        /**< Windows kernel image PA */
+        addr_t ntoskrnl_va;     /**< Windows kernel image VA */
+        addr_t banner;          /**< Linux linux_banner VA */
+        uint64_t pname_offset;
+    } init_profile_t;
+
+    int profile_enabled(
+    vmi_instance_t vmi);
+    status_t profile_load(
+    vmi_instance_t vmi,
+    const char *os,
+    init_profile_t *profile);
+    status_t profile_save(
+    vmi_instance_t vmi,
+    const char *os,
+    const init_profile_t *profile);
+
 /*-----------------------------------------
  * performance.c
  */
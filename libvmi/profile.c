@@ -0,0 +1,243 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Init profiles
+ *
+ * With "profile_cache" set in the config, the facts the OS init code
+ * discovers about a guest kernel are written to <profile_cache>/<name>.profile
+ * as key=value rows.  The next init for the same guest name, OS and memory
+ * size loads them back; the OS code then checks the kernel fingerprint and
+ * the values themselves against guest memory before using any of them. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libvmi.h"
+#include "private.h"
+
+#define PROFILE_ROW_LENGTH (PROFILE_STR_LENGTH + 64)
+
+static const char *page_mode_names[] = { "unknown", "legacy", "pae", "ia32e" };
+
+static const struct {
+    const char *key;
+    size_t offset;
+} profile_fields[] = {
+    { "kpgd", offsetof(init_profile_t, kpgd) },
+    { "init_task", offsetof(init_profile_t, init_task) },
+    { "kernel_boundary", offsetof(init_profile_t, kernel_boundary) },
+    { "kdversion_block", offsetof(init_profile_t, kdversion_block) },
+    { "ntoskrnl", offsetof(init_profile_t, ntoskrnl) },
+    { "ntoskrnl_va", offsetof(init_profile_t, ntoskrnl_va) },
+    { "banner", offsetof(init_profile_t, banner) },
+    { "pname_offset", offsetof(init_profile_t, pname_offset) }
+};
+
+#define PROFILE_FIELDS (sizeof(profile_fields) / sizeof(profile_fields[0]))
+
+static uint64_t *
+profile_field(
+    const init_profile_t *profile,
+    size_t i)
+{
+    return (uint64_t *) ((char *) profile + profile_fields[i].offset);
+}
+
+static const char *
+profile_dir(
+    vmi_instance_t vmi)
+{
+    if (!vmi->config) {
+        return NULL;
+    }
+    return g_hash_table_lookup(vmi->config, "profile_cache");
+}
+
+int
+profile_enabled(
+    vmi_instance_t vmi)
+{
+    return NULL != profile_dir(vmi);
+}
+
+/* the guest name with anything that could leave the directory replaced */
+static char *
+profile_path(
+    vmi_instance_t vmi)
+{
+    const char *dir = profile_dir(vmi);
+    char *path = NULL, *name = NULL;
+    size_t i;
+
+    if (!dir || !vmi->image_type || !vmi->image_type[0]) {
+        return NULL;
+    }
+
+    name = strdup(vmi->image_type);
+    for (i = 0; name[i]; ++i) {
+        if (!isalnum((unsigned char) name[i]) && name[i] != '-' && name[i] != '_'
+            && (name[i] != '.' || !i)) {
+            name[i] = '_';
+        }
+    }
+
+    path = safe_malloc(strlen(dir) + strlen(name) + sizeof("/.profile"));
+    sprintf(path, "%s/%s.profile", dir, name);
+    free(name);
+    return path;
+}
+
+status_t
+profile_load(
+    vmi_instance_t vmi,
+    const char *os,
+    init_profile_t *profile)
+{
+    char row[PROFILE_ROW_LENGTH];
+    char key[64], value[PROFILE_STR_LENGTH];
+    char *path = profile_path(vmi);
+    int os_match = 0, size_match = 0;
+    FILE *f = NULL;
+    size_t i;
+
+    memset(profile, 0, sizeof(init_profile_t));
+    if (!path) {
+        return VMI_FAILURE;
+    }
+
+    f = fopen(path, "r");
+    if (!f) {
+        dbprint(VMI_DEBUG_CORE, "--no init profile at %s\n", path);
+        free(path);
+        return VMI_FAILURE;
+    }
+
+    while (fgets(row, sizeof(row), f)) {
+        if ('#' == row[0] || 2 != sscanf(row, "%63[^=]=%255[^\n]", key, value)) {
+            continue;
+        }
+
+        if (!strcmp(key, "os")) {
+            os_match = !strcmp(value, os);
+        }
+        else if (!strcmp(key, "memsize")) {
+            size_match = (strtoull(value, NULL, 0) == vmi->size);
+        }
+        else if (!strcmp(key, "fingerprint")) {
+            snprintf(profile->fingerprint, PROFILE_STR_LENGTH, "%s", value);
+        }
+        else if (!strcmp(key, "page_mode")) {
+            for (i = 0; i < sizeof(page_mode_names) / sizeof(page_mode_names[0]); ++i) {
+                if (!strcmp(value, page_mode_names[i])) {
+                    profile->page_mode = (page_mode_t) i;
+                }
+            }
+        }
+        else {
+            for (i = 0; i < PROFILE_FIELDS; ++i) {
+                if (!strcmp(key, profile_fields[i].key)) {
+                    *profile_field(profile, i) = strtoull(value, NULL, 0);
+                }
+            }
+        }
+    }
+    fclose(f);
+
+    if (!os_match || !size_match || !profile->fingerprint[0]) {
+        dbprint(VMI_DEBUG_CORE, "--init profile %s belongs to another guest\n", path);
+        memset(profile, 0, sizeof(init_profile_t));
+        free(path);
+        return VMI_FAILURE;
+    }
+
+    dbprint(VMI_DEBUG_CORE, "--loaded init profile %s\n", path);
+    free(path);
+    return VMI_SUCCESS;
+}
+
+/* written next to the profile and renamed over it */
+status_t
+profile_save(
+    vmi_instance_t vmi,
+    const char *os,
+    const init_profile_t *profile)
+{
+    char *path = profile_path(vmi);
+    char *tmp = NULL;
+    FILE *f = NULL;
+    int fd = -1;
+    size_t i;
+
+    if (!path) {
+        return VMI_FAILURE;
+    }
+
+    if (mkdir(profile_dir(vmi), 0755) && EEXIST != errno) {
+        errprint("Failed to create init profile directory %s.\n", profile_dir(vmi));
+        goto error_exit;
+    }
+
+    tmp = safe_malloc(strlen(path) + sizeof(".XXXXXX"));
+    sprintf(tmp, "%s.XXXXXX", path);
+    fd = mkstemp(tmp);
+    if (fd < 0 || !(f = fdopen(fd, "w"))) {
+        errprint("Failed to write init profile %s.\n", path);
+        goto error_exit;
+    }
+
+    fprintf(f, "# LibVMI init profile, safe to delete\n");
+    fprintf(f, "os=%s\n", os);
+    fprintf(f, "memsize=0x%"PRIx64"\n", vmi->size);
+    fprintf(f, "fingerprint=%s\n", profile->fingerprint);
+    if (profile->page_mode < sizeof(page_mode_names) / sizeof(page_mode_names[0])) {
+        fprintf(f, "page_mode=%s\n", page_mode_names[profile->page_mode]);
+    }
+    for (i = 0; i < PROFILE_FIELDS; ++i) {
+        if (*profile_field(profile, i)) {
+            fprintf(f, "%s=0x%"PRIx64"\n", profile_fields[i].key, *profile_field(profile, i));
+        }
+    }
+
+    fd = -1;
+    if (fclose(f) || rename(tmp, path)) {
+        errprint("Failed to write init profile %s.\n", path);
+        goto error_exit;
+    }
+
+    dbprint(VMI_DEBUG_CORE, "--saved init profile %s\n", path);
+    free(tmp);
+    free(path);
+    return VMI_SUCCESS;
+
+error_exit:
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (tmp) {
+        unlink(tmp);
+        free(tmp);
+    }
+    free(path);
+    return VMI_FAILURE;
+}
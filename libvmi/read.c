@@ -27,6 +27,7 @@
 #include "libvmi.h"
 #include "private.h"
 #include "driver/interface.h"
+#include "driver/memory_cache.h"
 #include <string.h>
 #include <wchar.h>
 #include <iconv.h>  // conversion between character sets
@@ -54,6 +55,20 @@ vmi_read_pa(
     addr_t offset = 0;
     size_t buf_offset = 0;
 
+    /* flat backends are one mapping, copy the whole range at once */
+    if (vmi->flat_memory && paddr >= vmi->page_size) {
+        addr_t end = vmi->flat_memory_size & ~((addr_t) vmi->page_size - 1);
+
+        if (paddr >= end) {
+            return 0;
+        }
+        if (count > end - paddr) {
+            count = end - paddr;
+        }
+        memcpy(buf, vmi->flat_memory + paddr, count);
+        return count;
+    }
+
     while (count > 0) {
         size_t read_len = 0;
 
@@ -61,8 +76,10 @@ vmi_read_pa(
         phys_address = paddr + buf_offset;
         pfn = phys_address >> vmi->page_shift;
         offset = (vmi->page_size - 1) & phys_address;
+        memory_cache_lock(vmi, phys_address);
         memory = vmi_read_page(vmi, pfn);
         if (NULL == memory) {
+            memory_cache_unlock(vmi, phys_address);
             return buf_offset;
         }
 
@@ -77,6 +94,7 @@ vmi_read_pa(
         /* do the read */
         memcpy(((char *) buf) + (addr_t) buf_offset,
                memory + (addr_t) offset, read_len);
+        memory_cache_unlock(vmi, phys_address);
 
         /* set variables for next loop */
         count -= read_len;
@@ -86,6 +104,29 @@ vmi_read_pa(
     return buf_offset;
 }
 
+/* number of extents translated per round by vmi_read_va */
+#define READ_VA_EXTENTS 16
+
+/* the page directory of pid, or of the kernel for pid 0 */
+static addr_t
+read_dtb(
+    vmi_instance_t vmi,
+    vmi_pid_t pid)
+{
+    reg_t dtb = 0;
+
+    if (pid) {
+        dtb = vmi_pid_to_dtb(vmi, pid);
+    }
+    else if (vmi->kpgd) {
+        dtb = vmi->kpgd;
+    }
+    else {
+        driver_get_vcpureg(vmi, &dtb, CR3, 0);
+    }
+    return dtb;
+}
+
 size_t
 vmi_read_va(
     vmi_instance_t vmi,
@@ -94,11 +135,10 @@ vmi_read_va(
     void *buf,
     size_t count)
 {
-    unsigned char *memory = NULL;
-    addr_t paddr = 0;
-    addr_t pfn = 0;
-    addr_t offset = 0;
+    vmi_extent_t extents[READ_VA_EXTENTS];
+    addr_t dtb = 0;
     size_t buf_offset = 0;
+    int retried = 0;
 
     if (NULL == buf) {
         dbprint(VMI_DEBUG_READ, "--%s: buf passed as NULL, returning without read\n",
@@ -106,46 +146,511 @@ vmi_read_va(
         return 0;
     }
 
-    while (count > 0) {
-        size_t read_len = 0;
+    /* resolve the address space once for the whole read */
+    dtb = read_dtb(vmi, pid);
 
-        if (pid) {
-            paddr = vmi_translate_uv2p(vmi, vaddr + buf_offset, pid);
+    while (dtb && buf_offset < count) {
+        size_t n = vmi_translate_range(vmi, dtb, vaddr + buf_offset,
+                                       count - buf_offset, extents, READ_VA_EXTENTS);
+        size_t i;
+
+        if (!n) {
+            /* the process may have gone and its pid been reused */
+            if (pid && !retried && VMI_SUCCESS == pid_cache_del(vmi, pid)) {
+                retried = 1;
+                dtb = vmi_pid_to_dtb(vmi, pid);
+                continue;
+            }
+            break;
+        }
+
+        /* each extent is physically contiguous */
+        for (i = 0; i < n; ++i) {
+            size_t len_read = vmi_read_pa(vmi, extents[i].pa,
+                                          ((char *) buf) + buf_offset, extents[i].len);
+
+            buf_offset += len_read;
+            if (len_read != extents[i].len) {
+                return buf_offset;
+            }
+        }
+    }
+
+    return buf_offset;
+}
+
+///////////////////////////////////////////////////////////
+// Structure reads
+
+/* structures up to this size are read into a stack buffer */
+#define READ_STRUCT_STACK 256
+
+static size_t
+field_size(
+    const vmi_field_t *field,
+    uint8_t width)
+{
+    switch (field->type) {
+    case VMI_FIELD_8: return 1;
+    case VMI_FIELD_16: return 2;
+    case VMI_FIELD_32: return 4;
+    case VMI_FIELD_64: return 8;
+    case VMI_FIELD_ADDR: return width;
+    default: return field->size;
+    }
+}
+
+/* the byte range [start, end) of the guest structure covering all fields */
+static status_t
+struct_span(
+    const vmi_field_t *fields,
+    size_t n,
+    uint8_t width,
+    size_t *start,
+    size_t *end)
+{
+    size_t i;
+
+    *start = (size_t) -1;
+    *end = 0;
+    for (i = 0; i < n; ++i) {
+        size_t size = field_size(&fields[i], width);
+
+        if (fields[i].offset < *start) {
+            *start = fields[i].offset;
+        }
+        if (fields[i].offset + size > *end) {
+            *end = fields[i].offset + size;
+        }
+    }
+    return (n && *end > *start) ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+status_t
+vmi_read_struct(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    vmi_pid_t pid,
+    const vmi_field_t *fields,
+    size_t n,
+    void *out)
+{
+    unsigned char stack[READ_STRUCT_STACK];
+    unsigned char *buf = stack;
+    uint8_t width = vmi_get_address_width(vmi);
+    size_t start = 0, end = 0, i;
+    status_t ret = VMI_FAILURE;
+
+    if (VMI_FAILURE == struct_span(fields, n, width, &start, &end)) {
+        return VMI_FAILURE;
+    }
+
+    if (end - start > READ_STRUCT_STACK) {
+        buf = safe_malloc(end - start);
+    }
+    if (end - start != vmi_read_va(vmi, vaddr + start, pid, buf, end - start)) {
+        dbprint(VMI_DEBUG_READ, "--%s: failed to read 0x%"PRIx64"\n", __FUNCTION__, vaddr);
+        goto done;
+    }
+
+    for (i = 0; i < n; ++i) {
+        const unsigned char *src = buf + fields[i].offset - start;
+        unsigned char *dst = ((unsigned char *) out) + fields[i].out_offset;
+
+        if (VMI_FIELD_ADDR == fields[i].type) {
+            addr_t value = 0;
+
+            if (8 == width) {
+                memcpy(&value, src, 8);
+            }
+            else {
+                uint32_t tmp = 0;
+
+                memcpy(&tmp, src, 4);
+                value = tmp;
+            }
+            memcpy(dst, &value, sizeof(addr_t));
         }
         else {
-            paddr = vmi_translate_kv2p(vmi, vaddr + buf_offset);
+            memcpy(dst, src, field_size(&fields[i], width));
         }
+    }
+    ret = VMI_SUCCESS;
 
-        if (!paddr) {
-            return buf_offset;
+done:
+    if (buf != stack) {
+        free(buf);
+    }
+    return ret;
+}
+
+///////////////////////////////////////////////////////////
+// List walking
+
+/* upper bound on the entries visited by vmi_walk_list */
+#define WALK_LIST_MAX_ENTRIES 0x100000
+
+/* frames prefetched ahead of the current list entry */
+#define WALK_LIST_PREFETCH 4
+
+/* translate the next entry and pull its pages into the page cache */
+static void
+walk_list_prefetch(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t vaddr,
+    size_t len)
+{
+    vmi_extent_t extents[WALK_LIST_PREFETCH];
+    addr_t frames[WALK_LIST_PREFETCH];
+    size_t n, i, count = 0;
+
+    n = vmi_translate_range(vmi, dtb, vaddr, len, extents, WALK_LIST_PREFETCH);
+    for (i = 0; i < n && count < WALK_LIST_PREFETCH; ++i) {
+        addr_t frame = extents[i].pa & ~((addr_t) vmi->page_size - 1);
+        addr_t last = extents[i].pa + extents[i].len - 1;
+
+        for (; frame <= last && count < WALK_LIST_PREFETCH; frame += vmi->page_size) {
+            frames[count++] = frame;
         }
+    }
+    memory_cache_prefetch(vmi, frames, count);
+}
 
-        /* access the memory */
-        pfn = paddr >> vmi->page_shift;
-        offset = (vmi->page_size - 1) & paddr;
-        memory = vmi_read_page(vmi, pfn);
-        if (NULL == memory) {
-            return buf_offset;
+status_t
+vmi_walk_list(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    addr_t head,
+    size_t next_offset,
+    size_t entry_offset,
+    const vmi_field_t *fields,
+    size_t n,
+    list_entry_callback_t callback,
+    void *data)
+{
+    vmi_field_t *all = NULL;
+    unsigned char *out = NULL;
+    uint8_t width = vmi_get_address_width(vmi);
+    size_t out_size = 0, start = 0, end = 0, i;
+    size_t count = 0, power = 1, steps = 0;
+    addr_t dtb = read_dtb(vmi, pid);
+    addr_t link = 0, next = 0, mark = head;
+    status_t ret = VMI_FAILURE;
+
+    if (!callback || !dtb) {
+        return VMI_FAILURE;
+    }
+    if (VMI_FAILURE == vmi_read_addr_va(vmi, head + next_offset, pid, &link)) {
+        dbprint(VMI_DEBUG_READ, "--%s: failed to read list head 0x%"PRIx64"\n",
+                __FUNCTION__, head);
+        return VMI_FAILURE;
+    }
+
+    /* the forward pointer is read as one more field behind the caller's */
+    for (i = 0; i < n; ++i) {
+        size_t size = (VMI_FIELD_ADDR == fields[i].type) ?
+                      sizeof(addr_t) : field_size(&fields[i], width);
+
+        if (fields[i].out_offset + size > out_size) {
+            out_size = fields[i].out_offset + size;
         }
+    }
+    out_size = (out_size + sizeof(addr_t) - 1) & ~(sizeof(addr_t) - 1);
 
-        /* determine how much we can read */
-        if ((offset + count) > vmi->page_size) {
-            read_len = vmi->page_size - offset;
+    all = safe_malloc((n + 1) * sizeof(vmi_field_t));
+    if (n) {
+        memcpy(all, fields, n * sizeof(vmi_field_t));
+    }
+    all[n] = (vmi_field_t) { entry_offset + next_offset, VMI_FIELD_ADDR, 0, out_size };
+    out = safe_malloc(out_size + sizeof(addr_t));
+    memset(out, 0, out_size + sizeof(addr_t));
+    struct_span(all, n + 1, width, &start, &end);
+
+    while (link != head) {
+        addr_t entry = link - entry_offset;
+
+        if (!link) {
+            dbprint(VMI_DEBUG_READ, "--%s: NULL link in list at 0x%"PRIx64"\n", __FUNCTION__, head);
+            goto done;
         }
-        else {
-            read_len = count;
+        if (++count > WALK_LIST_MAX_ENTRIES) {
+            errprint("%s: list at 0x%"PRIx64" has too many entries\n", __FUNCTION__, head);
+            goto done;
         }
 
-        /* do the read */
-        memcpy(((char *) buf) + (addr_t) buf_offset,
-               memory + (addr_t) offset, read_len);
+        /* Brent's algorithm: a loop that never returns to head comes
+         * back to the link remembered at the last power of two */
+        if (link == mark) {
+            errprint("%s: list at 0x%"PRIx64" loops at 0x%"PRIx64"\n", __FUNCTION__, head, link);
+            goto done;
+        }
+        if (++steps == power) {
+            mark = link;
+            power <<= 1;
+            steps = 0;
+        }
 
-        /* set variables for next loop */
-        count -= read_len;
-        buf_offset += read_len;
+        if (VMI_FAILURE == vmi_read_struct(vmi, entry, pid, all, n + 1, out)) {
+            goto done;
+        }
+        memcpy(&next, out + out_size, sizeof(addr_t));
+
+        if (next && next != head) {
+            walk_list_prefetch(vmi, dtb, next - entry_offset + start, end - start);
+        }
+        if (VMI_FAILURE == callback(vmi, entry, out, data)) {
+            goto done;
+        }
+        link = next;
     }
+    ret = VMI_SUCCESS;
 
-    return buf_offset;
+done:
+    free(all);
+    free(out);
+    return ret;
+}
+
+///////////////////////////////////////////////////////////
+// Borrowed pages
+
+const void *
+vmi_map_pa(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    size_t *len,
+    vmi_pin_t *pin)
+{
+    addr_t offset = paddr & (vmi->page_size - 1);
+    addr_t frame = paddr - offset;
+    unsigned char *memory = NULL;
+
+    *pin = NULL;
+    if (vmi->flat_memory) {
+        /* all of memory stays mapped, nothing to pin */
+        memory = vmi_read_page(vmi, frame >> vmi->page_shift);
+    }
+    else if (frame) {
+        memory = memory_cache_pin(vmi, frame, (void **) pin);
+    }
+
+    if (NULL == memory) {
+        dbprint(VMI_DEBUG_READ, "--%s: failed to map 0x%"PRIx64"\n", __FUNCTION__, paddr);
+        return NULL;
+    }
+    if (len) {
+        *len = vmi->page_size - offset;
+    }
+    return memory + offset;
+}
+
+const void *
+vmi_map_va(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    vmi_pid_t pid,
+    size_t *len,
+    vmi_pin_t *pin)
+{
+    addr_t paddr = 0;
+
+    if (pid) {
+        paddr = vmi_translate_uv2p(vmi, vaddr, pid);
+    }
+    else {
+        paddr = vmi_translate_kv2p(vmi, vaddr);
+    }
+
+    if (!paddr) {
+        *pin = NULL;
+        return NULL;
+    }
+    return vmi_map_pa(vmi, paddr, len, pin);
+}
+
+void
+vmi_unmap(
+    vmi_instance_t vmi,
+    vmi_pin_t pin)
+{
+    memory_cache_unpin(vmi, pin);
+}
+
+///////////////////////////////////////////////////////////
+// Vectored reads
+
+/* the part of one request that falls into a single physical page */
+struct iov_piece {
+    addr_t pa;
+    size_t req;
+    size_t offset;
+    size_t len;
+};
+
+static int
+iov_piece_compare(
+    const void *a,
+    const void *b)
+{
+    const struct iov_piece *x = a;
+    const struct iov_piece *y = b;
+
+    return (x->pa > y->pa) - (x->pa < y->pa);
+}
+
+static void
+iov_add_pieces(
+    vmi_instance_t vmi,
+    GArray *pieces,
+    addr_t pa,
+    size_t req,
+    size_t offset,
+    size_t len)
+{
+    while (len > 0) {
+        struct iov_piece piece = { pa, req, offset, len };
+        size_t room = vmi->page_size - (pa & (vmi->page_size - 1));
+
+        if (piece.len > room) {
+            piece.len = room;
+        }
+        g_array_append_val(pieces, piece);
+
+        pa += piece.len;
+        offset += piece.len;
+        len -= piece.len;
+    }
+}
+
+/* sort the pieces by page, then fetch every page once */
+static status_t
+iov_read_pieces(
+    vmi_instance_t vmi,
+    GArray *pieces,
+    vmi_iovec_t *vec,
+    size_t n)
+{
+    struct iov_piece *piece = (struct iov_piece *) pieces->data;
+    addr_t page_mask = ~((addr_t) vmi->page_size - 1);
+    size_t count = pieces->len;
+    addr_t *frames = NULL;
+    size_t i, j, pages = 0;
+    status_t ret = VMI_SUCCESS;
+
+    qsort(piece, count, sizeof(struct iov_piece), iov_piece_compare);
+
+    /* let backends that map many pages per call fetch them up front */
+    frames = safe_malloc((count ? count : 1) * sizeof(addr_t));
+    for (i = 0; i < count; ++i) {
+        addr_t frame = piece[i].pa & page_mask;
+
+        if (!pages || frames[pages - 1] != frame) {
+            frames[pages++] = frame;
+        }
+    }
+    memory_cache_prefetch(vmi, frames, pages);
+    free(frames);
+
+    for (i = 0; i < count; i = j) {
+        addr_t frame = piece[i].pa & page_mask;
+        unsigned char *memory = NULL;
+
+        memory_cache_lock(vmi, frame);
+        memory = vmi_read_page(vmi, frame >> vmi->page_shift);
+        for (j = i; j < count && (piece[j].pa & page_mask) == frame; ++j) {
+            if (memory) {
+                memcpy(((char *) vec[piece[j].req].buf) + piece[j].offset,
+                       memory + (piece[j].pa & ~page_mask), piece[j].len);
+            }
+            else {
+                vec[piece[j].req].status = VMI_FAILURE;
+            }
+        }
+        memory_cache_unlock(vmi, frame);
+    }
+
+    for (i = 0; i < n; ++i) {
+        if (VMI_SUCCESS != vec[i].status) {
+            ret = VMI_FAILURE;
+        }
+    }
+    return ret;
+}
+
+status_t
+vmi_read_pa_iov(
+    vmi_instance_t vmi,
+    vmi_iovec_t *vec,
+    size_t n)
+{
+    GArray *pieces = g_array_new(FALSE, FALSE, sizeof(struct iov_piece));
+    status_t ret = VMI_FAILURE;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        vec[i].status = VMI_SUCCESS;
+        iov_add_pieces(vmi, pieces, vec[i].addr, i, 0, vec[i].len);
+    }
+
+    ret = iov_read_pieces(vmi, pieces, vec, n);
+    g_array_free(pieces, TRUE);
+    return ret;
+}
+
+status_t
+read_va_iov(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    vmi_iovec_t *vec,
+    size_t n)
+{
+    GArray *pieces = g_array_new(FALSE, FALSE, sizeof(struct iov_piece));
+    vmi_extent_t extents[READ_VA_EXTENTS];
+    status_t ret = VMI_FAILURE;
+    size_t i, k;
+
+    for (i = 0; i < n; ++i) {
+        size_t done = 0;
+
+        vec[i].status = VMI_SUCCESS;
+        while (done < vec[i].len) {
+            size_t count = vmi_translate_range(vmi, dtb, vec[i].addr + done,
+                                               vec[i].len - done, extents, READ_VA_EXTENTS);
+
+            if (!count) {
+                vec[i].status = VMI_FAILURE;
+                break;
+            }
+            for (k = 0; k < count; ++k) {
+                iov_add_pieces(vmi, pieces, extents[k].pa, i, done, extents[k].len);
+                done += extents[k].len;
+            }
+        }
+    }
+
+    ret = iov_read_pieces(vmi, pieces, vec, n);
+    g_array_free(pieces, TRUE);
+    return ret;
+}
+
+status_t
+vmi_read_va_iov(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    vmi_iovec_t *vec,
+    size_t n)
+{
+    addr_t dtb = read_dtb(vmi, pid);
+    size_t i;
+
+    if (!dtb) {
+        for (i = 0; i < n; ++i) {
+            vec[i].status = VMI_FAILURE;
+        }
+        return VMI_FAILURE;
+    }
+    return read_va_iov(vmi, dtb, vec, n);
 }
 
 #if ENABLE_SHM_SNAPSHOT == 1
@@ -412,8 +917,10 @@ vmi_read_str_va(
         /* access the memory */
         pfn = paddr >> vmi->page_shift;
         offset = (vmi->page_size - 1) & paddr;
+        memory_cache_lock(vmi, paddr);
         memory = vmi_read_page(vmi, pfn);
         if (NULL == memory) {
+            memory_cache_unlock(vmi, paddr);
             return rtnval;
         }
 
@@ -433,6 +940,7 @@ vmi_read_str_va(
          */
         rtnval = realloc(rtnval, len + 1 + read_len);
         memcpy(&rtnval[len], &memory[offset], read_len);
+        memory_cache_unlock(vmi, paddr);
         len += read_len;
         rtnval[len] = '\0';
     }
@@ -0,0 +1,334 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libvmi.h"
+#include "private.h"
+
+/* bytes of match start addresses searched per chunk */
+#define SCAN_CHUNK_SIZE (1024 * 1024)
+
+#define SCAN_MAX_WORKERS 8
+
+/* chunks each worker may search ahead of the callbacks */
+#define SCAN_AHEAD 2
+
+struct scan_match {
+    addr_t paddr;
+    size_t pattern;
+};
+
+struct scan_slot {
+    int done;
+    GArray *matches;
+};
+
+struct scan {
+    vmi_instance_t vmi;
+    void *mm;
+    addr_t start;
+    addr_t end;
+    size_t overlap;     /* longest pattern - 1 */
+    uint64_t chunks;
+    uint64_t next;      /* next chunk to search */
+    uint64_t delivered; /* chunks handed to the callback */
+    size_t window;
+    struct scan_slot *slots;
+    int stop;
+    int serialize;      /* reads must hold io_lock */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_mutex_t io_lock;
+};
+
+struct scan_segment {
+    GArray *matches;
+    addr_t paddr;
+};
+
+static void
+scan_report(
+    size_t offset,
+    size_t pattern,
+    void *data)
+{
+    struct scan_segment *segment = data;
+    struct scan_match match = { segment->paddr + offset, pattern };
+
+    g_array_append_val(segment->matches, match);
+}
+
+static gint
+scan_match_compare(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const struct scan_match *ma = a, *mb = b;
+
+    if (ma->paddr != mb->paddr) {
+        return (ma->paddr < mb->paddr) ? -1 : 1;
+    }
+    return (ma->pattern < mb->pattern) ? -1 : (ma->pattern > mb->pattern);
+}
+
+static size_t
+scan_read(
+    struct scan *scan,
+    addr_t paddr,
+    unsigned char *buf,
+    size_t count)
+{
+    size_t len = 0;
+
+    if (scan->serialize) {
+        pthread_mutex_lock(&scan->io_lock);
+    }
+    len = vmi_read_pa(scan->vmi, paddr, buf, count);
+    if (scan->serialize) {
+        pthread_mutex_unlock(&scan->io_lock);
+    }
+    return len;
+}
+
+/* searches one chunk, splitting it around pages that cannot be read */
+static GArray *
+scan_chunk(
+    struct scan *scan,
+    uint64_t chunk,
+    unsigned char *buf)
+{
+    GArray *matches = g_array_new(FALSE, FALSE, sizeof(struct scan_match));
+    addr_t base = scan->start + chunk * SCAN_CHUNK_SIZE;
+    size_t limit = MIN(SCAN_CHUNK_SIZE, scan->end - base);
+    size_t want = MIN(SCAN_CHUNK_SIZE + scan->overlap, scan->end - base);
+    size_t offset = 0;
+
+    while (offset < limit) {
+        struct scan_segment segment = { matches, base + offset };
+        size_t len = scan_read(scan, base + offset, buf + offset, want - offset);
+
+        if (len) {
+            multi_match(scan->mm, buf + offset, len, limit - offset, scan_report, &segment);
+        }
+        if (offset + len >= want) {
+            break;
+        }
+
+        /* skip the page that failed */
+        offset = ((base + offset + len) & ~((addr_t) VMI_PS_4KB - 1)) + VMI_PS_4KB - base;
+    }
+
+    g_array_sort(matches, scan_match_compare);
+    return matches;
+}
+
+static void *
+scan_worker(
+    void *arg)
+{
+    struct scan *scan = arg;
+    unsigned char *buf = safe_malloc(SCAN_CHUNK_SIZE + scan->overlap);
+
+    pthread_mutex_lock(&scan->lock);
+    for (;;) {
+        uint64_t chunk = 0;
+        GArray *matches = NULL;
+
+        while (!scan->stop && scan->next < scan->chunks
+               && scan->next >= scan->delivered + scan->window) {
+            pthread_cond_wait(&scan->cond, &scan->lock);
+        }
+        if (scan->stop || scan->next >= scan->chunks) {
+            break;
+        }
+        chunk = scan->next++;
+        pthread_mutex_unlock(&scan->lock);
+
+        matches = scan_chunk(scan, chunk, buf);
+
+        pthread_mutex_lock(&scan->lock);
+        scan->slots[chunk % scan->window].matches = matches;
+        scan->slots[chunk % scan->window].done = 1;
+        pthread_cond_broadcast(&scan->cond);
+    }
+    pthread_mutex_unlock(&scan->lock);
+
+    free(buf);
+    return NULL;
+}
+
+static status_t
+scan_deliver(
+    struct scan *scan,
+    GArray *matches,
+    scan_callback_t callback,
+    void *data)
+{
+    status_t ret = VMI_SUCCESS;
+    guint i;
+
+    if (scan->serialize && matches->len) {
+        pthread_mutex_lock(&scan->io_lock);
+    }
+    for (i = 0; i < matches->len && VMI_SUCCESS == ret; ++i) {
+        struct scan_match *match = &g_array_index(matches, struct scan_match, i);
+
+        ret = callback(scan->vmi, match->paddr, match->pattern, data);
+    }
+    if (scan->serialize && matches->len) {
+        pthread_mutex_unlock(&scan->io_lock);
+    }
+    return ret;
+}
+
+static unsigned int
+scan_workers(
+    uint64_t chunks)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus < 1) {
+        cpus = 1;
+    }
+    return (unsigned int) MIN(MIN((uint64_t) cpus, SCAN_MAX_WORKERS), chunks);
+}
+
+status_t
+vmi_scan_pa(
+    vmi_instance_t vmi,
+    addr_t start,
+    addr_t end,
+    const vmi_pattern_t *patterns,
+    size_t n,
+    scan_callback_t callback,
+    void *data)
+{
+    struct scan scan;
+    pthread_t threads[SCAN_MAX_WORKERS];
+    unsigned int workers = 0, started = 0, i = 0;
+    status_t ret = VMI_SUCCESS;
+    uint64_t chunk = 0;
+
+    if (!callback) {
+        return VMI_FAILURE;
+    }
+
+    memset(&scan, 0, sizeof(scan));
+    scan.mm = multi_match_init(patterns, n);
+    if (!scan.mm) {
+        errprint("%s: invalid patterns\n", __FUNCTION__);
+        return VMI_FAILURE;
+    }
+
+    scan.vmi = vmi;
+    scan.start = start;
+    scan.end = MIN(end, vmi_get_memsize(vmi));
+    scan.overlap = multi_match_max_len(scan.mm) - 1;
+    if (scan.end <= scan.start) {
+        multi_match_fini(scan.mm);
+        return VMI_SUCCESS;
+    }
+    scan.chunks = (scan.end - scan.start + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE;
+
+    workers = scan_workers(scan.chunks);
+    dbprint(VMI_DEBUG_READ, "--scanning PA 0x%"PRIx64"-0x%"PRIx64" for %zu patterns, %u workers\n",
+            scan.start, scan.end, n, workers);
+
+    /* a single worker is the calling thread */
+    if (workers < 2) {
+        unsigned char *buf = safe_malloc(SCAN_CHUNK_SIZE + scan.overlap);
+
+        for (chunk = 0; chunk < scan.chunks && VMI_SUCCESS == ret; ++chunk) {
+            GArray *matches = scan_chunk(&scan, chunk, buf);
+
+            ret = scan_deliver(&scan, matches, callback, data);
+            g_array_free(matches, TRUE);
+        }
+        free(buf);
+        multi_match_fini(scan.mm);
+        return ret;
+    }
+
+    scan.window = workers * SCAN_AHEAD;
+    scan.slots = safe_malloc(scan.window * sizeof(struct scan_slot));
+    memset(scan.slots, 0, scan.window * sizeof(struct scan_slot));
+    scan.serialize = !(vmi->flags & VMI_INIT_THREADSAFE);
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.cond, NULL);
+    pthread_mutex_init(&scan.io_lock, NULL);
+
+    for (started = 0; started < workers; ++started) {
+        if (pthread_create(&threads[started], NULL, scan_worker, &scan)) {
+            break;
+        }
+    }
+    if (!started) {
+        errprint("%s: failed to start scan workers\n", __FUNCTION__);
+        ret = VMI_FAILURE;
+        goto done;
+    }
+
+    /* hand the chunks to the callback in address order */
+    for (chunk = 0; chunk < scan.chunks && VMI_SUCCESS == ret; ++chunk) {
+        struct scan_slot *slot = &scan.slots[chunk % scan.window];
+        GArray *matches = NULL;
+
+        pthread_mutex_lock(&scan.lock);
+        while (!slot->done) {
+            pthread_cond_wait(&scan.cond, &scan.lock);
+        }
+        matches = slot->matches;
+        slot->matches = NULL;
+        slot->done = 0;
+        pthread_mutex_unlock(&scan.lock);
+
+        ret = scan_deliver(&scan, matches, callback, data);
+        g_array_free(matches, TRUE);
+
+        pthread_mutex_lock(&scan.lock);
+        scan.delivered++;
+        pthread_cond_broadcast(&scan.cond);
+        pthread_mutex_unlock(&scan.lock);
+    }
+
+    pthread_mutex_lock(&scan.lock);
+    scan.stop = 1;
+    pthread_cond_broadcast(&scan.cond);
+    pthread_mutex_unlock(&scan.lock);
+    for (i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+done:
+    for (i = 0; i < scan.window; ++i) {
+        if (scan.slots[i].matches) {
+            g_array_free(scan.slots[i].matches, TRUE);
+        }
+    }
+    free(scan.slots);
+    pthread_mutex_destroy(&scan.lock);
+    pthread_cond_destroy(&scan.cond);
+    pthread_mutex_destroy(&scan.io_lock);
+    multi_match_fini(scan.mm);
+    return ret;
+}
@@ -28,6 +28,11 @@
 #include "private.h"
 #include <string.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MULTI_MATCH_X86 1
+#endif
+
 // Code below modified from the Handbook of Exact String-Matching Algorithms by
 // Christian Charras and Thierry Lecroq.
 // http://igm.univ-mlv.fr/~lecroq/string/node14.html#SECTION00140
@@ -220,3 +225,294 @@ boyer_moore2(
 
     return -1;
 }
+
+// Multi-pattern search.  Every pattern is indexed by a two byte
+// fingerprint (its "anchor") taken from its least common looking bytes.
+// The haystack is searched for the first bytes of the anchors 16 or 32
+// bytes at a time, a bitmap of anchor pairs filters the hits and only
+// the patterns sharing a surviving anchor are compared in full.
+
+// more distinct anchor bytes than this fall back to the scalar search
+#define MULTI_MATCH_MAX_LEADS 8
+
+typedef struct multi_match_data {
+    size_t n;
+    unsigned char **x;      // patterns
+    size_t *m;              // pattern lengths
+    size_t *anchor;         // offset of the anchor in each pattern
+    uint16_t *pair;         // anchor bytes, first byte high
+    size_t max_len;
+    uint8_t pairs[65536 / 8];   // bitmap of anchor pairs
+    uint8_t singles[256];   // bytes that are a whole pattern
+    uint8_t lead_map[256];  // bytes that start an anchor
+    unsigned char leads[MULTI_MATCH_MAX_LEADS];
+    int nleads;             // -1 when there are too many for the vector search
+} multi_match_data_t;
+
+static int
+byte_rank(
+    unsigned char b)
+{
+    // zero and 0xff fill most of memory, control bytes much of the rest
+    if (b == 0x00 || b == 0xff) {
+        return 0;
+    }
+    return (b < 0x20) ? 1 : 2;
+}
+
+static size_t
+pick_anchor(
+    const unsigned char *x,
+    size_t m)
+{
+    size_t i, best = 0;
+    int best_rank = -1;
+
+    for (i = 0; i + 1 < m; ++i) {
+        // the first byte is what the vector search looks for
+        int rank = 2 * byte_rank(x[i]) + byte_rank(x[i + 1]);
+
+        if (rank > best_rank) {
+            best_rank = rank;
+            best = i;
+        }
+    }
+    return best;
+}
+
+void *
+multi_match_init(
+    const vmi_pattern_t *patterns,
+    size_t n)
+{
+    multi_match_data_t *mm = NULL;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        if (!patterns[i].data || !patterns[i].len) {
+            return NULL;
+        }
+    }
+    if (!n) {
+        return NULL;
+    }
+
+    mm = safe_malloc(sizeof(multi_match_data_t));
+    memset(mm, 0, sizeof(multi_match_data_t));
+    mm->n = n;
+    mm->x = safe_malloc(n * sizeof(unsigned char *));
+    mm->m = safe_malloc(n * sizeof(size_t));
+    mm->anchor = safe_malloc(n * sizeof(size_t));
+    mm->pair = safe_malloc(n * sizeof(uint16_t));
+
+    for (i = 0; i < n; ++i) {
+        unsigned char lead = 0;
+
+        mm->m[i] = patterns[i].len;
+        mm->x[i] = safe_malloc(mm->m[i]);
+        memcpy(mm->x[i], patterns[i].data, mm->m[i]);
+        mm->max_len = MAX(mm->max_len, mm->m[i]);
+
+        if (mm->m[i] == 1) {
+            mm->anchor[i] = 0;
+            mm->pair[i] = 0;
+            mm->singles[mm->x[i][0]] = 1;
+        }
+        else {
+            mm->anchor[i] = pick_anchor(mm->x[i], mm->m[i]);
+            mm->pair[i] = (mm->x[i][mm->anchor[i]] << 8) | mm->x[i][mm->anchor[i] + 1];
+            mm->pairs[mm->pair[i] >> 3] |= 1 << (mm->pair[i] & 7);
+        }
+
+        lead = mm->x[i][mm->anchor[i]];
+        if (!mm->lead_map[lead]) {
+            mm->lead_map[lead] = 1;
+            if (mm->nleads >= 0 && mm->nleads < MULTI_MATCH_MAX_LEADS) {
+                mm->leads[mm->nleads++] = lead;
+            }
+            else {
+                mm->nleads = -1;
+            }
+        }
+    }
+
+    return (void *) mm;
+}
+
+void
+multi_match_fini(
+    void *mm)
+{
+    multi_match_data_t *_mm = (multi_match_data_t *) mm;
+    size_t i;
+
+    for (i = 0; i < _mm->n; ++i) {
+        free(_mm->x[i]);
+    }
+    free(_mm->x);
+    free(_mm->m);
+    free(_mm->anchor);
+    free(_mm->pair);
+    free(_mm);
+}
+
+size_t
+multi_match_max_len(
+    void *mm)
+{
+    return ((multi_match_data_t *) mm)->max_len;
+}
+
+// checks the patterns anchored at y[q]
+static inline void
+multi_match_verify(
+    multi_match_data_t *mm,
+    const unsigned char *y,
+    size_t n,
+    size_t limit,
+    size_t q,
+    multi_match_report_t report,
+    void *data)
+{
+    uint16_t pair = 0;
+    int paired = 0;
+    size_t i;
+
+    if (q + 1 < n) {
+        pair = (y[q] << 8) | y[q + 1];
+        paired = mm->pairs[pair >> 3] & (1 << (pair & 7));
+    }
+    if (!paired && !mm->singles[y[q]]) {
+        return;
+    }
+
+    for (i = 0; i < mm->n; ++i) {
+        size_t start = 0;
+
+        if (mm->m[i] == 1) {
+            if (y[q] != mm->x[i][0]) {
+                continue;
+            }
+        }
+        else if (!paired || mm->pair[i] != pair) {
+            continue;
+        }
+
+        if (q < mm->anchor[i]) {
+            continue;
+        }
+        start = q - mm->anchor[i];
+        if (start >= limit || mm->m[i] > n - start) {
+            continue;
+        }
+        if (!memcmp(y + start, mm->x[i], mm->m[i])) {
+            report(start, i, data);
+        }
+    }
+}
+
+#ifdef MULTI_MATCH_X86
+__attribute__ ((target("avx2")))
+static size_t
+multi_match_avx2(
+    multi_match_data_t *mm,
+    const unsigned char *y,
+    size_t n,
+    size_t limit,
+    multi_match_report_t report,
+    void *data)
+{
+    __m256i leads[MULTI_MATCH_MAX_LEADS];
+    size_t q = 0;
+    int j;
+
+    for (j = 0; j < mm->nleads; ++j) {
+        leads[j] = _mm256_set1_epi8((char) mm->leads[j]);
+    }
+
+    for (q = 0; q + 32 <= n; q += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (y + q));
+        __m256i hits = _mm256_cmpeq_epi8(block, leads[0]);
+        uint32_t mask = 0;
+
+        for (j = 1; j < mm->nleads; ++j) {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, leads[j]));
+        }
+        mask = (uint32_t) _mm256_movemask_epi8(hits);
+        while (mask) {
+            multi_match_verify(mm, y, n, limit, q + __builtin_ctz(mask), report, data);
+            mask &= mask - 1;
+        }
+    }
+    return q;
+}
+
+__attribute__ ((target("sse2")))
+static size_t
+multi_match_sse2(
+    multi_match_data_t *mm,
+    const unsigned char *y,
+    size_t n,
+    size_t limit,
+    multi_match_report_t report,
+    void *data)
+{
+    __m128i leads[MULTI_MATCH_MAX_LEADS];
+    size_t q = 0;
+    int j;
+
+    for (j = 0; j < mm->nleads; ++j) {
+        leads[j] = _mm_set1_epi8((char) mm->leads[j]);
+    }
+
+    for (q = 0; q + 16 <= n; q += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (y + q));
+        __m128i hits = _mm_cmpeq_epi8(block, leads[0]);
+        uint32_t mask = 0;
+
+        for (j = 1; j < mm->nleads; ++j) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, leads[j]));
+        }
+        mask = (uint32_t) _mm_movemask_epi8(hits);
+        while (mask) {
+            multi_match_verify(mm, y, n, limit, q + __builtin_ctz(mask), report, data);
+            mask &= mask - 1;
+        }
+    }
+    return q;
+}
+#endif
+
+// y - pointer to string to search
+// n - len(y)
+// limit - only matches starting below limit are reported
+// Matches are reported in no particular order.
+void
+multi_match(
+    void *mm,
+    const unsigned char *y,
+    size_t n,
+    size_t limit,
+    multi_match_report_t report,
+    void *data)
+{
+    multi_match_data_t *_mm = (multi_match_data_t *) mm;
+    size_t q = 0;
+
+#ifdef MULTI_MATCH_X86
+    if (_mm->nleads > 0) {
+        if (__builtin_cpu_supports("avx2")) {
+            q = multi_match_avx2(_mm, y, n, limit, report, data);
+        }
+        else if (__builtin_cpu_supports("sse2")) {
+            q = multi_match_sse2(_mm, y, n, limit, report, data);
+        }
+    }
+#endif
+
+    for (; q < n; ++q) {
+        if (_mm->lead_map[y[q]]) {
+            multi_match_verify(_mm, y, n, limit, q, report, data);
+        }
+    }
+}
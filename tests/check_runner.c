@@ -65,6 +65,9 @@ main (void)
 #endif
     suite_add_tcase(s, cache_tcase());
     suite_add_tcase(s, get_va_pages_tcase());
+    suite_add_tcase(s, multi_tcase());
+    suite_add_tcase(s, qmp_tcase());
+    suite_add_tcase(s, memaccess_tcase());
 
     /* run the tests */
     SRunner *sr = srunner_create(s);
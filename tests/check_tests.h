@@ -28,9 +28,15 @@
 /* vm name access */
 char *get_testvm();
 
+/* synthetic IA-32e memory image, see test_getvapages.c */
+void make_pagetable_image(char *path);
+
 /* test cases */
 TCase *init_tcase (void);
 TCase *translate_tcase (void);
 TCase *read_tcase (void);
+TCase *multi_tcase (void);
+TCase *qmp_tcase (void);
+TCase *memaccess_tcase (void);
 
 #endif /* CHECK_TESTS_H */
@@ -24,12 +24,17 @@
 
 #include <check.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
+#include <pthread.h>
 #include "../libvmi/libvmi.h"
 #include "check_tests.h"
 #include "../libvmi/private.h"
+#include "../libvmi/driver/memory_cache.h"
 
 /* test cache */
 START_TEST (test_libvmi_cache)
@@ -38,7 +43,7 @@ START_TEST (test_libvmi_cache)
     status_t ret = vmi_init(&vmi, VMI_AUTO | VMI_INIT_COMPLETE, get_testvm());
 
     v2p_cache_flush(vmi);
-    v2p_cache_set(vmi, 0x400000, 0xabcde, 0x3b40a000);
+    v2p_cache_set(vmi, 0x400000, 0xabcde, 0x3b40a000, VMI_PS_4KB);
 
     addr_t pa = 0;
     ret = v2p_cache_get(vmi, 0x880000400000ull, 0xabcde, &pa);
@@ -53,10 +58,517 @@ START_TEST (test_libvmi_cache)
 }
 END_TEST
 
+/* test the software TLB in front of the v2p cache */
+START_TEST (test_libvmi_v2p_tlb)
+{
+    struct vmi_instance instance;
+    vmi_instance_t vmi = &instance;
+    addr_t pa = 0;
+    int i;
+
+    memset(&instance, 0, sizeof(instance));
+    instance.page_shift = 12;
+    instance.page_size = 4096;
+    v2p_cache_init(vmi);
+
+    /* one 2MB entry covers the whole large page */
+    v2p_cache_set(vmi, 0x40201000, 0x1000, 0x80201000, VMI_PS_2MB);
+    for (i = 0; i < 512; ++i) {
+        fail_unless(VMI_SUCCESS == v2p_cache_get(vmi, 0x40200000 + i * 4096 + 8, 0x1000, &pa),
+                    "large page not cached as a whole");
+        fail_unless(pa == 0x80200000 + i * 4096 + 8, "wrong large page translation");
+    }
+    fail_if(VMI_SUCCESS == v2p_cache_get(vmi, 0x40400000, 0x1000, &pa),
+            "hit beyond the large page");
+    fail_if(VMI_SUCCESS == v2p_cache_get(vmi, 0x40200000, 0x2000, &pa),
+            "hit for another dtb");
+
+    /* more 4kB pages than the TLB holds still resolve through the hash */
+    for (i = 1; i <= 4096; ++i) {
+        v2p_cache_set(vmi, (addr_t) i << 12, 0x1000, (addr_t) i << 20, VMI_PS_4KB);
+    }
+    for (i = 1; i <= 4096; ++i) {
+        fail_unless(VMI_SUCCESS == v2p_cache_get(vmi, ((addr_t) i << 12) + 1, 0x1000, &pa)
+                    && pa == ((addr_t) i << 20) + 1, "wrong 4kB translation");
+    }
+
+    v2p_cache_del(vmi, 0x40300000, 0x1000);
+    fail_if(VMI_SUCCESS == v2p_cache_get(vmi, 0x40200000, 0x1000, &pa),
+            "deleted large page still cached");
+
+    /* generation based validation drops translations on resume */
+    vmi_v2pcache_set_validation(vmi, VMI_V2P_VALIDATE_GENERATION);
+    fail_unless(VMI_SUCCESS == v2p_cache_get(vmi, 0x1000, 0x1000, &pa), "entry lost");
+    instance.v2p_generation++;
+    fail_if(VMI_SUCCESS == v2p_cache_get(vmi, 0x1000, 0x1000, &pa),
+            "stale generation still cached");
+
+    v2p_cache_flush(vmi);
+    vmi_v2pcache_set_validation(vmi, VMI_V2P_VALIDATE_ALWAYS);
+    fail_if(VMI_SUCCESS == v2p_cache_get(vmi, 0x2000, 0x1000, &pa),
+            "flush left entries behind");
+
+    v2p_cache_destroy(vmi);
+}
+END_TEST
+
+/* test the paging-structure cache and its invalidation */
+START_TEST (test_libvmi_ps_cache)
+{
+    struct vmi_instance instance;
+    vmi_instance_t vmi = &instance;
+    page_info_t info;
+
+    memset(&instance, 0, sizeof(instance));
+    instance.page_shift = 12;
+    instance.page_size = 4096;
+    pid_cache_init(vmi);
+    v2p_cache_init(vmi);
+
+    memset(&info, 0, sizeof(info));
+    info.l4_a = 0x1000;
+    info.l4_v = 0x2003;
+    info.l3_a = 0x2008;
+    info.l3_v = 0x3003;
+    info.l2_a = 0x3010;
+    info.l2_v = 0x4003;
+    ps_cache_set(vmi, 0x1000, 0x40400000, 21, &info);
+
+    /* any address under the same PDE hits, with the full path */
+    memset(&info, 0, sizeof(info));
+    fail_unless(VMI_SUCCESS == ps_cache_get(vmi, 0x1000, 0x405ff123, 21, &info),
+                "PDE not cached");
+    fail_unless(info.l4_v == 0x2003 && info.l3_a == 0x2008 && info.l2_v == 0x4003,
+                "wrong cached path");
+    fail_if(VMI_SUCCESS == ps_cache_get(vmi, 0x1000, 0x40600000, 21, &info),
+            "hit under another PDE");
+    fail_if(VMI_SUCCESS == ps_cache_get(vmi, 0x1000, 0x40400000, 30, &info),
+            "hit at another level");
+    fail_if(VMI_SUCCESS == ps_cache_get(vmi, 0x2000, 0x40400000, 21, &info),
+            "hit for another dtb");
+
+    v2p_cache_flush(vmi);
+    fail_if(VMI_SUCCESS == ps_cache_get(vmi, 0x1000, 0x40400000, 21, &info),
+            "v2p flush left entries behind");
+
+    ps_cache_set(vmi, 0x1000, 0x40400000, 21, &info);
+    pid_cache_flush(vmi);
+    fail_if(VMI_SUCCESS == ps_cache_get(vmi, 0x1000, 0x40400000, 21, &info),
+            "pid flush left entries behind");
+
+    v2p_cache_destroy(vmi);
+    pid_cache_destroy(vmi);
+}
+END_TEST
+
+/* test which page walks trust cached upper level entries */
+START_TEST (test_libvmi_ps_cache_walk)
+{
+    char path[] = "/tmp/libvmi-pagetable-XXXXXX";
+    vmi_instance_t vmi = NULL;
+    page_info_t info, stale;
+
+    make_pagetable_image(path);
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for page table image");
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+
+    /* a PDE for va 0x5000 that the guest has since replaced */
+    memset(&stale, 0, sizeof(stale));
+    stale.l4_a = 0x1000;
+    stale.l4_v = 0x2003;
+    stale.l3_a = 0x2000;
+    stale.l3_v = 0x3003;
+    stale.l2_a = 0x3000;
+    stale.l2_v = 0x3003;
+
+    /* by default every walk reads the entries again */
+    ps_cache_set(vmi, 0x1000, 0x5000, 21, &stale);
+    fail_unless(0x1000 == vmi_pagetable_lookup(vmi, 0x1000, 0x5000),
+                "walk used a stale PDE");
+    v2p_cache_flush(vmi);
+    fail_unless(0x1000 == vmi_pagetable_lookup(vmi, 0x1000, 0x5000), "walk failed");
+    fail_if(VMI_SUCCESS == ps_cache_get(vmi, 0x1000, 0x5000, 21, &info),
+            "PDE cached without a trusting policy");
+
+    /* trusted policies cache the path, the extended lookup never uses it */
+    vmi_v2pcache_set_validation(vmi, VMI_V2P_VALIDATE_NEVER);
+    v2p_cache_flush(vmi);
+    fail_unless(0x1000 == vmi_pagetable_lookup(vmi, 0x1000, 0x5000), "walk failed");
+    fail_unless(VMI_SUCCESS == ps_cache_get(vmi, 0x1000, 0x5000, 21, &info)
+                && info.l2_v == 0x4003, "PDE not cached");
+    ps_cache_set(vmi, 0x1000, 0x5000, 21, &stale);
+    fail_unless(VMI_SUCCESS == vmi_pagetable_lookup_extended(vmi, 0x1000, 0x5000, &info),
+                "extended lookup failed");
+    fail_unless(info.paddr == 0x1000 && info.l2_a == 0x3000 && info.l2_v == 0x4003
+                && info.l1_v == 0x1003, "extended lookup reported cached entries");
+
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
+/* stand-in driver that fills each page with its frame number */
+static int pages_live = 0;
+
+static void *
+fake_get_memory(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    uint32_t length)
+{
+    void *page = malloc(length);
+
+    memset(page, (int) (paddr >> 12), length);
+    __sync_fetch_and_add(&pages_live, 1);
+    return page;
+}
+
+static void
+fake_release_memory(
+    void *memory,
+    size_t length)
+{
+    if (memory) {
+        free(memory);
+        __sync_fetch_and_sub(&pages_live, 1);
+    }
+}
+
+/* test page cache budget and counters */
+START_TEST (test_libvmi_pagecache)
+{
+    struct vmi_instance instance;
+    vmi_instance_t vmi = &instance;
+    vmi_cache_stats_t stats;
+    uint8_t *page = NULL;
+    int i;
+
+    memset(&instance, 0, sizeof(instance));
+    instance.page_shift = 12;
+    instance.page_size = 4096;
+    memory_cache_init(vmi, fake_get_memory, fake_release_memory, ULONG_MAX);
+    fail_unless(vmi_pagecache_get_limit(vmi) == (uint64_t) MAX_PAGE_CACHE_SIZE * 4096,
+                "wrong default page cache limit");
+    fail_unless(VMI_SUCCESS == vmi_pagecache_set_limit(vmi, 4 * 4096),
+                "failed to set page cache limit");
+    fail_unless(vmi_pagecache_get_limit(vmi) == 4 * 4096, "wrong page cache limit");
+    vmi_pagecache_reset_stats(vmi);
+
+    /* touch pages 1..8 twice */
+    for (i = 1; i <= 8; ++i) {
+        page = memory_cache_insert(vmi, i * 4096);
+        fail_unless(page && page[0] == i, "wrong page returned by page cache");
+        page = memory_cache_insert(vmi, i * 4096);
+        fail_unless(page && page[0] == i, "wrong page returned by page cache");
+    }
+
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.misses == 8, "expected one miss per page");
+    fail_unless(stats.hits == 8, "expected one hit per page");
+    fail_unless(stats.evictions == 4, "expected evictions beyond the budget");
+    fail_unless(stats.entries == 4, "cache holds more pages than the budget");
+    fail_unless(stats.resident_bytes == 4 * 4096, "wrong resident byte count");
+    fail_unless(pages_live == 4, "evicted pages were not released");
+
+    /* shrinking the budget evicts right away */
+    vmi_pagecache_set_limit(vmi, 4096);
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.entries == 1, "shrinking did not evict");
+    fail_unless(stats.resident_bytes == 4096, "wrong resident byte count");
+
+    /* below one page the most recently read page is still kept */
+    memory_cache_insert(vmi, 2 * 4096);
+    vmi_pagecache_set_limit(vmi, 100);
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.entries == 1, "budget below one page emptied the cache");
+    page = memory_cache_insert(vmi, 3 * 4096);
+    fail_unless(page && page[0] == 3, "wrong page returned by page cache");
+    page = memory_cache_insert(vmi, 3 * 4096);
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.entries == 1 && pages_live == 1, "wrong pages kept below one page");
+    fail_unless(0 == vmi_pagecache_get_limit(NULL), "limit without an instance");
+
+    memory_cache_destroy(vmi);
+    fail_unless(pages_live == 0, "pages leaked by memory_cache_destroy");
+
+    /* drivers re-init the cache when switching modes, the budget stays */
+    memory_cache_init(vmi, fake_get_memory, fake_release_memory, ULONG_MAX);
+    fail_unless(vmi_pagecache_get_limit(vmi) == 100, "budget lost on cache re-init");
+    memory_cache_insert(vmi, 1 * 4096);
+    memory_cache_insert(vmi, 2 * 4096);
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.entries == 1, "re-initialized cache ignores the budget");
+    memory_cache_destroy(vmi);
+    fail_unless(pages_live == 0, "pages leaked by memory_cache_destroy");
+}
+END_TEST
+
+/* batch stand-in that cannot map frame 5 */
+static int batch_calls = 0;
+
+static size_t
+fake_get_memory_batch(
+    vmi_instance_t vmi,
+    const addr_t *paddrs,
+    void **data,
+    size_t n)
+{
+    size_t i, mapped = 0;
+
+    batch_calls++;
+    for (i = 0; i < n; ++i) {
+        data[i] = NULL;
+        if ((paddrs[i] >> 12) != 5) {
+            data[i] = fake_get_memory(vmi, paddrs[i], 4096);
+            mapped++;
+        }
+    }
+    return mapped;
+}
+
+/* test fetching the missing pages of a batch with one driver call */
+START_TEST (test_libvmi_pagecache_prefetch)
+{
+    struct vmi_instance instance;
+    vmi_instance_t vmi = &instance;
+    const addr_t paddrs[] = { 1 * 4096, 2 * 4096, 3 * 4096, 5 * 4096 };
+    vmi_cache_stats_t stats;
+    uint8_t *page = NULL;
+
+    memset(&instance, 0, sizeof(instance));
+    instance.page_shift = 12;
+    instance.page_size = 4096;
+    memory_cache_init(vmi, fake_get_memory, fake_release_memory, ULONG_MAX);
+
+    /* without a batch callback prefetching does nothing */
+    memory_cache_prefetch(vmi, paddrs, 4);
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.entries == 0, "prefetched without a batch callback");
+
+    memory_cache_set_batch(vmi, fake_get_memory_batch);
+    memory_cache_insert(vmi, 1 * 4096);
+    memory_cache_prefetch(vmi, paddrs, 4);
+    fail_unless(batch_calls == 1, "expected a single batch call");
+
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.misses == 3, "expected one miss per fetched page");
+    fail_unless(stats.entries == 3, "failed page was cached");
+
+    page = memory_cache_insert(vmi, 3 * 4096);
+    fail_unless(page && page[0] == 3, "wrong prefetched page");
+    page = memory_cache_insert(vmi, 5 * 4096);
+    fail_unless(page && page[0] == 5, "failed page not fetched on its own");
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.hits == 1 && stats.misses == 4, "wrong counters after prefetch");
+
+    memory_cache_destroy(vmi);
+    fail_unless(pages_live == 0, "pages leaked by memory_cache_destroy");
+}
+END_TEST
+
+/* test that pinned pages survive eviction */
+START_TEST (test_libvmi_pagecache_pin)
+{
+    struct vmi_instance instance;
+    vmi_instance_t vmi = &instance;
+    vmi_cache_stats_t stats;
+    uint8_t *page = NULL;
+    void *pin = NULL;
+    void *pin2 = NULL;
+    int i;
+
+    memset(&instance, 0, sizeof(instance));
+    instance.page_shift = 12;
+    instance.page_size = 4096;
+    memory_cache_init(vmi, fake_get_memory, fake_release_memory, ULONG_MAX);
+    vmi_pagecache_set_limit(vmi, 2 * 4096);
+
+    page = memory_cache_pin(vmi, 1 * 4096, &pin);
+    fail_unless(page && pin && page[0] == 1, "failed to pin page");
+    for (i = 2; i <= 5; ++i) {
+        memory_cache_insert(vmi, i * 4096);
+    }
+
+    /* the pinned page is still mapped and cached */
+    fail_unless(page[4095] == 1, "pinned page was released");
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.entries == 2 && pages_live == 2, "wrong pages kept");
+    fail_unless(memory_cache_insert(vmi, 1 * 4096) == page, "pinned page was evicted");
+
+    /* once unpinned it is evicted like any other page */
+    memory_cache_unpin(vmi, pin);
+    memory_cache_insert(vmi, 6 * 4096);
+    memory_cache_insert(vmi, 7 * 4096);
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.entries == 2 && pages_live == 2, "unpinned page was kept");
+
+    /* drivers re-create the cache when switching modes, a pinned page
+     * stays mapped until it is unpinned */
+    page = memory_cache_pin(vmi, 8 * 4096, &pin);
+    fail_unless(page && pin && page[0] == 8, "failed to pin page");
+    fail_unless(memory_cache_pin(vmi, 8 * 4096, &pin2) == page, "failed to pin page twice");
+    memory_cache_destroy(vmi);
+    fail_unless(pages_live == 1, "pinned page released by memory_cache_destroy");
+    memory_cache_init(vmi, fake_get_memory, fake_release_memory, ULONG_MAX);
+    fail_unless(page[4095] == 8, "pinned page was overwritten");
+    memory_cache_unpin(vmi, pin);
+    fail_unless(pages_live == 1 && page[0] == 8, "page released with a pin left");
+    fail_unless(memory_cache_insert(vmi, 8 * 4096) != NULL, "re-created cache failed");
+    memory_cache_unpin(vmi, pin2);
+    fail_unless(pages_live == 1, "retired page was not released");
+
+    memory_cache_destroy(vmi);
+    fail_unless(pages_live == 0, "pages leaked by memory_cache_destroy");
+}
+END_TEST
+
+/* test that a destroyed cache misses instead of faulting, as it does
+ * after leaving shm-snapshot mode */
+START_TEST (test_libvmi_pagecache_destroyed)
+{
+    struct vmi_instance instance;
+    vmi_instance_t vmi = &instance;
+    const addr_t paddrs[] = { 1 * 4096, 2 * 4096 };
+    void *pin = NULL;
+
+    memset(&instance, 0, sizeof(instance));
+    instance.page_shift = 12;
+    instance.page_size = 4096;
+    memory_cache_init(vmi, fake_get_memory, fake_release_memory, ULONG_MAX);
+    memory_cache_set_batch(vmi, fake_get_memory_batch);
+    fail_unless(NULL != memory_cache_insert(vmi, 1 * 4096), "failed to read page");
+    memory_cache_destroy(vmi);
+
+    memory_cache_lock(vmi, 1 * 4096);
+    fail_unless(NULL == memory_cache_insert(vmi, 1 * 4096), "destroyed cache hit");
+    memory_cache_unlock(vmi, 1 * 4096);
+    fail_unless(NULL == memory_cache_pin(vmi, 2 * 4096, &pin) && NULL == pin,
+                "destroyed cache pinned a page");
+    memory_cache_prefetch(vmi, paddrs, 2);
+    fail_unless(pages_live == 0, "destroyed cache fetched pages");
+}
+END_TEST
+
+#define NUM_THREADS 4
+
+static void *
+pagecache_worker (void *arg)
+{
+    vmi_instance_t vmi = arg;
+    uint8_t *page = NULL;
+    addr_t paddr;
+    int round;
+
+    for (round = 0; round < 2000; ++round) {
+        paddr = ((round % 31) + 1) * 4096;
+        memory_cache_lock(vmi, paddr);
+        page = memory_cache_insert(vmi, paddr);
+        if (!page || page[4095] != (paddr >> 12)) {
+            memory_cache_unlock(vmi, paddr);
+            return arg;
+        }
+        memory_cache_unlock(vmi, paddr);
+    }
+    return NULL;
+}
+
+/* test a sharded page cache with threads evicting each other's pages */
+START_TEST (test_libvmi_pagecache_threadsafe)
+{
+    struct vmi_instance instance;
+    vmi_instance_t vmi = &instance;
+    pthread_t threads[NUM_THREADS];
+    void *result = NULL;
+    int i, failed = 0;
+
+    memset(&instance, 0, sizeof(instance));
+    instance.page_shift = 12;
+    instance.page_size = 4096;
+    instance.flags = VMI_INIT_THREADSAFE;
+    memory_cache_init(vmi, fake_get_memory, fake_release_memory, ULONG_MAX);
+    vmi_pagecache_set_limit(vmi, 16 * 4096);
+
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pthread_create(&threads[i], NULL, pagecache_worker, vmi);
+    }
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pthread_join(threads[i], &result);
+        if (result) {
+            failed = 1;
+        }
+    }
+    fail_if(failed, "concurrent lookups returned wrong pages");
+
+    memory_cache_destroy(vmi);
+    fail_unless(pages_live == 0, "pages leaked by memory_cache_destroy");
+}
+END_TEST
+
+/* test that a flat file image is read without going through the page cache */
+START_TEST (test_libvmi_flat_file)
+{
+    char path[] = "/tmp/libvmi-flat-XXXXXX";
+    unsigned char page[4096];
+    const uint8_t *map = NULL;
+    vmi_instance_t vmi = NULL;
+    vmi_cache_stats_t stats;
+    vmi_pin_t pin = NULL;
+    uint8_t value = 0;
+    size_t len = 0;
+    int fd, i;
+
+    fd = mkstemp(path);
+    fail_unless(fd >= 0, "failed to create memory image");
+    for (i = 0; i < 16; ++i) {
+        memset(page, i, sizeof(page));
+        fail_unless(write(fd, page, sizeof(page)) == sizeof(page),
+                    "failed to write memory image");
+    }
+    close(fd);
+
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for file image");
+    vmi_pagecache_reset_stats(vmi);
+
+    /* frame 0 is never handed out, so start at page 1 */
+    for (i = 1; i < 16; ++i) {
+        fail_unless(VMI_SUCCESS == vmi_read_8_pa(vmi, i * 4096 + 1, &value),
+                    "failed to read file image");
+        fail_unless(value == i, "wrong value read from file image");
+    }
+    fail_unless(VMI_FAILURE == vmi_read_8_pa(vmi, 16 * 4096, &value),
+                "read past the end of the file image");
+
+    /* mapping hands out pointers into the image, no pin needed */
+    map = vmi_map_pa(vmi, 3 * 4096 + 5, &len, &pin);
+    fail_unless(map && map[0] == 3 && len == 4096 - 5 && NULL == pin,
+                "wrong mapping of file image");
+    vmi_unmap(vmi, pin);
+
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.misses == 0 && stats.entries == 0,
+                "flat file image went through the page cache");
+
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
 /* cache test cases */
 TCase *cache_tcase (void)
 {
     TCase *tc_init = tcase_create("LibVMI cache");
     tcase_add_test(tc_init, test_libvmi_cache);
+    tcase_add_test(tc_init, test_libvmi_v2p_tlb);
+    tcase_add_test(tc_init, test_libvmi_ps_cache);
+    tcase_add_test(tc_init, test_libvmi_ps_cache_walk);
+    tcase_add_test(tc_init, test_libvmi_pagecache);
+    tcase_add_test(tc_init, test_libvmi_pagecache_prefetch);
+    tcase_add_test(tc_init, test_libvmi_pagecache_pin);
+    tcase_add_test(tc_init, test_libvmi_pagecache_destroyed);
+    tcase_add_test(tc_init, test_libvmi_pagecache_threadsafe);
+    tcase_add_test(tc_init, test_libvmi_flat_file);
     return tc_init;
 }
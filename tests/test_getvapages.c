@@ -22,12 +22,14 @@
 
 #include <check.h>
 #include "../libvmi/libvmi.h"
+#include "../libvmi/libvmi_extra.h"
 #include "check_tests.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <inttypes.h>
 #include <glib.h>
@@ -72,12 +74,120 @@ START_TEST (test_get_va_pages)
 }
 END_TEST
 
+/* writes a small IA-32e address space into a file image:
+ *   0x1000 PML4, 0x2000 PDPT, 0x3000 PD, 0x4000 PT
+ * mapping three 4kB pages, one 2MB page and one 1GB page */
+void
+make_pagetable_image (char *path)
+{
+    uint64_t tables[5][512];
+    int fd;
+
+    memset(tables, 0, sizeof(tables));
+    tables[1][0] = 0x2000 | 0x3;
+    tables[2][0] = 0x3000 | 0x3;
+    tables[2][1] = 0x40000000 | 0x83;
+    tables[3][0] = 0x4000 | 0x3;
+    tables[3][1] = 0x200000 | 0x83;
+    tables[4][0] = 0x0 | 0x3;
+    tables[4][5] = 0x1000 | 0x3;
+    tables[4][511] = 0x2000 | 0x3;
+
+    fd = mkstemp(path);
+    fail_unless(fd >= 0, "failed to create page table image");
+    fail_unless(write(fd, tables, sizeof(tables)) == sizeof(tables),
+                "failed to write page table image");
+    close(fd);
+}
+
+struct va_page_count {
+    va_page_t pages[8];
+    int count;
+    int stop_after;
+};
+
+static status_t
+count_va_page (vmi_instance_t vmi, addr_t va, page_size_t size, void *data)
+{
+    struct va_page_count *c = data;
+
+    if (c->count < 8) {
+        c->pages[c->count].va = va;
+        c->pages[c->count].size = size;
+    }
+    c->count++;
+    return (c->count == c->stop_after) ? VMI_FAILURE : VMI_SUCCESS;
+}
+
+/* walk a synthetic page table image with and without building a list */
+START_TEST (test_foreach_va_page)
+{
+    char path[] = "/tmp/libvmi-pagetable-XXXXXX";
+    const va_page_t expected[] = {
+        { 0x0, VMI_PS_4KB },
+        { 0x5000, VMI_PS_4KB },
+        { 0x1ff000, VMI_PS_4KB },
+        { 0x200000, VMI_PS_2MB },
+        { 0x40000000, VMI_PS_1GB }
+    };
+    struct va_page_count c;
+    vmi_instance_t vmi = NULL;
+    GSList *list = NULL, *loop = NULL;
+    GArray *array = NULL;
+    int i;
+
+    make_pagetable_image(path);
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for page table image");
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+
+    memset(&c, 0, sizeof(c));
+    fail_unless(VMI_SUCCESS == vmi_foreach_va_page(vmi, 0x1000, count_va_page, &c),
+                "page walk failed");
+    fail_unless(c.count == 5, "wrong number of pages walked");
+    for (i = 0; i < 5; ++i) {
+        fail_unless(c.pages[i].va == expected[i].va
+                    && c.pages[i].size == expected[i].size,
+                    "wrong page walked");
+    }
+
+    /* the callback can end the walk early */
+    memset(&c, 0, sizeof(c));
+    c.stop_after = 2;
+    fail_unless(VMI_FAILURE == vmi_foreach_va_page(vmi, 0x1000, count_va_page, &c),
+                "stopped page walk reported success");
+    fail_unless(c.count == 2, "page walk did not stop");
+
+    array = vmi_get_va_pages_array(vmi, 0x1000);
+    fail_unless(array->len == 5, "wrong number of pages in array");
+    for (i = 0; i < 5; ++i) {
+        fail_unless(g_array_index(array, va_page_t, i).va == expected[i].va,
+                    "wrong page in array");
+    }
+    g_array_free(array, TRUE);
+
+    list = vmi_get_va_pages(vmi, 0x1000);
+    fail_unless(g_slist_length(list) == 5, "wrong number of pages in list");
+    for (i = 0, loop = list; loop; loop = loop->next, ++i) {
+        fail_unless(((va_page_t *) loop->data)->va == expected[i].va,
+                    "wrong page in list");
+        g_free(loop->data);
+    }
+    g_slist_free(list);
+
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
 /* translate test cases */
 TCase *get_va_pages_tcase (void)
 {
     TCase *tc_get_va_pages = tcase_create("LibVMI get_va_pages");
     tcase_set_timeout(tc_get_va_pages, 90);
     tcase_add_test(tc_get_va_pages, test_get_va_pages);
+    tcase_add_test(tc_get_va_pages, test_foreach_va_page);
     return tc_get_va_pages;
 }
 
@@ -25,10 +25,15 @@
 #include <check.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
 #include "../libvmi/libvmi.h"
 #include "check_tests.h"
+#include "../libvmi/private.h"
+#include "../libvmi/peparse.h"
 
 
 /* test init_complete with passed config */
@@ -157,6 +162,578 @@ START_TEST (test_libvmi_init1)
 }
 END_TEST
 
+/* test saving and loading init profiles */
+START_TEST (test_libvmi_init_profile)
+{
+    struct vmi_instance instance;
+    vmi_instance_t vmi = &instance;
+    char dir[] = "/tmp/libvmi-profile-XXXXXX";
+    char path[PATH_MAX];
+    init_profile_t saved, loaded;
+
+    fail_unless(NULL != mkdtemp(dir), "failed to create profile directory");
+    memset(&instance, 0, sizeof(instance));
+    instance.size = 0x10000000;
+    instance.image_type = "../win7";
+    instance.config = g_hash_table_new(g_str_hash, g_str_equal);
+
+    /* profiles are opt-in */
+    fail_if(profile_enabled(vmi), "profiles enabled without profile_cache");
+    fail_if(VMI_SUCCESS == profile_load(vmi, "windows", &loaded),
+            "profile loaded without profile_cache");
+
+    g_hash_table_insert(instance.config, "profile_cache", dir);
+    fail_unless(profile_enabled(vmi), "profile_cache ignored");
+    fail_if(VMI_SUCCESS == profile_load(vmi, "windows", &loaded),
+            "loaded a profile that was never saved");
+
+    memset(&saved, 0, sizeof(saved));
+    strcpy(saved.fingerprint, "ntoskrnl:4CE7951A5DC000");
+    saved.page_mode = VMI_PM_IA32E;
+    saved.kpgd = 0x187000;
+    saved.init_task = 0xfffffa8000c9c040ULL;
+    saved.kernel_boundary = 0xfffff80000000000ULL;
+    saved.kdversion_block = 0xfffff800029f30a0ULL;
+    saved.ntoskrnl = 0x2614000;
+    saved.ntoskrnl_va = 0xfffff80002614000ULL;
+    saved.pname_offset = 0x2e0;
+    fail_unless(VMI_SUCCESS == profile_save(vmi, "windows", &saved),
+                "failed to save profile");
+
+    /* the name cannot leave the directory */
+    snprintf(path, sizeof(path), "%s/_._win7.profile", dir);
+    fail_unless(0 == access(path, R_OK), "profile not saved under its guest name");
+
+    fail_unless(VMI_SUCCESS == profile_load(vmi, "windows", &loaded),
+                "failed to load profile");
+    fail_unless(0 == memcmp(&saved, &loaded, sizeof(saved)),
+                "loaded profile differs from the saved one");
+
+    /* another OS or memory size is another guest */
+    fail_if(VMI_SUCCESS == profile_load(vmi, "linux", &loaded),
+            "loaded the profile of another OS");
+    instance.size += 0x1000;
+    fail_if(VMI_SUCCESS == profile_load(vmi, "windows", &loaded),
+            "loaded the profile of another memory size");
+
+    unlink(path);
+    rmdir(dir);
+    g_hash_table_destroy(instance.config);
+}
+END_TEST
+
+/* synthetic IA-32e image with a decoy KDBG header before a valid one */
+#define KDBG_DECOY_PA 0x1080
+#define KDBG_VALID_PA 0x2080
+#define KDBG_BOUNDARY 0xfffff80000000000ULL
+
+static void
+make_kdbg_image (char *path)
+{
+    uint8_t image[0x3000];
+    KDDEBUGGER_DATA64 kdbg;
+    int fd;
+
+    memset(image, 0, sizeof(image));
+    memset(&kdbg, 0, sizeof(kdbg));
+    kdbg.Header.List[1] = 0xfffff80000000000ULL;
+    memcpy(&kdbg.Header.OwnerTag, "KDBG", 4);
+    kdbg.Header.Size = 0x340;
+
+    /* a stray copy of the header without a kernel around it */
+    memcpy(image + KDBG_DECOY_PA, &kdbg, sizeof(kdbg));
+    kdbg.KernBase = KDBG_BOUNDARY + 0x1000;
+    memcpy(image + KDBG_VALID_PA, &kdbg, sizeof(kdbg));
+
+    fd = mkstemp(path);
+    fail_unless(fd >= 0, "failed to create KDBG image");
+    fail_unless(write(fd, image, sizeof(image)) == sizeof(image),
+                "failed to write KDBG image");
+    close(fd);
+}
+
+static status_t
+find_kdbg_decoy (vmi_instance_t vmi, struct kdbg_search *search,
+                 addr_t *kdvb_pa, addr_t *kernel_va_boundary)
+{
+    *kdvb_pa = KDBG_DECOY_PA;
+    *kernel_va_boundary = KDBG_BOUNDARY;
+    return VMI_SUCCESS;
+}
+
+static status_t
+find_kdbg_valid (vmi_instance_t vmi, struct kdbg_search *search,
+                 addr_t *kdvb_pa, addr_t *kernel_va_boundary)
+{
+    *kdvb_pa = KDBG_VALID_PA;
+    *kernel_va_boundary = KDBG_BOUNDARY;
+    return VMI_SUCCESS;
+}
+
+/* set once find_kdbg_slow saw the search being cancelled */
+static int kdbg_slow_cancelled = 0;
+
+static status_t
+find_kdbg_slow (vmi_instance_t vmi, struct kdbg_search *search,
+                addr_t *kdvb_pa, addr_t *kernel_va_boundary)
+{
+    int i;
+
+    for (i = 0; i < 5000 && !kdbg_cancelled(search); ++i) {
+        usleep(1000);
+    }
+    kdbg_slow_cancelled = kdbg_cancelled(search);
+    return VMI_FAILURE;
+}
+
+static void
+check_kdbg_search (uint32_t flags)
+{
+    char path[] = "/tmp/libvmi-kdbg-XXXXXX";
+    vmi_instance_t vmi = NULL;
+    struct kdbg_search search;
+    addr_t kdvb_pa = 0, boundary = 0;
+
+    make_kdbg_image(path);
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL | flags, path),
+                "vmi_init failed for KDBG image");
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+
+    /* the decoy has the right header but no KernBase */
+    fail_if(VMI_SUCCESS == kdbg_validate(vmi, KDBG_DECOY_PA, KDBG_BOUNDARY),
+            "decoy KDBG accepted");
+    fail_unless(VMI_SUCCESS == kdbg_validate(vmi, KDBG_VALID_PA, KDBG_BOUNDARY),
+                "valid KDBG rejected");
+    fail_if(VMI_SUCCESS == kdbg_validate(vmi, KDBG_VALID_PA, 0),
+            "KDBG accepted outside its kernel");
+    fail_unless(VMI_SUCCESS == windows_kdbg_check(vmi, KDBG_BOUNDARY + KDBG_VALID_PA, KDBG_BOUNDARY),
+                "remembered KDBG rejected");
+    fail_if(VMI_SUCCESS == windows_kdbg_check(vmi, KDBG_BOUNDARY + KDBG_DECOY_PA, KDBG_BOUNDARY),
+            "remembered decoy KDBG accepted");
+
+    /* the physical memory scan skips the decoy */
+    fail_unless(VMI_SUCCESS == find_kdversionblock_address(vmi, NULL, &kdvb_pa, &boundary),
+                "physical memory scan failed");
+    fail_unless(kdvb_pa == KDBG_VALID_PA && boundary == KDBG_BOUNDARY,
+                "physical memory scan found the wrong KDBG");
+
+    /* a rejected candidate does not end the tier, the first valid one does */
+    {
+        struct kdbg_strategy tier[] = {
+            { "decoy", find_kdbg_decoy },
+            { "valid", find_kdbg_valid },
+            { "slow", find_kdbg_slow }
+        };
+
+        memset(&search, 0, sizeof(search));
+        pthread_mutex_init(&search.lock, NULL);
+        kdbg_slow_cancelled = 0;
+        fail_unless(VMI_SUCCESS == kdbg_run_tier(vmi, &search, tier, 3),
+                    "KDBG tier failed");
+        fail_unless(search.done && search.kdvb_pa == KDBG_VALID_PA
+                    && search.kernel_va_boundary == KDBG_BOUNDARY,
+                    "KDBG tier found the wrong KDBG");
+        fail_if(VMI_SUCCESS == tier[0].ret, "decoy strategy won the tier");
+        fail_unless(VMI_SUCCESS == tier[1].ret, "valid strategy lost the tier");
+        fail_if(VMI_SUCCESS == tier[2].ret, "slow strategy won the tier");
+        if (flags & VMI_INIT_THREADSAFE) {
+            /* racing, the losing strategy is stopped by the cancel flag */
+            fail_unless(tier[2].ran && kdbg_slow_cancelled,
+                        "slow strategy was not cancelled");
+        }
+        else {
+            /* in order, the strategies after the winner never run */
+            fail_unless(tier[0].ran && tier[1].ran && !tier[2].ran,
+                        "strategies ran after the search was done");
+        }
+        pthread_mutex_destroy(&search.lock);
+    }
+
+    /* a tier of rejected candidates fails */
+    {
+        struct kdbg_strategy tier[] = {
+            { "decoy", find_kdbg_decoy },
+            { "decoy again", find_kdbg_decoy }
+        };
+
+        memset(&search, 0, sizeof(search));
+        pthread_mutex_init(&search.lock, NULL);
+        fail_if(VMI_SUCCESS == kdbg_run_tier(vmi, &search, tier, 2),
+                "tier of decoys succeeded");
+        fail_if(search.done, "tier of decoys ended the search");
+        pthread_mutex_destroy(&search.lock);
+    }
+
+    vmi_destroy(vmi);
+    unlink(path);
+}
+
+/* test the KdVersionBlock validation and search tiers */
+START_TEST (test_libvmi_init_kdbg)
+{
+    check_kdbg_search(0);
+}
+END_TEST
+
+/* test the racing KdVersionBlock search tiers */
+START_TEST (test_libvmi_init_kdbg_threadsafe)
+{
+    check_kdbg_search(VMI_INIT_THREADSAFE);
+}
+END_TEST
+
+/* synthetic IA-32e kernel image: ntoskrnl headers, KDBG and EPROCESS for
+ * Windows, linux_banner for Linux.  The page tables at 0x1000 map the
+ * kernel 1MB above where it sits in physical memory, the KERNEL_* values
+ * below are physical addresses */
+#define KERNEL_PGD 0x1000
+#define KERNEL_PTE(va) (0x4000 + ((va) >> 12) * 8)
+#define KERNEL_VA(pa) ((pa) + 0x100000)
+#define KERNEL_NTOSKRNL 0x5000
+#define KERNEL_KDBG 0x6080
+#define KERNEL_INIT_TASK 0x6800
+#define KERNEL_PNAME_OFFSET 0x100
+#define KERNEL_BANNER 0x7000
+
+static void
+patch_kernel_image (int fd, addr_t pa, const void *buf, size_t len)
+{
+    fail_unless(pwrite(fd, buf, len, pa) == len, "failed to write kernel image");
+}
+
+static void
+make_kernel_image (char *path)
+{
+    uint64_t entry = 0;
+    struct dos_header dos;
+    struct pe_header pe;
+    struct optional_header_pe32plus oh;
+    KDDEBUGGER_DATA64 kdbg;
+    const char banner[] = "Linux version 3.2.0-test (gcc) #1 SMP\n";
+    int fd = mkstemp(path);
+    addr_t pa;
+
+    fail_unless(fd >= 0, "failed to create kernel image");
+    fail_unless(0 == ftruncate(fd, 0x8000), "failed to size kernel image");
+
+    entry = 0x2000 | 0x3;
+    patch_kernel_image(fd, KERNEL_PGD, &entry, sizeof(entry));
+    entry = 0x3000 | 0x3;
+    patch_kernel_image(fd, 0x2000, &entry, sizeof(entry));
+    entry = 0x4000 | 0x3;
+    patch_kernel_image(fd, 0x3000, &entry, sizeof(entry));
+    for (pa = 0x5000; pa < 0x8000; pa += 0x1000) {
+        entry = pa | 0x3;
+        patch_kernel_image(fd, KERNEL_PTE(KERNEL_VA(pa)), &entry, sizeof(entry));
+    }
+
+    memset(&dos, 0, sizeof(dos));
+    dos.signature = IMAGE_DOS_HEADER;
+    dos.offset_to_pe = 0x80;
+    patch_kernel_image(fd, KERNEL_NTOSKRNL, &dos, sizeof(dos));
+    memset(&pe, 0, sizeof(pe));
+    pe.signature = IMAGE_NT_SIGNATURE;
+    pe.time_date_stamp = 0x4ce7951a;
+    pe.size_of_optional_header = sizeof(oh);
+    patch_kernel_image(fd, KERNEL_NTOSKRNL + 0x80, &pe, sizeof(pe));
+    memset(&oh, 0, sizeof(oh));
+    oh.magic = IMAGE_PE32_PLUS_MAGIC;
+    oh.size_of_image = 0x5dc000;
+    patch_kernel_image(fd, KERNEL_NTOSKRNL + 0x80 + sizeof(pe), &oh, sizeof(oh));
+
+    memset(&kdbg, 0, sizeof(kdbg));
+    kdbg.Header.List[1] = 0xfffff80000000000ULL;
+    memcpy(&kdbg.Header.OwnerTag, "KDBG", 4);
+    kdbg.Header.Size = 0x340;
+    kdbg.KernBase = KERNEL_VA(KERNEL_NTOSKRNL);
+    patch_kernel_image(fd, KERNEL_KDBG, &kdbg, sizeof(kdbg));
+    patch_kernel_image(fd, KERNEL_INIT_TASK + KERNEL_PNAME_OFFSET, "System", 7);
+
+    patch_kernel_image(fd, KERNEL_BANNER, banner, sizeof(banner) - 1);
+    close(fd);
+}
+
+/* a fresh instance on the kernel image with profile_cache set */
+static vmi_instance_t
+open_kernel_image (char *path, char *dir, page_mode_t page_mode)
+{
+    vmi_instance_t vmi = NULL;
+
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for kernel image");
+    vmi->page_mode = page_mode;
+    vmi->config = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(vmi->config, "profile_cache", dir);
+    return vmi;
+}
+
+static void
+close_kernel_image (vmi_instance_t vmi)
+{
+    g_hash_table_destroy(vmi->config);
+    vmi->config = NULL;
+    vmi_destroy(vmi);
+}
+
+static vmi_instance_t
+open_windows_image (char *path, char *dir, page_mode_t page_mode)
+{
+    vmi_instance_t vmi = open_kernel_image(path, dir, page_mode);
+
+    vmi->os_data = calloc(1, sizeof(struct windows_instance));
+    return vmi;
+}
+
+/* restore has to fail and leave the instance as it found it */
+static void
+check_windows_restore_rejected (char *path, char *dir, page_mode_t page_mode,
+                                const char *reason)
+{
+    vmi_instance_t vmi = open_windows_image(path, dir, page_mode);
+    windows_instance_t windows = vmi->os_data;
+
+    fail_if(VMI_SUCCESS == windows_profile_restore(vmi), reason);
+    fail_unless(vmi->page_mode == page_mode, "page mode not restored");
+    fail_unless(!vmi->kpgd && !vmi->init_task && !windows->ntoskrnl_va
+                && !windows->kdversion_block, "rejected profile was used");
+    close_kernel_image(vmi);
+}
+
+/* test that a Windows init profile is only used while it matches the guest */
+START_TEST (test_libvmi_init_profile_windows)
+{
+    char path[] = "/tmp/libvmi-kernel-XXXXXX";
+    char dir[] = "/tmp/libvmi-profile-XXXXXX";
+    char profile[PATH_MAX];
+    const addr_t pe_stamp = KERNEL_NTOSKRNL + 0x80 + offsetof(struct pe_header, time_date_stamp);
+    const uint32_t stamp = 0x4ce7951a, other_stamp = 0x4ce7951b;
+    const uint64_t pte = KERNEL_NTOSKRNL | 0x3, moved_pte = 0x7000 | 0x3;
+    const uint32_t magic = 0x580003;
+    vmi_instance_t vmi = NULL;
+    windows_instance_t windows = NULL;
+    int fd;
+
+    make_kernel_image(path);
+    fail_unless(NULL != mkdtemp(dir), "failed to create profile directory");
+    fd = open(path, O_RDWR);
+    fail_unless(fd >= 0, "failed to open kernel image");
+
+    /* what a complete init found */
+    vmi = open_windows_image(path, dir, VMI_PM_IA32E);
+    windows = vmi->os_data;
+    vmi->kpgd = KERNEL_PGD;
+    vmi->init_task = KERNEL_VA(KERNEL_INIT_TASK);
+    windows->ntoskrnl = KERNEL_NTOSKRNL;
+    windows->ntoskrnl_va = KERNEL_VA(KERNEL_NTOSKRNL);
+    windows->kdversion_block = KERNEL_VA(KERNEL_KDBG);
+    windows->kernel_boundary = KERNEL_VA(0);
+    windows_profile_save(vmi);
+    snprintf(profile, sizeof(profile), "%s/%s.profile", dir, vmi->image_type);
+
+    /* as windows_get_offset("win_pname") does, which scans physical
+     * memory for the Idle process and saves the profile again */
+    patch_kernel_image(fd, 0x7400, &magic, sizeof(magic));
+    patch_kernel_image(fd, 0x7400 + KERNEL_PNAME_OFFSET, "Idle", 5);
+    windows->pname_offset = find_pname_offset(vmi, NULL);
+    fail_unless(windows->pname_offset == KERNEL_PNAME_OFFSET, "wrong pname offset found");
+    fail_unless(windows->idle_proc == 0x7400, "Idle process not found");
+    fail_unless(vmi->init_task == KERNEL_VA(KERNEL_INIT_TASK), "init_task replaced by the Idle PA");
+    windows_profile_save(vmi);
+    close_kernel_image(vmi);
+    fail_unless(0 == access(profile, R_OK), "profile not saved");
+
+    vmi = open_windows_image(path, dir, VMI_PM_UNKNOWN);
+    windows = vmi->os_data;
+    fail_unless(VMI_SUCCESS == windows_profile_restore(vmi), "failed to restore profile");
+    fail_unless(vmi->page_mode == VMI_PM_IA32E && vmi->kpgd == KERNEL_PGD
+                && vmi->init_task == KERNEL_VA(KERNEL_INIT_TASK), "wrong kernel restored");
+    fail_unless(windows->ntoskrnl == KERNEL_NTOSKRNL
+                && windows->ntoskrnl_va == KERNEL_VA(KERNEL_NTOSKRNL)
+                && windows->kdversion_block == KERNEL_VA(KERNEL_KDBG)
+                && windows->kernel_boundary == KERNEL_VA(0)
+                && windows->pname_offset == KERNEL_PNAME_OFFSET, "wrong ntoskrnl restored");
+    close_kernel_image(vmi);
+
+    check_windows_restore_rejected(path, dir, VMI_PM_PAE,
+                                   "restored a profile for another page mode");
+
+    patch_kernel_image(fd, pe_stamp, &other_stamp, sizeof(other_stamp));
+    check_windows_restore_rejected(path, dir, VMI_PM_UNKNOWN,
+                                   "restored a profile for another ntoskrnl build");
+    patch_kernel_image(fd, pe_stamp, &stamp, sizeof(stamp));
+
+    patch_kernel_image(fd, KERNEL_PTE(KERNEL_VA(KERNEL_NTOSKRNL)), &moved_pte, sizeof(moved_pte));
+    check_windows_restore_rejected(path, dir, VMI_PM_UNKNOWN,
+                                   "restored a profile with ntoskrnl mapped elsewhere");
+    patch_kernel_image(fd, KERNEL_PTE(KERNEL_VA(KERNEL_NTOSKRNL)), &pte, sizeof(pte));
+
+    patch_kernel_image(fd, KERNEL_KDBG + offsetof(KDDEBUGGER_DATA64, Header.OwnerTag), "KDBX", 4);
+    check_windows_restore_rejected(path, dir, VMI_PM_UNKNOWN,
+                                   "restored a profile with a broken KdVersionBlock");
+    patch_kernel_image(fd, KERNEL_KDBG + offsetof(KDDEBUGGER_DATA64, Header.OwnerTag), "KDBG", 4);
+
+    /* the image is back to what the profile was saved for */
+    vmi = open_windows_image(path, dir, VMI_PM_UNKNOWN);
+    fail_unless(VMI_SUCCESS == windows_profile_restore(vmi), "failed to restore profile again");
+    close_kernel_image(vmi);
+
+    close(fd);
+    unlink(profile);
+    unlink(path);
+    rmdir(dir);
+}
+END_TEST
+
+static void
+write_sysmap (const char *path, const char *map)
+{
+    FILE *f = fopen(path, "w");
+
+    fail_unless(NULL != f, "failed to create System.map");
+    fail_unless(EOF != fputs(map, f), "failed to write System.map");
+    fclose(f);
+}
+
+static vmi_instance_t
+open_linux_image (char *path, char *dir, page_mode_t page_mode, char *sysmap)
+{
+    vmi_instance_t vmi = open_kernel_image(path, dir, page_mode);
+    linux_instance_t linux_instance = calloc(1, sizeof(struct linux_instance));
+
+    linux_instance->sysmap = sysmap;
+    pthread_mutex_init(&linux_instance->sysmap_lock, NULL);
+    vmi->os_data = linux_instance;
+    return vmi;
+}
+
+static void
+close_linux_image (vmi_instance_t vmi)
+{
+    linux_instance_t linux_instance = vmi->os_data;
+
+    linux_system_map_free(linux_instance);
+    pthread_mutex_destroy(&linux_instance->sysmap_lock);
+    close_kernel_image(vmi);
+}
+
+static void
+check_linux_restore_rejected (char *path, char *dir, page_mode_t page_mode,
+                              char *sysmap, const char *reason)
+{
+    vmi_instance_t vmi = open_linux_image(path, dir, page_mode, sysmap);
+
+    fail_if(VMI_SUCCESS == linux_profile_restore(vmi), reason);
+    fail_unless(vmi->page_mode == page_mode, "page mode not restored");
+    fail_unless(!vmi->kpgd && !vmi->init_task, "rejected profile was used");
+    close_linux_image(vmi);
+}
+
+/* test that a Linux init profile is only used while it matches the guest */
+START_TEST (test_libvmi_init_profile_linux)
+{
+    char path[] = "/tmp/libvmi-kernel-XXXXXX";
+    char dir[] = "/tmp/libvmi-profile-XXXXXX";
+    char sysmap[PATH_MAX], profile[PATH_MAX];
+    const char map[] =
+        "0000000000106800 D init_task\n"
+        "0000000000107000 D linux_banner\n";
+    vmi_instance_t vmi = NULL;
+    linux_instance_t linux_instance = NULL;
+    int fd;
+
+    make_kernel_image(path);
+    fail_unless(NULL != mkdtemp(dir), "failed to create profile directory");
+    snprintf(sysmap, sizeof(sysmap), "%s/System.map", dir);
+    write_sysmap(sysmap, map);
+    fd = open(path, O_RDWR);
+    fail_unless(fd >= 0, "failed to open kernel image");
+
+    vmi = open_linux_image(path, dir, VMI_PM_IA32E, sysmap);
+    vmi->kpgd = KERNEL_PGD;
+    vmi->init_task = KERNEL_VA(KERNEL_INIT_TASK);
+    linux_profile_save(vmi);
+    snprintf(profile, sizeof(profile), "%s/%s.profile", dir, vmi->image_type);
+    close_linux_image(vmi);
+    fail_unless(0 == access(profile, R_OK), "profile not saved");
+
+    /* System.map is left for the first symbol lookup */
+    vmi = open_linux_image(path, dir, VMI_PM_UNKNOWN, sysmap);
+    linux_instance = vmi->os_data;
+    fail_unless(VMI_SUCCESS == linux_profile_restore(vmi), "failed to restore profile");
+    fail_unless(vmi->page_mode == VMI_PM_IA32E && vmi->kpgd == KERNEL_PGD
+                && vmi->init_task == KERNEL_VA(KERNEL_INIT_TASK), "wrong kernel restored");
+    fail_if(linux_instance->sysmap_loaded, "System.map loaded during restore");
+    close_linux_image(vmi);
+
+    check_linux_restore_rejected(path, dir, VMI_PM_PAE, sysmap,
+                                 "restored a profile for another page mode");
+
+    patch_kernel_image(fd, KERNEL_BANNER + 14, "4", 1);
+    check_linux_restore_rejected(path, dir, VMI_PM_UNKNOWN, sysmap,
+                                 "restored a profile for another kernel");
+    patch_kernel_image(fd, KERNEL_BANNER + 14, "3", 1);
+
+    write_sysmap(sysmap, "0000000000106900 D init_task\n"
+                         "0000000000107000 D linux_banner\n"
+                         "0000000000107100 D linux_proc_banner\n");
+    check_linux_restore_rejected(path, dir, VMI_PM_UNKNOWN, sysmap,
+                                 "restored a profile for another System.map");
+
+    close(fd);
+    unlink(sysmap);
+    unlink(profile);
+    unlink(path);
+    rmdir(dir);
+}
+END_TEST
+
+/* test finding a kernel thread, which only has an active_mm, by pgd */
+START_TEST (test_libvmi_linux_active_mm)
+{
+    char path[] = "/tmp/libvmi-kernel-XXXXXX";
+    char dir[] = "/tmp/libvmi-profile-XXXXXX";
+    linux_instance_t linux_instance = NULL;
+    vmi_instance_t vmi = NULL;
+    uint64_t value = 0;
+    uint32_t pid = 42;
+    int fd;
+
+    make_kernel_image(path);
+    fail_unless(NULL != mkdtemp(dir), "failed to create profile directory");
+    fd = open(path, O_RDWR);
+    fail_unless(fd >= 0, "failed to open kernel image");
+
+    /* init_task: a list of its own, mm NULL and active_mm at mm + 8,
+     * with the mm_struct's pgd pointing at the banner page */
+    value = KERNEL_VA(KERNEL_INIT_TASK + 0x10);
+    patch_kernel_image(fd, KERNEL_INIT_TASK + 0x10, &value, sizeof(value));
+    value = KERNEL_VA(0x7800);
+    patch_kernel_image(fd, KERNEL_INIT_TASK + 0x28, &value, sizeof(value));
+    patch_kernel_image(fd, KERNEL_INIT_TASK + 0x30, &pid, sizeof(pid));
+    value = KERNEL_VA(KERNEL_BANNER);
+    patch_kernel_image(fd, 0x7800 + 0x40, &value, sizeof(value));
+    close(fd);
+
+    vmi = open_linux_image(path, dir, VMI_PM_IA32E, NULL);
+    vmi->kpgd = KERNEL_PGD;
+    vmi->init_task = KERNEL_VA(KERNEL_INIT_TASK);
+    linux_instance = vmi->os_data;
+    linux_instance->tasks_offset = 0x10;
+    linux_instance->mm_offset = 0x20;
+    linux_instance->pid_offset = 0x30;
+    linux_instance->pgd_offset = 0x40;
+
+    /* the file driver cannot tell the address width */
+    fail_unless(42 == linux_pgd_to_pid(vmi, KERNEL_BANNER), "kernel thread not found by pgd");
+    fail_unless(KERNEL_BANNER == linux_pid_to_pgd(vmi, 42), "active_mm not used for pgd");
+    close_linux_image(vmi);
+
+    unlink(path);
+    rmdir(dir);
+}
+END_TEST
+
 /* init test cases */
 TCase *init_tcase (void)
 {
@@ -164,5 +741,11 @@ TCase *init_tcase (void)
     tcase_add_test(tc_init, test_libvmi_init1);
     tcase_add_test(tc_init, test_libvmi_init2);
     tcase_add_test(tc_init, test_libvmi_init3);
+    tcase_add_test(tc_init, test_libvmi_init_profile);
+    tcase_add_test(tc_init, test_libvmi_init_profile_windows);
+    tcase_add_test(tc_init, test_libvmi_init_profile_linux);
+    tcase_add_test(tc_init, test_libvmi_linux_active_mm);
+    tcase_add_test(tc_init, test_libvmi_init_kdbg);
+    tcase_add_test(tc_init, test_libvmi_init_kdbg_threadsafe);
     return tc_init;
 }
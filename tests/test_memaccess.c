@@ -0,0 +1,241 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "../libvmi/libvmi.h"
+#include "check_tests.h"
+#include "../libvmi/driver/memaccess.h"
+
+#define FAKE_PAGES 64
+#define FAKE_SIZE (FAKE_PAGES * 4096)
+
+/* The physmem-access thread of the qemu patch, serving a small buffer on
+ * one end of a socketpair.  "classic" answers like the original patch. */
+struct fake_memaccess {
+    int fd;
+    int classic;
+    int batches;
+    uint8_t memory[FAKE_SIZE];
+    pthread_t thread;
+};
+
+static int
+fake_io(
+    int fd,
+    void *buf,
+    size_t length,
+    int out)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (length) {
+        n = out ? write(fd, p, length) : read(fd, p, length);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int
+fake_range(
+    struct fake_memaccess *fake,
+    memaccess_request_t *req,
+    int padded)
+{
+    uint8_t status = 1;
+    uint8_t *zeros = NULL;
+    int ret;
+
+    if (req->address < FAKE_SIZE && req->length <= FAKE_SIZE - req->address) {
+        return fake_io(fake->fd, fake->memory + req->address, req->length, 1)
+            || fake_io(fake->fd, &status, 1, 1);
+    }
+    status = 0;
+    if (!padded) {
+        return fake_io(fake->fd, &status, 1, 1);
+    }
+    zeros = calloc(1, req->length);
+    ret = fake_io(fake->fd, zeros, req->length, 1) || fake_io(fake->fd, &status, 1, 1);
+    free(zeros);
+    return ret;
+}
+
+static void *
+fake_memaccess_serve(
+    void *arg)
+{
+    struct fake_memaccess *fake = arg;
+    memaccess_request_t req, range;
+    uint8_t status;
+    uint8_t buf[FAKE_SIZE];
+    uint64_t i;
+
+    while (!fake_io(fake->fd, &req, sizeof(req), 0) && MEMACCESS_QUIT != req.type) {
+        if (MEMACCESS_READ == req.type) {
+            fake_range(fake, &req, 0);
+        }
+        else if (MEMACCESS_WRITE == req.type) {
+            fake_io(fake->fd, buf, req.length, 0);
+            status = req.address < FAKE_SIZE && req.length <= FAKE_SIZE - req.address;
+            if (status) {
+                memcpy(fake->memory + req.address, buf, req.length);
+            }
+            fake_io(fake->fd, &status, 1, 1);
+        }
+        else if (MEMACCESS_BATCH_READ == req.type && !fake->classic) {
+            fake->batches++;
+            status = 1;
+            if (!req.length) {
+                fake_io(fake->fd, &status, 1, 1);
+            }
+            for (i = 0; i < req.length; ++i) {
+                fake_io(fake->fd, &range, sizeof(range), 0);
+                fake_range(fake, &range, 1);
+            }
+        }
+        else {
+            status = 0;
+            fake_io(fake->fd, &status, 1, 1);
+        }
+    }
+    close(fake->fd);
+    return NULL;
+}
+
+static int
+fake_memaccess_start(
+    struct fake_memaccess *fake,
+    int classic)
+{
+    int fds[2];
+    int i;
+
+    memset(fake, 0, sizeof(*fake));
+    for (i = 0; i < FAKE_SIZE; ++i) {
+        fake->memory[i] = (uint8_t) (i / 4096 + i);
+    }
+    fake->classic = classic;
+    fail_unless(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair() failed");
+    fake->fd = fds[1];
+    pthread_create(&fake->thread, NULL, fake_memaccess_serve, fake);
+    return fds[0];
+}
+
+static void
+fake_memaccess_stop(
+    struct fake_memaccess *fake,
+    int fd)
+{
+    memaccess_quit(fd);
+    pthread_join(fake->thread, NULL);
+    close(fd);
+}
+
+/* single requests, write status checked */
+START_TEST (test_libvmi_memaccess_single)
+{
+    struct fake_memaccess *fake = malloc(sizeof(struct fake_memaccess));
+    int fd = fake_memaccess_start(fake, 1);
+    uint8_t page[4096], data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    fail_unless(0 == memaccess_probe_batch(fd), "classic server took a batch");
+
+    fail_unless(VMI_SUCCESS == memaccess_read(fd, 4096 * 3, page, 4096)
+                && !memcmp(page, fake->memory + 4096 * 3, 4096), "read failed");
+    fail_unless(VMI_FAILURE == memaccess_read(fd, FAKE_SIZE, page, 4096),
+                "read past the end succeeded");
+    fail_unless(VMI_SUCCESS == memaccess_read(fd, 16, page, 8)
+                && !memcmp(page, fake->memory + 16, 8), "stream out of sync after a failed read");
+
+    fail_unless(VMI_SUCCESS == memaccess_write(fd, 100, data, 8), "write failed");
+    fail_unless(VMI_FAILURE == memaccess_write(fd, FAKE_SIZE - 4, data, 8),
+                "write past the end succeeded");
+    fail_unless(VMI_SUCCESS == memaccess_read(fd, 100, page, 8)
+                && !memcmp(page, data, 8), "write not visible");
+
+    fake_memaccess_stop(fake, fd);
+    free(fake);
+}
+END_TEST
+
+/* more ranges than the window holds, scattered, some of them failing */
+START_TEST (test_libvmi_memaccess_batch)
+{
+    struct fake_memaccess *fake = malloc(sizeof(struct fake_memaccess));
+    int fd = fake_memaccess_start(fake, 0);
+    size_t n = MEMACCESS_WINDOW * MEMACCESS_BATCH_MAX * 2 + 17;
+    memaccess_range_t *ranges = calloc(n, sizeof(memaccess_range_t));
+    uint8_t *buf = malloc(n * 4096);
+    uint8_t page[4096];
+    size_t i;
+
+    fail_unless(1 == memaccess_probe_batch(fd), "batch server not detected");
+
+    for (i = 0; i < n; ++i) {
+        /* backwards so replies cannot line up by accident; every 100th
+         * range is past the end of memory */
+        ranges[i].address = (i % 100 == 99) ? FAKE_SIZE + i * 4096
+                            : ((n - i) % FAKE_PAGES) * 4096;
+        ranges[i].length = (i % 7) ? 4096 : 512;
+        ranges[i].buf = buf + i * 4096;
+        memset(ranges[i].buf, 0xcc, ranges[i].length);
+    }
+
+    fail_unless(VMI_SUCCESS == memaccess_read_batch(fd, ranges, n), "batch read failed");
+    for (i = 0; i < n; ++i) {
+        if (i % 100 == 99) {
+            fail_unless(0 == ranges[i].status, "range %zu past the end succeeded", i);
+            continue;
+        }
+        fail_unless(1 == ranges[i].status, "range %zu failed", i);
+        fail_unless(!memcmp(ranges[i].buf, fake->memory + ranges[i].address, ranges[i].length),
+                    "range %zu has the wrong data", i);
+    }
+    fail_unless(fake->batches == 1 + (n + MEMACCESS_BATCH_MAX - 1) / MEMACCESS_BATCH_MAX,
+                "expected the probe plus one batch per %d ranges", MEMACCESS_BATCH_MAX);
+
+    fail_unless(VMI_SUCCESS == memaccess_read(fd, 4096, page, 4096)
+                && !memcmp(page, fake->memory + 4096, 4096), "stream out of sync after a batch");
+
+    fake_memaccess_stop(fake, fd);
+    free(buf);
+    free(ranges);
+    free(fake);
+}
+END_TEST
+
+/* physmem-access socket test cases */
+TCase *memaccess_tcase (void)
+{
+    TCase *tc_memaccess = tcase_create("LibVMI memaccess");
+    tcase_add_test(tc_memaccess, test_libvmi_memaccess_single);
+    tcase_add_test(tc_memaccess, test_libvmi_memaccess_batch);
+    return tc_memaccess;
+}
@@ -0,0 +1,246 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2012 VMITools Project
+ *
+ * Author: Bryan D. Payne (bdpayne@acm.org)
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../libvmi/libvmi.h"
+#include "check_tests.h"
+#include "../libvmi/private.h"
+
+#define NUM_IMAGES 4
+#define IMAGE_PAGES 16
+#define IMAGE_PAGE_SIZE 4096
+#define NUM_THREADS 4
+#define CACHED_PAGES 64
+
+/* write a small memory image where every byte of page i is (id * IMAGE_PAGES + i) */
+static void
+make_image (char *path, int id, int pages)
+{
+    int fd = mkstemp(path);
+    unsigned char page[IMAGE_PAGE_SIZE];
+    int i;
+
+    fail_unless(fd >= 0, "failed to create memory image");
+    for (i = 0; i < pages; ++i) {
+        memset(page, id * IMAGE_PAGES + i, IMAGE_PAGE_SIZE);
+        fail_unless(write(fd, page, IMAGE_PAGE_SIZE) == IMAGE_PAGE_SIZE,
+                    "failed to write memory image");
+    }
+    close(fd);
+}
+
+static int
+check_image (vmi_instance_t vmi, int id)
+{
+    int i;
+
+    /* frame 0 is never handed out by vmi_read_page */
+    for (i = 1; i < IMAGE_PAGES; ++i) {
+        uint8_t value = 0;
+
+        if (VMI_SUCCESS != vmi_read_8_pa(vmi, i * IMAGE_PAGE_SIZE + 7, &value)) {
+            return 0;
+        }
+        if (value != id * IMAGE_PAGES + i) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* several file instances living side by side in one process */
+START_TEST (test_libvmi_multi_file)
+{
+    char paths[NUM_IMAGES][32];
+    vmi_instance_t vmis[NUM_IMAGES];
+    int i, round;
+
+    for (i = 0; i < NUM_IMAGES; ++i) {
+        snprintf(paths[i], sizeof(paths[i]), "/tmp/libvmi-multi-XXXXXX");
+        make_image(paths[i], i, IMAGE_PAGES);
+        fail_unless(VMI_SUCCESS ==
+                    vmi_init(&vmis[i], VMI_FILE | VMI_INIT_PARTIAL, paths[i]),
+                    "vmi_init failed for file image");
+    }
+
+    /* interleave reads so every instance repeatedly hits its own cache */
+    for (round = 0; round < 3; ++round) {
+        for (i = 0; i < NUM_IMAGES; ++i) {
+            fail_unless(check_image(vmis[i], i),
+                        "instance read another instance's memory");
+        }
+    }
+
+    /* tearing down one instance must not disturb the others */
+    vmi_destroy(vmis[0]);
+    for (i = 1; i < NUM_IMAGES; ++i) {
+        fail_unless(check_image(vmis[i], i),
+                    "instance broken by destroying a sibling");
+    }
+
+    for (i = 1; i < NUM_IMAGES; ++i) {
+        vmi_destroy(vmis[i]);
+    }
+    for (i = 0; i < NUM_IMAGES; ++i) {
+        unlink(paths[i]);
+    }
+}
+END_TEST
+
+static void *
+check_image_worker (void *arg)
+{
+    vmi_instance_t vmi = arg;
+    int round;
+
+    for (round = 0; round < 200; ++round) {
+        if (!check_image(vmi, 0)) {
+            return arg;
+        }
+    }
+    return NULL;
+}
+
+/* several threads sharing one VMI_INIT_THREADSAFE instance on the flat mapping */
+START_TEST (test_libvmi_threadsafe_file)
+{
+    char path[32];
+    vmi_instance_t vmi = NULL;
+    pthread_t threads[NUM_THREADS];
+    void *result = NULL;
+    int i, failed = 0;
+
+    snprintf(path, sizeof(path), "/tmp/libvmi-multi-XXXXXX");
+    make_image(path, 0, IMAGE_PAGES);
+    fail_unless(VMI_SUCCESS ==
+                vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL | VMI_INIT_THREADSAFE, path),
+                "vmi_init failed for file image");
+
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pthread_create(&threads[i], NULL, check_image_worker, vmi);
+    }
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pthread_join(threads[i], &result);
+        if (result) {
+            failed = 1;
+        }
+    }
+    fail_if(failed, "concurrent reads returned wrong data");
+
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
+static void *
+cached_image_worker (void *arg)
+{
+    vmi_instance_t vmi = arg;
+    const uint8_t *map = NULL;
+    vmi_pin_t pin = NULL;
+    size_t len = 0;
+    uint8_t value = 0;
+    int round, i;
+
+    for (round = 0; round < 50; ++round) {
+        for (i = 1; i < CACHED_PAGES; ++i) {
+            /* keep a page pinned while other threads evict its shard */
+            if (!(i % 5)) {
+                map = vmi_map_pa(vmi, i * IMAGE_PAGE_SIZE, &len, &pin);
+                if (!map || !pin || map[0] != i) {
+                    return arg;
+                }
+            }
+            if (VMI_SUCCESS != vmi_read_8_pa(vmi, ((i * 7) % (CACHED_PAGES - 1) + 1) * IMAGE_PAGE_SIZE + 9, &value)
+                || value != (i * 7) % (CACHED_PAGES - 1) + 1) {
+                return arg;
+            }
+            if (!(i % 5)) {
+                if (map[IMAGE_PAGE_SIZE - 1] != i) {
+                    return arg;
+                }
+                vmi_unmap(vmi, pin);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* several threads sharing the sharded page cache of one instance */
+START_TEST (test_libvmi_threadsafe_cache)
+{
+    char path[32];
+    vmi_instance_t vmi = NULL;
+    vmi_cache_stats_t stats;
+    pthread_t threads[NUM_THREADS];
+    void *result = NULL;
+    int i, failed = 0;
+
+    snprintf(path, sizeof(path), "/tmp/libvmi-multi-XXXXXX");
+    make_image(path, 0, CACHED_PAGES);
+    fail_unless(VMI_SUCCESS ==
+                vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL | VMI_INIT_THREADSAFE |
+                         VMI_INIT_PAGECACHE, path),
+                "vmi_init failed for file image");
+
+    /* without the flat mapping every read goes through the page cache;
+     * a budget of one page per shard keeps the shards evicting */
+    fail_unless(NULL == vmi->flat_memory, "flat mapping used with VMI_INIT_PAGECACHE");
+    vmi_pagecache_set_limit(vmi, 16 * IMAGE_PAGE_SIZE);
+    vmi_pagecache_reset_stats(vmi);
+
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pthread_create(&threads[i], NULL, cached_image_worker, vmi);
+    }
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pthread_join(threads[i], &result);
+        if (result) {
+            failed = 1;
+        }
+    }
+    fail_if(failed, "concurrent cached reads returned wrong data");
+
+    vmi_pagecache_get_stats(vmi, &stats);
+    fail_unless(stats.misses > 0 && stats.evictions > 0,
+                "reads did not go through the page cache");
+
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
+/* multiple instance test cases */
+TCase *multi_tcase (void)
+{
+    TCase *tc_multi = tcase_create("LibVMI Multiple Instances");
+    tcase_add_test(tc_multi, test_libvmi_multi_file);
+    tcase_add_test(tc_multi, test_libvmi_threadsafe_file);
+    tcase_add_test(tc_multi, test_libvmi_threadsafe_cache);
+    return tc_multi;
+}
@@ -24,10 +24,15 @@
 #include "../libvmi/libvmi.h"
 #include "../libvmi/peparse.h"
 #include "check_tests.h"
+#include "../libvmi/private.h"
+#include "../libvmi/os/os_interface.h"
+#include "../libvmi/os/windows/windows.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -295,12 +300,219 @@ START_TEST (test_peparse)
 }
 END_TEST
 
+#define TEST_PE_PA 0x200000
+
+static void
+write_image (int fd, addr_t pa, const void *buf, size_t len)
+{
+    fail_unless(pwrite(fd, buf, len, pa) == len, "failed to write PE image");
+}
+
+/* a DLL at VA 0x200000 exporting Start, an alias of it, Second, a forwarder
+ * and an ordinal-only function; the export directory is [0x1000, 0x1200) */
+static void
+make_pe_image (char *path)
+{
+    const uint64_t pml4 = 0x2000 | 0x3;
+    struct dos_header dos;
+    struct pe_header pe;
+    struct optional_header_pe32plus oh;
+    struct export_table et;
+    const uint32_t functions[] = { 0x2000, 0x2010, 0x1150, 0x3000 };
+    const uint32_t names[] = { 0x10a0, 0x10b0, 0x1800, 0x10c0 };
+    const uint16_t ordinals[] = { 0, 2, 1, 0 };
+    int fd;
+
+    make_pagetable_image(path);
+    fd = open(path, O_RDWR);
+    fail_unless(fd >= 0, "failed to open page table image");
+
+    /* a second address space at 0x5000 sharing every mapping */
+    write_image(fd, 0x5000, &pml4, sizeof(pml4));
+
+    memset(&dos, 0, sizeof(dos));
+    dos.signature = IMAGE_DOS_HEADER;
+    dos.offset_to_pe = 0x80;
+    write_image(fd, TEST_PE_PA, &dos, sizeof(dos));
+
+    memset(&pe, 0, sizeof(pe));
+    pe.signature = IMAGE_NT_SIGNATURE;
+    pe.size_of_optional_header = sizeof(oh);
+    write_image(fd, TEST_PE_PA + 0x80, &pe, sizeof(pe));
+
+    memset(&oh, 0, sizeof(oh));
+    oh.magic = IMAGE_PE32_PLUS_MAGIC;
+    oh.number_of_rva_and_sizes = 16;
+    oh.idd[IMAGE_DIRECTORY_ENTRY_EXPORT].virtual_address = 0x1000;
+    oh.idd[IMAGE_DIRECTORY_ENTRY_EXPORT].size = 0x200;
+    write_image(fd, TEST_PE_PA + 0x80 + sizeof(pe), &oh, sizeof(oh));
+
+    memset(&et, 0, sizeof(et));
+    et.name = 0x1100;
+    et.number_of_functions = 4;
+    et.number_of_names = 4;
+    et.address_of_functions = 0x1040;
+    et.address_of_names = 0x1060;
+    et.address_of_name_ordinals = 0x1080;
+    write_image(fd, TEST_PE_PA + 0x1000, &et, sizeof(et));
+    write_image(fd, TEST_PE_PA + 0x1040, functions, sizeof(functions));
+    write_image(fd, TEST_PE_PA + 0x1060, names, sizeof(names));
+    write_image(fd, TEST_PE_PA + 0x1080, ordinals, sizeof(ordinals));
+    write_image(fd, TEST_PE_PA + 0x10a0, "AliasStart", 11);
+    write_image(fd, TEST_PE_PA + 0x10b0, "Forwarded", 10);
+    write_image(fd, TEST_PE_PA + 0x10c0, "Start", 6);
+    write_image(fd, TEST_PE_PA + 0x1100, "test.dll", 9);
+    write_image(fd, TEST_PE_PA + 0x1150, "other.Start", 12);
+    /* names outside the export directory are read one by one */
+    write_image(fd, TEST_PE_PA + 0x1800, "Second", 7);
+    write_image(fd, TEST_PE_PA + 0x3fff, "", 1);
+    close(fd);
+}
+
+/* an instance on the PE image with just the Windows export lookups set up */
+static vmi_instance_t
+open_pe_image (uint32_t flags)
+{
+    char path[] = "/tmp/libvmi-pe-XXXXXX";
+    struct windows_instance *windows = NULL;
+    vmi_instance_t vmi = NULL;
+
+    make_pe_image(path);
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL | flags, path),
+                "vmi_init failed for PE image");
+    unlink(path);
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+    vmi->kpgd = 0x1000;
+    pid_cache_set(vmi, 4, 0x5000);
+
+    windows = malloc(sizeof(struct windows_instance));
+    memset(windows, 0, sizeof(struct windows_instance));
+    pthread_mutex_init(&windows->export_lock, NULL);
+    vmi->os_data = windows;
+    vmi->os_interface = malloc(sizeof(struct os_interface));
+    memset(vmi->os_interface, 0, sizeof(struct os_interface));
+    vmi->os_interface->os_usym2rva = windows_export_to_rva;
+    vmi->os_interface->os_rva2sym = windows_rva_to_export;
+    return vmi;
+}
+
+static void
+close_pe_image (vmi_instance_t vmi)
+{
+    struct windows_instance *windows = vmi->os_data;
+
+    windows_export_index_destroy(windows);
+    pthread_mutex_destroy(&windows->export_lock);
+    vmi_destroy(vmi);
+}
+
+/* test export lookups through the export index */
+START_TEST (test_peparse_exports)
+{
+    const addr_t base = 0x200000;
+    vmi_instance_t vmi = open_pe_image(0);
+    struct windows_instance *windows = vmi->os_data;
+    const char *sym = NULL;
+
+    fail_unless(vmi_translate_sym2v(vmi, base, 0, "Start") == base + 0x2000,
+                "wrong address for Start");
+    fail_unless(vmi_translate_sym2v(vmi, base, 0, "AliasStart") == base + 0x2000,
+                "wrong address for AliasStart");
+    fail_unless(vmi_translate_sym2v(vmi, base, 0, "Second") == base + 0x2010,
+                "wrong address for Second");
+    fail_unless(vmi_translate_sym2v(vmi, base, 0, "Forwarded") == 0,
+                "resolved a forwarded export");
+    fail_unless(vmi_translate_sym2v(vmi, base, 0, "Missing") == 0,
+                "resolved a missing export");
+
+    /* the first name in AddressOfNames order wins for aliases */
+    sym = vmi_translate_v2sym(vmi, base, 0, 0x2000);
+    fail_unless(sym && !strcmp(sym, "AliasStart"), "wrong name for 0x2000");
+    sym = vmi_translate_v2sym(vmi, base, 0, 0x2010);
+    fail_unless(sym && !strcmp(sym, "Second"), "wrong name for 0x2010");
+    fail_unless(NULL == vmi_translate_v2sym(vmi, base, 0, 0x3000),
+                "named an ordinal-only export");
+    fail_unless(NULL == vmi_translate_v2sym(vmi, base, 0, 0x1150),
+                "named a forwarder");
+
+    /* another process mapping the same pages reuses the index */
+    fail_unless(vmi_translate_sym2v(vmi, base, 4, "Second") == base + 0x2010,
+                "wrong address for Second in pid 4");
+    fail_unless(g_hash_table_size(windows->export_modules) == 2,
+                "wrong number of indexed modules");
+    fail_unless(g_hash_table_size(windows->export_indexes) == 1,
+                "export index not shared");
+
+    close_pe_image(vmi);
+}
+END_TEST
+
+#define EXPORT_THREADS 4
+
+/* looks up exports straight through the index, below the symbol caches */
+static void *
+export_worker (void *arg)
+{
+    vmi_instance_t vmi = arg;
+    const addr_t base = 0x200000;
+    addr_t rva = 0;
+    char *sym = NULL;
+    int i;
+
+    for (i = 0; i < 2000; ++i) {
+        vmi_pid_t pid = (i & 1) ? 4 : 0;
+
+        if (VMI_SUCCESS != windows_export_to_rva(vmi, base, pid, "Second", &rva)
+            || rva != 0x2010) {
+            return arg;
+        }
+        sym = windows_rva_to_export(vmi, 0x2000, base, pid);
+        if (!sym || strcmp(sym, "AliasStart")) {
+            free(sym);
+            return arg;
+        }
+        free(sym);
+    }
+    return NULL;
+}
+
+/* test several threads sharing the export index of one instance */
+START_TEST (test_peparse_exports_threadsafe)
+{
+    vmi_instance_t vmi = open_pe_image(VMI_INIT_THREADSAFE);
+    struct windows_instance *windows = vmi->os_data;
+    pthread_t threads[EXPORT_THREADS];
+    void *result = NULL;
+    int i, failed = 0;
+
+    for (i = 0; i < EXPORT_THREADS; ++i) {
+        pthread_create(&threads[i], NULL, export_worker, vmi);
+    }
+    for (i = 0; i < EXPORT_THREADS; ++i) {
+        pthread_join(threads[i], &result);
+        if (result) {
+            failed = 1;
+        }
+    }
+    fail_if(failed, "concurrent export lookups failed");
+    fail_unless(g_hash_table_size(windows->export_modules) == 2,
+                "wrong number of indexed modules");
+    fail_unless(g_hash_table_size(windows->export_indexes) == 1,
+                "export index not shared");
+
+    close_pe_image(vmi);
+}
+END_TEST
+
 /* translate test cases */
 TCase *peparse_tcase (void)
 {
     TCase *tc_peparse = tcase_create("LibVMI PEparse");
     tcase_set_timeout(tc_peparse, 30);
     tcase_add_test(tc_peparse, test_peparse);
+    tcase_add_test(tc_peparse, test_peparse_exports);
+    tcase_add_test(tc_peparse, test_peparse_exports_threadsafe);
     // uv2p
     return tc_peparse;
 }
@@ -0,0 +1,406 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../libvmi/libvmi.h"
+#include "check_tests.h"
+#include "../libvmi/private.h"
+#include "../libvmi/driver/qmp.h"
+
+/* "info registers -a" of a two vCPU guest, as QEMU puts it in a QMP reply */
+static const char *fake_registers =
+    "{\"return\": \"CPU#0\\r\\n"
+    "RAX=0000000000000001 RBX=ffff880000000000 RCX=0000000000000000 RDX=0000000000000000\\r\\n"
+    "RSI=0000000000000000 RDI=0000000000000000 RBP=ffffffff81a01e48 RSP=ffffffff81a01e48\\r\\n"
+    "R8 =0000000000000008 R9 =0000000000000000 R10=0000000000000000 R11=0000000000000000\\r\\n"
+    "RIP=ffffffff8104f596 RFL=00000246 [---Z-P-] CPL=0 II=0 A20=1 SMM=0 HLT=1\\r\\n"
+    "CS =0010 0000000000000000 ffffffff 00a09b00 DPL=0 CS64 [-RA]\\r\\n"
+    "CR0=8005003b CR2=00007f3c2b6f8000 CR3=0000000001c0e000 CR4=000006f0\\r\\n"
+    "DR6=00000000ffff0ff0 DR7=0000000000000400\\r\\n"
+    "EFER=0000000000000d01\\r\\n"
+    "CPU#1\\r\\n"
+    "RAX=0000000000000002 RBX=0000000000000000 RCX=0000000000000000 RDX=0000000000000000\\r\\n"
+    "RIP=ffffffff8104f597 RFL=00000246 [---Z-P-] CPL=0 II=0 A20=1 SMM=0 HLT=1\\r\\n"
+    "CR0=8005003b CR2=0000000000000000 CR3=000000003a5f2000 CR4=000006f0\\r\\n"
+    "EFER=0000000000000d01\\r\\n\"}\n";
+
+/* guest memory behind the fake monitor, every word holds its own address */
+#define FAKE_MEMORY_SIZE 0x200000
+
+/* A stand-in for QEMU's QMP monitor: greets, accepts capabilities, answers
+ * "info registers" (after an unrelated event, as a running guest would),
+ * pmemsaves its memory and rejects everything else. */
+struct fake_qmp {
+    char path[PATH_MAX];
+    int listen_fd;
+    pthread_t thread;
+    int connections;
+    int commands;
+    uint32_t *memory;
+    int pmemsaves;
+    size_t pmemsave_sizes[16];
+};
+
+static void
+fake_qmp_send(
+    int fd,
+    const char *text)
+{
+    if (write(fd, text, strlen(text)) < 0) {
+        return;
+    }
+}
+
+/* pmemsave fopen()s the file name it is given and writes the range */
+static void
+fake_qmp_pmemsave(
+    struct fake_qmp *fake,
+    int fd,
+    const char *command)
+{
+    const char *p = NULL;
+    char filename[PATH_MAX];
+    uint64_t address = 0, size = 0;
+    FILE *dump = NULL;
+    size_t n = 0;
+
+    if ((p = strstr(command, "\"val\": ")) && 1 == sscanf(p, "\"val\": %"SCNu64, &address)
+        && (p = strstr(command, "\"size\": ")) && 1 == sscanf(p, "\"size\": %"SCNu64, &size)
+        && (p = strstr(command, "\"filename\": \"")) && 1 == sscanf(p, "\"filename\": \"%4095[^\"]", filename)
+        && address <= FAKE_MEMORY_SIZE && size <= FAKE_MEMORY_SIZE - address
+        && (dump = fopen(filename, "wb"))) {
+        n = fwrite((uint8_t *) fake->memory + address, 1, size, dump);
+        fclose(dump);
+    }
+    if (fake->pmemsaves < 16) {
+        fake->pmemsave_sizes[fake->pmemsaves] = size;
+    }
+    fake->pmemsaves++;
+
+    if (!dump || n != size) {
+        fake_qmp_send(fd, "{\"error\": {\"class\": \"GenericError\", \"desc\": \"Invalid parameter 'val'\"}}\n");
+        return;
+    }
+    fake_qmp_send(fd, "{\"return\": {}}\n");
+}
+
+static void *
+fake_qmp_serve(
+    void *arg)
+{
+    struct fake_qmp *fake = arg;
+    char buf[4096];
+    size_t have = 0;
+    ssize_t n;
+    char *eol = NULL;
+    int fd;
+
+    while ((fd = accept(fake->listen_fd, NULL, NULL)) >= 0) {
+        fake->connections++;
+        fake_qmp_send(fd, "{\"QMP\": {\"version\": {\"qemu\": {\"major\": 2}}, \"capabilities\": []}}\n");
+        have = 0;
+        while ((n = read(fd, buf + have, sizeof(buf) - have - 1)) > 0) {
+            have += n;
+            buf[have] = '\0';
+            while ((eol = strchr(buf, '\n'))) {
+                *eol = '\0';
+                fake->commands++;
+                if (strstr(buf, "qmp_capabilities")) {
+                    fake_qmp_send(fd, "{\"return\": {}}\n");
+                }
+                else if (strstr(buf, "info registers")) {
+                    fake_qmp_send(fd, "{\"timestamp\": {\"seconds\": 1, \"microseconds\": 2}, \"event\": \"RTC_CHANGE\", \"data\": {\"offset\": 0}}\n");
+                    fake_qmp_send(fd, fake_registers);
+                }
+                else if (strstr(buf, "\"pmemsave\"")) {
+                    fake_qmp_pmemsave(fake, fd, buf);
+                }
+                else {
+                    fake_qmp_send(fd, "{\"error\": {\"class\": \"CommandNotFound\", \"desc\": \"unknown\"}}\n");
+                }
+                have -= eol + 1 - buf;
+                memmove(buf, eol + 1, have + 1);
+            }
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static void
+fake_qmp_start(
+    struct fake_qmp *fake)
+{
+    struct sockaddr_un address;
+    size_t i;
+
+    memset(fake, 0, sizeof(*fake));
+    fake->memory = malloc(FAKE_MEMORY_SIZE);
+    for (i = 0; i < FAKE_MEMORY_SIZE / 4; ++i) {
+        fake->memory[i] = i * 4;
+    }
+    snprintf(fake->path, sizeof(fake->path), "/tmp/libvmi_check_qmp.%d", getpid());
+    unlink(fake->path);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, fake->path);
+    fake->listen_fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    fail_unless(fake->listen_fd >= 0, "socket() failed");
+    fail_unless(0 == bind(fake->listen_fd, (struct sockaddr *) &address, sizeof(address)),
+                "bind() failed");
+    fail_unless(0 == listen(fake->listen_fd, 1), "listen() failed");
+    pthread_create(&fake->thread, NULL, fake_qmp_serve, fake);
+}
+
+static void
+fake_qmp_stop(
+    struct fake_qmp *fake)
+{
+    shutdown(fake->listen_fd, SHUT_RDWR);
+    close(fake->listen_fd);
+    pthread_join(fake->thread, NULL);
+    unlink(fake->path);
+    free(fake->memory);
+}
+
+/* one connection carries every command, events do not end up as replies */
+START_TEST (test_libvmi_qmp_session)
+{
+    struct fake_qmp fake;
+    qmp_session_t qmp = NULL;
+    qmp_registers_t regs = NULL;
+    char *reply = NULL, *dump = NULL;
+    reg_t value = 0;
+    uid_t uid = 0;
+    int i;
+
+    fake_qmp_start(&fake);
+    qmp = qmp_connect(fake.path);
+    fail_unless(NULL != qmp, "failed to connect to the fake monitor");
+    fail_unless(VMI_SUCCESS == qmp_peer_uid(qmp, &uid) && uid == geteuid(),
+                "wrong uid for the monitor");
+
+    for (i = 0; i < 3; ++i) {
+        reply = qmp_execute(qmp,
+            "{\"execute\": \"human-monitor-command\", \"arguments\": {\"command-line\": \"info registers -a\"}}");
+        fail_unless(NULL != reply && !strncmp(reply, "{\"return\"", 9),
+                    "event line returned as the reply");
+        dump = qmp_reply_string(reply);
+        fail_unless(NULL != dump && strstr(dump, "CPU#1\r\nRAX="),
+                    "reply string not decoded");
+        regs = qmp_parse_registers(dump);
+        fail_unless(2 == qmp_registers_vcpus(regs), "expected two vCPUs");
+        fail_unless(VMI_SUCCESS == qmp_get_register(regs, 1, "CR3", &value)
+                    && 0x3a5f2000 == value, "wrong CR3 for vCPU 1");
+        qmp_free_registers(regs);
+        g_free(dump);
+        g_free(reply);
+    }
+
+    reply = qmp_execute(qmp, "{\"execute\": \"pmemaccess\"}");
+    fail_unless(NULL != reply && strstr(reply, "CommandNotFound"),
+                "error reply not passed through");
+    g_free(reply);
+
+    qmp_close(qmp);
+    fake_qmp_stop(&fake);
+    fail_unless(1 == fake.connections, "session reconnected");
+    fail_unless(5 == fake.commands, "expected capabilities plus four commands");
+
+    fail_unless(NULL == qmp_connect(fake.path), "connected to a removed socket");
+}
+END_TEST
+
+/* register dumps with and without CPU#n sections */
+START_TEST (test_libvmi_qmp_registers)
+{
+    char *dump = qmp_reply_string(fake_registers);
+    qmp_registers_t regs = qmp_parse_registers(dump);
+    reg_t value = 0;
+
+    fail_unless(NULL != regs, "failed to parse the register dump");
+    fail_unless(VMI_SUCCESS == qmp_get_register(regs, 0, "RAX", &value) && 1 == value,
+                "wrong RAX for vCPU 0");
+    fail_unless(VMI_SUCCESS == qmp_get_register(regs, 1, "RAX", &value) && 2 == value,
+                "wrong RAX for vCPU 1");
+    fail_unless(VMI_SUCCESS == qmp_get_register(regs, 0, "RFL", &value) && 0x246 == value,
+                "wrong RFLAGS");
+    fail_unless(VMI_SUCCESS == qmp_get_register(regs, 0, "EFER", &value) && 0xd01 == value,
+                "wrong EFER");
+    fail_unless(VMI_SUCCESS == qmp_get_register(regs, 0, "R10", &value) && 0 == value,
+                "R10 not parsed");
+    /* QEMU pads short names, "R8 =" */
+    fail_unless(VMI_SUCCESS == qmp_get_register(regs, 0, "R8", &value) && 8 == value,
+                "padded R8 not parsed");
+    fail_unless(VMI_FAILURE == qmp_get_register(regs, 0, "CR8", &value),
+                "CR8 is not in the dump");
+    fail_unless(VMI_FAILURE == qmp_get_register(regs, 1, "DR7", &value),
+                "vCPU 1 has no DR7 in the dump");
+    fail_unless(VMI_FAILURE == qmp_get_register(regs, 2, "RAX", &value),
+                "vCPU 2 does not exist");
+    qmp_free_registers(regs);
+    g_free(dump);
+
+    /* plain "info registers" answers for whichever vCPU is asked */
+    regs = qmp_parse_registers("EAX=0000beef EBX=00000000\nEIP=c0100000 EFL=00000002\nCR3=00adf000\n");
+    fail_unless(VMI_SUCCESS == qmp_get_register(regs, 3, "CR3", &value) && 0xadf000 == value,
+                "single section not shared between vCPUs");
+    fail_unless(VMI_SUCCESS == qmp_get_register(regs, 0, "EAX", &value) && 0xbeef == value,
+                "wrong EAX");
+    qmp_free_registers(regs);
+
+    fail_unless(NULL == qmp_parse_registers("unknown command: 'info registers -a'"),
+                "parsed an error message");
+    fail_unless(NULL == qmp_reply_string("{\"return\": {}}"), "non-string reply decoded");
+    fail_unless(NULL == qmp_reply_string("{\"return\": \"cut of"), "unterminated reply decoded");
+}
+END_TEST
+
+/* "xp /<n>wx" rows, little-endian words, a short dump */
+START_TEST (test_libvmi_qmp_xp)
+{
+    const char *dump =
+        "0000000000001000: 0x464c457f 0x00010102 0x00000000 0x00000000\r\n"
+        "0000000000001010: 0x003e0003 0x00000001\r\n";
+    uint8_t buf[24];
+    uint32_t word;
+
+    memset(buf, 0xcc, sizeof(buf));
+    fail_unless(24 == qmp_parse_xp(dump, 0x1000, buf, sizeof(buf)), "wrong length parsed");
+    fail_unless(!memcmp(buf, "\x7f" "ELF", 4), "first word not little-endian");
+    memcpy(&word, buf + 16, 4);
+    fail_unless(0x003e0003 == word, "second row at the wrong offset");
+
+    fail_unless(24 == qmp_parse_xp(dump, 0x1000, buf, 32), "missing words counted");
+    fail_unless(0 == qmp_parse_xp(dump, 0x2000, buf, 16), "rows before paddr used");
+    fail_unless(0 == qmp_parse_xp("Cannot access memory\r\n", 0x1000, buf, 16),
+                "parsed an error message");
+    fail_unless(0 == qmp_parse_xp(NULL, 0x1000, buf, 16), "parsed nothing");
+}
+END_TEST
+
+/* every word of a page read back from the fake memory at paddr */
+static int
+fake_page_matches(
+    const void *page,
+    addr_t paddr)
+{
+    const uint32_t *words = page;
+    size_t i;
+
+    for (i = 0; i < 1024; ++i) {
+        if (words[i] != paddr + i * 4) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* pmemsave reads and how batches are split into dumps */
+START_TEST (test_libvmi_qmp_pmemsave)
+{
+    /* ascending runs with a gap page, a run exactly QMP_PMEMSAVE_MAX long,
+     * one frame that does not fit and a frame outside guest memory */
+    const addr_t paddrs[] = {
+        0x5000, 0x7000, 0x8000,
+        0x4000, 0x4000 + QMP_PMEMSAVE_MAX - 0x1000,
+        0x4000 + QMP_PMEMSAVE_MAX,
+        0x2000,
+        FAKE_MEMORY_SIZE,
+        0x1000
+    };
+    const size_t dumps[] = { 0x4000, QMP_PMEMSAVE_MAX, 0x1000, 0x1000, 0x1000, 0x1000 };
+    const size_t n = sizeof(paddrs) / sizeof(paddrs[0]);
+    void *data[sizeof(paddrs) / sizeof(paddrs[0])];
+    char dir[] = "/tmp/libvmi-pmemsave-XXXXXX";
+    char path[PATH_MAX];
+    struct fake_qmp fake;
+    qmp_session_t qmp = NULL;
+    uint8_t buf[4096];
+    size_t i;
+
+    fail_unless(NULL != mkdtemp(dir), "failed to create dump directory");
+    snprintf(path, sizeof(path), "%s/memory", dir);
+    fake_qmp_start(&fake);
+    qmp = qmp_connect(fake.path);
+    fail_unless(NULL != qmp, "failed to connect to the fake monitor");
+
+    fail_unless(VMI_SUCCESS == qmp_pmemsave(qmp, path, 0x3000, buf, sizeof(buf)),
+                "pmemsave failed");
+    fail_unless(fake_page_matches(buf, 0x3000), "wrong page read");
+    fail_unless(VMI_FAILURE == qmp_pmemsave(qmp, path, FAKE_MEMORY_SIZE, buf, sizeof(buf)),
+                "failed dump reported as read");
+    fail_unless(2 == fake.pmemsaves, "expected one pmemsave per read");
+
+    fake.pmemsaves = 0;
+    fail_unless(n - 1 == qmp_pmemsave_batch(qmp, path, paddrs, data, n, 4096),
+                "wrong number of pages read");
+    fail_unless(sizeof(dumps) / sizeof(dumps[0]) == fake.pmemsaves,
+                "frames grouped into the wrong number of dumps");
+    for (i = 0; i < sizeof(dumps) / sizeof(dumps[0]); ++i) {
+        fail_unless(dumps[i] == fake.pmemsave_sizes[i], "wrong dump size");
+    }
+    for (i = 0; i < n; ++i) {
+        if (FAKE_MEMORY_SIZE == paddrs[i]) {
+            fail_unless(NULL == data[i], "page returned from a failed dump");
+            continue;
+        }
+        fail_unless(NULL != data[i] && fake_page_matches(data[i], paddrs[i]),
+                    "page copied from the wrong offset in its dump");
+        free(data[i]);
+    }
+
+    qmp_close(qmp);
+    fake_qmp_stop(&fake);
+
+    /* without a session nothing is read */
+    fail_unless(0 == qmp_pmemsave_batch(NULL, path, paddrs, data, n, 4096),
+                "read pages without a session");
+    for (i = 0; i < n; ++i) {
+        fail_unless(NULL == data[i], "page returned without a session");
+    }
+    fail_unless(VMI_FAILURE == qmp_pmemsave(NULL, path, 0x1000, buf, sizeof(buf)),
+                "pmemsave without a session");
+
+    unlink(path);
+    rmdir(dir);
+}
+END_TEST
+
+/* QMP test cases */
+TCase *qmp_tcase (void)
+{
+    TCase *tc_qmp = tcase_create("LibVMI QMP");
+    tcase_add_test(tc_qmp, test_libvmi_qmp_session);
+    tcase_add_test(tc_qmp, test_libvmi_qmp_registers);
+    tcase_add_test(tc_qmp, test_libvmi_qmp_xp);
+    tcase_add_test(tc_qmp, test_libvmi_qmp_pmemsave);
+    return tc_qmp;
+}
@@ -22,10 +22,16 @@
  * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <check.h>
 #include "../libvmi/libvmi.h"
 #include "check_tests.h"
+#include "../libvmi/private.h"
+#include "../libvmi/os/os_interface.h"
 
 char *get_sym (vmi_instance_t vmi)
 {
@@ -264,6 +270,394 @@ START_TEST (test_vmi_read_64_pa)
 }
 END_TEST
 
+/* scattered reads from a synthetic page table image */
+START_TEST (test_vmi_read_iov)
+{
+    char path[] = "/tmp/libvmi-pagetable-XXXXXX";
+    uint64_t v[5] = { 0 };
+    uint64_t pair[2] = { 0 };
+    vmi_iovec_t vec[] = {
+        { 0x4ff8, &v[0], 8 },
+        { 0x2008, &v[1], 8 },
+        { 0x3000, pair, 16 },
+        { 0x1ffc, &v[2], 8 },   /* spans two pages */
+        { 0x9000, &v[3], 8 }    /* beyond the image */
+    };
+    vmi_iovec_t vvec[] = {
+        { 0x1ff008, &v[0], 8 },
+        { 0x5000, &v[1], 8 },
+        { 0x6000, &v[4], 8 }    /* not mapped */
+    };
+    vmi_instance_t vmi = NULL;
+    vmi_as_t as = NULL;
+
+    make_pagetable_image(path);
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for page table image");
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+
+    fail_unless(VMI_FAILURE == vmi_read_pa_iov(vmi, vec, 5),
+                "read beyond the image succeeded");
+    fail_unless(vec[0].status == VMI_SUCCESS && v[0] == 0x2003, "wrong PT entry");
+    fail_unless(vec[1].status == VMI_SUCCESS && v[1] == 0x40000083, "wrong PDPT entry");
+    fail_unless(vec[2].status == VMI_SUCCESS && pair[0] == 0x4003
+                && pair[1] == 0x200083, "wrong PD entries");
+    fail_unless(vec[3].status == VMI_SUCCESS && v[2] == 0x3003ULL << 32,
+                "wrong data across pages");
+    fail_unless(vec[4].status == VMI_FAILURE, "no failure beyond the image");
+
+    memset(v, 0, sizeof(v));
+    as = vmi_open_address_space_dtb(vmi, 0x1000);
+    fail_unless(VMI_FAILURE == vmi_as_read_iov(as, vvec, 3),
+                "read from an unmapped page succeeded");
+    fail_unless(vvec[0].status == VMI_SUCCESS && v[0] == 0x40000083, "wrong data at 0x1ff008");
+    fail_unless(vvec[1].status == VMI_SUCCESS && v[1] == 0x2003, "wrong data at 0x5000");
+    fail_unless(vvec[2].status == VMI_FAILURE, "no failure on unmapped page");
+
+    vmi_close_address_space(as);
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
+struct pdpt_fields {
+    uint64_t entry;
+    addr_t next;
+    uint32_t low;
+    uint16_t flags;
+    uint8_t type;
+    unsigned char raw[2];
+};
+
+/* gather structure members from a synthetic page table image */
+START_TEST (test_vmi_read_struct)
+{
+    char path[] = "/tmp/libvmi-pagetable-XXXXXX";
+    struct pdpt_fields out;
+    vmi_field_t fields[] = {
+        { 0x0, VMI_FIELD_64, 0, offsetof(struct pdpt_fields, entry) },
+        { 0x8, VMI_FIELD_ADDR, 0, offsetof(struct pdpt_fields, next) },
+        { 0x8, VMI_FIELD_32, 0, offsetof(struct pdpt_fields, low) },
+        { 0x9, VMI_FIELD_16, 0, offsetof(struct pdpt_fields, flags) },
+        { 0x8, VMI_FIELD_8, 0, offsetof(struct pdpt_fields, type) },
+        { 0xb, VMI_FIELD_BYTES, 2, offsetof(struct pdpt_fields, raw) }
+    };
+    vmi_instance_t vmi = NULL;
+
+    make_pagetable_image(path);
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for page table image");
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+    vmi->kpgd = 0x1000;
+
+    /* va 0x1ff000 maps the PDPT page */
+    memset(&out, 0xff, sizeof(out));
+    fail_unless(VMI_SUCCESS == vmi_read_struct(vmi, 0x1ff000, 0, fields, 6, &out),
+                "vmi_read_struct failed");
+    fail_unless(out.entry == 0x3003, "wrong 64-bit field");
+    fail_unless(out.next == 0x40000083, "wrong address field");
+    fail_unless(out.low == 0x40000083, "wrong 32-bit field");
+    fail_unless(out.flags == 0, "wrong 16-bit field");
+    fail_unless(out.type == 0x83, "wrong 8-bit field");
+    fail_unless(out.raw[0] == 0x40 && out.raw[1] == 0, "wrong byte field");
+
+    /* a structure on an unmapped page fails as a whole */
+    fail_unless(VMI_FAILURE == vmi_read_struct(vmi, 0x6000, 0, fields, 6, &out),
+                "read from an unmapped page succeeded");
+
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
+/* a list node in the synthetic image: pid at 0, links at 8 */
+struct list_node {
+    uint64_t pid;
+    uint64_t next;
+    uint64_t prev;
+};
+
+static void
+write_node (int fd, addr_t paddr, uint64_t pid, uint64_t next, uint64_t prev)
+{
+    struct list_node node = { pid, next, prev };
+
+    fail_unless(pwrite(fd, &node, sizeof(node), paddr) == sizeof(node),
+                "failed to write list node");
+}
+
+struct walk_result {
+    addr_t entries[8];
+    uint32_t pids[8];
+    int count;
+    int stop_after;
+};
+
+static status_t
+record_entry (vmi_instance_t vmi, addr_t entry, const void *fields, void *data)
+{
+    struct walk_result *r = data;
+
+    if (r->count < 8) {
+        r->entries[r->count] = entry;
+        r->pids[r->count] = *(const uint32_t *) fields;
+    }
+    r->count++;
+    return (r->count == r->stop_after) ? VMI_FAILURE : VMI_SUCCESS;
+}
+
+/* walk a list spread over two pages of a synthetic image */
+START_TEST (test_vmi_walk_list)
+{
+    char path[] = "/tmp/libvmi-pagetable-XXXXXX";
+    vmi_field_t field = { 0, VMI_FIELD_32, 0, 0 };
+    vmi_instance_t vmi = NULL;
+    uint64_t pte[2] = { 0x5000 | 0x3, 0x6000 | 0x3 };
+    struct walk_result r;
+    int fd;
+
+    /* two extra pages at pa 0x5000 and 0x6000, mapped at va 0x6000 and
+     * 0x7000 by PT entries 6 and 7, hold a head at va 0x6008 and nodes
+     * at 0x6100, 0x6200 and 0x7100 */
+    make_pagetable_image(path);
+    fd = open(path, O_RDWR);
+    fail_unless(fd >= 0, "failed to open page table image");
+    fail_unless(0 == ftruncate(fd, 0x7000), "failed to grow page table image");
+    fail_unless(pwrite(fd, pte, sizeof(pte), 0x4000 + 6 * 8) == sizeof(pte),
+                "failed to map list pages");
+    write_node(fd, 0x5000, 0, 0x6108, 0x7108);
+    write_node(fd, 0x5100, 10, 0x6208, 0x6008);
+    write_node(fd, 0x5200, 20, 0x7108, 0x6108);
+    write_node(fd, 0x6100, 30, 0x6008, 0x6208);
+
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for page table image");
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+    vmi->kpgd = 0x1000;
+
+    memset(&r, 0, sizeof(r));
+    fail_unless(VMI_SUCCESS == vmi_walk_list(vmi, 0, 0x6008, 0, 8, &field, 1, record_entry, &r),
+                "list walk failed");
+    fail_unless(r.count == 3, "wrong number of entries walked");
+    fail_unless(r.entries[0] == 0x6100 && r.entries[1] == 0x6200 && r.entries[2] == 0x7100,
+                "wrong entries walked");
+    fail_unless(r.pids[0] == 10 && r.pids[1] == 20 && r.pids[2] == 30, "wrong fields read");
+
+    /* backwards through the prev pointers */
+    memset(&r, 0, sizeof(r));
+    fail_unless(VMI_SUCCESS == vmi_walk_list(vmi, 0, 0x6008, 8, 8, &field, 1, record_entry, &r),
+                "backward list walk failed");
+    fail_unless(r.count == 3 && r.pids[0] == 30 && r.pids[2] == 10, "wrong backward walk");
+
+    /* the callback can end the walk early */
+    memset(&r, 0, sizeof(r));
+    r.stop_after = 2;
+    fail_unless(VMI_FAILURE == vmi_walk_list(vmi, 0, 0x6008, 0, 8, &field, 1, record_entry, &r),
+                "stopped list walk reported success");
+    fail_unless(r.count == 2, "list walk did not stop");
+
+    /* a loop that never gets back to the head is caught */
+    vmi_destroy(vmi);
+    write_node(fd, 0x6100, 30, 0x6208, 0x6208);
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for page table image");
+    vmi_set_page_mode(vmi, VMI_PM_IA32E);
+    vmi->kpgd = 0x1000;
+    memset(&r, 0, sizeof(r));
+    fail_unless(VMI_FAILURE == vmi_walk_list(vmi, 0, 0x6008, 0, 8, &field, 1, record_entry, &r),
+                "looping list walk reported success");
+    fail_unless(r.count < 8, "loop not detected");
+
+    close(fd);
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
+/* stand-in OS that knows three kernel symbols */
+static status_t
+fake_ksym2v (vmi_instance_t vmi, const char *symbol, addr_t *base, addr_t *address)
+{
+    if (!strcmp(symbol, "pml4_0")) {
+        *address = 0x5000;
+    }
+    else if (!strcmp(symbol, "pdpt_1")) {
+        *address = 0x1ff008;
+    }
+    else if (!strcmp(symbol, "page_end")) {
+        *address = 0x1ffffc;
+    }
+    else {
+        return VMI_FAILURE;
+    }
+    *base = 0;
+    return VMI_SUCCESS;
+}
+
+/* read through symbol handles from a synthetic page table image */
+START_TEST (test_vmi_read_sym)
+{
+    char path[] = "/tmp/libvmi-pagetable-XXXXXX";
+    const uint64_t pte = 0x2000 | 0x3;
+    vmi_sym_t pml4 = NULL, pdpt = NULL, end = NULL;
+    vmi_instance_t vmi = NULL;
+    uint64_t value = 0;
+    addr_t addr = 0;
+    int fd;
+
+    make_pagetable_image(path);
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for page table image");
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+    vmi->kpgd = 0x1000;
+    vmi->os_interface = malloc(sizeof(struct os_interface));
+    memset(vmi->os_interface, 0, sizeof(struct os_interface));
+    vmi->os_interface->os_ksym2v = fake_ksym2v;
+
+    fail_unless(NULL == vmi_resolve_ksym(vmi, "missing"), "resolved a missing symbol");
+    pml4 = vmi_resolve_ksym(vmi, "pml4_0");
+    pdpt = vmi_resolve_ksym(vmi, "pdpt_1");
+    end = vmi_resolve_ksym(vmi, "page_end");
+    fail_unless(pml4 && pdpt && end, "failed to resolve symbols");
+    fail_unless(vmi_sym_get_vaddr(pdpt) == 0x1ff008, "wrong symbol address");
+
+    fail_unless(VMI_SUCCESS == vmi_read_64_sym(vmi, pdpt, &value) && value == 0x40000083,
+                "wrong 64-bit read");
+    fail_unless(VMI_SUCCESS == vmi_read_addr_sym(vmi, pdpt, &addr) && addr == 0x40000083,
+                "wrong address read");
+    fail_unless(VMI_SUCCESS == vmi_read_64_sym(vmi, pml4, &value) && value == 0x2003,
+                "wrong read at pml4_0");
+
+    /* the second half of page_end lies on an unbacked page */
+    fail_unless(VMI_SUCCESS == vmi_read_32_sym(vmi, end, (uint32_t *) &value),
+                "failed to read within the page");
+    fail_unless(VMI_FAILURE == vmi_read_64_sym(vmi, end, &value), "read past the image");
+
+    /* map pml4_0 onto the PDPT, the handle notices once the cache is flushed */
+    fd = open(path, O_RDWR);
+    fail_unless(fd >= 0 && pwrite(fd, &pte, sizeof(pte), 0x4028) == sizeof(pte),
+                "failed to patch page table");
+    close(fd);
+    fail_unless(VMI_SUCCESS == vmi_read_64_sym(vmi, pml4, &value) && value == 0x2003,
+                "translation not reused");
+    vmi_v2pcache_flush(vmi);
+    fail_unless(VMI_SUCCESS == vmi_read_64_sym(vmi, pml4, &value) && value == 0x3003,
+                "stale translation used after flush");
+
+    /* file images are read-only */
+    fail_unless(VMI_FAILURE == vmi_write_64_sym(vmi, pdpt, &value), "wrote to a file image");
+
+    vmi_free_sym(pml4);
+    vmi_free_sym(pdpt);
+    vmi_free_sym(end);
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
+#define SCAN_IMAGE_SIZE 0x300000
+
+struct scan_hits {
+    addr_t paddr[16];
+    size_t pattern[16];
+    int count;
+    int stop_after;
+};
+
+static status_t
+record_scan_hit (vmi_instance_t vmi, addr_t paddr, size_t pattern, void *data)
+{
+    struct scan_hits *hits = data;
+
+    if (hits->count < 16) {
+        hits->paddr[hits->count] = paddr;
+        hits->pattern[hits->count] = pattern;
+    }
+    hits->count++;
+    return (hits->count == hits->stop_after) ? VMI_FAILURE : VMI_SUCCESS;
+}
+
+static void
+check_scan_hits (struct scan_hits *hits, const addr_t *paddr, const size_t *pattern, int n)
+{
+    int i;
+
+    fail_unless(hits->count == n, "wrong number of matches");
+    for (i = 0; i < n; ++i) {
+        fail_unless(hits->paddr[i] == paddr[i] && hits->pattern[i] == pattern[i],
+                    "wrong match");
+    }
+}
+
+/* scan a zero filled image with matches straddling the chunk boundaries */
+START_TEST (test_vmi_scan_pa)
+{
+    char path[] = "/tmp/libvmi-scan-XXXXXX";
+    const vmi_pattern_t patterns[] = {
+        { "KDBG", 4 },
+        { "KD", 2 },
+        { "Idle\0\0", 6 },
+        { "Z", 1 }
+    };
+    const vmi_pattern_t empty = { "", 0 };
+    const addr_t paddr[] = {
+        0x2000, 0x2000, 0xffffe, 0xffffe, 0x1ffffd, 0x250000, SCAN_IMAGE_SIZE - 2
+    };
+    const size_t pattern[] = { 0, 1, 0, 1, 2, 3, 1 };
+    const uint32_t flags[] = { 0, VMI_INIT_THREADSAFE };
+    struct scan_hits hits;
+    vmi_instance_t vmi = NULL;
+    int fd, i;
+
+    fd = mkstemp(path);
+    fail_unless(fd >= 0, "failed to create scan image");
+    fail_unless(ftruncate(fd, SCAN_IMAGE_SIZE) == 0, "failed to size scan image");
+    fail_unless(pwrite(fd, "KDBG", 4, 0x2000) == 4
+                && pwrite(fd, "KDBG", 4, 0xffffe) == 4
+                && pwrite(fd, "Idle", 4, 0x1ffffd) == 4
+                && pwrite(fd, "Z", 1, 0x250000) == 1
+                && pwrite(fd, "KD", 2, SCAN_IMAGE_SIZE - 2) == 2,
+                "failed to write scan image");
+    close(fd);
+
+    for (i = 0; i < 2; ++i) {
+        fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL | flags[i], path),
+                    "vmi_init failed for scan image");
+
+        memset(&hits, 0, sizeof(hits));
+        fail_unless(VMI_SUCCESS == vmi_scan_pa(vmi, 0, ~0ULL, patterns, 4, record_scan_hit, &hits),
+                    "scan failed");
+        check_scan_hits(&hits, paddr, pattern, 7);
+
+        /* matches must lie wholly inside the range */
+        memset(&hits, 0, sizeof(hits));
+        fail_unless(VMI_SUCCESS == vmi_scan_pa(vmi, 0xffffe, 0x200002, patterns, 4,
+                                               record_scan_hit, &hits),
+                    "range scan failed");
+        check_scan_hits(&hits, paddr + 2, pattern + 2, 2);
+
+        /* the callback can end the scan early */
+        memset(&hits, 0, sizeof(hits));
+        hits.stop_after = 3;
+        fail_unless(VMI_FAILURE == vmi_scan_pa(vmi, 0, ~0ULL, patterns, 4, record_scan_hit, &hits),
+                    "stopped scan reported success");
+        check_scan_hits(&hits, paddr, pattern, 3);
+
+        fail_unless(VMI_FAILURE == vmi_scan_pa(vmi, 0, ~0ULL, patterns, 0, record_scan_hit, &hits),
+                    "scanned without patterns");
+        fail_unless(VMI_FAILURE == vmi_scan_pa(vmi, 0, ~0ULL, &empty, 1, record_scan_hit, &hits),
+                    "scanned for an empty pattern");
+
+        vmi_destroy(vmi);
+    }
+    unlink(path);
+}
+END_TEST
+
 /* read test cases */
 TCase *read_tcase (void)
 {
@@ -295,6 +689,12 @@ TCase *read_tcase (void)
     tcase_add_test(tc_read, test_vmi_read_64_pa);
     // vmi_read_addr_pa
     // vmi_read_str_pa
+
+    tcase_add_test(tc_read, test_vmi_read_iov);
+    tcase_add_test(tc_read, test_vmi_read_struct);
+    tcase_add_test(tc_read, test_vmi_walk_list);
+    tcase_add_test(tc_read, test_vmi_read_sym);
+    tcase_add_test(tc_read, test_vmi_scan_pa);
   
     return tc_read;
 }
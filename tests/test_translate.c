@@ -23,8 +23,14 @@
  */
 
 #include <check.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include "../libvmi/libvmi.h"
 #include "check_tests.h"
+#include "../libvmi/private.h"
+#include "../libvmi/os/linux/linux.h"
 
 
 /* test vmi_pid_to_dtb */
@@ -127,6 +133,197 @@ START_TEST (test_libvmi_ksym2v)
 }
 END_TEST
 
+/* test forward and reverse lookups in a loaded System.map */
+START_TEST (test_libvmi_linux_sysmap)
+{
+    char path[] = "/tmp/libvmi-sysmap-XXXXXX";
+    const char map[] =
+        "ffffffff81a00000 D init_task\n"
+        "ffffffff81000000 T _text\n"
+        "ffffffff81000000 T startup_64\n"
+        "ffffffff81c00000 d dup\n"
+        "ffffffff81000100 t secondary_startup_64\n"
+        "not a symbol row\n"
+        "ffffffff81b00000 d dup\n";
+    struct vmi_instance instance;
+    struct linux_instance linux_instance;
+    vmi_instance_t vmi = &instance;
+    addr_t address = 0;
+    const char *sym = NULL;
+    int fd;
+
+    fd = mkstemp(path);
+    fail_unless(fd >= 0, "failed to create System.map");
+    fail_unless(write(fd, map, sizeof(map) - 1) == sizeof(map) - 1,
+                "failed to write System.map");
+    close(fd);
+
+    memset(&instance, 0, sizeof(instance));
+    memset(&linux_instance, 0, sizeof(linux_instance));
+    linux_instance.sysmap = path;
+    instance.os_data = &linux_instance;
+    fail_unless(VMI_SUCCESS == linux_system_map_load(vmi), "failed to load System.map");
+    unlink(path);
+
+    fail_unless(VMI_SUCCESS == linux_system_map_symbol_to_address(vmi, "init_task", NULL, &address)
+                && address == 0xffffffff81a00000ULL, "wrong address for init_task");
+    fail_unless(VMI_SUCCESS == linux_system_map_symbol_to_address(vmi, "dup", NULL, &address)
+                && address == 0xffffffff81c00000ULL, "first of duplicate names not returned");
+    fail_unless(VMI_FAILURE == linux_system_map_symbol_to_address(vmi, "missing", NULL, &address),
+                "found a missing symbol");
+
+    /* aliases resolve to the first name in the file */
+    sym = linux_system_map_address_to_symbol(vmi, 0xffffffff81000000ULL, 0, 0);
+    fail_unless(sym && !strcmp(sym, "_text"), "wrong symbol for _text");
+    sym = linux_system_map_address_to_symbol(vmi, 0x100, 0xffffffff81000000ULL, 0);
+    fail_unless(sym && !strcmp(sym, "secondary_startup_64"), "wrong symbol for base + rva");
+    fail_unless(NULL == linux_system_map_address_to_symbol(vmi, 0xffffffff81000001ULL, 0, 0),
+                "resolved an address without a symbol");
+    fail_unless(NULL == linux_system_map_address_to_symbol(vmi, 0xffffffffffffffffULL, 0, 0),
+                "resolved an address past the last symbol");
+
+    linux_system_map_free(&linux_instance);
+    fail_unless(VMI_FAILURE == linux_system_map_symbol_to_address(vmi, "init_task", NULL, &address),
+                "lookup succeeded after free");
+}
+END_TEST
+
+/* test batch translation against single lookups on a synthetic image */
+START_TEST (test_libvmi_v2p_batch)
+{
+    char path[] = "/tmp/libvmi-pagetable-XXXXXX";
+    const addr_t in[] = {
+        0x40000123, 0x5008, 0x1ff000, 0x201000, 0x6000, 0x0, 0x5fff, 0x3fffffff
+    };
+    const size_t n = sizeof(in) / sizeof(in[0]);
+    addr_t out[sizeof(in) / sizeof(in[0])];
+    vmi_instance_t vmi = NULL;
+    size_t i;
+
+    make_pagetable_image(path);
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for page table image");
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+
+    /* 0x6000 is not mapped, so the batch as a whole fails */
+    fail_unless(VMI_FAILURE == vmi_pagetable_lookup_batch(vmi, 0x1000, in, out, n),
+                "batch with an unmapped address succeeded");
+
+    vmi_v2pcache_flush(vmi);
+    for (i = 0; i < n; ++i) {
+        fail_unless(out[i] == vmi_pagetable_lookup(vmi, 0x1000, in[i]),
+                    "batch and single translation differ");
+    }
+    fail_unless(out[0] == 0x40000123, "wrong 1GB page translation");
+    fail_unless(out[1] == 0x1008, "wrong 4kB page translation");
+    fail_unless(out[3] == 0x201000, "wrong 2MB page translation");
+    fail_unless(out[4] == 0, "unmapped address translated");
+
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
+/* split virtual ranges into physically contiguous extents */
+START_TEST (test_libvmi_translate_range)
+{
+    char path[] = "/tmp/libvmi-pagetable-XXXXXX";
+    const uint64_t pte = 0x2000 | 0x3;
+    vmi_extent_t extents[4];
+    vmi_instance_t vmi = NULL;
+    int fd;
+
+    /* map va 0x6000 to pa 0x2000, right behind the page backing 0x5000 */
+    make_pagetable_image(path);
+    fd = open(path, O_WRONLY);
+    fail_unless(fd >= 0, "failed to open page table image");
+    fail_unless(sizeof(pte) == pwrite(fd, &pte, sizeof(pte), 0x4000 + 6 * 8),
+                "failed to patch page table image");
+    close(fd);
+
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for page table image");
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+
+    /* physically adjacent 4kB pages merge */
+    fail_unless(1 == vmi_translate_range(vmi, 0x1000, 0x5800, 0x1000, extents, 4),
+                "adjacent pages not merged");
+    fail_unless(extents[0].va == 0x5800 && extents[0].pa == 0x1800
+                && extents[0].len == 0x1000, "wrong merged extent");
+
+    /* a 4kB page followed by a 2MB page */
+    fail_unless(2 == vmi_translate_range(vmi, 0x1000, 0x1ff800, 0x1800, extents, 4),
+                "wrong number of extents");
+    fail_unless(extents[0].pa == 0x2800 && extents[0].len == 0x800,
+                "wrong 4kB extent");
+    fail_unless(extents[1].va == 0x200000 && extents[1].pa == 0x200000
+                && extents[1].len == 0x1000, "wrong 2MB extent");
+
+    /* the range is cut short by the capacity and by unmapped pages */
+    fail_unless(1 == vmi_translate_range(vmi, 0x1000, 0x1ff800, 0x1800, extents, 1),
+                "capacity not honoured");
+    fail_unless(extents[0].len == 0x800, "wrong extent length");
+    fail_unless(1 == vmi_translate_range(vmi, 0x1000, 0x6000, 0x2000, extents, 4),
+                "translated past an unmapped page");
+    fail_unless(extents[0].len == 0x1000, "wrong extent length");
+    fail_unless(0 == vmi_translate_range(vmi, 0x1000, 0x7000, 0x10, extents, 4),
+                "unmapped range translated");
+
+    /* a 1GB page is a single extent */
+    fail_unless(1 == vmi_translate_range(vmi, 0x1000, 0x40000000, 0x300000, extents, 4),
+                "1GB page split");
+    fail_unless(extents[0].pa == 0x40000000 && extents[0].len == 0x300000,
+                "wrong 1GB extent");
+
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
+/* read and translate through an address space handle */
+START_TEST (test_libvmi_address_space)
+{
+    char path[] = "/tmp/libvmi-pagetable-XXXXXX";
+    uint64_t data[2] = { 0, 0 };
+    vmi_instance_t vmi = NULL;
+    vmi_as_t as = NULL;
+
+    make_pagetable_image(path);
+    fail_unless(VMI_SUCCESS == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, path),
+                "vmi_init failed for page table image");
+    fail_unless(VMI_SUCCESS == vmi_set_page_mode(vmi, VMI_PM_IA32E),
+                "failed to set page mode");
+
+    fail_unless(NULL == vmi_open_address_space_dtb(vmi, 0),
+                "opened an address space without a dtb");
+    as = vmi_open_address_space_dtb(vmi, 0x1000);
+    fail_unless(NULL != as, "failed to open address space");
+    fail_unless(0x1000 == vmi_as_get_dtb(as), "wrong dtb");
+
+    fail_unless(0x1008 == vmi_as_translate(as, 0x5008), "wrong 4kB page translation");
+    fail_unless(0x1008 == vmi_as_translate(as, 0x5008), "wrong cached translation");
+    fail_unless(0x201000 == vmi_as_translate(as, 0x201000), "wrong 2MB page translation");
+    fail_unless(0 == vmi_as_translate(as, 0x6000), "unmapped address translated");
+
+    /* va 0x5000 maps the PML4, whose first entry points to the PDPT */
+    fail_unless(16 == vmi_as_read(as, 0x5000, data, 16), "short read");
+    fail_unless(0x2003 == data[0] && 0 == data[1], "wrong data read");
+
+    /* reads stop at the first unmapped page */
+    fail_unless(8 == vmi_as_read(as, 0x5ff8, data, 16), "read past unmapped page");
+
+    /* flushing the instance also drops the handle's translations */
+    vmi_v2pcache_flush(vmi);
+    fail_unless(0x1008 == vmi_as_translate(as, 0x5008), "wrong translation after flush");
+
+    vmi_close_address_space(as);
+    vmi_destroy(vmi);
+    unlink(path);
+}
+END_TEST
+
 /* translate test cases */
 TCase *translate_tcase (void)
 {
@@ -136,5 +333,9 @@ TCase *translate_tcase (void)
     // uv2p
     tcase_add_test(tc_translate, test_libvmi_kv2p);
     tcase_add_test(tc_translate, test_libvmi_piddtb);
+    tcase_add_test(tc_translate, test_libvmi_v2p_batch);
+    tcase_add_test(tc_translate, test_libvmi_translate_range);
+    tcase_add_test(tc_translate, test_libvmi_address_space);
+    tcase_add_test(tc_translate, test_libvmi_linux_sysmap);
     return tc_translate;
 }
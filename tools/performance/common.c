@@ -25,6 +25,7 @@
  */  
 #include "common.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 void print_measurement(
@@ -92,3 +93,49 @@ void avg_measurement(
     printf("mean (dropped first-%ld) %f\n", data[0],
             (double) ((double) sum / ((double) loops - 1.0)));
 } 
+
+int write_pagetable_image(
+    const char *path,
+    uint64_t tables)
+{
+    uint64_t pds = (tables + PT_ENTRIES - 1) / PT_ENTRIES;
+    uint64_t table[PT_ENTRIES];
+    uint64_t i, j;
+    FILE *f = fopen(path, "wb");
+
+    if (!f) {
+        return -1;
+    }
+
+    /* frame 0 is never handed out, leave it empty */
+    memset(table, 0, sizeof(table));
+    fwrite(table, sizeof(table), 1, f);
+
+    table[0] = PT_PDPT_PA | 0x3;
+    fwrite(table, sizeof(table), 1, f);
+
+    memset(table, 0, sizeof(table));
+    for (i = 0; i < pds; ++i) {
+        table[i] = PT_PD_PA(i) | 0x3;
+    }
+    fwrite(table, sizeof(table), 1, f);
+
+    for (i = 0; i < pds; ++i) {
+        memset(table, 0, sizeof(table));
+        for (j = 0; j < PT_ENTRIES && i * PT_ENTRIES + j < tables; ++j) {
+            table[j] = PT_PD_PA(pds + i * PT_ENTRIES + j) | 0x3;
+        }
+        fwrite(table, sizeof(table), 1, f);
+    }
+
+    /* every page maps the PML4 page, only the table layout matters */
+    for (j = 0; j < PT_ENTRIES; ++j) {
+        table[j] = PT_PML4_PA | 0x3;
+    }
+    for (i = 0; i < tables; ++i) {
+        fwrite(table, sizeof(table), 1, f);
+    }
+
+    fclose(f);
+    return 0;
+}
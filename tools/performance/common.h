@@ -27,8 +27,15 @@
 #define COMMON_H
     
 #include <stdio.h>
+#include <stdint.h>
 #include <sys/time.h>
 
+/* layout of the synthetic IA-32e images from write_pagetable_image */
+#define PT_ENTRIES 512
+#define PT_PML4_PA 0x1000ULL
+#define PT_PDPT_PA 0x2000ULL
+#define PT_PD_PA(i) (0x3000ULL + (i) * 0x1000ULL)
+
 void print_measurement(
     struct timeval ktv_start,
     struct timeval ktv_end,
@@ -38,4 +45,13 @@ void avg_measurement(
     long int *data,
     int loops);
 
+/*
+ * Writes a memory image holding one PML4 at PT_PML4_PA, one PDPT and
+ * enough page directories to map <tables> * 2MB of virtual address
+ * space from address zero with 4kB pages.
+ */
+int write_pagetable_image(
+    const char *path,
+    uint64_t tables);
+
 #endif  /* COMMON_H */
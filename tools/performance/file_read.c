@@ -0,0 +1,116 @@
+/* The LibVMI Library is an introspection library that simplifies access to 
+ * memory in a target virtual machine or in a file containing a dump of 
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */  
+
+/*
+ * Measures vmi_read_pa throughput over a whole memory image file.  Each
+ * loop reads the image front to back in <buf size> chunks.  The loops run
+ * twice: first with the default instance, which copies straight out of
+ * the file mapping, then with VMI_INIT_PAGECACHE, where with images
+ * larger than the page cache nearly every page is a cache miss and the
+ * cost of bringing pages in from the file driver dominates.
+ *
+ * usage: file_read <image file> <buf size> <loops>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include "libvmi/libvmi.h"
+#include "common.h"
+
+static int read_image(
+    char *name,
+    uint32_t flags,
+    unsigned char *buf,
+    int buf_size,
+    long int *data,
+    int loops)
+{
+    vmi_instance_t vmi;
+    struct timeval ktv_start;
+    struct timeval ktv_end;
+    vmi_cache_stats_t stats;
+    long int diff;
+    uint64_t size = 0;
+    addr_t pa = 0;
+    int i = 0;
+
+    if (VMI_FAILURE == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL | flags, name)) {
+        printf("Failed to init LibVMI library.\n");
+        return 1;
+    }
+    size = vmi_get_memsize(vmi);
+
+    for (i = 0; i < loops; ++i) {
+        vmi_pagecache_reset_stats(vmi);
+        gettimeofday(&ktv_start, 0);
+        /* frame 0 is never handed out, start at the second page */
+        for (pa = 4096; pa + buf_size <= size; pa += buf_size) {
+            vmi_read_pa(vmi, pa, buf, buf_size);
+        }
+        gettimeofday(&ktv_end, 0);
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        vmi_pagecache_get_stats(vmi, &stats);
+        printf("  %.1f MB/s, cache hits %"PRIu64" misses %"PRIu64"\n",
+               (double) (size - 4096) / (double) (diff ? diff : 1),
+               stats.hits, stats.misses);
+        data[i] = diff;
+    }
+    avg_measurement(data, loops);
+
+    vmi_destroy(vmi);
+    return 0;
+}
+
+int main(int argc, char **argv) 
+{
+    unsigned char *buf = NULL;
+    long int *data = NULL;
+    int buf_size = 0;
+    int loops = 0;
+    int ret = 0;
+
+    if (argc != 4) {
+        printf("usage: %s <image file> <buf size> <loops>\n", argv[0]);
+        return 1;
+    }
+    buf_size = atoi(argv[2]);
+    loops = atoi(argv[3]);
+    if (buf_size < 1 || loops < 1) {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    buf = malloc(buf_size);
+    data = malloc(loops * sizeof(long int));
+
+    printf("file mapping:\n");
+    ret = read_image(argv[1], 0, buf, buf_size, data, loops);
+    if (!ret) {
+        printf("page cache:\n");
+        ret = read_image(argv[1], VMI_INIT_PAGECACHE, buf, buf_size, data, loops);
+    }
+
+    free(buf);
+    free(data);
+    return ret;
+}
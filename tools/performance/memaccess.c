@@ -0,0 +1,161 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reads the first <pages> pages from a physmem-access socket, one READ at
+ * a time as kvm_get_memory_patch does, and then through pipelined
+ * BATCH_READs.  Run it against memaccess_server or a patched qemu.
+ *
+ * usage: memaccess <socket path> <pages> <loops>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "driver/memaccess.h"
+#include "common.h"
+
+#define PAGE_SIZE 4096
+
+static int
+connect_socket(
+    const char *path)
+{
+    struct sockaddr_un address;
+    int fd = socket(PF_UNIX, SOCK_STREAM, 0);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address))) {
+        printf("failed to connect to %s\n", path);
+        exit(1);
+    }
+    return fd;
+}
+
+static uint64_t
+checksum(
+    const uint8_t *buf,
+    size_t length)
+{
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < length; ++i) {
+        sum = sum * 31 + buf[i];
+    }
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    struct timeval ktv_start;
+    struct timeval ktv_end;
+    memaccess_range_t *ranges = NULL;
+    uint8_t *buf = NULL;
+    long int *data = NULL;
+    long int diff;
+    uint64_t sum = 0;
+    size_t pages = 0, i, failed;
+    int loops = 0, loop, fd;
+
+    if (argc != 4) {
+        printf("usage: %s <socket path> <pages> <loops>\n", argv[0]);
+        return 1;
+    }
+    pages = strtoul(argv[2], NULL, 0);
+    loops = atoi(argv[3]);
+    if (!pages || loops < 1) {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    buf = malloc(pages * PAGE_SIZE);
+    ranges = malloc(pages * sizeof(memaccess_range_t));
+    data = malloc(loops * sizeof(long int));
+    for (i = 0; i < pages; ++i) {
+        ranges[i].address = i * PAGE_SIZE;
+        ranges[i].length = PAGE_SIZE;
+        ranges[i].buf = buf + i * PAGE_SIZE;
+    }
+
+    fd = connect_socket(argv[1]);
+    if (!memaccess_probe_batch(fd)) {
+        printf("server does not support batched reads\n");
+        return 1;
+    }
+
+    printf("one READ per page:\n");
+    for (loop = 0; loop < loops; ++loop) {
+        memset(buf, 0, pages * PAGE_SIZE);
+        failed = 0;
+        gettimeofday(&ktv_start, 0);
+        for (i = 0; i < pages; ++i) {
+            failed += (VMI_FAILURE == memaccess_read(fd, ranges[i].address,
+                                                     ranges[i].buf, PAGE_SIZE));
+        }
+        gettimeofday(&ktv_end, 0);
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        printf("  %.1f MB/s, %zu failed\n",
+               (double) (pages * PAGE_SIZE) / (double) (diff ? diff : 1), failed);
+        data[loop] = diff;
+    }
+    avg_measurement(data, loops);
+    sum = checksum(buf, pages * PAGE_SIZE);
+
+    printf("pipelined BATCH_READ of %d pages, %d in flight:\n",
+           MEMACCESS_BATCH_MAX, MEMACCESS_WINDOW);
+    for (loop = 0; loop < loops; ++loop) {
+        memset(buf, 0, pages * PAGE_SIZE);
+        failed = 0;
+        gettimeofday(&ktv_start, 0);
+        if (VMI_FAILURE == memaccess_read_batch(fd, ranges, pages)) {
+            printf("connection lost\n");
+            return 1;
+        }
+        gettimeofday(&ktv_end, 0);
+        for (i = 0; i < pages; ++i) {
+            failed += !ranges[i].status;
+        }
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        printf("  %.1f MB/s, %zu failed\n",
+               (double) (pages * PAGE_SIZE) / (double) (diff ? diff : 1), failed);
+        data[loop] = diff;
+    }
+    avg_measurement(data, loops);
+
+    if (checksum(buf, pages * PAGE_SIZE) != sum) {
+        printf("batched reads returned different data\n");
+        return 1;
+    }
+
+    memaccess_quit(fd);
+    close(fd);
+    free(data);
+    free(ranges);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,259 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stand-in for the physmem-access thread of the qemu patch: serves a memory
+ * image on a Unix socket with the request protocol in
+ * libvmi/driver/memaccess.h, one client connection after another.  Writes
+ * go to a private copy of the image.  With -c it answers like the original
+ * patch, which knows nothing about MEMACCESS_BATCH_READ.
+ *
+ * usage: memaccess_server [-c] <socket path> <image file>
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "driver/memaccess.h"
+
+#define MAX_LENGTH (16 * 1024 * 1024)
+
+static uint8_t *memory = NULL;
+static uint64_t memory_size = 0;
+static int classic = 0;
+
+static int
+write_full(
+    int fd,
+    const void *buf,
+    size_t length)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (length) {
+        n = write(fd, p, length);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int
+read_full(
+    int fd,
+    void *buf,
+    size_t length)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (length) {
+        n = read(fd, p, length);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int
+in_image(
+    uint64_t address,
+    uint64_t length)
+{
+    return length <= MAX_LENGTH && address < memory_size
+        && length <= memory_size - address;
+}
+
+static int
+send_status(
+    int fd,
+    uint8_t status)
+{
+    return write_full(fd, &status, 1);
+}
+
+/* the reply to one range of a batch always has <length> bytes */
+static int
+serve_range(
+    int fd,
+    const memaccess_request_t *req,
+    uint8_t *zeros)
+{
+    uint64_t left = req->length;
+    size_t chunk;
+
+    if (in_image(req->address, req->length)) {
+        return write_full(fd, memory + req->address, req->length) || send_status(fd, 1);
+    }
+    while (left) {
+        chunk = left < MAX_LENGTH ? left : MAX_LENGTH;
+        if (write_full(fd, zeros, chunk)) {
+            return -1;
+        }
+        left -= chunk;
+    }
+    return send_status(fd, 0);
+}
+
+static int
+serve_batch(
+    int fd,
+    uint64_t count,
+    uint8_t *zeros)
+{
+    memaccess_request_t ranges[MEMACCESS_BATCH_MAX];
+    uint64_t i;
+
+    if (!count) {
+        return send_status(fd, 1);
+    }
+    if (count > MEMACCESS_BATCH_MAX
+        || read_full(fd, ranges, count * sizeof(memaccess_request_t))) {
+        return -1;
+    }
+    for (i = 0; i < count; ++i) {
+        if (serve_range(fd, &ranges[i], zeros)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+serve(
+    int fd)
+{
+    memaccess_request_t req;
+    uint8_t *zeros = calloc(1, MAX_LENGTH);
+    uint8_t *buf = malloc(MAX_LENGTH);
+    int ret = 0;
+
+    while (!ret && !read_full(fd, &req, sizeof(req))) {
+        switch (req.type) {
+        case MEMACCESS_QUIT:
+            ret = -1;
+            break;
+        case MEMACCESS_READ:
+            if (in_image(req.address, req.length)) {
+                ret = write_full(fd, memory + req.address, req.length) || send_status(fd, 1);
+            }
+            else {
+                ret = send_status(fd, 0);
+            }
+            break;
+        case MEMACCESS_WRITE:
+            if (req.length > MAX_LENGTH || read_full(fd, buf, req.length)) {
+                ret = -1;
+                break;
+            }
+            if (in_image(req.address, req.length)) {
+                memcpy(memory + req.address, buf, req.length);
+                ret = send_status(fd, 1);
+            }
+            else {
+                ret = send_status(fd, 0);
+            }
+            break;
+        case MEMACCESS_BATCH_READ:
+            if (!classic) {
+                ret = serve_batch(fd, req.length, zeros);
+                break;
+            }
+            /* fall through */
+        default:
+            ret = send_status(fd, 0);
+            break;
+        }
+    }
+
+    free(buf);
+    free(zeros);
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un address;
+    struct stat st;
+    int listen_fd, fd, image;
+    int arg = 1;
+
+    if (argc > 1 && !strcmp(argv[1], "-c")) {
+        classic = 1;
+        arg++;
+    }
+    if (argc - arg != 2 || strlen(argv[arg]) >= sizeof(address.sun_path)) {
+        printf("usage: %s [-c] <socket path> <image file>\n", argv[0]);
+        return 1;
+    }
+
+    image = open(argv[arg + 1], O_RDONLY);
+    if (image < 0 || fstat(image, &st) || !st.st_size) {
+        printf("failed to open %s\n", argv[arg + 1]);
+        return 1;
+    }
+    memory_size = st.st_size;
+    memory = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, image, 0);
+    if (MAP_FAILED == memory) {
+        printf("failed to map %s\n", argv[arg + 1]);
+        return 1;
+    }
+    close(image);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, argv[arg]);
+    unlink(argv[arg]);
+    listen_fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &address, sizeof(address))
+        || listen(listen_fd, 1)) {
+        printf("failed to listen on %s\n", argv[arg]);
+        return 1;
+    }
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        serve(fd);
+        close(fd);
+    }
+
+    close(listen_fd);
+    unlink(argv[arg]);
+    munmap(memory, memory_size);
+    return 0;
+}
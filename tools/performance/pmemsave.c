@@ -0,0 +1,332 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reads <pages> pages through a fake QEMU monitor the two ways KVM native
+ * mode can: one "xp /1024wx" per page, as kvm_get_memory_native does
+ * without pmemsave, and qmp_pmemsave_batch with one pmemsave to a tmpfs
+ * file per QMP_PMEMSAVE_MAX bytes, as kvm_get_memory_pmemsave_batch does.  The monitor runs in a thread of
+ * this process and answers both commands like QEMU would.
+ *
+ * usage: pmemsave <pages> <loops>
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "libvmi.h"
+#include "driver/qmp.h"
+#include "common.h"
+
+#define PAGE_SIZE 4096
+
+static uint8_t *memory = NULL;
+static uint64_t memory_size = 0;
+
+static int
+send_text(
+    int fd,
+    const char *text,
+    size_t length)
+{
+    ssize_t n;
+
+    while (length) {
+        n = write(fd, text, length);
+        if (n <= 0) {
+            return -1;
+        }
+        text += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/* "xp /<n>wx <addr>" as HMP prints it, four words per row */
+static int
+monitor_xp(
+    int fd,
+    unsigned int words,
+    uint64_t address)
+{
+    char *reply = malloc(words * 20 + 64);
+    size_t length = 0;
+    uint32_t word;
+    unsigned int i;
+    int ret;
+
+    length += sprintf(reply, "{\"return\": \"");
+    for (i = 0; i < words && address + i * 4 + 4 <= memory_size; ++i) {
+        if (!(i % 4)) {
+            length += sprintf(reply + length, "%016"PRIx64":", address + i * 4);
+        }
+        memcpy(&word, memory + address + i * 4, 4);
+        length += sprintf(reply + length, " 0x%08x", word);
+        if (i % 4 == 3 || i == words - 1) {
+            length += sprintf(reply + length, "\\r\\n");
+        }
+    }
+    length += sprintf(reply + length, "\"}\n");
+
+    ret = send_text(fd, reply, length);
+    free(reply);
+    return ret;
+}
+
+/* pmemsave fopen()s the file name it is given and writes the range */
+static int
+monitor_pmemsave(
+    int fd,
+    const char *command)
+{
+    const char *error = "{\"error\": {\"class\": \"GenericError\", \"desc\": \"pmemsave\"}}\n";
+    const char *p = NULL;
+    char filename[256];
+    uint64_t address = 0, size = 0;
+    FILE *dump = NULL;
+    size_t n = 0;
+
+    if (!(p = strstr(command, "\"val\": ")) || 1 != sscanf(p, "\"val\": %"SCNu64, &address)
+        || !(p = strstr(command, "\"size\": ")) || 1 != sscanf(p, "\"size\": %"SCNu64, &size)
+        || !(p = strstr(command, "\"filename\": \"")) || 1 != sscanf(p, "\"filename\": \"%255[^\"]", filename)
+        || address > memory_size || size > memory_size - address) {
+        return send_text(fd, error, strlen(error));
+    }
+
+    dump = fopen(filename, "wb");
+    if (dump) {
+        n = fwrite(memory + address, 1, size, dump);
+        fclose(dump);
+    }
+    if (!dump || n != size) {
+        return send_text(fd, error, strlen(error));
+    }
+    return send_text(fd, "{\"return\": {}}\n", 15);
+}
+
+static void *
+monitor_serve(
+    void *arg)
+{
+    int listen_fd = *(int *) arg;
+    char buf[4096];
+    char *eol = NULL;
+    size_t have = 0;
+    ssize_t n;
+    unsigned int words;
+    uint64_t address;
+    int fd, ret = 0;
+    const char *greeting = "{\"QMP\": {\"version\": {\"qemu\": {\"major\": 2}}, \"capabilities\": []}}\n";
+    const char *unknown = "{\"error\": {\"class\": \"CommandNotFound\", \"desc\": \"unknown\"}}\n";
+
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0 || send_text(fd, greeting, strlen(greeting))) {
+        return NULL;
+    }
+    while (!ret && (n = read(fd, buf + have, sizeof(buf) - have - 1)) > 0) {
+        have += n;
+        buf[have] = '\0';
+        while (!ret && (eol = strchr(buf, '\n'))) {
+            *eol = '\0';
+            if (strstr(buf, "qmp_capabilities")) {
+                ret = send_text(fd, "{\"return\": {}}\n", 15);
+            }
+            else if (strstr(buf, "\"xp /")
+                     && 2 == sscanf(strstr(buf, "\"xp /"), "\"xp /%uwx 0x%"SCNx64, &words, &address)) {
+                ret = monitor_xp(fd, words, address);
+            }
+            else if (strstr(buf, "\"pmemsave\"")) {
+                ret = monitor_pmemsave(fd, buf);
+            }
+            else {
+                ret = send_text(fd, unknown, strlen(unknown));
+            }
+            have -= eol + 1 - buf;
+            memmove(buf, eol + 1, have + 1);
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static int
+monitor_listen(
+    const char *path)
+{
+    struct sockaddr_un address;
+    int fd = socket(PF_UNIX, SOCK_STREAM, 0);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &address, sizeof(address)) || listen(fd, 1)) {
+        printf("failed to listen on %s\n", path);
+        exit(1);
+    }
+    return fd;
+}
+
+static size_t
+read_xp(
+    qmp_session_t qmp,
+    uint8_t *buf,
+    size_t pages)
+{
+    char command[128];
+    char *reply = NULL, *dump = NULL;
+    size_t i, failed = 0;
+
+    for (i = 0; i < pages; ++i) {
+        sprintf(command,
+                "{\"execute\": \"human-monitor-command\", \"arguments\": {\"command-line\": \"xp /%dwx 0x%zx\"}}",
+                PAGE_SIZE / 4, i * PAGE_SIZE);
+        reply = qmp_execute(qmp, command);
+        dump = qmp_reply_string(reply);
+        failed += (PAGE_SIZE != qmp_parse_xp(dump, i * PAGE_SIZE, buf + i * PAGE_SIZE, PAGE_SIZE));
+        g_free(dump);
+        g_free(reply);
+    }
+    return failed;
+}
+
+static size_t
+read_pmemsave(
+    qmp_session_t qmp,
+    const char *path,
+    uint8_t *buf,
+    size_t pages)
+{
+    addr_t *paddrs = malloc(pages * sizeof(addr_t));
+    void **data = malloc(pages * sizeof(void *));
+    size_t i, failed;
+
+    for (i = 0; i < pages; ++i) {
+        paddrs[i] = i * PAGE_SIZE;
+    }
+    failed = pages - qmp_pmemsave_batch(qmp, path, paddrs, data, pages, PAGE_SIZE);
+    for (i = 0; i < pages; ++i) {
+        if (data[i]) {
+            memcpy(buf + i * PAGE_SIZE, data[i], PAGE_SIZE);
+            free(data[i]);
+        }
+    }
+    free(data);
+    free(paddrs);
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    struct timeval ktv_start;
+    struct timeval ktv_end;
+    char dir[] = "/dev/shm/libvmi-pmemsave-XXXXXX";
+    char socket_path[64], dump_path[64];
+    qmp_session_t qmp = NULL;
+    pthread_t monitor;
+    uint8_t *buf = NULL;
+    long int *data = NULL;
+    long int diff;
+    size_t pages = 0, i, failed;
+    int loops = 0, loop, listen_fd;
+
+    if (argc != 3) {
+        printf("usage: %s <pages> <loops>\n", argv[0]);
+        return 1;
+    }
+    pages = strtoul(argv[1], NULL, 0);
+    loops = atoi(argv[2]);
+    if (!pages || loops < 1) {
+        printf("invalid arguments\n");
+        return 1;
+    }
+    if (!mkdtemp(dir)) {
+        printf("failed to create a directory in /dev/shm\n");
+        return 1;
+    }
+    snprintf(socket_path, sizeof(socket_path), "%s/qmp", dir);
+    snprintf(dump_path, sizeof(dump_path), "%s/dump", dir);
+
+    memory_size = pages * PAGE_SIZE;
+    memory = malloc(memory_size);
+    for (i = 0; i < memory_size; ++i) {
+        memory[i] = (uint8_t) (i / PAGE_SIZE * 7 + i);
+    }
+    buf = malloc(memory_size);
+    data = malloc(loops * sizeof(long int));
+
+    listen_fd = monitor_listen(socket_path);
+    pthread_create(&monitor, NULL, monitor_serve, &listen_fd);
+    qmp = qmp_connect(socket_path);
+    if (!qmp) {
+        printf("failed to connect to the monitor\n");
+        return 1;
+    }
+
+    printf("one xp per page:\n");
+    for (loop = 0; loop < loops; ++loop) {
+        memset(buf, 0, memory_size);
+        gettimeofday(&ktv_start, 0);
+        failed = read_xp(qmp, buf, pages);
+        gettimeofday(&ktv_end, 0);
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        printf("  %.1f MB/s, %zu failed\n", (double) memory_size / (double) (diff ? diff : 1), failed);
+        data[loop] = diff;
+    }
+    avg_measurement(data, loops);
+    if (memcmp(buf, memory, memory_size)) {
+        printf("xp returned the wrong data\n");
+        return 1;
+    }
+
+    printf("one pmemsave per %d pages:\n", QMP_PMEMSAVE_MAX / PAGE_SIZE);
+    for (loop = 0; loop < loops; ++loop) {
+        memset(buf, 0, memory_size);
+        gettimeofday(&ktv_start, 0);
+        failed = read_pmemsave(qmp, dump_path, buf, pages);
+        gettimeofday(&ktv_end, 0);
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        printf("  %.1f MB/s, %zu failed\n", (double) memory_size / (double) (diff ? diff : 1), failed);
+        data[loop] = diff;
+    }
+    avg_measurement(data, loops);
+    if (memcmp(buf, memory, memory_size)) {
+        printf("pmemsave returned the wrong data\n");
+        return 1;
+    }
+
+    qmp_close(qmp);
+    pthread_join(monitor, NULL);
+    close(listen_fd);
+    unlink(socket_path);
+    unlink(dump_path);
+    rmdir(dir);
+    free(data);
+    free(buf);
+    free(memory);
+    return 0;
+}
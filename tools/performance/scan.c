@@ -0,0 +1,156 @@
+/* The LibVMI Library is an introspection library that simplifies access to 
+ * memory in a target virtual machine or in a file containing a dump of 
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */  
+
+/*
+ * Compares a search of a whole memory image for the Windows EPROCESS
+ * magic values and the KDBG tag, done the old way (1MB reads checked
+ * every 4 bytes), with the same search through vmi_scan_pa.  Both
+ * report the number of matches so the results can be checked.
+ *
+ * usage: scan <image file> <loops>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include "libvmi/libvmi.h"
+#include "common.h"
+
+#define BLOCK_SIZE (1024 * 1024)
+
+static const uint32_t magics[] = { 0x1b0003, 0x200003, 0x580003 };
+
+static uint64_t
+scan_blocks(
+    vmi_instance_t vmi,
+    uint64_t size)
+{
+    static unsigned char block[BLOCK_SIZE + 8];
+    uint64_t found = 0;
+    addr_t pa = 0;
+    size_t offset = 0;
+    int i;
+
+    /* frame 0 is never handed out, start at the second page */
+    for (pa = 4096; pa < size; pa += BLOCK_SIZE) {
+        size_t len = vmi_read_pa(vmi, pa, block, BLOCK_SIZE + 8);
+
+        for (offset = 0; offset < BLOCK_SIZE && offset + 4 <= len; offset += 4) {
+            uint32_t value;
+
+            memcpy(&value, block + offset, 4);
+            for (i = 0; i < 3; ++i) {
+                found += (value == magics[i]);
+            }
+            if (offset + 8 <= len && !memcmp(block + offset, "\x00\xf8\xff\xffKDBG", 8)) {
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+static status_t
+count_match(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    size_t pattern,
+    void *data)
+{
+    if (!(paddr & 3)) {
+        (*(uint64_t *) data)++;
+    }
+    return VMI_SUCCESS;
+}
+
+static uint64_t
+scan_patterns(
+    vmi_instance_t vmi,
+    uint64_t size)
+{
+    const vmi_pattern_t patterns[] = {
+        { &magics[0], 4 },
+        { &magics[1], 4 },
+        { &magics[2], 4 },
+        { "\x00\xf8\xff\xffKDBG", 8 }
+    };
+    uint64_t found = 0;
+
+    vmi_scan_pa(vmi, 4096, size, patterns, 4, count_match, &found);
+    return found;
+}
+
+int main(int argc, char **argv) 
+{
+    vmi_instance_t vmi;
+    struct timeval ktv_start;
+    struct timeval ktv_end;
+    long int *data = NULL;
+    long int diff;
+    uint64_t size = 0, found = 0;
+    int loops = 0;
+    int i = 0;
+
+    if (argc != 3) {
+        printf("usage: %s <image file> <loops>\n", argv[0]);
+        return 1;
+    }
+    loops = atoi(argv[2]);
+    if (loops < 1) {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    if (VMI_FAILURE == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL | VMI_INIT_THREADSAFE, argv[1])) {
+        printf("Failed to init LibVMI library.\n");
+        return 1;
+    }
+    size = vmi_get_memsize(vmi);
+    data = malloc(loops * sizeof(long int));
+
+    printf("block reads checked every 4 bytes:\n");
+    for (i = 0; i < loops; ++i) {
+        gettimeofday(&ktv_start, 0);
+        found = scan_blocks(vmi, size);
+        gettimeofday(&ktv_end, 0);
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        printf("  %.1f MB/s, %"PRIu64" matches\n", (double) size / (double) (diff ? diff : 1), found);
+        data[i] = diff;
+    }
+    avg_measurement(data, loops);
+
+    printf("vmi_scan_pa:\n");
+    for (i = 0; i < loops; ++i) {
+        gettimeofday(&ktv_start, 0);
+        found = scan_patterns(vmi, size);
+        gettimeofday(&ktv_end, 0);
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        printf("  %.1f MB/s, %"PRIu64" matches\n", (double) size / (double) (diff ? diff : 1), found);
+        data[i] = diff;
+    }
+    avg_measurement(data, loops);
+
+    vmi_destroy(vmi);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,143 @@
+/* The LibVMI Library is an introspection library that simplifies access to 
+ * memory in a target virtual machine or in a file containing a dump of 
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */  
+
+/*
+ * Measures vmi_read_pa throughput from several threads sharing one
+ * VMI_INIT_THREADSAFE instance on a memory image file.  Each thread
+ * reads from its own slice of the image, so the run shows how well the
+ * sharded page cache scales with the thread count.  The instance is
+ * opened with VMI_INIT_PAGECACHE, otherwise reads would be served from
+ * the file mapping and never reach the cache.
+ *
+ * usage: threaded_read <image file> <max threads> <reads per thread>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include "libvmi/libvmi.h"
+#include "common.h"
+
+#define READ_SIZE 256
+
+struct worker {
+    pthread_t thread;
+    vmi_instance_t vmi;
+    addr_t start;
+    addr_t length;
+    int reads;
+    int failures;
+};
+
+static void *read_worker(
+    void *arg)
+{
+    struct worker *w = arg;
+    unsigned char buf[READ_SIZE];
+    unsigned int seed = (unsigned int) w->start;
+    int i = 0;
+
+    for (i = 0; i < w->reads; ++i) {
+        addr_t offset = ((addr_t) rand_r(&seed) * 4096) % (w->length - READ_SIZE);
+
+        if (vmi_read_pa(w->vmi, w->start + offset, buf, READ_SIZE) != READ_SIZE) {
+            w->failures++;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) 
+{
+    vmi_instance_t vmi;
+    struct timeval ktv_start;
+    struct timeval ktv_end;
+    struct worker *workers = NULL;
+    vmi_cache_stats_t stats;
+    int max_threads = 0;
+    int reads = 0;
+    int threads = 0;
+    int i = 0;
+    long int diff;
+    addr_t slice;
+
+    if (argc != 4) {
+        printf("usage: %s <image file> <max threads> <reads per thread>\n", argv[0]);
+        return 1;
+    }
+    max_threads = atoi(argv[2]);
+    reads = atoi(argv[3]);
+    if (max_threads < 1 || reads < 1) {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    if (VMI_FAILURE ==
+        vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL | VMI_INIT_THREADSAFE |
+                 VMI_INIT_PAGECACHE, argv[1])) {
+        printf("Failed to init LibVMI library.\n");
+        return 1;
+    }
+
+    /* skip frame 0, which is never handed out */
+    slice = (vmi_get_memsize(vmi) - 4096) / max_threads;
+    if (slice < 2 * 4096) {
+        printf("image too small for %d threads\n", max_threads);
+        vmi_destroy(vmi);
+        return 1;
+    }
+
+    workers = malloc(max_threads * sizeof(struct worker));
+    for (threads = 1; threads <= max_threads; threads *= 2) {
+        int failures = 0;
+
+        vmi_pagecache_reset_stats(vmi);
+        for (i = 0; i < threads; ++i) {
+            workers[i].vmi = vmi;
+            workers[i].start = 4096 + i * slice;
+            workers[i].length = slice;
+            workers[i].reads = reads;
+            workers[i].failures = 0;
+        }
+
+        gettimeofday(&ktv_start, 0);
+        for (i = 0; i < threads; ++i) {
+            pthread_create(&workers[i].thread, NULL, read_worker, &workers[i]);
+        }
+        for (i = 0; i < threads; ++i) {
+            pthread_join(workers[i].thread, NULL);
+            failures += workers[i].failures;
+        }
+        gettimeofday(&ktv_end, 0);
+
+        printf("threads %d: ", threads);
+        print_measurement(ktv_start, ktv_end, &diff);
+        vmi_pagecache_get_stats(vmi, &stats);
+        printf("  %.0f reads/s, %d failed, cache hits %"PRIu64" misses %"PRIu64"\n",
+               (double) threads * reads * 1000000.0 / (double) (diff ? diff : 1),
+               failures, stats.hits, stats.misses);
+    }
+
+    vmi_destroy(vmi);
+    free(workers);
+    return 0;
+}
@@ -0,0 +1,202 @@
+/* The LibVMI Library is an introspection library that simplifies access to 
+ * memory in a target virtual machine or in a file containing a dump of 
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */  
+/*
+ * Measures cached virtual to physical translation throughput on a
+ * synthetic IA-32e memory image mapping <MB mapped> megabytes with 4kB
+ * pages.  For each v2p validation policy the image is translated page
+ * by page, first with a hot set of 512 pages that fits in the TLB and
+ * then sweeping the whole mapping.  vmi_pagetable_lookup is called
+ * directly since a file image has no CR3 for vmi_translate_kv2p.  A
+ * sweep uses vmi_pagetable_lookup_extended, which skips the TLB and
+ * v2p cache, to time the page walk itself.  Finally every page is
+ * translated from a flushed cache in ascending and then in random
+ * order, one at a time and with vmi_pagetable_lookup_batch in batches
+ * of <BATCH> addresses.
+ *
+ * usage: translate <image file to create> <MB mapped> <loops>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "libvmi/libvmi.h"
+#include "common.h"
+
+#define HOT_PAGES 512
+#define BATCH 4096
+
+static addr_t
+walk(vmi_instance_t vmi, addr_t dtb, addr_t va)
+{
+    page_info_t info;
+
+    vmi_pagetable_lookup_extended(vmi, dtb, va, &info);
+    return info.paddr;
+}
+
+static void
+run(vmi_instance_t vmi, const char *name, uint64_t pages, uint64_t window, int loops,
+    addr_t (*lookup)(vmi_instance_t, addr_t, addr_t))
+{
+    struct timeval ktv_start;
+    struct timeval ktv_end;
+    long int *data = malloc(loops * sizeof(long int));
+    long int diff;
+    uint64_t i, bad = 0;
+    int loop;
+
+    printf("%s, %"PRIu64" translations over %"PRIu64" pages\n", name, pages, window);
+    for (loop = 0; loop < loops; ++loop) {
+        gettimeofday(&ktv_start, 0);
+        for (i = 0; i < pages; ++i) {
+            if (PT_PML4_PA + 8 != lookup(vmi, PT_PML4_PA, (i % window) * 4096 + 8)) {
+                bad++;
+            }
+        }
+        gettimeofday(&ktv_end, 0);
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        printf("  %.2f M translations/s\n", (double) pages / (double) (diff ? diff : 1));
+        data[loop] = diff;
+    }
+    avg_measurement(data, loops);
+    if (bad) {
+        printf("  %"PRIu64" wrong translations\n", bad);
+    }
+    free(data);
+}
+
+static void
+run_cold(vmi_instance_t vmi, const char *name, const addr_t *vas, uint64_t pages,
+    int loops, int batch)
+{
+    struct timeval ktv_start;
+    struct timeval ktv_end;
+    long int *data = malloc(loops * sizeof(long int));
+    addr_t *pas = malloc(pages * sizeof(addr_t));
+    long int diff;
+    uint64_t i, bad = 0;
+    int loop;
+
+    printf("%s, %"PRIu64" translations from a flushed cache\n", name, pages);
+    for (loop = 0; loop < loops; ++loop) {
+        vmi_v2pcache_flush(vmi);
+        gettimeofday(&ktv_start, 0);
+        if (batch) {
+            for (i = 0; i < pages; i += BATCH) {
+                vmi_pagetable_lookup_batch(vmi, PT_PML4_PA, vas + i, pas + i,
+                                           pages - i < BATCH ? pages - i : BATCH);
+            }
+        }
+        else {
+            for (i = 0; i < pages; ++i) {
+                pas[i] = vmi_pagetable_lookup(vmi, PT_PML4_PA, vas[i]);
+            }
+        }
+        gettimeofday(&ktv_end, 0);
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        printf("  %.1f ns per address\n", (double) diff * 1000.0 / (double) pages);
+        data[loop] = diff;
+    }
+    avg_measurement(data, loops);
+    for (i = 0; i < pages; ++i) {
+        if (PT_PML4_PA + 8 != pas[i]) {
+            bad++;
+        }
+    }
+    if (bad) {
+        printf("  %"PRIu64" wrong translations\n", bad);
+    }
+    free(pas);
+    free(data);
+}
+
+int main(int argc, char **argv) 
+{
+    const struct {
+        const char *name;
+        v2p_validation_t policy;
+    } policies[] = {
+        { "VMI_V2P_VALIDATE_ALWAYS", VMI_V2P_VALIDATE_ALWAYS },
+        { "VMI_V2P_VALIDATE_NEVER", VMI_V2P_VALIDATE_NEVER },
+        { "VMI_V2P_VALIDATE_GENERATION", VMI_V2P_VALIDATE_GENERATION }
+    };
+    vmi_instance_t vmi;
+    addr_t *vas = NULL;
+    uint64_t tables = 0, pages = 0, j, k;
+    int loops = 0;
+    int i = 0;
+
+    if (argc != 4) {
+        printf("usage: %s <image file to create> <MB mapped> <loops>\n", argv[0]);
+        return 1;
+    }
+    tables = strtoull(argv[2], NULL, 0) / 2;
+    loops = atoi(argv[3]);
+    if (tables < 1 || tables > PT_ENTRIES * PT_ENTRIES || loops < 1) {
+        printf("invalid arguments\n");
+        return 1;
+    }
+    pages = tables * PT_ENTRIES;
+
+    if (write_pagetable_image(argv[1], tables)) {
+        printf("Failed to write %s.\n", argv[1]);
+        return 1;
+    }
+    if (VMI_FAILURE == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, argv[1])) {
+        printf("Failed to init LibVMI library.\n");
+        return 1;
+    }
+    vmi_set_page_mode(vmi, VMI_PM_IA32E);
+
+    for (i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i) {
+        vmi_v2pcache_set_validation(vmi, policies[i].policy);
+        vmi_v2pcache_flush(vmi);
+        run(vmi, policies[i].name, pages, HOT_PAGES, loops, vmi_pagetable_lookup);
+        run(vmi, policies[i].name, pages, pages, loops, vmi_pagetable_lookup);
+    }
+    run(vmi, "page walk", pages, pages, loops, walk);
+
+    vas = malloc(pages * sizeof(addr_t));
+    for (j = 0; j < pages; ++j) {
+        vas[j] = j * 4096 + 8;
+    }
+    vmi_v2pcache_set_validation(vmi, VMI_V2P_VALIDATE_ALWAYS);
+    run_cold(vmi, "vmi_pagetable_lookup, ascending", vas, pages, loops, 0);
+    run_cold(vmi, "vmi_pagetable_lookup_batch, ascending", vas, pages, loops, 1);
+
+    for (j = pages - 1; j > 0; --j) {
+        addr_t tmp = vas[j];
+
+        k = random() % (j + 1);
+        vas[j] = vas[k];
+        vas[k] = tmp;
+    }
+    run_cold(vmi, "vmi_pagetable_lookup, shuffled", vas, pages, loops, 0);
+    run_cold(vmi, "vmi_pagetable_lookup_batch, shuffled", vas, pages, loops, 1);
+    free(vas);
+
+    vmi_destroy(vmi);
+    unlink(argv[1]);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/* The LibVMI Library is an introspection library that simplifies access to 
+ * memory in a target virtual machine or in a file containing a dump of 
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */  
+
+/*
+ * Measures page table enumeration on a synthetic IA-32e memory image.
+ * The image holds one PML4, one PDPT and enough page directories and
+ * page tables to map <MB mapped> megabytes with 4kB pages.  Each loop
+ * walks it once with vmi_foreach_va_page, which reads every table as a
+ * whole page, and once with one vmi_read_64_pa call per entry.
+ *
+ * usage: va_pages <image file to create> <MB mapped> <loops>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "libvmi/libvmi.h"
+#include "common.h"
+
+static status_t
+count_page(vmi_instance_t vmi, addr_t va, page_size_t size, void *data)
+{
+    (*(uint64_t *) data)++;
+    return VMI_SUCCESS;
+}
+
+/* the old way: one physical read for every entry of every table */
+static uint64_t
+count_pages_per_entry(vmi_instance_t vmi, addr_t dtb)
+{
+    uint64_t count = 0, pml4e, pdpte, pde, pte;
+    int i, j, k, l;
+
+    for (i = 0; i < PT_ENTRIES; ++i) {
+        if (VMI_FAILURE == vmi_read_64_pa(vmi, dtb + i * 8, &pml4e) || !(pml4e & 1)) {
+            continue;
+        }
+        for (j = 0; j < PT_ENTRIES; ++j) {
+            if (VMI_FAILURE == vmi_read_64_pa(vmi, (pml4e & ~0xfffULL) + j * 8, &pdpte)
+                || !(pdpte & 1)) {
+                continue;
+            }
+            for (k = 0; k < PT_ENTRIES; ++k) {
+                if (VMI_FAILURE == vmi_read_64_pa(vmi, (pdpte & ~0xfffULL) + k * 8, &pde)
+                    || !(pde & 1)) {
+                    continue;
+                }
+                for (l = 0; l < PT_ENTRIES; ++l) {
+                    if (VMI_SUCCESS == vmi_read_64_pa(vmi, (pde & ~0xfffULL) + l * 8, &pte)
+                        && (pte & 1)) {
+                        count++;
+                    }
+                }
+            }
+        }
+    }
+    return count;
+}
+
+int main(int argc, char **argv) 
+{
+    vmi_instance_t vmi;
+    struct timeval ktv_start;
+    struct timeval ktv_end;
+    long int *data = NULL;
+    long int diff;
+    uint64_t tables = 0, count = 0;
+    int loops = 0;
+    int i = 0;
+
+    if (argc != 4) {
+        printf("usage: %s <image file to create> <MB mapped> <loops>\n", argv[0]);
+        return 1;
+    }
+    tables = strtoull(argv[2], NULL, 0) / 2;
+    loops = atoi(argv[3]);
+    if (tables < 1 || tables > PT_ENTRIES * PT_ENTRIES || loops < 1) {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    if (write_pagetable_image(argv[1], tables)) {
+        printf("Failed to write %s.\n", argv[1]);
+        return 1;
+    }
+    if (VMI_FAILURE == vmi_init(&vmi, VMI_FILE | VMI_INIT_PARTIAL, argv[1])) {
+        printf("Failed to init LibVMI library.\n");
+        return 1;
+    }
+    vmi_set_page_mode(vmi, VMI_PM_IA32E);
+
+    data = malloc(loops * sizeof(long int));
+
+    printf("vmi_foreach_va_page, %"PRIu64" page tables\n", tables);
+    for (i = 0; i < loops; ++i) {
+        count = 0;
+        gettimeofday(&ktv_start, 0);
+        vmi_foreach_va_page(vmi, PT_PML4_PA, count_page, &count);
+        gettimeofday(&ktv_end, 0);
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        printf("  %"PRIu64" pages\n", count);
+        data[i] = diff;
+    }
+    avg_measurement(data, loops);
+
+    printf("vmi_read_64_pa per entry, %"PRIu64" page tables\n", tables);
+    for (i = 0; i < loops; ++i) {
+        gettimeofday(&ktv_start, 0);
+        count = count_pages_per_entry(vmi, PT_PML4_PA);
+        gettimeofday(&ktv_end, 0);
+
+        print_measurement(ktv_start, ktv_end, &diff);
+        printf("  %"PRIu64" pages\n", count);
+        data[i] = diff;
+    }
+    avg_measurement(data, loops);
+
+    vmi_destroy(vmi);
+    unlink(argv[1]);
+    free(data);
+    return 0;
+}